@@ -0,0 +1,61 @@
+#include "arena.h"
+
+#include "error.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define ARENA_BLOCK_SIZE 65536
+#define ARENA_ALIGNMENT 16
+
+struct ArenaBlock {
+  struct ArenaBlock *next;
+  size_t used;
+  size_t size;
+};
+
+/* the block header is padded so that what follows it stays aligned */
+#define BLOCK_HEADER_SIZE                                                      \
+  ((sizeof(struct ArenaBlock) + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT *       \
+   ARENA_ALIGNMENT)
+
+void initializeArena(struct Arena *arena) { arena->blocks = NULL; }
+
+void *allocateFromArena(struct Arena *arena, size_t size) {
+  struct ArenaBlock *block = arena->blocks;
+  char *memory;
+
+  size = (size + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT;
+  if (block == NULL || block->size - block->used < size) {
+    size_t blockSize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+
+    /* calloc so that big blocks come straight from zeroed pages */
+    block = calloc(1, BLOCK_HEADER_SIZE + blockSize);
+    if (block == NULL) {
+      fail("Out of memory");
+    }
+    block->size = blockSize;
+    block->used = 0;
+    if (arena->blocks != NULL && blockSize > ARENA_BLOCK_SIZE) {
+      /* keep bumping through the current block, it still has room */
+      block->next = arena->blocks->next;
+      arena->blocks->next = block;
+    } else {
+      block->next = arena->blocks;
+      arena->blocks = block;
+    }
+  }
+
+  memory = (char *)block + BLOCK_HEADER_SIZE + block->used;
+  block->used += size;
+  return memory;
+}
+
+void freeArena(struct Arena *arena) {
+  while (arena->blocks != NULL) {
+    struct ArenaBlock *next = arena->blocks->next;
+
+    free(arena->blocks);
+    arena->blocks = next;
+  }
+}
@@ -0,0 +1,24 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <stddef.h>
+
+/*
+ * Memory handed out by bumping a pointer through large blocks, all of which
+ * are released together. Whatever is allocated from it lives as long as the
+ * program it was compiled for.
+ */
+struct ArenaBlock;
+
+struct Arena {
+  struct ArenaBlock *blocks;
+};
+
+void initializeArena(struct Arena *arena);
+
+/* zeroed, and aligned for any type; fails when memory runs out */
+void *allocateFromArena(struct Arena *arena, size_t size);
+
+void freeArena(struct Arena *arena);
+
+#endif /* !ARENA_H_ */
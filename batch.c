@@ -0,0 +1,368 @@
+#define _DEFAULT_SOURCE
+
+#include "batch.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libbroas.h"
+#include "vector.h"
+
+/* a line of the jobs file, and once it has run, what it printed and how */
+struct BatchJob {
+  long int line;
+  int argc;
+  char **argv;
+  char *output;
+  long int length;
+  long int capacity;
+  int status; /* a BroasStatus */
+  long int exitCode;
+  char *message; /* broasError() when status is not BROAS_OK */
+  int done;
+};
+
+struct Batch {
+  struct BroasProgram *program;
+  size_t memoryBytes;
+  long int callDepth;
+  struct BatchJob *jobs;
+  long int numberOfJobs;
+  pthread_mutex_t lock;
+  pthread_cond_t finished; /* signalled whenever a job is done */
+  long int next;           /* the first job no thread has taken */
+};
+
+/* a thread that runs jobs, all of them in one context */
+struct Worker {
+  struct Batch *batch;
+  struct BatchJob *job; /* the one running, which the output goes to */
+};
+
+static long int collectOutput(void *data, char const *bytes, long int length) {
+  struct BatchJob *job = ((struct Worker *)data)->job;
+
+  if (job->length + length > job->capacity) {
+    long int capacity = job->capacity > 0 ? job->capacity : 4096;
+    char *output;
+
+    while (capacity < job->length + length) {
+      capacity *= 2;
+    }
+    output = realloc(job->output, capacity);
+    if (output == NULL) {
+      return -1;
+    }
+    job->output = output;
+    job->capacity = capacity;
+  }
+  memcpy(job->output + job->length, bytes, length);
+  job->length += length;
+  return length;
+}
+
+/* jobs share standard input, so none of them reads it */
+static long int readNothing(void *data, char *buffer, long int capacity) {
+  (void)data;
+  (void)buffer;
+  (void)capacity;
+  return 0;
+}
+
+static void *runJobs(void *argument) {
+  struct Worker *worker = argument;
+  struct Batch *batch = worker->batch;
+  struct BroasContext *context;
+  struct BroasIo io;
+  int status;
+  int used = 0;
+
+  io.write = collectOutput;
+  io.read = readNothing;
+  io.data = worker;
+  status =
+      broasCreateContext(batch->program, batch->memoryBytes, &io, &context);
+  if (status == BROAS_OK) {
+    broasSetCallDepth(context, batch->callDepth);
+  }
+  for (;;) {
+    struct BatchJob *job = NULL;
+
+    pthread_mutex_lock(&batch->lock);
+    if (batch->next < batch->numberOfJobs) {
+      job = &batch->jobs[batch->next++];
+    }
+    pthread_mutex_unlock(&batch->lock);
+    if (job == NULL) {
+      break;
+    }
+
+    worker->job = job;
+    /* every job starts with memory and variables of its own */
+    if (status == BROAS_OK && used) {
+      status = broasResetContext(context);
+    }
+    used = 1;
+    job->status = status == BROAS_OK
+                      ? broasRun(context, job->argc, job->argv, &job->exitCode)
+                      : status;
+    if (job->status != BROAS_OK) {
+      job->message = strdup(broasError());
+    }
+
+    pthread_mutex_lock(&batch->lock);
+    job->done = 1;
+    pthread_cond_broadcast(&batch->finished);
+    pthread_mutex_unlock(&batch->lock);
+  }
+  broasDestroyContext(context);
+  return NULL;
+}
+
+/* the whole file, with a terminator after it, or NULL */
+static char *readFile(char const *path, long int *pLength) {
+  FILE *file = fopen(path, "rb");
+  char *text = NULL;
+  long int length = 0;
+  long int capacity = 0;
+
+  if (file == NULL) {
+    fprintf(stderr, "Cannot open %s\n", path);
+    return NULL;
+  }
+  for (;;) {
+    size_t got;
+
+    if (length + 1 >= capacity) {
+      char *grown;
+
+      capacity = capacity > 0 ? 2 * capacity : 65536;
+      grown = realloc(text, capacity);
+      if (grown == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        free(text);
+        fclose(file);
+        return NULL;
+      }
+      text = grown;
+    }
+    got = fread(text + length, 1, capacity - length - 1, file);
+    if (got == 0) {
+      break;
+    }
+    length += got;
+  }
+  if (ferror(file)) {
+    fprintf(stderr, "Cannot read %s\n", path);
+    free(text);
+    text = NULL;
+  } else {
+    text[length] = '\0';
+    *pLength = length;
+  }
+  fclose(file);
+  return text;
+}
+
+static int isBlank(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+/* the argument lists of the first numberOfJobs jobs, and the jobs */
+static void freeJobs(struct BatchJob *jobs, long int numberOfJobs) {
+  long int i;
+
+  for (i = 0; i < numberOfJobs; i++) {
+    free(jobs[i].argv);
+  }
+  free(jobs);
+}
+
+/*
+ * Cuts text into a job for every line, whose arguments are its words; they
+ * are terminated in place, so text has to outlive the jobs. Returns the
+ * number of jobs, or -1 when there is no room for them.
+ */
+static long int parseJobs(char *text, long int length,
+                          struct BatchJob **pJobs) {
+  struct BatchJob *jobs = NULL;
+  long int numberOfJobs = 0;
+  long int capacity = 0;
+  char *line = text;
+  char *end = text + length;
+
+  while (line < end) {
+    char *newline = memchr(line, '\n', end - line);
+    char *stop = newline != NULL ? newline : end;
+    struct BatchJob *job;
+    char *word;
+    int argc = 0;
+
+    if (numberOfJobs == capacity) {
+      struct BatchJob *grown;
+
+      capacity = capacity > 0 ? 2 * capacity : 256;
+      grown = realloc(jobs, capacity * sizeof(struct BatchJob));
+      if (grown == NULL) {
+        freeJobs(jobs, numberOfJobs);
+        return -1;
+      }
+      jobs = grown;
+    }
+    job = &jobs[numberOfJobs];
+    memset(job, 0, sizeof(struct BatchJob));
+    job->line = ++numberOfJobs;
+
+    for (word = line; word < stop;) {
+      if (isBlank(*word)) {
+        ++word;
+        continue;
+      }
+      ++argc;
+      while (word < stop && !isBlank(*word)) {
+        ++word;
+      }
+    }
+    job->argv = malloc((argc + 1) * sizeof(char *));
+    if (job->argv == NULL) {
+      freeJobs(jobs, numberOfJobs - 1);
+      return -1;
+    }
+    for (word = line; word < stop;) {
+      if (isBlank(*word)) {
+        ++word;
+        continue;
+      }
+      job->argv[job->argc++] = word;
+      while (word < stop && !isBlank(*word)) {
+        ++word;
+      }
+      *word++ = '\0';
+    }
+    job->argv[job->argc] = NULL;
+    line = stop + 1;
+  }
+  *pJobs = jobs;
+  return numberOfJobs;
+}
+
+int runBatch(char const *programPath, char const *jobsPath, int flags,
+             size_t memoryBytes, long int callDepth, int jobs,
+             char const *vectorKernel) {
+  struct Batch batch;
+  struct Worker *workers;
+  pthread_t *threads;
+  char *source;
+  char *text;
+  long int sourceLength;
+  long int textLength;
+  long int i;
+  int started;
+  int status = 0;
+
+  source = readFile(programPath, &sourceLength);
+  text = source != NULL ? readFile(jobsPath, &textLength) : NULL;
+  if (text == NULL) {
+    free(source);
+    return 1;
+  }
+  if (broasCompile(source, sourceLength, flags, &batch.program) != BROAS_OK) {
+    fprintf(stderr, "%s\n", broasError());
+    free(source);
+    free(text);
+    return 1;
+  }
+  free(source);
+  /* libbroas picks the vector kernels itself on its first call */
+  if (vectorKernel != NULL) {
+    initializeVectors(vectorKernel);
+  }
+
+  batch.memoryBytes = memoryBytes;
+  batch.callDepth = callDepth;
+  batch.numberOfJobs = parseJobs(text, textLength, &batch.jobs);
+  if (batch.numberOfJobs < 0) {
+    fprintf(stderr, "Out of memory\n");
+    free(text);
+    broasDestroyProgram(batch.program);
+    return 1;
+  }
+  batch.next = 0;
+  pthread_mutex_init(&batch.lock, NULL);
+  pthread_cond_init(&batch.finished, NULL);
+  if (jobs <= 0) {
+    jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  if (jobs > batch.numberOfJobs) {
+    jobs = (int)batch.numberOfJobs;
+  }
+  if (jobs < 1) {
+    jobs = 1;
+  }
+
+  workers = malloc(jobs * sizeof(struct Worker));
+  threads = malloc(jobs * sizeof(pthread_t));
+  if (workers == NULL || threads == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    free(workers);
+    free(threads);
+    pthread_cond_destroy(&batch.finished);
+    pthread_mutex_destroy(&batch.lock);
+    freeJobs(batch.jobs, batch.numberOfJobs);
+    free(text);
+    broasDestroyProgram(batch.program);
+    return 1;
+  }
+  for (started = 0; started < jobs; started++) {
+    workers[started].batch = &batch;
+    workers[started].job = NULL;
+    if (pthread_create(&threads[started], NULL, runJobs, &workers[started]) !=
+        0) {
+      break;
+    }
+  }
+  if (started == 0) {
+    runJobs(&workers[0]);
+  }
+
+  /* each job's output is written as soon as the ones before it are */
+  for (i = 0; i < batch.numberOfJobs; i++) {
+    struct BatchJob *job = &batch.jobs[i];
+
+    pthread_mutex_lock(&batch.lock);
+    while (!job->done) {
+      pthread_cond_wait(&batch.finished, &batch.lock);
+    }
+    pthread_mutex_unlock(&batch.lock);
+
+    fwrite(job->output, 1, job->length, stdout);
+    fflush(stdout);
+    if (job->status == BROAS_OK) {
+      fprintf(stderr, "%s:%ld: exit %ld\n", jobsPath, job->line,
+              job->exitCode);
+    } else {
+      fprintf(stderr, "%s:%ld: %s\n", jobsPath, job->line, job->message);
+    }
+    if (job->status != BROAS_OK || job->exitCode != 0) {
+      status = 1;
+    }
+    free(job->output);
+    free(job->message);
+    free(job->argv);
+  }
+
+  for (i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  pthread_cond_destroy(&batch.finished);
+  pthread_mutex_destroy(&batch.lock);
+  free(threads);
+  free(workers);
+  free(batch.jobs);
+  free(text);
+  broasDestroyProgram(batch.program);
+  return status;
+}
@@ -0,0 +1,24 @@
+#ifndef BATCH_H_
+#define BATCH_H_
+
+#include <stddef.h>
+
+/*
+ * --batch: compiles the program at programPath once, with the BROAS_ flags
+ * of libbroas.h, and runs it once for every line of the file at jobsPath,
+ * with the words of the line as its arguments. The runs are spread over
+ * jobs threads, or one per processor when jobs is 0, each run with a
+ * memory of memoryBytes (0 for the default) and variables of its own and
+ * without input. Their output is written to stdout in the order of the
+ * lines, each run's in one piece, and how each ended to stderr after it.
+ * callDepth is the choice of --call-depth and vectorKernel that of
+ * --vector, or NULL.
+ *
+ * Returns the status broas exits with: 0 when every run exited with 0,
+ * else 1.
+ */
+int runBatch(char const *programPath, char const *jobsPath, int flags,
+             size_t memoryBytes, long int callDepth, int jobs,
+             char const *vectorKernel);
+
+#endif /* !BATCH_H_ */
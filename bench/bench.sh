@@ -0,0 +1,77 @@
+#!/bin/sh
+# Runs the workloads below on both engines, with and without -O and the JIT,
+# RUNS times each (5 by default). For each one it reports the instructions
+# the program executes, the best and the median wall time, instructions per
+# second of the best time, the peak resident set size, and the time to start
+# and run an empty program in the same mode. Every mode must print the same
+# as the switch engine. The results also go to RESULTS (bench/results.csv by
+# default) as CSV, tagged with the commit they were measured at, for
+# bench/compare.sh to set against another build's.
+# Usage: [RUNS=n] [RESULTS=file] bench/bench.sh, or make bench
+cd "$(dirname "$0")/.." || exit 1
+runs=${RUNS:-5}
+results=${RESULTS:-bench/results.csv}
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+make -s --no-print-directory OUT="$tmp/switch" || exit 1
+make -s --no-print-directory threaded OUT="$tmp/threaded" || exit 1
+gcc -O2 -Wall -Wextra bench/measure.c -o "$tmp/measure" || exit 1
+
+commit=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+if [ -n "$(git status --porcelain --untracked-files=no 2>/dev/null)" ]; then
+	commit="$commit+"
+fi
+
+echo 'exit 0' > "$tmp/empty.broas"
+awk 'BEGIN { for (i = 0; i < 40000; i++) print "the quick  brown fox\tjumps over   the lazy dog", i }' > "$tmp/text"
+
+# name, program, standard input and arguments
+workloads="fib bench/fib.broas /dev/null
+sieve bench/sieve.broas /dev/null
+matrix bench/matrix.broas /dev/null
+sort bench/sort.broas /dev/null
+reverse bench/reverse.broas /dev/null alpha beta gamma delta epsilon zeta eta theta iota kappa lambda mu
+filter bench/filter.broas $tmp/text"
+
+# the engine, then its options
+modes="switch
+threaded
+switch -O
+switch --jit
+switch -O --jit"
+
+# the exit code and a checksum of the output
+result() {
+	"$@" > "$tmp/output" 2>&1
+	echo "exit $? $(cksum < "$tmp/output")"
+}
+
+status=0
+echo "commit,engine,options,program,runs,instructions,best_ms,median_ms,instructions_per_second,peak_rss_kb,startup_ms" > "$results"
+printf '%-8s %-16s %12s %10s %10s %14s %10s %10s\n' program mode instructions "best (ms)" "median" "instr/s" "rss (KB)" "startup"
+while read -r name program input arguments; do
+	instructions=$("$tmp/switch" --count "$program" $arguments < "$input" 2>&1 > /dev/null | sed -n 's/ instructions executed$//p')
+	expected=$(result "$tmp/switch" "$program" $arguments < "$input")
+	while read -r engine options; do
+		if [ "$(result "$tmp/$engine" $options "$program" $arguments < "$input")" != "$expected" ]; then
+			echo "$name: $engine $options differs from the switch engine" >&2
+			status=1
+		fi
+		set -- $("$tmp/measure" "$runs" "$input" "$tmp/$engine" $options "$program" $arguments)
+		best=$1
+		median=$2
+		rss=$3
+		set -- $("$tmp/measure" "$runs" /dev/null "$tmp/$engine" $options "$tmp/empty.broas")
+		startup=$1
+		rate=$(awk -v n="$instructions" -v ms="$best" 'BEGIN { printf "%.0f", (ms > 0 ? n * 1000 / ms : 0) }')
+		printf '%-8s %-16s %12s %10s %10s %14s %10s %10s\n' "$name" "$engine $options" "$instructions" "$best" "$median" "$rate" "$rss" "$startup"
+		echo "$commit,$engine,$options,$name,$runs,$instructions,$best,$median,$rate,$rss,$startup" >> "$results"
+	done <<MODES
+$modes
+MODES
+done <<WORKLOADS
+$workloads
+WORKLOADS
+echo "results in $results"
+exit $status
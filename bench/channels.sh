@@ -0,0 +1,51 @@
+#!/bin/sh
+# Times bench/channels.broas, which passes 200000 words through one channel,
+# for 1 -> 1 and a few N -> M topologies of producers and consumers, in the
+# switch and threaded engines, and reports messages per second. Every run
+# must receive every word sent.
+# Usage: bench/channels.sh [runs] [topologies...], topologies as N:M
+cd "$(dirname "$0")/.." || exit 1
+runs=${1:-3}
+topologies="1:1 1:2 2:1 2:2 4:4"
+if [ $# -gt 1 ]; then
+	shift
+	topologies=$*
+fi
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+make -s --no-print-directory OUT="$tmp/switch" || exit 1
+make -s --no-print-directory threaded OUT="$tmp/threaded" || exit 1
+
+best() {
+	b=
+	i=0
+	while [ $i -lt "$runs" ]; do
+		s=$(date +%s%N)
+		"$@" > /dev/null < /dev/null
+		t=$(( ($(date +%s%N) - s) / 1000000 ))
+		if [ -z "$b" ] || [ "$t" -lt "$b" ]; then b=$t; fi
+		i=$((i + 1))
+	done
+	echo "$b"
+}
+
+status=0
+printf '%-10s %12s %14s %14s %14s\n' topology "switch (ms)" "messages/s" "threaded (ms)" "messages/s"
+for topology in $topologies; do
+	producers=${topology%:*}
+	consumers=${topology#*:}
+	messages=$((200000 / producers * producers))
+	for engine in switch threaded; do
+		if [ "$("$tmp/$engine" bench/channels.broas $producers $consumers)" != "$messages" ]; then
+			echo "$engine on $producers -> $consumers lost messages" >&2
+			status=1
+		fi
+	done
+	switch=$(best "$tmp/switch" bench/channels.broas $producers $consumers)
+	threaded=$(best "$tmp/threaded" bench/channels.broas $producers $consumers)
+	printf '%-10s %12s %14s %14s %14s\n' "$producers -> $consumers" "$switch" \
+		"$(awk "BEGIN { printf \"%.0f\", $messages * 1000 / ($switch > 0 ? $switch : 1) }")" "$threaded" \
+		"$(awk "BEGIN { printf \"%.0f\", $messages * 1000 / ($threaded > 0 ? $threaded : 1) }")"
+done
+exit $status
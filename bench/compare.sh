@@ -0,0 +1,17 @@
+#!/bin/sh
+# Sets two results files of bench/bench.sh side by side: the best time of
+# every workload in every mode in each, and how many times faster the second
+# one is. Usage: bench/compare.sh old.csv new.csv
+if [ $# -ne 2 ]; then
+	echo "Usage: bench/compare.sh old.csv new.csv" >&2
+	exit 1
+fi
+awk -F, '
+FNR == 1 { next }
+NR == FNR { old[$2 " " $3 "," $4] = $7; before = $1; next }
+FNR == 2 {
+	printf "%-8s %-16s %12s %12s %8s\n", "program", "mode", before " (ms)", $1 " (ms)", "speedup"
+}
+($2 " " $3 "," $4) in old {
+	printf "%-8s %-16s %12s %12s %7.2fx\n", $4, $2 " " $3, old[$2 " " $3 "," $4], $7, ($7 > 0 ? old[$2 " " $3 "," $4] / $7 : 0)
+}' "$1" "$2"
@@ -0,0 +1,45 @@
+#!/bin/sh
+# Builds the switch and the threaded engine and times both, plus -O and the
+# JIT, on every program in bench/. Every mode must produce the same output and
+# exit code as the switch engine. Usage: bench/engines.sh [runs]
+cd "$(dirname "$0")/.." || exit 1
+runs=${1:-5}
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+make -s --no-print-directory OUT="$tmp/switch" || exit 1
+make -s --no-print-directory threaded OUT="$tmp/threaded" || exit 1
+
+best() {
+	b=
+	i=0
+	while [ $i -lt "$runs" ]; do
+		s=$(date +%s%N)
+		"$@" > /dev/null < /dev/null
+		t=$(( ($(date +%s%N) - s) / 1000000 ))
+		if [ -z "$b" ] || [ "$t" -lt "$b" ]; then b=$t; fi
+		i=$((i + 1))
+	done
+	echo "$b"
+}
+
+result() {
+	"$@" < /dev/null 2>&1
+	echo "exit $?"
+}
+
+status=0
+printf '%-20s %12s %12s %12s %12s\n' program "switch (ms)" "threaded (ms)" "-O (ms)" "jit (ms)"
+for program in bench/*.broas; do
+	expected=$(result "$tmp/switch" "$program")
+	for mode in "$tmp/threaded" "$tmp/switch -O" "$tmp/switch --jit"; do
+		if [ "$(result $mode "$program")" != "$expected" ]; then
+			echo "$program: $mode differs from the switch engine" >&2
+			status=1
+		fi
+	done
+	printf '%-20s %12s %12s %12s %12s\n' "$(basename "$program")" \
+		"$(best "$tmp/switch" "$program")" "$(best "$tmp/threaded" "$program")" \
+		"$(best "$tmp/switch" -O "$program")" "$(best "$tmp/switch" --jit "$program")"
+done
+exit $status
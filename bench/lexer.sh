@@ -0,0 +1,39 @@
+#!/bin/sh
+# Builds the lexer's own driver (LEXER_MAIN) and times it on a generated
+# program of the given number of lines, which ends up with about four tokens
+# and 16 bytes per line, once for each of the given thread counts.
+# Usage: bench/lexer.sh [lines] [runs] [threads...]
+# bench/lexer.sh 3200000 5 1 2 4 8 tokenizes a 50 MB program.
+cd "$(dirname "$0")/.." || exit 1
+lines=${1:-50000}
+runs=${2:-20}
+threads=1
+if [ $# -gt 2 ]; then
+	shift 2
+	threads=$*
+fi
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+gcc -O2 -ansi -pedantic -Wall -Wextra -pthread -DLEXER_MAIN lexer.c error.c -o "$tmp/lexer" || exit 1
+
+awk -v lines="$lines" 'BEGIN {
+	split("add sub mult div mod xor or and sl sr", r, " ")
+	split("beq bneq blt bgt ble bge", b, " ")
+	srand(1)
+	for (i = 0; i < lines; i++) {
+		if (i % 20 == 0) print "@block" i / 20
+		k = rand()
+		if (k < 0.6) printf "%s v%d v%d %d\n", r[int(rand() * 10) + 1], rand() * 40, rand() * 40, rand() * 2000 - 1000
+		else if (k < 0.75) printf "%s v%d %d @block%d\n", b[int(rand() * 6) + 1], rand() * 40, rand() * 100, rand() * lines / 20
+		else if (k < 0.85) printf "lw v%d p%d ; load\n", rand() * 40, rand() * 10
+		else if (k < 0.95) printf "sw v%d p%d\n", rand() * 40, rand() * 10
+		else print "print '"'"'\\n'"'"'"
+	}
+}' > "$tmp/program.broas"
+
+echo "$lines lines, $(wc -c < "$tmp/program.broas") bytes"
+for n in $threads; do
+	printf '%s thread(s): ' "$n"
+	"$tmp/lexer" "$tmp/program.broas" "$runs" "$n"
+done
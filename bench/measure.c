@@ -0,0 +1,82 @@
+/*
+ * Runs a command a number of times, reading its standard input from a file
+ * and throwing its output away, and prints the best and the median wall time
+ * in milliseconds, the largest peak resident set size in kilobytes and the
+ * exit status of the last run. bench/bench.sh builds and uses it.
+ * Usage: measure runs input command [arguments...]
+ */
+#define _DEFAULT_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static int compareTimes(void const *left, void const *right) {
+  double a = *(double const *)left;
+  double b = *(double const *)right;
+
+  return a < b ? -1 : a > b;
+}
+
+int main(int argc, char **argv) {
+  int runs = argc > 1 ? atoi(argv[1]) : 0;
+  double *times;
+  long int peak = 0;
+  int status = 0;
+  int i;
+
+  if (argc < 4 || runs < 1) {
+    fprintf(stderr, "Usage: measure runs input command [arguments...]\n");
+    return 1;
+  }
+
+  times = malloc(runs * sizeof(double));
+  for (i = 0; i < runs; i++) {
+    struct timespec start;
+    struct timespec stop;
+    struct rusage usage;
+    pid_t child;
+    int childStatus;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    child = fork();
+    if (child == 0) {
+      int input = open(argv[2], O_RDONLY);
+      int output = open("/dev/null", O_WRONLY);
+
+      if (input < 0 || output < 0) {
+        perror(input < 0 ? argv[2] : "/dev/null");
+        _exit(127);
+      }
+      dup2(input, 0);
+      dup2(output, 1);
+      dup2(output, 2);
+      execv(argv[3], argv + 3);
+      _exit(127);
+    }
+    if (child < 0 || wait4(child, &childStatus, 0, &usage) < 0) {
+      perror("measure");
+      return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    times[i] = (stop.tv_sec - start.tv_sec) * 1e3 +
+               (stop.tv_nsec - start.tv_nsec) / 1e6;
+    if (usage.ru_maxrss > peak) {
+      peak = usage.ru_maxrss;
+    }
+    status = WIFEXITED(childStatus) ? WEXITSTATUS(childStatus)
+                                    : 128 + WTERMSIG(childStatus);
+  }
+
+  qsort(times, runs, sizeof(double), compareTimes);
+  printf("%.2f %.2f %ld %d\n", times[0], times[runs / 2], peak, status);
+  free(times);
+  return 0;
+}
@@ -0,0 +1,51 @@
+#!/bin/sh
+# Times bench/gather.broas, which loads and stores at random all over memory,
+# with memory of each given size backed by ordinary and by huge pages, in the
+# switch engine and the JIT. When perf is installed, it also counts the dTLB
+# load misses of each run. Usage: bench/memory.sh [runs] [sizes...]
+cd "$(dirname "$0")/.." || exit 1
+runs=${1:-3}
+sizes="64M 256M 1G"
+if [ $# -gt 1 ]; then
+	shift
+	sizes=$*
+fi
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+make -s --no-print-directory OUT="$tmp/broas" || exit 1
+
+best() {
+	b=
+	i=0
+	while [ $i -lt "$runs" ]; do
+		s=$(date +%s%N)
+		"$@" > /dev/null < /dev/null
+		t=$(( ($(date +%s%N) - s) / 1000000 ))
+		if [ -z "$b" ] || [ "$t" -lt "$b" ]; then b=$t; fi
+		i=$((i + 1))
+	done
+	echo "$b"
+}
+
+misses() {
+	if command -v perf > /dev/null 2>&1; then
+		perf stat -x, -e dTLB-load-misses "$@" 2>&1 > /dev/null < /dev/null |
+			awk -F, '/dTLB/ { print $1; found = 1 } END { if (!found) print "-" }'
+	else
+		echo -
+	fi
+}
+
+printf '%-6s %-6s %14s %14s %16s %16s\n' size engine "4K pages (ms)" "huge (ms)" "4K dTLB misses" "huge dTLB misses"
+for size in $sizes; do
+	for engine in switch jit; do
+		flags="--mem $size"
+		[ "$engine" = jit ] && flags="$flags --jit"
+		printf '%-6s %-6s %14s %14s %16s %16s\n' "$size" "$engine" \
+			"$(best "$tmp/broas" $flags --no-huge-pages bench/gather.broas)" \
+			"$(best "$tmp/broas" $flags bench/gather.broas)" \
+			"$(misses "$tmp/broas" $flags --no-huge-pages bench/gather.broas)" \
+			"$(misses "$tmp/broas" $flags bench/gather.broas)"
+	done
+done
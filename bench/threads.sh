@@ -0,0 +1,61 @@
+#!/bin/sh
+# Times bench/primes.broas, which splits its work among as many threads as
+# it is told to, on 1 to N threads (the number of processors by default), in
+# the switch and threaded engines. Every run must print the same count; the
+# speedup is against the same engine on 1 thread. bench/pfor.broas does the
+# same work with pfor, which is timed with --threads in the switch engine.
+# The JIT leaves programs with threads to the interpreter, so it is not
+# timed.
+# Usage: bench/threads.sh [runs] [N]
+cd "$(dirname "$0")/.." || exit 1
+runs=${1:-3}
+cores=${2:-$(getconf _NPROCESSORS_ONLN 2>/dev/null || echo 1)}
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+make -s --no-print-directory OUT="$tmp/switch" || exit 1
+make -s --no-print-directory threaded OUT="$tmp/threaded" || exit 1
+
+best() {
+	b=
+	i=0
+	while [ $i -lt "$runs" ]; do
+		s=$(date +%s%N)
+		"$@" > /dev/null < /dev/null
+		t=$(( ($(date +%s%N) - s) / 1000000 ))
+		if [ -z "$b" ] || [ "$t" -lt "$b" ]; then b=$t; fi
+		i=$((i + 1))
+	done
+	echo "$b"
+}
+
+status=0
+expected=$("$tmp/switch" bench/primes.broas 1)
+printf '%-8s %12s %8s %14s %8s %10s %8s\n' threads "switch (ms)" speedup "threaded (ms)" speedup "pfor (ms)" speedup
+n=1
+while [ $n -le "$cores" ]; do
+	for engine in switch threaded; do
+		if [ "$("$tmp/$engine" bench/primes.broas $n)" != "$expected" ]; then
+			echo "$engine on $n threads differs from 1 thread" >&2
+			status=1
+		fi
+	done
+	if [ "$("$tmp/switch" --threads=$n bench/pfor.broas)" != "$expected" ]; then
+		echo "pfor on $n threads differs from 1 thread" >&2
+		status=1
+	fi
+	switch=$(best "$tmp/switch" bench/primes.broas $n)
+	threaded=$(best "$tmp/threaded" bench/primes.broas $n)
+	pfor=$(best "$tmp/switch" --threads=$n bench/pfor.broas)
+	if [ $n -eq 1 ]; then
+		switch1=$switch
+		threaded1=$threaded
+		pfor1=$pfor
+	fi
+	printf '%-8s %12s %8s %14s %8s %10s %8s\n' $n "$switch" \
+		"$(awk "BEGIN { printf \"%.2fx\", $switch1 / $switch }")" "$threaded" \
+		"$(awk "BEGIN { printf \"%.2fx\", $threaded1 / $threaded }")" "$pfor" \
+		"$(awk "BEGIN { printf \"%.2fx\", $pfor1 / $pfor }")"
+	n=$((n + 1))
+done
+exit $status
@@ -0,0 +1,115 @@
+#!/bin/sh
+# Times every vector instruction against the lw/sw loop that computes the
+# same thing, on vectors of 100000 words, 1000 times over. The loops run on
+# the JIT, which is 20 times faster than the switch engine at them, and the
+# vector instructions on each of the kernels; every version must print the
+# same checksum.
+# Usage: bench/vectors.sh [runs]
+cd "$(dirname "$0")/.." || exit 1
+runs=${1:-3}
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+make -s --no-print-directory OUT="$tmp/broas" || exit 1
+
+best() {
+	b=
+	i=0
+	while [ $i -lt "$runs" ]; do
+		s=$(date +%s%N)
+		"$@" > /dev/null < /dev/null
+		t=$(( ($(date +%s%N) - s) / 1000000 ))
+		if [ -z "$b" ] || [ "$t" -lt "$b" ]; then b=$t; fi
+		i=$((i + 1))
+	done
+	echo "$b"
+}
+
+# a and b are filled with pseudo-random words, c receives the results
+prologue='add n 100000 0
+add a 1024 0
+add b 101024 0
+add c 201024 0
+add x 12345 0
+add i 0 0
+@setup
+mult x x 1103515245
+add x x 12345
+and x x 1048575
+sub x x 524288
+add p a i
+sw x p
+xor y x 777
+add p b i
+sw y p
+add i i 1
+blt i n @setup
+add total 0 0
+add r 0 0
+@round'
+
+# the checksum takes in one word of c, or the result of a reduction
+epilogue='add r r 1
+blt r 1000 @round
+add k 0 0
+@print
+and digit total 15
+add digit digit 65
+print digit
+sr total total 4
+add k k 1
+blt k 16 @print
+print '"'\\n'"'
+exit 0'
+
+elementwise() {
+	printf '%s\nvlen n\n%s c a b\nmod p r n\nadd p p c\nlw z p\nadd total total z\n%s\n' "$prologue" "$1" "$epilogue" > "$tmp/vector.broas"
+	printf '%s\nadd i 0 0\n@loop\nadd p a i\nlw u p\nadd p b i\nlw v p\n%s z u v\nadd p c i\nsw z p\nadd i i 1\nblt i n @loop\nmod p r n\nadd p p c\nlw z p\nadd total total z\n%s\n' "$prologue" "$2" "$epilogue" > "$tmp/loop.broas"
+}
+
+scale() {
+	printf '%s\nvlen n\nvscale c a 3\nmod p r n\nadd p p c\nlw z p\nadd total total z\n%s\n' "$prologue" "$epilogue" > "$tmp/vector.broas"
+	printf '%s\nadd i 0 0\n@loop\nadd p a i\nlw u p\nmult z u 3\nadd p c i\nsw z p\nadd i i 1\nblt i n @loop\nmod p r n\nadd p p c\nlw z p\nadd total total z\n%s\n' "$prologue" "$epilogue" > "$tmp/loop.broas"
+}
+
+# $2 folds word u into s, starting from $3
+reduction() {
+	printf '%s\nvlen n\n%s s a\nadd total total s\n%s\n' "$prologue" "$1" "$epilogue" > "$tmp/vector.broas"
+	printf '%s\nadd s %s 0\nadd i 0 0\n@loop\nadd p a i\nlw u p\n%s\nadd i i 1\nblt i n @loop\nadd total total s\n%s\n' "$prologue" "$3" "$2" "$epilogue" > "$tmp/loop.broas"
+}
+
+dot() {
+	printf '%s\nvlen n\nvdot s a b\nadd total total s\n%s\n' "$prologue" "$epilogue" > "$tmp/vector.broas"
+	printf '%s\nadd s 0 0\nadd i 0 0\n@loop\nadd p a i\nlw u p\nadd p b i\nlw v p\nmult z u v\nadd s s z\nadd i i 1\nblt i n @loop\nadd total total s\n%s\n' "$prologue" "$epilogue" > "$tmp/loop.broas"
+}
+
+status=0
+printf '%-8s %12s %12s %12s %12s\n' instr "loop (ms)" scalar sse2 avx2
+for instruction in vadd vsub vmult vand vor vxor vscale vsum vmin vmax vdot; do
+	case $instruction in
+	vscale) scale ;;
+	vsum) reduction vsum 'add s s u' 0 ;;
+	vmin) reduction vmin 'bge u s @keep
+add s u 0
+@keep' 9223372036854775807 ;;
+	vmax) reduction vmax 'ble u s @keep
+add s u 0
+@keep' -9223372036854775808 ;;
+	vdot) dot ;;
+	*) elementwise "$instruction" "${instruction#v}" ;;
+	esac
+	expected=$("$tmp/broas" --jit "$tmp/loop.broas")
+	for version in "--vector=scalar $tmp/vector.broas" \
+		"--vector=sse2 $tmp/vector.broas" "--vector=avx2 $tmp/vector.broas"; do
+		if [ "$("$tmp/broas" $version 2>&1)" != "$expected" ]; then
+			echo "$instruction: broas $version differs from the loop" >&2
+			status=1
+		fi
+	done
+	printf '%-8s %12s %12s %12s %12s\n' "$instruction" \
+		"$(best "$tmp/broas" --jit "$tmp/loop.broas")" \
+		"$(best "$tmp/broas" --vector=scalar "$tmp/vector.broas")" \
+		"$(best "$tmp/broas" --vector=sse2 "$tmp/vector.broas")" \
+		"$(best "$tmp/broas" --vector=avx2 "$tmp/vector.broas")"
+done
+exit $status
@@ -4,7 +4,6 @@
 #include "kernel/fcntl.h"
 
 #define MAX_TOKENS_IN_FILE 1024
-#define MAX_TOKENS_IN_LINE 5
 #define MAX_INSTRUCTIONS 100
 
 #define MAX_LABELS 100
@@ -13,16 +12,20 @@
 
 #define MEMORY_SIZE 1024
 
+#define OUTPUT_BUFFER_SIZE 1024
+
 #define MX_TOK_SZ 32
 
+#define MAX_OPERANDS 3
+
 struct Label {
   char *name;
   long int instructionIndex;
 };
 
+/* indexed by register slot, only used for diagnostics */
 struct Variable {
   char *name;
-  void *value;
 };
 
 enum TokenType { LABEL,
@@ -38,6 +41,82 @@ struct LexToken {
   } token;
 };
 
+enum Opcode {
+  OP_ADD,
+  OP_SUB,
+  OP_LW,
+  OP_SW,
+  OP_MULT,
+  OP_DIV,
+  OP_BEQ,
+  OP_BNEQ,
+  OP_MOD,
+  OP_XOR,
+  OP_OR,
+  OP_AND,
+  OP_NOT,
+  OP_SL,
+  OP_SR,
+  OP_BLT,
+  OP_BGT,
+  OP_BLE,
+  OP_BGE,
+  OP_JMP,
+  OP_REF,
+  OP_DEREF,
+  OP_PRINT,
+  OP_EXIT,
+  OP_SYSCALL
+};
+
+/*
+ * Labels are resolved while compiling, so an OPERAND_LABEL carries the
+ * instruction index it names, and every distinct variable name is interned
+ * to a register slot that an OPERAND_VARIABLE carries instead of the name.
+ * Operands that cannot be evaluated (labels that are never defined, opcodes
+ * in operand position) keep their name so the interpreter can report them
+ * when, and only if, they are executed.
+ */
+enum OperandKind {
+  OPERAND_IMMEDIATE,
+  OPERAND_VARIABLE,
+  OPERAND_LABEL,
+  OPERAND_UNDEFINED,
+  OPERAND_INVALID
+};
+
+struct Operand {
+  enum OperandKind kind;
+  union {
+    long int value;
+    char *name;
+  } as;
+};
+
+struct Instruction {
+  enum Opcode opcode;
+  struct Operand operands[MAX_OPERANDS];
+};
+
+/* print collects characters here so that it takes one write per buffer rather than one per character */
+static char output[OUTPUT_BUFFER_SIZE];
+static int outputLength;
+
+/* xv6 has no atexit, so this runs before every exit once the program has started */
+void flushOutput(void) {
+  if (outputLength > 0) {
+    write(1, output, outputLength);
+    outputLength = 0;
+  }
+}
+
+void writeCharacter(char c) {
+  output[outputLength++] = c;
+  if (outputLength == OUTPUT_BUFFER_SIZE) {
+    flushOutput();
+  }
+}
+
 long readchar(int fd, char *pc) { return read(fd, pc, 1); }
 
 int readline(int fd, char *line, unsigned long max) {
@@ -162,66 +241,192 @@ int getTokens(int fd, struct LexToken *tokens) {
   return n;
 }
 
-void *getValue(struct LexToken valueToken, struct Variable *variables, int numberOfVariables, struct Label *labels, int numberOfLabels) {
-  if (valueToken.type == IMMEDIATE)
-    return (void *)valueToken.token.tokint;
-  else if (valueToken.type == VARIABLE) {
-    int i;
-    for (i = 0; i < numberOfVariables; ++i) {
-      if (strcmp(variables[i].name, valueToken.token.tokstr) == 0) {
-        return variables[i].value;
-      }
-    }
-  } else if (valueToken.type == LABEL) {
-    int i;
-    for (i = 0; i < numberOfLabels; ++i) {
-      if (strcmp(labels[i].name, valueToken.token.tokstr) == 0) {
-        return (void *)labels[i].instructionIndex;
-      }
+struct OpcodeInfo {
+  char const *name;
+  int operandCount;
+};
+
+/* indexed by enum Opcode */
+static struct OpcodeInfo const opcodeTable[] = {
+    {"add", 3}, {"sub", 3}, {"lw", 2}, {"sw", 2}, {"mult", 3},
+    {"div", 3}, {"beq", 3}, {"bneq", 3}, {"mod", 3}, {"xor", 3},
+    {"or", 3}, {"and", 3}, {"not", 2}, {"sl", 3}, {"sr", 3},
+    {"blt", 3}, {"bgt", 3}, {"ble", 3}, {"bge", 3}, {"jmp", 1},
+    {"ref", 2}, {"deref", 3}, {"print", 1}, {"exit", 1}, {"syscall", 3}};
+
+static int const numberOfOpcodes = sizeof(opcodeTable) / sizeof(opcodeTable[0]);
+
+int lookupOpcode(char const *name) {
+  int i;
+
+  for (i = 0; i < numberOfOpcodes; i++) {
+    if (strcmp(name, opcodeTable[i].name) == 0) {
+      return i;
     }
-  } else {
-    fprintf(2, "Cannot get value of %s, (can only access value of a variable or immediate or label)\n", valueToken.token.tokstr);
-    exit(1);
   }
-  fprintf(2, "%s not defined\n", valueToken.token.tokstr);
+
+  fprintf(2, "Unknown operation %s\n", name);
   exit(1);
 }
 
-void setValue(struct LexToken *pVariableToken, void *value, struct Variable *variables, int *pNumberOfVariables) {
+long int findLabel(char const *name, struct Label *labels, int numberOfLabels) {
   int i;
-  struct LexToken variableToken = *pVariableToken;
 
-  if (variableToken.type != VARIABLE) {
-    fprintf(2, "Can only set value of a variable\n");
+  for (i = 0; i < numberOfLabels; i++) {
+    if (strcmp(labels[i].name, name) == 0) {
+      return labels[i].instructionIndex;
+    }
+  }
+  return -1;
+}
+
+long int internVariable(char *name, struct Variable *variables, int maxVariables, int *pNumberOfVariables) {
+  int i;
+
+  for (i = 0; i < *pNumberOfVariables; i++) {
+    if (strcmp(variables[i].name, name) == 0) {
+      return i;
+    }
+  }
+
+  if (*pNumberOfVariables == maxVariables) {
+    fprintf(2, "Too many variables, at most %d are supported\n", maxVariables);
     exit(1);
   }
+  variables[*pNumberOfVariables].name = name;
+  return (*pNumberOfVariables)++;
+}
+
+void compileOperand(struct LexToken *token, struct Operand *operand, struct Label *labels, int numberOfLabels, struct Variable *variables, int maxVariables, int *pNumberOfVariables) {
+  switch (token->type) {
+    case IMMEDIATE:
+      operand->kind = OPERAND_IMMEDIATE;
+      operand->as.value = token->token.tokint;
+      break;
+    case VARIABLE:
+      operand->kind = OPERAND_VARIABLE;
+      operand->as.value = internVariable(token->token.tokstr, variables, maxVariables, pNumberOfVariables);
+      break;
+    case LABEL:
+      operand->as.value = findLabel(token->token.tokstr, labels, numberOfLabels);
+      if (operand->as.value < 0) {
+        operand->kind = OPERAND_UNDEFINED;
+        operand->as.name = token->token.tokstr;
+      } else {
+        operand->kind = OPERAND_LABEL;
+      }
+      break;
+    default:
+      operand->kind = OPERAND_INVALID;
+      operand->as.name = token->token.tokstr;
+      break;
+  }
+}
+
+/*
+ * Turns the token stream into instructions. The first pass records where
+ * every label points so that the second pass can resolve forward branches
+ * and give each variable name its register slot. Returns the number of
+ * instructions.
+ */
+int compileTokens(struct LexToken *tokens, int totalTokens, struct Instruction *instructions, struct Label *labels, int *pNumberOfLabels, struct Variable *variables, int maxVariables, int *pNumberOfVariables) {
+  int numberOfLabels = 0;
+  int numberOfInstructions = 0;
+  int i = 0;
 
-  for (i = 0; i < *pNumberOfVariables; ++i) {
-    if (strcmp(variables[i].name, variableToken.token.tokstr) == 0) {
-      variables[i].value = value;
-      return;
+  while (i < totalTokens) {
+    struct LexToken *lexToken = &tokens[i++];
+
+    if (lexToken->type == OPCODE) {
+      int opcode = lookupOpcode(lexToken->token.tokstr);
+
+      if (i + opcodeTable[opcode].operandCount > totalTokens) {
+        fprintf(2, "Missing operand for %s\n", lexToken->token.tokstr);
+        exit(1);
+      }
+      i += opcodeTable[opcode].operandCount;
+      ++numberOfInstructions;
+    } else if (lexToken->type == LABEL) {
+      labels[numberOfLabels].name = lexToken->token.tokstr;
+      labels[numberOfLabels].instructionIndex = numberOfInstructions;
+      ++numberOfLabels;
+    } else {
+      fprintf(2, "Unexpected token %s in place of opcode or label, (encountered at %dth token position)\n", lexToken->token.tokstr, i);
+      exit(1);
     }
   }
 
-  variables[*pNumberOfVariables].name = pVariableToken->token.tokstr;
-  variables[*pNumberOfVariables].value = value;
-  ++(*pNumberOfVariables);
+  numberOfInstructions = 0;
+  *pNumberOfVariables = 0;
+  i = 0;
+  while (i < totalTokens) {
+    struct LexToken *lexToken = &tokens[i++];
+    struct Instruction *instruction;
+    int operand;
+
+    if (lexToken->type != OPCODE) {
+      continue;
+    }
+
+    instruction = &instructions[numberOfInstructions++];
+    instruction->opcode = (enum Opcode)lookupOpcode(lexToken->token.tokstr);
+    for (operand = 0; operand < opcodeTable[instruction->opcode].operandCount; operand++) {
+      compileOperand(&tokens[i++], &instruction->operands[operand], labels, numberOfLabels, variables, maxVariables, pNumberOfVariables);
+    }
+  }
+
+  *pNumberOfLabels = numberOfLabels;
+  return numberOfInstructions;
+}
+
+void *getValue(struct Operand *operand, long int *registers, char *defined, struct Variable *variables) {
+  if (operand->kind == OPERAND_IMMEDIATE || operand->kind == OPERAND_LABEL)
+    return (void *)operand->as.value;
+  else if (operand->kind == OPERAND_VARIABLE) {
+    if (defined[operand->as.value]) {
+      return (void *)registers[operand->as.value];
+    }
+    flushOutput();
+    fprintf(2, "%s not defined\n", variables[operand->as.value].name);
+    exit(1);
+  } else if (operand->kind == OPERAND_INVALID) {
+    flushOutput();
+    fprintf(2, "Cannot get value of %s, (can only access value of a variable or immediate or label)\n", operand->as.name);
+    exit(1);
+  }
+  flushOutput();
+  fprintf(2, "%s not defined\n", operand->as.name);
+  exit(1);
+}
+
+void setValue(struct Operand *operand, void *value, long int *registers, char *defined) {
+  if (operand->kind != OPERAND_VARIABLE) {
+    flushOutput();
+    fprintf(2, "Can only set value of a variable\n");
+    exit(1);
+  }
+
+  registers[operand->as.value] = (long int)value;
+  defined[operand->as.value] = 1;
 }
 
 int main(int argc, char **argv) {
   int fd;
 
-  static struct LexToken instructions[MAX_INSTRUCTIONS][MAX_TOKENS_IN_LINE];
+  static struct Instruction instructions[MAX_INSTRUCTIONS];
   static struct LexToken tokens[MAX_TOKENS_IN_FILE];
   int totalTokens;
   int nextInstruction = 0;
   int totalInstructions;
 
   static struct Label labels[MAX_LABELS];
-  int nextLabel = 0;
+  int numberOfLabels;
 
   static struct Variable variables[MAX_VARIABLES];
-  int nextVariable = 0;
+  int numberOfVariables;
+
+  static long int registers[MAX_VARIABLES];
+  static char defined[MAX_VARIABLES];
 
   static void *memory[MEMORY_SIZE];
 
@@ -240,351 +445,265 @@ int main(int argc, char **argv) {
   }
 
   totalTokens = getTokens(fd, tokens);
+  totalInstructions = compileTokens(tokens, totalTokens, instructions, labels, &numberOfLabels, variables, MAX_VARIABLES, &numberOfVariables);
 
-  i = 0;
-  while (i < totalTokens) {
-    struct LexToken lexToken = tokens[i++];
-
-    if (lexToken.type == OPCODE) {
-      instructions[nextInstruction][0] = lexToken;
-
-      if (strcmp(lexToken.token.tokstr, "add") == 0) {
-        instructions[nextInstruction][1] = tokens[i++];
-        instructions[nextInstruction][2] = tokens[i++];
-        instructions[nextInstruction][3] = tokens[i++];
-      } else if (strcmp(lexToken.token.tokstr, "sub") == 0) {
-        instructions[nextInstruction][1] = tokens[i++];
-        instructions[nextInstruction][2] = tokens[i++];
-        instructions[nextInstruction][3] = tokens[i++];
-      } else if (strcmp(lexToken.token.tokstr, "lw") == 0) {
-        instructions[nextInstruction][1] = tokens[i++];
-        instructions[nextInstruction][2] = tokens[i++];
-      } else if (strcmp(lexToken.token.tokstr, "sw") == 0) {
-        instructions[nextInstruction][1] = tokens[i++];
-        instructions[nextInstruction][2] = tokens[i++];
-      } else if (strcmp(lexToken.token.tokstr, "mult") == 0) {
-        instructions[nextInstruction][1] = tokens[i++];
-        instructions[nextInstruction][2] = tokens[i++];
-        instructions[nextInstruction][3] = tokens[i++];
-      } else if (strcmp(lexToken.token.tokstr, "div") == 0) {
-        instructions[nextInstruction][1] = tokens[i++];
-        instructions[nextInstruction][2] = tokens[i++];
-        instructions[nextInstruction][3] = tokens[i++];
-      } else if (strcmp(lexToken.token.tokstr, "beq") == 0) {
-        instructions[nextInstruction][1] = tokens[i++];
-        instructions[nextInstruction][2] = tokens[i++];
-        instructions[nextInstruction][3] = tokens[i++];
-      } else if (strcmp(lexToken.token.tokstr, "bneq") == 0) {
-        instructions[nextInstruction][1] = tokens[i++];
-        instructions[nextInstruction][2] = tokens[i++];
-        instructions[nextInstruction][3] = tokens[i++];
-      } else if (strcmp(lexToken.token.tokstr, "mod") == 0) {
-        instructions[nextInstruction][1] = tokens[i++];
-        instructions[nextInstruction][2] = tokens[i++];
-        instructions[nextInstruction][3] = tokens[i++];
-      } else if (strcmp(lexToken.token.tokstr, "xor") == 0) {
-        instructions[nextInstruction][1] = tokens[i++];
-        instructions[nextInstruction][2] = tokens[i++];
-        instructions[nextInstruction][3] = tokens[i++];
-      } else if (strcmp(lexToken.token.tokstr, "or") == 0) {
-        instructions[nextInstruction][1] = tokens[i++];
-        instructions[nextInstruction][2] = tokens[i++];
-        instructions[nextInstruction][3] = tokens[i++];
-      } else if (strcmp(lexToken.token.tokstr, "and") == 0) {
-        instructions[nextInstruction][1] = tokens[i++];
-        instructions[nextInstruction][2] = tokens[i++];
-        instructions[nextInstruction][3] = tokens[i++];
-      } else if (strcmp(lexToken.token.tokstr, "not") == 0) {
-        instructions[nextInstruction][1] = tokens[i++];
-        instructions[nextInstruction][2] = tokens[i++];
-      } else if (strcmp(lexToken.token.tokstr, "sl") == 0) {
-        instructions[nextInstruction][1] = tokens[i++];
-        instructions[nextInstruction][2] = tokens[i++];
-        instructions[nextInstruction][3] = tokens[i++];
-      } else if (strcmp(lexToken.token.tokstr, "sr") == 0) {
-        instructions[nextInstruction][1] = tokens[i++];
-        instructions[nextInstruction][2] = tokens[i++];
-        instructions[nextInstruction][3] = tokens[i++];
-      } else if (strcmp(lexToken.token.tokstr, "blt") == 0) {
-        instructions[nextInstruction][1] = tokens[i++];
-        instructions[nextInstruction][2] = tokens[i++];
-        instructions[nextInstruction][3] = tokens[i++];
-      } else if (strcmp(lexToken.token.tokstr, "bgt") == 0) {
-        instructions[nextInstruction][1] = tokens[i++];
-        instructions[nextInstruction][2] = tokens[i++];
-        instructions[nextInstruction][3] = tokens[i++];
-      } else if (strcmp(lexToken.token.tokstr, "ble") == 0) {
-        instructions[nextInstruction][1] = tokens[i++];
-        instructions[nextInstruction][2] = tokens[i++];
-        instructions[nextInstruction][3] = tokens[i++];
-      } else if (strcmp(lexToken.token.tokstr, "bge") == 0) {
-        instructions[nextInstruction][1] = tokens[i++];
-        instructions[nextInstruction][2] = tokens[i++];
-        instructions[nextInstruction][3] = tokens[i++];
-      } else if (strcmp(lexToken.token.tokstr, "jmp") == 0) {
-        instructions[nextInstruction][1] = tokens[i++];
-      } else if (strcmp(lexToken.token.tokstr, "ref") == 0) {
-        instructions[nextInstruction][1] = tokens[i++];
-        instructions[nextInstruction][2] = tokens[i++];
-      } else if (strcmp(lexToken.token.tokstr, "deref") == 0) {
-        instructions[nextInstruction][1] = tokens[i++];
-        instructions[nextInstruction][2] = tokens[i++];
-        instructions[nextInstruction][3] = tokens[i++];
-      } else if (strcmp(lexToken.token.tokstr, "print") == 0) {
-        instructions[nextInstruction][1] = tokens[i++];
-      } else if (strcmp(lexToken.token.tokstr, "syscall") == 0) {
-        instructions[nextInstruction][1] = tokens[i++];
-        instructions[nextInstruction][2] = tokens[i++];
-        instructions[nextInstruction][3] = tokens[i++];
-      } else if (strcmp(lexToken.token.tokstr, "exit") == 0) {
-        instructions[nextInstruction][1] = tokens[i++];
-      } else {
-        fprintf(2, "Unknown operation %s\n", lexToken.token.tokstr);
-        exit(1);
-      }
-
-      ++nextInstruction;
-    }
+  while (nextInstruction < totalInstructions) {
+    struct Instruction *instruction = &instructions[nextInstruction];
+    struct Operand *operands = instruction->operands;
 
-    else if (lexToken.type == LABEL) {
-      labels[nextLabel].name = tokens[i - 1].token.tokstr;
-      labels[nextLabel].instructionIndex = nextInstruction;
-      ++nextLabel;
-    }
+    switch (instruction->opcode) {
+      case OP_ADD: {
+        long int leftOperand = (long int)getValue(&operands[1], registers, defined, variables);
+        long int rightOperand = (long int)getValue(&operands[2], registers, defined, variables);
+        long int result = leftOperand + rightOperand;
 
-    else {
-      fprintf(2, "Unexpected token %s in place of opcode or label, (encountered at %dth token position)\n", lexToken.token.tokstr, i);
-      exit(1);
-    }
-  }
+        setValue(&operands[0], (void *)result, registers, defined);
+        break;
+      }
 
-  totalInstructions = nextInstruction;
-  nextInstruction = 0;
+      case OP_SUB: {
+        long int leftOperand = (long int)getValue(&operands[1], registers, defined, variables);
+        long int rightOperand = (long int)getValue(&operands[2], registers, defined, variables);
+        long int result = leftOperand - rightOperand;
 
-  while (nextInstruction < totalInstructions) {
-    struct LexToken *instruction = instructions[nextInstruction];
-    char *opcode = instruction[0].token.tokstr;
+        setValue(&operands[0], (void *)result, registers, defined);
+        break;
+      }
 
-    if (strcmp(opcode, "add") == 0) {
-      long int leftOperand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-      long int rightOperand = (long int)getValue(instruction[3], variables, nextVariable, labels, nextLabel);
-      long int result = leftOperand + rightOperand;
+      case OP_LW: {
+        long int memoryOperand = (long int)getValue(&operands[1], registers, defined, variables);
 
-      setValue(&instruction[1], (void *)result, variables, &nextVariable);
-    }
+        setValue(&operands[0], memory[memoryOperand], registers, defined);
+        break;
+      }
 
-    else if (strcmp(opcode, "sub") == 0) {
-      long int leftOperand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-      long int rightOperand = (long int)getValue(instruction[3], variables, nextVariable, labels, nextLabel);
-      long int result = leftOperand - rightOperand;
+      case OP_SW: {
+        void *variableOperand = getValue(&operands[0], registers, defined, variables);
+        long int memoryOperand = (long int)getValue(&operands[1], registers, defined, variables);
 
-      setValue(&instruction[1], (void *)result, variables, &nextVariable);
-    }
+        memory[memoryOperand] = variableOperand;
+        break;
+      }
 
-    else if (strcmp(opcode, "lw") == 0) {
-      long int memoryOperand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
+      case OP_MULT: {
+        long int leftOperand = (long int)getValue(&operands[1], registers, defined, variables);
+        long int rightOperand = (long int)getValue(&operands[2], registers, defined, variables);
+        long int result = leftOperand * rightOperand;
 
-      setValue(&instruction[1], memory[memoryOperand], variables, &nextVariable);
-    }
+        setValue(&operands[0], (void *)result, registers, defined);
+        break;
+      }
 
-    else if (strcmp(opcode, "sw") == 0) {
-      void *variableOperand = getValue(instruction[1], variables, nextVariable, labels, nextLabel);
-      long int memoryOperand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
+      case OP_DIV: {
+        long int leftOperand = (long int)getValue(&operands[1], registers, defined, variables);
+        long int rightOperand = (long int)getValue(&operands[2], registers, defined, variables);
+        long int result = leftOperand / rightOperand;
 
-      memory[memoryOperand] = variableOperand;
-    }
+        setValue(&operands[0], (void *)result, registers, defined);
+        break;
+      }
 
-    else if (strcmp(opcode, "mult") == 0) {
-      long int leftOperand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-      long int rightOperand = (long int)getValue(instruction[3], variables, nextVariable, labels, nextLabel);
-      long int result = leftOperand * rightOperand;
+      case OP_BEQ: {
+        long int leftOperand = (long int)getValue(&operands[0], registers, defined, variables);
+        long int rightOperand = (long int)getValue(&operands[1], registers, defined, variables);
+        long int branchAddress = (long int)getValue(&operands[2], registers, defined, variables);
 
-      setValue(&instruction[1], (void *)result, variables, &nextVariable);
-    }
+        if (leftOperand == rightOperand) {
+          nextInstruction = branchAddress;
+          continue;
+        }
+        break;
+      }
 
-    else if (strcmp(opcode, "div") == 0) {
-      long int leftOperand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-      long int rightOperand = (long int)getValue(instruction[3], variables, nextVariable, labels, nextLabel);
-      long int result = leftOperand / rightOperand;
+      case OP_BNEQ: {
+        long int leftOperand = (long int)getValue(&operands[0], registers, defined, variables);
+        long int rightOperand = (long int)getValue(&operands[1], registers, defined, variables);
+        long int branchAddress = (long int)getValue(&operands[2], registers, defined, variables);
 
-      setValue(&instruction[1], (void *)result, variables, &nextVariable);
-    }
+        if (leftOperand != rightOperand) {
+          nextInstruction = branchAddress;
+          continue;
+        }
+        break;
+      }
 
-    else if (strcmp(opcode, "beq") == 0) {
-      long int leftOperand = (long int)getValue(instruction[1], variables, nextVariable, labels, nextLabel);
-      long int rightOperand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-      long int branchAddress = (long int)getValue(instruction[3], variables, nextVariable, labels, nextLabel);
+      case OP_MOD: {
+        long int leftOperand = (long int)getValue(&operands[1], registers, defined, variables);
+        long int rightOperand = (long int)getValue(&operands[2], registers, defined, variables);
+        long int result = leftOperand % rightOperand;
 
-      if (leftOperand == rightOperand) {
-        nextInstruction = branchAddress;
-        continue;
+        setValue(&operands[0], (void *)result, registers, defined);
+        break;
       }
-    }
 
-    else if (strcmp(opcode, "bneq") == 0) {
-      long int leftOperand = (long int)getValue(instruction[1], variables, nextVariable, labels, nextLabel);
-      long int rightOperand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-      long int branchAddress = (long int)getValue(instruction[3], variables, nextVariable, labels, nextLabel);
+      case OP_XOR: {
+        long int leftOperand = (long int)getValue(&operands[1], registers, defined, variables);
+        long int rightOperand = (long int)getValue(&operands[2], registers, defined, variables);
+        long int result = leftOperand ^ rightOperand;
 
-      if (leftOperand != rightOperand) {
-        nextInstruction = branchAddress;
-        continue;
+        setValue(&operands[0], (void *)result, registers, defined);
+        break;
       }
-    }
 
-    else if (strcmp(opcode, "mod") == 0) {
-      long int leftOperand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-      long int rightOperand = (long int)getValue(instruction[3], variables, nextVariable, labels, nextLabel);
-      long int result = leftOperand % rightOperand;
+      case OP_OR: {
+        long int leftOperand = (long int)getValue(&operands[1], registers, defined, variables);
+        long int rightOperand = (long int)getValue(&operands[2], registers, defined, variables);
+        long int result = leftOperand | rightOperand;
 
-      setValue(&instruction[1], (void *)result, variables, &nextVariable);
-    }
+        setValue(&operands[0], (void *)result, registers, defined);
+        break;
+      }
 
-    else if (strcmp(opcode, "xor") == 0) {
-      long int leftOperand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-      long int rightOperand = (long int)getValue(instruction[3], variables, nextVariable, labels, nextLabel);
-      long int result = leftOperand ^ rightOperand;
+      case OP_AND: {
+        long int leftOperand = (long int)getValue(&operands[1], registers, defined, variables);
+        long int rightOperand = (long int)getValue(&operands[2], registers, defined, variables);
+        long int result = leftOperand & rightOperand;
 
-      setValue(&instruction[1], (void *)result, variables, &nextVariable);
-    }
+        setValue(&operands[0], (void *)result, registers, defined);
+        break;
+      }
 
-    else if (strcmp(opcode, "or") == 0) {
-      long int leftOperand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-      long int rightOperand = (long int)getValue(instruction[3], variables, nextVariable, labels, nextLabel);
-      long int result = leftOperand | rightOperand;
+      case OP_NOT: {
+        long int operand = (long int)getValue(&operands[1], registers, defined, variables);
+        long int result = ~operand;
 
-      setValue(&instruction[1], (void *)result, variables, &nextVariable);
-    }
+        setValue(&operands[0], (void *)result, registers, defined);
+        break;
+      }
 
-    else if (strcmp(opcode, "and") == 0) {
-      long int leftOperand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-      long int rightOperand = (long int)getValue(instruction[3], variables, nextVariable, labels, nextLabel);
-      long int result = leftOperand & rightOperand;
+      case OP_SL: {
+        long int leftOperand = (long int)getValue(&operands[1], registers, defined, variables);
+        long int rightOperand = (long int)getValue(&operands[2], registers, defined, variables);
+        long int result = leftOperand << rightOperand;
 
-      setValue(&instruction[1], (void *)result, variables, &nextVariable);
-    }
+        setValue(&operands[0], (void *)result, registers, defined);
+        break;
+      }
 
-    else if (strcmp(opcode, "not") == 0) {
-      long int operand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-      long int result = ~operand;
+      case OP_SR: {
+        long int leftOperand = (long int)getValue(&operands[1], registers, defined, variables);
+        long int rightOperand = (long int)getValue(&operands[2], registers, defined, variables);
+        long int result = leftOperand >> rightOperand;
 
-      setValue(&instruction[1], (void *)result, variables, &nextVariable);
-    }
+        setValue(&operands[0], (void *)result, registers, defined);
+        break;
+      }
 
-    else if (strcmp(opcode, "sl") == 0) {
-      long int leftOperand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-      long int rightOperand = (long int)getValue(instruction[3], variables, nextVariable, labels, nextLabel);
-      long int result = leftOperand << rightOperand;
+      case OP_BLT: {
+        long int leftOperand = (long int)getValue(&operands[0], registers, defined, variables);
+        long int rightOperand = (long int)getValue(&operands[1], registers, defined, variables);
+        long int branchAddress = (long int)getValue(&operands[2], registers, defined, variables);
 
-      setValue(&instruction[1], (void *)result, variables, &nextVariable);
-    }
+        if (leftOperand < rightOperand) {
+          nextInstruction = branchAddress;
+          continue;
+        }
+        break;
+      }
 
-    else if (strcmp(opcode, "sr") == 0) {
-      long int leftOperand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-      long int rightOperand = (long int)getValue(instruction[3], variables, nextVariable, labels, nextLabel);
-      long int result = leftOperand >> rightOperand;
+      case OP_BGT: {
+        long int leftOperand = (long int)getValue(&operands[0], registers, defined, variables);
+        long int rightOperand = (long int)getValue(&operands[1], registers, defined, variables);
+        long int branchAddress = (long int)getValue(&operands[2], registers, defined, variables);
 
-      setValue(&instruction[1], (void *)result, variables, &nextVariable);
-    }
+        if (leftOperand > rightOperand) {
+          nextInstruction = branchAddress;
+          continue;
+        }
+        break;
+      }
 
-    else if (strcmp(opcode, "blt") == 0) {
-      long int leftOperand = (long int)getValue(instruction[1], variables, nextVariable, labels, nextLabel);
-      long int rightOperand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-      long int branchAddress = (long int)getValue(instruction[3], variables, nextVariable, labels, nextLabel);
+      case OP_BLE: {
+        long int leftOperand = (long int)getValue(&operands[0], registers, defined, variables);
+        long int rightOperand = (long int)getValue(&operands[1], registers, defined, variables);
+        long int branchAddress = (long int)getValue(&operands[2], registers, defined, variables);
 
-      if (leftOperand < rightOperand) {
-        nextInstruction = branchAddress;
-        continue;
+        if (leftOperand <= rightOperand) {
+          nextInstruction = branchAddress;
+          continue;
+        }
+        break;
       }
-    }
 
-    else if (strcmp(opcode, "bgt") == 0) {
-      long int leftOperand = (long int)getValue(instruction[1], variables, nextVariable, labels, nextLabel);
-      long int rightOperand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-      long int branchAddress = (long int)getValue(instruction[3], variables, nextVariable, labels, nextLabel);
+      case OP_BGE: {
+        long int leftOperand = (long int)getValue(&operands[0], registers, defined, variables);
+        long int rightOperand = (long int)getValue(&operands[1], registers, defined, variables);
+        long int branchAddress = (long int)getValue(&operands[2], registers, defined, variables);
 
-      if (leftOperand > rightOperand) {
-        nextInstruction = branchAddress;
-        continue;
+        if (leftOperand >= rightOperand) {
+          nextInstruction = branchAddress;
+          continue;
+        }
+        break;
       }
-    }
 
-    else if (strcmp(opcode, "ble") == 0) {
-      long int leftOperand = (long int)getValue(instruction[1], variables, nextVariable, labels, nextLabel);
-      long int rightOperand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-      long int branchAddress = (long int)getValue(instruction[3], variables, nextVariable, labels, nextLabel);
+      case OP_JMP: {
+        long int jumpAddress = (long int)getValue(&operands[0], registers, defined, variables);
 
-      if (leftOperand <= rightOperand) {
-        nextInstruction = branchAddress;
+        nextInstruction = jumpAddress;
         continue;
       }
-    }
 
-    else if (strcmp(opcode, "bge") == 0) {
-      long int leftOperand = (long int)getValue(instruction[1], variables, nextVariable, labels, nextLabel);
-      long int rightOperand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-      long int branchAddress = (long int)getValue(instruction[3], variables, nextVariable, labels, nextLabel);
+      case OP_REF: {
+        long int memoryOperand = (long int)getValue(&operands[1], registers, defined, variables);
 
-      if (leftOperand >= rightOperand) {
-        nextInstruction = branchAddress;
-        continue;
+        setValue(&operands[0], (void *)(memory + memoryOperand), registers, defined);
+        break;
       }
-    }
 
-    else if (strcmp(opcode, "jmp") == 0) {
-      long int jumpAddress = (long int)getValue(instruction[1], variables, nextVariable, labels, nextLabel);
-
-      nextInstruction = jumpAddress;
-      continue;
-    }
+      case OP_DEREF: {
+        long int *addressOperand = (long int *)getValue(&operands[1], registers, defined, variables);
+        long int sizeOperand = (long int)getValue(&operands[2], registers, defined, variables);
 
-    else if (strcmp(opcode, "ref") == 0) {
-      long int memoryOperand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
+        long int result = 0;
 
-      setValue(&instruction[1], (void *)(memory + memoryOperand), variables, &nextVariable);
-    }
+        int byteCount;
+        for (byteCount = sizeOperand - 1; byteCount >= 0; --byteCount) {
+          char byte = *((char *)addressOperand + byteCount);
+          result = (result << 8) | byte;
+        }
 
-    else if (strcmp(opcode, "deref") == 0) {
-      long int *addressOperand = (long int *)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-      long int sizeOperand = (long int)getValue(instruction[3], variables, nextVariable, labels, nextLabel);
+        setValue(&operands[0], (void *)result, registers, defined);
+        break;
+      }
 
-      long int result = 0;
+      case OP_PRINT: {
+        long int operand = (long int)getValue(&operands[0], registers, defined, variables);
 
-      int byteCount;
-      for (byteCount = sizeOperand - 1; byteCount >= 0; --byteCount) {
-        char byte = *((char *)addressOperand + byteCount);
-        result = (result << 8) | byte;
+        writeCharacter((char)operand);
+        break;
       }
 
-      setValue(&instruction[1], (void *)result, variables, &nextVariable);
-    }
-
-    else if (strcmp(opcode, "print") == 0) {
-      long int operand = (long int)getValue(instruction[1], variables, nextVariable, labels, nextLabel);
+      case OP_SYSCALL: {
+        long int syscallNumber = (long int)getValue(&operands[1], registers, defined, variables);
+        long int paramStart = (long int)getValue(&operands[2], registers, defined, variables);
+        long int result;
 
-      printf("%c", (char)operand);
-    }
+        /* the system call may write to the console too */
+        flushOutput();
+        result = syscall(syscallNumber, (uint64)memory[paramStart], (uint64)memory[paramStart + 1], (uint64)memory[paramStart + 2], (uint64)memory[paramStart + 3], (uint64)memory[paramStart + 4]);
 
-    else if (strcmp(opcode, "syscall") == 0) {
-      long int syscallNumber = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-      long int paramStart = (long int)getValue(instruction[3], variables, nextVariable, labels, nextLabel);
-      long int result = syscall(syscallNumber, (uint64)memory[paramStart], (uint64)memory[paramStart + 1], (uint64)memory[paramStart + 2], (uint64)memory[paramStart + 3], (uint64)memory[paramStart + 4]);
+        setValue(&operands[0], (void *)result, registers, defined);
+        break;
+      }
 
-      setValue(&instruction[1], (void *)result, variables, &nextVariable);
-    }
+      case OP_EXIT: {
+        long int exitCode = (long int)getValue(&operands[0], registers, defined, variables);
 
-    else if (strcmp(opcode, "exit") == 0) {
-      long int exitCode = (long int)getValue(instruction[1], variables, nextVariable, labels, nextLabel);
-      exit(exitCode);
-    }
+        flushOutput();
+        exit(exitCode);
+      }
 
-    else {
-      printf("Unknown operation %s\n", opcode);
+      default:
+        flushOutput();
+        printf("Unknown operation %s\n", opcodeTable[instruction->opcode].name);
+        break;
     }
 
     ++nextInstruction;
   }
 
+  flushOutput();
   close(fd);
   return 0;
-}
\ No newline at end of file
+}
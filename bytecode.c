@@ -0,0 +1,341 @@
+#include "bytecode.h"
+
+#include "error.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct OpcodeInfo {
+  char const *name;
+  int operandCount;
+};
+
+/* indexed by enum Opcode */
+static struct OpcodeInfo const opcodeTable[] = {
+    {"add", 3},  {"sub", 3},   {"lw", 2},    {"sw", 2},   {"mult", 3},
+    {"div", 3},  {"beq", 3},   {"bneq", 3},  {"mod", 3},  {"xor", 3},
+    {"or", 3},   {"and", 3},   {"not", 2},   {"sl", 3},   {"sr", 3},
+    {"blt", 3},  {"bgt", 3},   {"ble", 3},   {"bge", 3},  {"jmp", 1},
+    {"ref", 2},  {"deref", 3}, {"print", 1}, {"scan", 1}, {"exit", 1},
+    {"mmap", 3}, {"mmapw", 3}, {"munmap", 2}, {"madvise", 3},
+    {"mcopy", 3}, {"mfill", 3}, {"mcmp", 3},  {"mfind", 3},
+    {"vlen", 1},  {"vadd", 3},  {"vsub", 3},  {"vmult", 3}, {"vand", 3},
+    {"vor", 3},   {"vxor", 3},  {"vscale", 3}, {"vsum", 2}, {"vmin", 2},
+    {"vmax", 2},  {"vdot", 3},  {"spawn", 3}, {"join", 2}, {"cas", 3},
+    {"fadd", 3},  {"xchg", 3},  {"fence", 0}, {"pfor", 3},  {"pend", 0},
+    {"chan", 2},  {"send", 2},  {"recv", 3}, {"trysend", 3}, {"tryrecv", 3},
+    {"close", 1}, {"call", 1},  {"ret", 0},
+    {"halt", 0},     {"nop", 0},      {"div", 3},      {"mod", 3},
+    {"add+beq", 3}, {"add+bneq", 3}, {"add+blt", 3},  {"add+bgt", 3},
+    {"add+ble", 3}, {"add+bge", 3},  {"beq", 3},      {"bneq", 3},
+    {"blt", 3},     {"bgt", 3},      {"ble", 3},      {"bge", 3},
+    {"lw+add", 2},  {"sw+add", 2}};
+
+char const *opcodeName(enum Opcode opcode) {
+  return opcodeTable[opcode].name;
+}
+
+int operandCount(enum Opcode opcode) { return opcodeTable[opcode].operandCount; }
+
+/*
+ * The constant pool that OPERAND_CONSTANT, OPERAND_UNDEFINED, OPERAND_INVALID
+ * and OPERAND_DIVISOR operands index. Entries are only ever added.
+ */
+union PoolEntry {
+  long int value;
+  char *name;
+  struct Divisor divisor;
+};
+
+struct ConstantPool {
+  union PoolEntry *entries;
+  long int size;
+  long int capacity;
+};
+
+/* broas compiles into this one, the library gives each program its own */
+static struct ConstantPool standardPool;
+static __thread struct ConstantPool *pool = &standardPool;
+
+struct ConstantPool *createPool(void) {
+  return calloc(1, sizeof(struct ConstantPool));
+}
+
+void destroyPool(struct ConstantPool *constants) {
+  free(constants->entries);
+  free(constants);
+}
+
+struct ConstantPool *usePool(struct ConstantPool *constants) {
+  struct ConstantPool *previous = pool;
+
+  pool = constants != NULL ? constants : &standardPool;
+  return previous;
+}
+
+static long int addToPool(union PoolEntry const *entry) {
+  if (pool->size == pool->capacity) {
+    pool->capacity = pool->capacity == 0 ? 64 : 2 * pool->capacity;
+    pool->entries =
+        realloc(pool->entries, pool->capacity * sizeof(union PoolEntry));
+  }
+  if (pool->size > MAX_OPERAND_VALUE) {
+    fail("Too many constants, at most %ld are supported",
+         MAX_OPERAND_VALUE + 1);
+  }
+  pool->entries[pool->size] = *entry;
+  return pool->size++;
+}
+
+long int pooledEntries(void) { return pool->size; }
+
+long int pooledValue(long int index) { return pool->entries[index].value; }
+
+char *pooledName(long int index) { return pool->entries[index].name; }
+
+long int poolValue(long int value) {
+  union PoolEntry entry;
+
+  entry.value = value;
+  return addToPool(&entry);
+}
+
+long int poolName(char *name) {
+  union PoolEntry entry;
+
+  entry.name = name;
+  return addToPool(&entry);
+}
+
+long int operandValue(struct Operand const *operand) {
+  return operand->kind == OPERAND_CONSTANT ? pool->entries[operand->value].value
+                                           : operand->value;
+}
+
+char *operandName(struct Operand const *operand) {
+  return pool->entries[operand->value].name;
+}
+
+struct Divisor const *operandDivisor(struct Operand const *operand) {
+  return &pool->entries[operand->value].divisor;
+}
+
+void setImmediate(struct Operand *operand, long int value) {
+  if (MIN_OPERAND_VALUE <= value && value <= MAX_OPERAND_VALUE) {
+    operand->kind = OPERAND_IMMEDIATE;
+    operand->value = value;
+  } else {
+    union PoolEntry entry;
+
+    entry.value = value;
+    operand->kind = OPERAND_CONSTANT;
+    operand->value = addToPool(&entry);
+  }
+}
+
+void setDivisor(struct Operand *operand, struct Divisor const *divisor) {
+  union PoolEntry entry;
+
+  entry.divisor = *divisor;
+  operand->kind = OPERAND_DIVISOR;
+  operand->value = addToPool(&entry);
+}
+
+static void setName(struct Operand *operand, enum OperandKind kind,
+                    char *name) {
+  union PoolEntry entry;
+
+  entry.name = name;
+  operand->kind = kind;
+  operand->value = addToPool(&entry);
+}
+
+/* an open-addressed hash table of names, grown to stay at most half full */
+struct Name {
+  char *name;
+  long int value;
+};
+
+struct NameTable {
+  struct Name *slots;
+  unsigned long int mask;
+  long int size;
+};
+
+static void initializeNameTable(struct NameTable *table) {
+  table->slots = calloc(64, sizeof(struct Name));
+  table->mask = 63;
+  table->size = 0;
+}
+
+static struct Name *probe(struct Name *slots, unsigned long int mask,
+                          char const *name) {
+  unsigned long int hash = 2166136261UL;
+  char const *c;
+
+  for (c = name; *c != '\0'; c++) {
+    hash = (hash ^ (unsigned char)*c) * 16777619UL;
+  }
+  for (;;) {
+    struct Name *slot = &slots[hash & mask];
+
+    if (slot->name == NULL || strcmp(slot->name, name) == 0) {
+      return slot;
+    }
+    hash++;
+  }
+}
+
+/* the slot holding name, or the empty slot to add it to */
+static struct Name *findName(struct NameTable *table, char const *name) {
+  if (2 * (unsigned long int)table->size >= table->mask) {
+    unsigned long int mask = 2 * table->mask + 1;
+    struct Name *slots = calloc(mask + 1, sizeof(struct Name));
+    unsigned long int i;
+
+    for (i = 0; i <= table->mask; i++) {
+      if (table->slots[i].name != NULL) {
+        *probe(slots, mask, table->slots[i].name) = table->slots[i];
+      }
+    }
+    free(table->slots);
+    table->slots = slots;
+    table->mask = mask;
+  }
+  return probe(table->slots, table->mask, name);
+}
+
+/* fills in a slot that findName() returned empty */
+static void addName(struct NameTable *table, struct Name *slot, char *name,
+                    long int value) {
+  slot->name = name;
+  slot->value = value;
+  ++table->size;
+}
+
+static void compileOperand(struct LexToken *token, struct Operand *operand,
+                           struct NameTable *labels, struct NameTable *names,
+                           struct Variable *variables,
+                           int *pNumberOfVariables) {
+  struct Name *slot;
+
+  switch (token->type) {
+  case IMMEDIATE:
+    setImmediate(operand, token->tokint);
+    break;
+  case VARIABLE:
+    slot = findName(names, token->tokstr);
+    if (slot->name == NULL) {
+      if (*pNumberOfVariables > MAX_OPERAND_VALUE) {
+        fail("Too many variables, at most %ld are supported",
+             MAX_OPERAND_VALUE + 1);
+      }
+      addName(names, slot, token->tokstr, *pNumberOfVariables);
+      variables[(*pNumberOfVariables)++].name = token->tokstr;
+    }
+    operand->kind = OPERAND_VARIABLE;
+    operand->value = slot->value;
+    break;
+  case LABEL:
+    slot = findName(labels, token->tokstr);
+    if (slot->name == NULL) {
+      setName(operand, OPERAND_UNDEFINED, token->tokstr);
+    } else {
+      operand->kind = OPERAND_LABEL;
+      operand->value = slot->value;
+    }
+    break;
+  default:
+    setName(operand, OPERAND_INVALID, token->tokstr);
+    break;
+  }
+}
+
+/*
+ * The first pass records where every label points so that the second pass
+ * can resolve forward branches and give each variable name its register
+ * slot.
+ */
+long int compileTokens(struct LexToken *tokens, int totalTokens,
+                       struct Arena *arena, struct Instruction **pInstructions,
+                       struct Variable **pVariables, int *pNumberOfVariables) {
+  struct NameTable labels;
+  struct NameTable names;
+  struct Instruction *instructions;
+  struct Variable *variables;
+  long int numberOfInstructions = 0;
+  int i = 0;
+
+  initializeNameTable(&labels);
+  while (i < totalTokens) {
+    struct LexToken *lexToken = &tokens[i++];
+
+    if (lexToken->type == OPCODE) {
+      long int opcode = lexToken->tokint;
+
+      if (i + opcodeTable[opcode].operandCount > totalTokens) {
+        free(labels.slots);
+        fail("Missing operand for %s", lexToken->tokstr);
+      }
+      i += opcodeTable[opcode].operandCount;
+      ++numberOfInstructions;
+    } else if (lexToken->type == LABEL) {
+      struct Name *slot = findName(&labels, lexToken->tokstr);
+
+      /* the first definition of a label is the one branches go to */
+      if (slot->name == NULL) {
+        addName(&labels, slot, lexToken->tokstr, numberOfInstructions);
+      }
+    } else {
+      free(labels.slots);
+      fail("Unexpected token %s in place of opcode or label, (encountered "
+           "at %dth token position)",
+           lexToken->tokstr, i);
+    }
+  }
+
+  /* every instruction, the room after them included, needs an index */
+  if (numberOfInstructions >= MAX_OPERAND_VALUE / 2) {
+    free(labels.slots);
+    fail("Too many instructions, at most %ld are supported",
+         MAX_OPERAND_VALUE / 2 - 1);
+  }
+
+  instructions = allocateFromArena(
+      arena, 2 * (numberOfInstructions + 1) * sizeof(struct Instruction));
+  variables = malloc((totalTokens + 1) * sizeof(struct Variable));
+  initializeNameTable(&names);
+  numberOfInstructions = 0;
+  *pNumberOfVariables = 0;
+  i = 0;
+  while (i < totalTokens) {
+    struct LexToken *lexToken = &tokens[i++];
+    struct Instruction *instruction;
+    int operand;
+
+    if (lexToken->type != OPCODE) {
+      continue;
+    }
+
+    instruction = &instructions[numberOfInstructions++];
+    instruction->opcode = (enum Opcode)lexToken->tokint;
+    for (operand = 0; operand < opcodeTable[instruction->opcode].operandCount;
+         operand++) {
+      compileOperand(&tokens[i++], &instruction->operands[operand], &labels,
+                     &names, variables, pNumberOfVariables);
+    }
+  }
+
+  instructions[numberOfInstructions].opcode = OP_HALT;
+
+  *pInstructions = instructions;
+  *pVariables = allocateFromArena(
+      arena, (*pNumberOfVariables + 1) * sizeof(struct Variable));
+  memcpy(*pVariables, variables,
+         *pNumberOfVariables * sizeof(struct Variable));
+  free(variables);
+  free(labels.slots);
+  free(names.slots);
+  return numberOfInstructions;
+}
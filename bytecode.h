@@ -0,0 +1,211 @@
+#ifndef BYTECODE_H_
+#define BYTECODE_H_
+
+#include "arena.h"
+#include "lexer.h"
+
+#define MAX_OPERANDS 3
+
+enum Opcode {
+  OP_ADD,
+  OP_SUB,
+  OP_LW,
+  OP_SW,
+  OP_MULT,
+  OP_DIV,
+  OP_BEQ,
+  OP_BNEQ,
+  OP_MOD,
+  OP_XOR,
+  OP_OR,
+  OP_AND,
+  OP_NOT,
+  OP_SL,
+  OP_SR,
+  OP_BLT,
+  OP_BGT,
+  OP_BLE,
+  OP_BGE,
+  OP_JMP,
+  OP_REF,
+  OP_DEREF,
+  OP_PRINT,
+  OP_SCAN,
+  OP_EXIT,
+  OP_MMAP,
+  OP_MMAPW,
+  OP_MUNMAP,
+  OP_MADVISE,
+  OP_MCOPY,
+  OP_MFILL,
+  OP_MCMP,
+  OP_MFIND,
+  OP_VLEN,
+  OP_VADD,
+  OP_VSUB,
+  OP_VMULT,
+  OP_VAND,
+  OP_VOR,
+  OP_VXOR,
+  OP_VSCALE,
+  OP_VSUM,
+  OP_VMIN,
+  OP_VMAX,
+  OP_VDOT,
+  OP_SPAWN,
+  OP_JOIN,
+  OP_CAS,
+  OP_FADD,
+  OP_XCHG,
+  OP_FENCE,
+  OP_PFOR,
+  OP_PEND,
+  OP_CHAN,
+  OP_SEND,
+  OP_RECV,
+  OP_TRYSEND,
+  OP_TRYRECV,
+  OP_CLOSE,
+  OP_CALL,
+  OP_RET,
+  OP_HALT, /* appended after the last instruction, never written in source */
+  OP_NOP,  /* left by optimizeInstructions() where an instruction was removed */
+
+  /*
+   * div and mod by an immediate, written by optimizeLoops(). The third
+   * operand is an OPERAND_DIVISOR that carries the multiplier and shift the
+   * quotient is computed with.
+   */
+  OP_DIVIDE_BY_CONSTANT,
+  OP_MODULO_BY_CONSTANT,
+
+  /*
+   * Superinstructions written by fuseInstructions(). The pair forms stand in
+   * for an instruction and the one after it: they read the operands of both
+   * and continue two instructions later, while the second instruction stays
+   * as it was for code that branches straight to it.
+   */
+  OP_INCREMENT_BEQ,
+  OP_INCREMENT_BNEQ,
+  OP_INCREMENT_BLT,
+  OP_INCREMENT_BGT,
+  OP_INCREMENT_BLE,
+  OP_INCREMENT_BGE,
+  OP_BEQ_IMMEDIATE,
+  OP_BNEQ_IMMEDIATE,
+  OP_BLT_IMMEDIATE,
+  OP_BGT_IMMEDIATE,
+  OP_BLE_IMMEDIATE,
+  OP_BGE_IMMEDIATE,
+  OP_LOAD_AND_BUMP,
+  OP_STORE_AND_BUMP
+};
+
+/*
+ * Labels are resolved while compiling, so an OPERAND_LABEL carries the
+ * instruction index it names, and every distinct variable name is interned
+ * to a register slot that an OPERAND_VARIABLE carries instead of the name.
+ * Operands that cannot be evaluated (labels that are never defined, opcodes
+ * in operand position) keep their name so the interpreter can report them
+ * when, and only if, they are executed.
+ *
+ * An immediate too wide for the operand's value field is an OPERAND_CONSTANT
+ * instead; it, the names and the divisors live in a constant pool that
+ * value indexes.
+ */
+enum OperandKind {
+  OPERAND_IMMEDIATE,
+  OPERAND_VARIABLE,
+  OPERAND_LABEL,
+  OPERAND_UNDEFINED,
+  OPERAND_INVALID,
+  OPERAND_DIVISOR,
+  OPERAND_CONSTANT
+};
+
+/* the range of value, and so of instruction indexes and register slots */
+#define OPERAND_VALUE_BITS 28
+#define MIN_OPERAND_VALUE (-(1L << (OPERAND_VALUE_BITS - 1)))
+#define MAX_OPERAND_VALUE ((1L << (OPERAND_VALUE_BITS - 1)) - 1)
+
+/*
+ * n / divisor is the high half of n * magic, plus n when the divisor is
+ * positive and magic negative (minus n for the opposite signs), shifted
+ * right by shift and rounded towards zero (Hacker's Delight, chapter 10).
+ */
+struct Divisor {
+  long int divisor;
+  long int magic;
+  int shift;
+};
+
+/* an instruction takes 16 bytes, so four of them share a cache line */
+struct Operand {
+  unsigned int kind : 32 - OPERAND_VALUE_BITS; /* enum OperandKind */
+  signed int value : OPERAND_VALUE_BITS;
+};
+
+struct Instruction {
+  enum Opcode opcode;
+  struct Operand operands[MAX_OPERANDS];
+};
+
+/* indexed by register slot, only used for diagnostics */
+struct Variable {
+  char *name;
+};
+
+char const *opcodeName(enum Opcode opcode);
+
+/* the number of operands it is written with */
+int operandCount(enum Opcode opcode);
+
+/* the value of an immediate, a constant or a label */
+long int operandValue(struct Operand const *operand);
+
+/* the name an undefined or invalid operand was written with */
+char *operandName(struct Operand const *operand);
+
+struct Divisor const *operandDivisor(struct Operand const *operand);
+
+/* makes operand the immediate value, pooling it when it is too wide */
+void setImmediate(struct Operand *operand, long int value);
+
+void setDivisor(struct Operand *operand, struct Divisor const *divisor);
+
+/*
+ * A constant pool of a program's own, for programs that have to outlive the
+ * ones compiled after them. Operands index the calling thread's current
+ * pool, which usePool() sets (NULL setting the one broas compiles into) and
+ * returns the previous one of, so it has to be the program's while it is
+ * compiled, optimized and run.
+ */
+struct ConstantPool;
+
+struct ConstantPool *createPool(void);
+void destroyPool(struct ConstantPool *pool);
+struct ConstantPool *usePool(struct ConstantPool *pool);
+
+/*
+ * The constant pool as a whole, for saving compiled programs and loading
+ * them again. The pool does not know whether an entry is a value or a name,
+ * the operands that index it do. Entries pooled again in the order they
+ * were saved in, before anything else is pooled, get their old indexes back.
+ */
+long int pooledEntries(void);
+long int pooledValue(long int index);
+char *pooledName(long int index);
+long int poolValue(long int value);
+long int poolName(char *name);
+
+/*
+ * Turns the token stream into instructions allocated from arena, ending with
+ * OP_HALT and followed by room for as many instructions again, which
+ * optimizeLoops() may use. Variable names are interned to register slots;
+ * variables receives the name of each. Returns the number of instructions.
+ */
+long int compileTokens(struct LexToken *tokens, int totalTokens,
+                       struct Arena *arena, struct Instruction **pInstructions,
+                       struct Variable **pVariables, int *pNumberOfVariables);
+
+#endif /* !BYTECODE_H_ */
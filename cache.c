@@ -0,0 +1,360 @@
+#define _DEFAULT_SOURCE
+
+#include "cache.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/* bumped whenever the layout below changes */
+#define CACHE_VERSION 1
+
+/*
+ * A .broc file is this header, the string offsets of the variable names,
+ * the constant pool as a kind (CONSTANT_VALUE or CONSTANT_NAME) and a value
+ * or string offset per entry, the strings, padded to a multiple of 8 bytes,
+ * and the instructions, OP_HALT included. The room for optimizeLoops() after
+ * them is a hole the file is extended over, which reads as zeros and takes
+ * no space on disk.
+ */
+struct CacheHeader {
+  char magic[4];
+  int version;
+  int instructionSize;
+  int wordSize;
+  int halt; /* OP_HALT, which moves when opcodes are added */
+  int numberOfVariables;
+  long int totalInstructions;
+  long int numberOfConstants;
+  long int stringsSize;
+  long int sourceSize;
+  long int sourceSeconds;
+  long int sourceNanoseconds;
+  unsigned long int sourceHash;
+  /* of the file up to the end of the instructions, this field taken as 0 */
+  unsigned long int checksum;
+};
+
+enum { CONSTANT_VALUE, CONSTANT_NAME };
+
+/* the source that cachePath() was called for */
+static long int sourceSize;
+static long int sourceSeconds;
+static long int sourceNanoseconds;
+static unsigned long int sourceHash;
+static int byContent;
+
+#define HASH_BASIS 14695981039346656037UL
+#define HASH_PRIME 1099511628211UL
+
+/* FNV-1a, a word at a time with the bytes left over one at a time */
+static unsigned long int hashBytes(unsigned long int hash,
+                                   unsigned char const *bytes, size_t size) {
+  while (size >= sizeof(unsigned long int)) {
+    unsigned long int word;
+
+    memcpy(&word, bytes, sizeof(word));
+    hash = (hash ^ word) * HASH_PRIME;
+    hash ^= hash >> 32;
+    bytes += sizeof(word);
+    size -= sizeof(word);
+  }
+  while (size-- > 0) {
+    hash = (hash ^ *bytes++) * HASH_PRIME;
+  }
+  return hash;
+}
+
+static unsigned long int hashSource(int fd, size_t size) {
+  unsigned long int hash;
+  void *source;
+
+  if (size == 0) {
+    return HASH_BASIS;
+  }
+  source = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (source == MAP_FAILED) {
+    return HASH_BASIS;
+  }
+  hash = hashBytes(HASH_BASIS, source, size);
+  munmap(source, size);
+  return hash;
+}
+
+char *cachePath(char const *sourcePath, int fd, char const *directory) {
+  struct stat status;
+  char *path;
+
+  if (fstat(fd, &status) != 0 || !S_ISREG(status.st_mode)) {
+    return NULL;
+  }
+  sourceSize = status.st_size;
+  sourceSeconds = status.st_mtim.tv_sec;
+  sourceNanoseconds = status.st_mtim.tv_nsec;
+
+  if (directory == NULL) {
+    size_t length = strlen(sourcePath);
+
+    byContent = 0;
+    path = malloc(length + sizeof(".broc"));
+    strcpy(path, sourcePath);
+    if (length > 6 && strcmp(path + length - 6, ".broas") == 0) {
+      length -= 6;
+    }
+    strcpy(path + length, ".broc");
+    return path;
+  }
+
+  byContent = 1;
+  sourceHash = hashSource(fd, status.st_size);
+  mkdir(directory, 0777);
+  path = malloc(strlen(directory) + sizeof("/0123456789abcdef.broc"));
+  sprintf(path, "%s/%016lx.broc", directory, sourceHash);
+  return path;
+}
+
+static long int instructionsOffset(struct CacheHeader const *header) {
+  return (long int)sizeof(struct CacheHeader) +
+         header->numberOfVariables * (long int)sizeof(long int) +
+         header->numberOfConstants * 2 * (long int)sizeof(long int) +
+         header->stringsSize;
+}
+
+/* where the instructions end, OP_HALT included */
+static long int checkedSize(struct CacheHeader const *header) {
+  return instructionsOffset(header) +
+         (header->totalInstructions + 1) * (long int)sizeof(struct Instruction);
+}
+
+static unsigned long int checksum(unsigned char const *file,
+                                  struct CacheHeader const *header) {
+  struct CacheHeader copy = *header;
+
+  copy.checksum = 0;
+  return hashBytes(hashBytes(HASH_BASIS, (unsigned char const *)&copy,
+                             sizeof(copy)),
+                   file + sizeof(copy), checkedSize(header) - sizeof(copy));
+}
+
+static int validHeader(struct CacheHeader const *header, long int fileSize) {
+  if (memcmp(header->magic, "BROC", 4) != 0 ||
+      header->version != CACHE_VERSION ||
+      header->instructionSize != (int)sizeof(struct Instruction) ||
+      header->wordSize != (int)sizeof(long int) || header->halt != OP_HALT) {
+    return 0;
+  }
+  if (header->sourceSize != sourceSize ||
+      (byContent ? header->sourceHash != sourceHash
+                 : header->sourceSeconds != sourceSeconds ||
+                       header->sourceNanoseconds != sourceNanoseconds)) {
+    return 0;
+  }
+  if (header->numberOfVariables < 0 || header->totalInstructions < 0 ||
+      header->totalInstructions >= MAX_OPERAND_VALUE / 2 ||
+      header->numberOfConstants < 0 ||
+      header->numberOfConstants > MAX_OPERAND_VALUE + 1 ||
+      header->stringsSize < 0 || header->stringsSize > fileSize ||
+      header->stringsSize % sizeof(long int) != 0) {
+    return 0;
+  }
+  return checkedSize(header) +
+             (header->totalInstructions + 1) *
+                 (long int)sizeof(struct Instruction) ==
+         fileSize;
+}
+
+long int loadCache(char const *path, struct Arena *arena,
+                   struct Instruction **pInstructions,
+                   struct Variable **pVariables, int *pNumberOfVariables) {
+  struct CacheHeader header;
+  struct stat status;
+  unsigned char *file;
+  long int const *offsets;
+  long int const *constants;
+  char *strings;
+  struct Variable *variables;
+  long int i;
+  int fd = open(path, O_RDONLY);
+
+  if (fd < 0) {
+    return -1;
+  }
+  if (fstat(fd, &status) != 0 ||
+      status.st_size < (off_t)sizeof(struct CacheHeader)) {
+    close(fd);
+    return -1;
+  }
+  /* private and writable, as the optimizer and fusion rewrite instructions */
+  file = mmap(NULL, status.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+              0);
+  close(fd);
+  if (file == MAP_FAILED) {
+    return -1;
+  }
+
+  memcpy(&header, file, sizeof(header));
+  if (!validHeader(&header, status.st_size) ||
+      checksum(file, &header) != header.checksum || pooledEntries() != 0) {
+    munmap(file, status.st_size);
+    return -1;
+  }
+
+  offsets = (long int const *)(file + sizeof(header));
+  constants = offsets + header.numberOfVariables;
+  strings = (char *)(constants + 2 * header.numberOfConstants);
+  if (header.stringsSize > 0 && strings[header.stringsSize - 1] != '\0') {
+    munmap(file, status.st_size);
+    return -1;
+  }
+  for (i = 0; i < header.numberOfVariables; i++) {
+    if (offsets[i] < 0 || offsets[i] >= header.stringsSize) {
+      munmap(file, status.st_size);
+      return -1;
+    }
+  }
+  for (i = 0; i < header.numberOfConstants; i++) {
+    if (constants[2 * i] == CONSTANT_NAME &&
+        (constants[2 * i + 1] < 0 ||
+         constants[2 * i + 1] >= header.stringsSize)) {
+      munmap(file, status.st_size);
+      return -1;
+    }
+  }
+
+  /* the file stays mapped for as long as the program runs */
+  for (i = 0; i < header.numberOfConstants; i++) {
+    if (constants[2 * i] == CONSTANT_NAME) {
+      poolName(strings + constants[2 * i + 1]);
+    } else {
+      poolValue(constants[2 * i + 1]);
+    }
+  }
+  variables = allocateFromArena(
+      arena, (header.numberOfVariables + 1) * sizeof(struct Variable));
+  for (i = 0; i < header.numberOfVariables; i++) {
+    variables[i].name = strings + offsets[i];
+  }
+
+  *pInstructions = (struct Instruction *)(file + instructionsOffset(&header));
+  *pVariables = variables;
+  *pNumberOfVariables = header.numberOfVariables;
+  return header.totalInstructions;
+}
+
+static long int addString(char *strings, long int *pSize, char const *string) {
+  long int offset = *pSize;
+  size_t length = strlen(string) + 1;
+
+  memcpy(strings + offset, string, length);
+  *pSize += length;
+  return offset;
+}
+
+void saveCache(char const *path, struct Instruction const *instructions,
+               long int totalInstructions, struct Variable const *variables,
+               int numberOfVariables) {
+  struct CacheHeader header;
+  long int numberOfConstants = pooledEntries();
+  char *kinds = calloc(numberOfConstants + 1, 1);
+  long int stringsSize = 0;
+  long int *offsets;
+  long int *constants;
+  char *strings;
+  unsigned char *image;
+  long int size;
+  long int written;
+  char *temporary;
+  int fd;
+  long int i;
+  int j;
+
+  /* the pool does not know which of its entries are names */
+  for (i = 0; i < totalInstructions; i++) {
+    for (j = 0; j < operandCount(instructions[i].opcode); j++) {
+      struct Operand const *operand = &instructions[i].operands[j];
+
+      if (operand->kind == OPERAND_UNDEFINED ||
+          operand->kind == OPERAND_INVALID) {
+        kinds[operand->value] = 1;
+      }
+    }
+  }
+  for (i = 0; i < numberOfVariables; i++) {
+    stringsSize += strlen(variables[i].name) + 1;
+  }
+  for (i = 0; i < numberOfConstants; i++) {
+    if (kinds[i]) {
+      stringsSize += strlen(pooledName(i)) + 1;
+    }
+  }
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, "BROC", 4);
+  header.version = CACHE_VERSION;
+  header.instructionSize = sizeof(struct Instruction);
+  header.wordSize = sizeof(long int);
+  header.halt = OP_HALT;
+  header.numberOfVariables = numberOfVariables;
+  header.totalInstructions = totalInstructions;
+  header.numberOfConstants = numberOfConstants;
+  header.stringsSize =
+      (stringsSize + sizeof(long int) - 1) & ~(long int)(sizeof(long int) - 1);
+  header.sourceSize = sourceSize;
+  header.sourceSeconds = sourceSeconds;
+  header.sourceNanoseconds = sourceNanoseconds;
+  header.sourceHash = sourceHash;
+
+  size = checkedSize(&header);
+  image = calloc(size, 1);
+  offsets = (long int *)(image + sizeof(header));
+  constants = offsets + numberOfVariables;
+  strings = (char *)(constants + 2 * numberOfConstants);
+  stringsSize = 0;
+  for (i = 0; i < numberOfVariables; i++) {
+    offsets[i] = addString(strings, &stringsSize, variables[i].name);
+  }
+  for (i = 0; i < numberOfConstants; i++) {
+    if (kinds[i]) {
+      constants[2 * i] = CONSTANT_NAME;
+      constants[2 * i + 1] = addString(strings, &stringsSize, pooledName(i));
+    } else {
+      constants[2 * i] = CONSTANT_VALUE;
+      constants[2 * i + 1] = pooledValue(i);
+    }
+  }
+  memcpy(image + instructionsOffset(&header), instructions,
+         (totalInstructions + 1) * sizeof(struct Instruction));
+  memcpy(image, &header, sizeof(header));
+  header.checksum = checksum(image, &header);
+  memcpy(image, &header, sizeof(header));
+
+  temporary = malloc(strlen(path) + 32);
+  sprintf(temporary, "%s.%ld", path, (long int)getpid());
+  fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  written = 0;
+  if (fd >= 0) {
+    long int count = 0;
+
+    while (written < size &&
+           (count = write(fd, image + written, size - written)) > 0) {
+      written += count;
+    }
+    if (written == size &&
+        ftruncate(fd, size + (totalInstructions + 1) *
+                                 (long int)sizeof(struct Instruction)) != 0) {
+      written = -1;
+    }
+    if (close(fd) != 0 || written != size || rename(temporary, path) != 0) {
+      unlink(temporary);
+    }
+  }
+
+  free(temporary);
+  free(image);
+  free(kinds);
+}
@@ -0,0 +1,44 @@
+#ifndef CACHE_H_
+#define CACHE_H_
+
+#include "arena.h"
+#include "bytecode.h"
+
+/*
+ * Compiled programs saved in .broc files for --cache, so that running a
+ * program again skips lexing and compiling it. A .broc file holds the
+ * instructions with their labels already resolved, the names of the
+ * variables and the constant pool, and is loaded with a single mmap.
+ *
+ * Without a directory the file goes next to the source, prog.broas getting
+ * prog.broc, and is used while the source keeps its size and modification
+ * time. With one it goes into the directory, named after a hash of the
+ * source's contents, and is used by any source with those contents.
+ *
+ * cachePath() returns the path of the file for the source open on fd, or
+ * NULL when the source is not a regular file.
+ */
+char *cachePath(char const *sourcePath, int fd, char const *directory);
+
+/*
+ * Loads the program saved at path as compileTokens() would have compiled it,
+ * and returns its number of instructions, or -1 when the file is missing,
+ * was written by another version of broas, is out of date or is corrupt, in
+ * which case the program has to be compiled from source. Loading has to come
+ * before anything else uses the constant pool.
+ */
+long int loadCache(char const *path, struct Arena *arena,
+                   struct Instruction **pInstructions,
+                   struct Variable **pVariables, int *pNumberOfVariables);
+
+/*
+ * Saves a program just as compileTokens() returned it. The file is written
+ * under another name and renamed into place, so that a broas running at the
+ * same time never loads half of it. Failing to save is not an error, the
+ * program is simply compiled again next time.
+ */
+void saveCache(char const *path, struct Instruction const *instructions,
+               long int totalInstructions, struct Variable const *variables,
+               int numberOfVariables);
+
+#endif /* !CACHE_H_ */
@@ -0,0 +1,394 @@
+#define _DEFAULT_SOURCE
+
+#include "channel.h"
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <sched.h>
+#endif
+
+#include "error.h"
+
+#define CACHE_LINE 64
+
+/* the table of channels grows by blocks, so a channel never moves */
+#define CHANNEL_BLOCK 256
+#define CHANNEL_BLOCKS 256
+
+/*
+ * A slot of the ring. Its sequence is the position of the send that may
+ * fill it next, and one more than that once the word is in, until the
+ * receive at that position empties it for the send a round later.
+ */
+struct Cell {
+  unsigned long int sequence;
+  long int value;
+};
+
+/*
+ * A bounded queue after Dmitry Vyukov's: a sender claims the position at
+ * head and a receiver the one at tail with one compare and swap each, and
+ * the sequence of the cell tells them whether it is theirs yet. With one
+ * sender and one receiver the compare and swap always succeeds the first
+ * time. head and tail are on cache lines of their own, so that senders and
+ * receivers do not take the line from each other.
+ */
+struct Channel {
+  struct Cell *cells;
+  unsigned long int capacity;
+  int closed;
+  /* bumped whenever a word is received, and when the channel closes */
+  int notFull;
+  /* bumped whenever a word is sent, and when the channel closes */
+  int notEmpty;
+  int sendersParked;
+  int receiversParked;
+  char padding[CACHE_LINE];
+  union {
+    unsigned long int position;
+    char line[CACHE_LINE];
+  } head;
+  union {
+    unsigned long int position;
+    char line[CACHE_LINE];
+  } tail;
+};
+
+struct Channels {
+  pthread_mutex_t lock; /* taken to make a channel */
+  long int count;
+  struct Channel **blocks[CHANNEL_BLOCKS];
+};
+
+#ifdef __linux__
+
+/* sleeps while *word is seen, or until a signal comes */
+static void park(int *word, int seen) {
+  syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+}
+
+static void unpark(int *word, int count) {
+  syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+#else
+
+/* without futexes, a parked thread yields until the word changes */
+static void park(int *word, int seen) {
+  if (__atomic_load_n(word, __ATOMIC_SEQ_CST) == seen) {
+    sched_yield();
+  }
+}
+
+static void unpark(int *word, int count) {
+  (void)word;
+  (void)count;
+}
+
+#endif
+
+/*
+ * Bumps word and wakes a thread parked on it, if any. It has to be called
+ * after the change they wait for, which the fence orders before the load of
+ * parked; waitFor() orders its count in parked before it looks again.
+ */
+static void signalChange(int *word, int *parked) {
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(parked, __ATOMIC_SEQ_CST) > 0) {
+    __atomic_fetch_add(word, 1, __ATOMIC_SEQ_CST);
+    unpark(word, 1);
+  }
+}
+
+static int pushWord(struct Channel *channel, long int value) {
+  unsigned long int position =
+      __atomic_load_n(&channel->head.position, __ATOMIC_RELAXED);
+  struct Cell *cell;
+
+  for (;;) {
+    long int difference;
+
+    cell = &channel->cells[position % channel->capacity];
+    difference =
+        (long int)(__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) -
+                   position);
+    if (difference == 0) {
+      if (__atomic_compare_exchange_n(&channel->head.position, &position,
+                                      position + 1, 1, __ATOMIC_RELAXED,
+                                      __ATOMIC_RELAXED)) {
+        break;
+      }
+    } else if (difference < 0) {
+      /* the cell still holds the word sent a round ago */
+      return 0;
+    } else {
+      position = __atomic_load_n(&channel->head.position, __ATOMIC_RELAXED);
+    }
+  }
+  cell->value = value;
+  __atomic_store_n(&cell->sequence, position + 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+static int popWord(struct Channel *channel, long int *value) {
+  unsigned long int position =
+      __atomic_load_n(&channel->tail.position, __ATOMIC_RELAXED);
+  struct Cell *cell;
+
+  for (;;) {
+    long int difference;
+
+    cell = &channel->cells[position % channel->capacity];
+    difference =
+        (long int)(__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) -
+                   (position + 1));
+    if (difference == 0) {
+      if (__atomic_compare_exchange_n(&channel->tail.position, &position,
+                                      position + 1, 1, __ATOMIC_RELAXED,
+                                      __ATOMIC_RELAXED)) {
+        break;
+      }
+    } else if (difference < 0) {
+      /* no word was sent at this position yet */
+      return 0;
+    } else {
+      position = __atomic_load_n(&channel->tail.position, __ATOMIC_RELAXED);
+    }
+  }
+  *value = cell->value;
+  __atomic_store_n(&cell->sequence, position + channel->capacity,
+                   __ATOMIC_RELEASE);
+  return 1;
+}
+
+static int isClosed(struct Channel *channel) {
+  return __atomic_load_n(&channel->closed, __ATOMIC_SEQ_CST);
+}
+
+void shareChannels(struct Machine *machine) {
+  /* only one thread runs until then, so nothing races for this */
+  if (machine->channels == NULL) {
+    machine->channels = calloc(1, sizeof(struct Channels));
+    if (machine->channels == NULL) {
+      fail("Cannot make room for channels");
+    }
+    pthread_mutex_init(&machine->channels->lock, NULL);
+  }
+}
+
+static struct Channel *findChannel(struct Machine *machine, long int id) {
+  struct Channels *channels = machine->channels;
+
+  if (channels == NULL || id < 1 ||
+      id > __atomic_load_n(&channels->count, __ATOMIC_ACQUIRE)) {
+    fail("No channel %ld", id);
+  }
+  return channels->blocks[(id - 1) / CHANNEL_BLOCK][(id - 1) % CHANNEL_BLOCK];
+}
+
+long int makeChannel(struct Machine *machine, long int capacity) {
+  struct Channels *channels;
+  struct Channel *channel;
+  unsigned long int i;
+  long int id;
+
+  if (capacity < 1) {
+    fail("Channel capacity %ld is not positive", capacity);
+  }
+  if ((unsigned long int)capacity > (size_t)-1 / sizeof(struct Cell)) {
+    fail("Cannot make a channel of %ld words", capacity);
+  }
+  shareChannels(machine);
+  channels = machine->channels;
+
+  channel = calloc(1, sizeof(struct Channel));
+  if (channel == NULL) {
+    fail("Cannot make a channel of %ld words", capacity);
+  }
+  channel->cells = malloc(capacity * sizeof(struct Cell));
+  if (channel->cells == NULL) {
+    free(channel);
+    fail("Cannot make a channel of %ld words", capacity);
+  }
+  channel->capacity = capacity;
+  for (i = 0; i < channel->capacity; i++) {
+    channel->cells[i].sequence = i;
+  }
+
+  pthread_mutex_lock(&channels->lock);
+  id = channels->count + 1;
+  if (id > (long int)CHANNEL_BLOCK * CHANNEL_BLOCKS) {
+    pthread_mutex_unlock(&channels->lock);
+    free(channel->cells);
+    free(channel);
+    fail("Too many channels");
+  }
+  if (channels->blocks[(id - 1) / CHANNEL_BLOCK] == NULL) {
+    channels->blocks[(id - 1) / CHANNEL_BLOCK] =
+        malloc(CHANNEL_BLOCK * sizeof(struct Channel *));
+    if (channels->blocks[(id - 1) / CHANNEL_BLOCK] == NULL) {
+      pthread_mutex_unlock(&channels->lock);
+      free(channel->cells);
+      free(channel);
+      fail("Cannot make room for channel %ld", id);
+    }
+  }
+  channels->blocks[(id - 1) / CHANNEL_BLOCK][(id - 1) % CHANNEL_BLOCK] =
+      channel;
+  /* findChannel() reads the count without the lock */
+  __atomic_store_n(&channels->count, id, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&channels->lock);
+  return id;
+}
+
+/*
+ * Parks the calling thread on word until it changes from what it was before
+ * ready() was tried once more, unless ready() succeeds. Returns what ready()
+ * did.
+ */
+static int waitFor(int *word, int *parked,
+                   int (*ready)(struct Channel *channel, long int *value),
+                   struct Channel *channel, long int *value) {
+  int seen;
+  int done;
+
+  __atomic_fetch_add(parked, 1, __ATOMIC_SEQ_CST);
+  seen = __atomic_load_n(word, __ATOMIC_SEQ_CST);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  done = ready(channel, value);
+  if (!done && !isClosed(channel)) {
+    park(word, seen);
+  }
+  __atomic_fetch_sub(parked, 1, __ATOMIC_SEQ_CST);
+  return done;
+}
+
+static int readyToSend(struct Channel *channel, long int *value) {
+  return !isClosed(channel) && pushWord(channel, *value);
+}
+
+void sendWord(struct Machine *machine, long int id, long int value) {
+  struct Channel *channel = findChannel(machine, id);
+
+  for (;;) {
+    if (isClosed(channel)) {
+      fail("Channel %ld is closed", id);
+    }
+    if (pushWord(channel, value) ||
+        waitFor(&channel->notFull, &channel->sendersParked, readyToSend,
+                channel, &value)) {
+      break;
+    }
+  }
+  signalChange(&channel->notEmpty, &channel->receiversParked);
+}
+
+long int trySendWord(struct Machine *machine, long int id, long int value) {
+  struct Channel *channel = findChannel(machine, id);
+
+  if (isClosed(channel)) {
+    fail("Channel %ld is closed", id);
+  }
+  if (!pushWord(channel, value)) {
+    return 0;
+  }
+  signalChange(&channel->notEmpty, &channel->receiversParked);
+  return 1;
+}
+
+long int receiveWord(struct Machine *machine, long int id, long int closed) {
+  struct Channel *channel = findChannel(machine, id);
+  long int value;
+
+  for (;;) {
+    if (popWord(channel, &value)) {
+      break;
+    }
+    /* the words sent before it closed are there to be received first */
+    if (isClosed(channel)) {
+      if (popWord(channel, &value)) {
+        break;
+      }
+      return closed;
+    }
+    if (waitFor(&channel->notEmpty, &channel->receiversParked, popWord,
+                channel, &value)) {
+      break;
+    }
+  }
+  signalChange(&channel->notFull, &channel->sendersParked);
+  return value;
+}
+
+long int tryReceiveWord(struct Machine *machine, long int id, long int empty) {
+  struct Channel *channel = findChannel(machine, id);
+  long int value;
+
+  if (!popWord(channel, &value)) {
+    return empty;
+  }
+  signalChange(&channel->notFull, &channel->sendersParked);
+  return value;
+}
+
+/* returns 0 when the channel was closed already */
+static int shutChannel(struct Channel *channel) {
+  if (__atomic_exchange_n(&channel->closed, 1, __ATOMIC_SEQ_CST)) {
+    return 0;
+  }
+  __atomic_fetch_add(&channel->notFull, 1, __ATOMIC_SEQ_CST);
+  __atomic_fetch_add(&channel->notEmpty, 1, __ATOMIC_SEQ_CST);
+  unpark(&channel->notFull, INT_MAX);
+  unpark(&channel->notEmpty, INT_MAX);
+  return 1;
+}
+
+void closeChannel(struct Machine *machine, long int id) {
+  if (!shutChannel(findChannel(machine, id))) {
+    fail("Channel %ld is closed", id);
+  }
+}
+
+void closeChannels(struct Machine *machine) {
+  struct Channels *channels = machine->channels;
+  long int id;
+
+  if (channels == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&channels->lock);
+  for (id = 1; id <= channels->count; id++) {
+    shutChannel(
+        channels->blocks[(id - 1) / CHANNEL_BLOCK][(id - 1) % CHANNEL_BLOCK]);
+  }
+  pthread_mutex_unlock(&channels->lock);
+}
+
+void finishChannels(struct Machine *machine) {
+  struct Channels *channels = machine->channels;
+  long int id;
+
+  if (channels == NULL) {
+    return;
+  }
+  for (id = 1; id <= channels->count; id++) {
+    struct Channel *channel =
+        channels->blocks[(id - 1) / CHANNEL_BLOCK][(id - 1) % CHANNEL_BLOCK];
+
+    free(channel->cells);
+    free(channel);
+  }
+  for (id = 0; id < CHANNEL_BLOCKS; id++) {
+    free(channels->blocks[id]);
+  }
+  pthread_mutex_destroy(&channels->lock);
+  free(channels);
+  machine->channels = NULL;
+}
@@ -0,0 +1,56 @@
+#ifndef CHANNEL_H_
+#define CHANNEL_H_
+
+#include "interpreter.h"
+
+/*
+ * Channels pass words between the threads of a program. Each is a ring of a
+ * fixed number of words that any number of threads send to and receive from
+ * without a lock, and a thread that has to wait for room or for a word
+ * sleeps until another makes it. Channels are numbered from 1 and belong to
+ * the machine, which they last as long as.
+ */
+
+/*
+ * Readies machine for threads to share its channels, which it has to be
+ * before a second thread starts; see shareMachine().
+ */
+void shareChannels(struct Machine *machine);
+
+/* returns the number of a new channel that holds up to capacity words */
+long int makeChannel(struct Machine *machine, long int capacity);
+
+/*
+ * Sends value on channel id, waiting while it is full. Fails when there is
+ * no such channel or it is closed.
+ */
+void sendWord(struct Machine *machine, long int id, long int value);
+
+/* sends value unless channel id is full; returns 1 when it did, else 0 */
+long int trySendWord(struct Machine *machine, long int id, long int value);
+
+/*
+ * Receives a word from channel id, waiting while it is empty, or returns
+ * closed once it is closed and every word sent on it was received.
+ */
+long int receiveWord(struct Machine *machine, long int id, long int closed);
+
+/* receives a word unless channel id is empty; returns empty when it is */
+long int tryReceiveWord(struct Machine *machine, long int id, long int empty);
+
+/*
+ * Closes channel id, waking the threads that wait on it. Fails when it was
+ * closed already.
+ */
+void closeChannel(struct Machine *machine, long int id);
+
+/*
+ * Closes every channel still open, so that no thread is left waiting on
+ * one, for when the program stopped before it could close them.
+ */
+void closeChannels(struct Machine *machine);
+
+/* frees the channels once the program and all of its threads are done */
+void finishChannels(struct Machine *machine);
+
+#endif /* !CHANNEL_H_ */
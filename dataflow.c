@@ -0,0 +1,472 @@
+#include "dataflow.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+int writesDestination(enum Opcode opcode) {
+  switch (opcode) {
+  case OP_ADD:
+  case OP_SUB:
+  case OP_LW:
+  case OP_MULT:
+  case OP_DIV:
+  case OP_MOD:
+  case OP_XOR:
+  case OP_OR:
+  case OP_AND:
+  case OP_NOT:
+  case OP_SL:
+  case OP_SR:
+  case OP_REF:
+  case OP_DEREF:
+  case OP_SCAN:
+  case OP_MMAP:
+  case OP_MMAPW:
+  case OP_MCMP:
+  case OP_MFIND:
+  case OP_VSUM:
+  case OP_VMIN:
+  case OP_VMAX:
+  case OP_VDOT:
+  case OP_SPAWN:
+  case OP_JOIN:
+  case OP_CAS:
+  case OP_FADD:
+  case OP_XCHG:
+  case OP_PFOR:
+  case OP_CHAN:
+  case OP_RECV:
+  case OP_TRYSEND:
+  case OP_TRYRECV:
+  case OP_DIVIDE_BY_CONSTANT:
+  case OP_MODULO_BY_CONSTANT:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+int readOperands(enum Opcode opcode, int *order) {
+  switch (opcode) {
+  case OP_ADD:
+  case OP_SUB:
+  case OP_MULT:
+  case OP_DIV:
+  case OP_MOD:
+  case OP_XOR:
+  case OP_OR:
+  case OP_AND:
+  case OP_SL:
+  case OP_SR:
+  case OP_DEREF:
+  case OP_MMAP:
+  case OP_MMAPW:
+  case OP_VDOT:
+  case OP_SPAWN:
+  case OP_FADD:
+  case OP_XCHG:
+  case OP_RECV:
+  case OP_TRYSEND:
+  case OP_TRYRECV:
+    order[0] = 1;
+    order[1] = 2;
+    return 2;
+  case OP_NOT:
+  case OP_LW:
+  case OP_REF:
+  case OP_JOIN:
+  case OP_CHAN:
+  case OP_VSUM:
+  case OP_VMIN:
+  case OP_VMAX:
+  case OP_DIVIDE_BY_CONSTANT:
+  case OP_MODULO_BY_CONSTANT:
+    order[0] = 1;
+    return 1;
+  case OP_SW:
+  case OP_MUNMAP:
+  case OP_SEND:
+    order[0] = 0;
+    order[1] = 1;
+    return 2;
+  case OP_MADVISE:
+  case OP_MCOPY:
+  case OP_MFILL:
+  case OP_MCMP:
+  case OP_MFIND:
+  case OP_CAS:
+  case OP_PFOR:
+  case OP_VADD:
+  case OP_VSUB:
+  case OP_VMULT:
+  case OP_VAND:
+  case OP_VOR:
+  case OP_VXOR:
+  case OP_VSCALE:
+  case OP_BEQ:
+  case OP_BNEQ:
+  case OP_BLT:
+  case OP_BGT:
+  case OP_BLE:
+  case OP_BGE:
+    order[0] = 0;
+    order[1] = 1;
+    order[2] = 2;
+    return 3;
+  case OP_JMP:
+  case OP_PRINT:
+  case OP_EXIT:
+  case OP_VLEN:
+  case OP_CLOSE:
+  case OP_CALL:
+    order[0] = 0;
+    return 1;
+  case OP_SCAN:
+  case OP_FENCE:
+  case OP_PEND:
+  case OP_RET:
+  case OP_NOP:
+    return 0;
+  default:
+    return -1;
+  }
+}
+
+int isBranch(enum Opcode opcode) {
+  return opcode == OP_BEQ || opcode == OP_BNEQ || opcode == OP_BLT ||
+         opcode == OP_BGT || opcode == OP_BLE || opcode == OP_BGE;
+}
+
+int isPure(struct Instruction *instruction) {
+  struct Operand *operands = instruction->operands;
+  int order[MAX_OPERANDS];
+  int count = readOperands(instruction->opcode, order);
+  int j;
+
+  switch (instruction->opcode) {
+  case OP_ADD:
+  case OP_SUB:
+  case OP_MULT:
+  case OP_XOR:
+  case OP_OR:
+  case OP_AND:
+  case OP_NOT:
+  case OP_SL:
+  case OP_SR:
+  case OP_REF:
+  case OP_DIVIDE_BY_CONSTANT:
+  case OP_MODULO_BY_CONSTANT:
+    break;
+  case OP_DIV:
+  case OP_MOD:
+    /* these trap on 0, and on -1 when dividing the smallest number */
+    if (operands[2].kind != OPERAND_IMMEDIATE &&
+        operands[2].kind != OPERAND_LABEL &&
+        operands[2].kind != OPERAND_CONSTANT) {
+      return 0;
+    }
+    if (operandValue(&operands[2]) == 0 || operandValue(&operands[2]) == -1) {
+      return 0;
+    }
+    break;
+  default:
+    return 0;
+  }
+
+  if (operands[0].kind != OPERAND_VARIABLE) {
+    return 0;
+  }
+  for (j = 0; j < count; j++) {
+    enum OperandKind kind = operands[order[j]].kind;
+
+    if (kind != OPERAND_IMMEDIATE && kind != OPERAND_VARIABLE &&
+        kind != OPERAND_LABEL && kind != OPERAND_CONSTANT) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int jumpOperand(struct Instruction *instruction) {
+  if (instruction->opcode == OP_JMP || instruction->opcode == OP_CALL) {
+    return 0;
+  }
+  if (isBranch(instruction->opcode)) {
+    return 2;
+  }
+  if (instruction->opcode == OP_SPAWN) {
+    return 1;
+  }
+  if (instruction->opcode == OP_PFOR) {
+    return 2;
+  }
+  return -1;
+}
+
+long int directTarget(struct Operand *operand, long int totalInstructions) {
+  long int target;
+
+  if (operand->kind == OPERAND_VARIABLE) {
+    return -1;
+  }
+  /* an operand that cannot be evaluated stops the program where it is */
+  if (operand->kind != OPERAND_IMMEDIATE && operand->kind != OPERAND_LABEL &&
+      operand->kind != OPERAND_CONSTANT) {
+    return totalInstructions;
+  }
+  target = operandValue(operand);
+  if ((unsigned long int)target >= (unsigned long int)totalInstructions) {
+    return totalInstructions;
+  }
+  return target;
+}
+
+int fallsThrough(enum Opcode opcode) {
+  return opcode != OP_JMP && opcode != OP_EXIT && opcode != OP_PEND &&
+         opcode != OP_RET;
+}
+
+void buildControlFlowGraph(struct ControlFlowGraph *graph,
+                           struct Instruction *instructions,
+                           long int totalInstructions) {
+  char *leader = calloc(totalInstructions + 1, 1);
+  int indirect = 0;
+  long int numberOfBlocks = 0;
+  long int i;
+
+  leader[0] = 1;
+  for (i = 0; i < totalInstructions; i++) {
+    int jump = jumpOperand(&instructions[i]);
+
+    if (jump >= 0) {
+      long int target =
+          directTarget(&instructions[i].operands[jump], totalInstructions);
+
+      if (target < 0) {
+        indirect = 1;
+      } else {
+        leader[target] = 1;
+      }
+      leader[i + 1] = 1;
+    } else if (!fallsThrough(instructions[i].opcode)) {
+      leader[i + 1] = 1;
+    }
+  }
+  if (indirect) {
+    memset(leader, 1, totalInstructions);
+  }
+
+  for (i = 0; i < totalInstructions; i++) {
+    numberOfBlocks += leader[i];
+  }
+  graph->blocks = malloc((numberOfBlocks + 1) * sizeof(struct BasicBlock));
+  graph->blockOf = malloc((totalInstructions + 1) * sizeof(long int));
+  graph->numberOfBlocks = 0;
+
+  for (i = 0; i < totalInstructions; i++) {
+    if (leader[i]) {
+      graph->blocks[graph->numberOfBlocks++].first = i;
+    }
+    graph->blockOf[i] = graph->numberOfBlocks - 1;
+    graph->blocks[graph->numberOfBlocks - 1].last = i;
+  }
+  graph->blockOf[totalInstructions] = graph->numberOfBlocks;
+
+  for (i = 0; i < graph->numberOfBlocks; i++) {
+    struct BasicBlock *block = &graph->blocks[i];
+    struct Instruction *instruction = &instructions[block->last];
+    int jump = jumpOperand(instruction);
+
+    block->numberOfSuccessors = 0;
+    block->indirect = 0;
+    block->returns = instruction->opcode == OP_RET;
+    block->returnPoint =
+        block->first > 0 && instructions[block->first - 1].opcode == OP_CALL;
+    if (fallsThrough(instruction->opcode) &&
+        block->last + 1 < totalInstructions) {
+      block->successors[block->numberOfSuccessors++] =
+          graph->blockOf[block->last + 1];
+    }
+    if (jump >= 0) {
+      long int target =
+          directTarget(&instruction->operands[jump], totalInstructions);
+
+      if (target < 0) {
+        block->indirect = 1;
+      } else if (target < totalInstructions) {
+        block->successors[block->numberOfSuccessors++] = graph->blockOf[target];
+      }
+    }
+  }
+
+  free(leader);
+}
+
+void freeControlFlowGraph(struct ControlFlowGraph *graph) {
+  free(graph->blocks);
+  free(graph->blockOf);
+}
+
+size_t variableWords(int numberOfVariables) {
+  return numberOfVariables / BITS_PER_WORD + 1;
+}
+
+static int intersect(unsigned long *in, unsigned long *out, size_t words) {
+  int changed = 0;
+  size_t w;
+
+  for (w = 0; w < words; w++) {
+    if ((in[w] & out[w]) != in[w]) {
+      in[w] &= out[w];
+      changed = 1;
+    }
+  }
+  return changed;
+}
+
+/*
+ * Only the first instruction of a block has predecessors of its own, so
+ * the fixed point is found on the blocks and the sets of the instructions
+ * inside them are filled in along the way.
+ */
+unsigned long *analyseDefinedVariables(struct ControlFlowGraph *graph,
+                                       struct Instruction *instructions,
+                                       long int totalInstructions,
+                                       int numberOfVariables) {
+  size_t words = variableWords(numberOfVariables);
+  unsigned long *defined =
+      malloc((totalInstructions + 1) * words * sizeof(unsigned long));
+  unsigned long *out = malloc(words * sizeof(unsigned long));
+  int changed = 1;
+
+  memset(defined, 0xff,
+         (totalInstructions + 1) * words * sizeof(unsigned long));
+  memset(defined, 0, words * sizeof(unsigned long));
+
+  while (changed) {
+    long int b;
+
+    changed = 0;
+    for (b = 0; b < graph->numberOfBlocks; b++) {
+      struct BasicBlock *block = &graph->blocks[b];
+      long int i;
+      int s;
+
+      memcpy(out, defined + block->first * words, words * sizeof(unsigned long));
+      for (i = block->first; i <= block->last; i++) {
+        struct Instruction *instruction = &instructions[i];
+
+        if (i > block->first) {
+          memcpy(defined + i * words, out, words * sizeof(unsigned long));
+        }
+        if (writesDestination(instruction->opcode) &&
+            instruction->operands[0].kind == OPERAND_VARIABLE) {
+          ADD_VARIABLE(out, instruction->operands[0].value);
+        }
+      }
+
+      for (s = 0; s < block->numberOfSuccessors; s++) {
+        long int first = graph->blocks[block->successors[s]].first;
+        changed |= intersect(defined + first * words, out, words);
+      }
+      if (block->indirect || block->returns) {
+        long int j;
+        for (j = 0; j < graph->numberOfBlocks; j++) {
+          long int first = graph->blocks[j].first;
+
+          if (block->indirect || graph->blocks[j].returnPoint) {
+            changed |= intersect(defined + first * words, out, words);
+          }
+        }
+      }
+    }
+  }
+
+  free(out);
+  return defined;
+}
+
+int isDefinedBefore(unsigned long *defined, int numberOfVariables, long int i,
+                    long int slot) {
+  return HAS_VARIABLE(defined + i * variableWords(numberOfVariables), slot);
+}
+
+void liveAfterBlock(struct ControlFlowGraph *graph, unsigned long *live,
+                    long int block, int numberOfVariables,
+                    unsigned long *out) {
+  struct BasicBlock *basicBlock = &graph->blocks[block];
+  size_t words = variableWords(numberOfVariables);
+  long int b;
+  size_t w;
+  int s;
+
+  memset(out, 0, words * sizeof(unsigned long));
+  for (s = 0; s < basicBlock->numberOfSuccessors; s++) {
+    unsigned long *in = live + basicBlock->successors[s] * words;
+    for (w = 0; w < words; w++) {
+      out[w] |= in[w];
+    }
+  }
+  if (basicBlock->indirect || basicBlock->returns) {
+    for (b = 0; b < graph->numberOfBlocks; b++) {
+      unsigned long *in = live + b * words;
+
+      if (!basicBlock->indirect && !graph->blocks[b].returnPoint) {
+        continue;
+      }
+      for (w = 0; w < words; w++) {
+        out[w] |= in[w];
+      }
+    }
+  }
+}
+
+void transferLive(struct Instruction *instruction, unsigned long *live) {
+  int order[MAX_OPERANDS];
+  int count = readOperands(instruction->opcode, order);
+  int j;
+
+  if (writesDestination(instruction->opcode) &&
+      instruction->operands[0].kind == OPERAND_VARIABLE) {
+    REMOVE_VARIABLE(live, instruction->operands[0].value);
+  }
+  for (j = 0; j < count; j++) {
+    struct Operand *operand = &instruction->operands[order[j]];
+
+    if (operand->kind == OPERAND_VARIABLE) {
+      ADD_VARIABLE(live, operand->value);
+    }
+  }
+}
+
+unsigned long *analyseLiveVariables(struct ControlFlowGraph *graph,
+                                    struct Instruction *instructions,
+                                    int numberOfVariables) {
+  size_t words = variableWords(numberOfVariables);
+  unsigned long *live =
+      calloc((graph->numberOfBlocks + 1) * words, sizeof(unsigned long));
+  unsigned long *in = malloc(words * sizeof(unsigned long));
+  int changed = 1;
+
+  while (changed) {
+    long int b;
+
+    changed = 0;
+    for (b = graph->numberOfBlocks - 1; b >= 0; b--) {
+      struct BasicBlock *block = &graph->blocks[b];
+      long int i;
+
+      liveAfterBlock(graph, live, b, numberOfVariables, in);
+      for (i = block->last; i >= block->first; i--) {
+        transferLive(&instructions[i], in);
+      }
+      if (memcmp(in, live + b * words, words * sizeof(unsigned long)) != 0) {
+        memcpy(live + b * words, in, words * sizeof(unsigned long));
+        changed = 1;
+      }
+    }
+  }
+
+  free(in);
+  return live;
+}
@@ -0,0 +1,120 @@
+#ifndef DATAFLOW_H_
+#define DATAFLOW_H_
+
+#include <limits.h>
+#include <stddef.h>
+
+#include "bytecode.h"
+
+#define BITS_PER_WORD (CHAR_BIT * sizeof(unsigned long))
+
+/* bitsets of variables, indexed by register slot */
+#define HAS_VARIABLE(set, slot) \
+  (((set)[(slot) / BITS_PER_WORD] >> ((slot) % BITS_PER_WORD)) & 1)
+#define ADD_VARIABLE(set, slot) \
+  ((set)[(slot) / BITS_PER_WORD] |= 1UL << ((slot) % BITS_PER_WORD))
+#define REMOVE_VARIABLE(set, slot) \
+  ((set)[(slot) / BITS_PER_WORD] &= ~(1UL << ((slot) % BITS_PER_WORD)))
+
+/* whether the opcode writes the variable in its first operand */
+int writesDestination(enum Opcode opcode);
+
+/*
+ * Fills order with the operands the interpreter reads, in the order it reads
+ * them, so that errors come out in the same sequence. Returns -1 for
+ * opcodes that are not understood.
+ */
+int readOperands(enum Opcode opcode, int *order);
+
+int isBranch(enum Opcode opcode);
+
+/* whether the next instruction may run after this one */
+int fallsThrough(enum Opcode opcode);
+
+/*
+ * Whether the instruction only computes its destination from its operands:
+ * it cannot fail, provided the variables it reads are set, and touches
+ * nothing else. Memory is never assumed to hold anything, so loads (which
+ * may fault) are not pure.
+ */
+int isPure(struct Instruction *instruction);
+
+/*
+ * The operand holding the jump target, or -1 when the instruction has none.
+ * The label a thread is spawned at counts as one: the thread continues from
+ * there with the variables as they were, as though spawn had branched. So
+ * does the body of a pfor, which also writes its loop variable as far as
+ * the analyses go, since the body runs with every value of it, and the
+ * subroutine a call goes to, which it is taken to fall through from as well
+ * since the subroutine returns there.
+ */
+int jumpOperand(struct Instruction *instruction);
+
+/*
+ * Where a jump through operand goes: an instruction index, totalInstructions
+ * when it halts, or -1 when the target is only known at run time.
+ */
+long int directTarget(struct Operand *operand, long int totalInstructions);
+
+/*
+ * A basic block runs from first to last without any other way in or out.
+ * A block ending in a jump through a variable may be followed by any block,
+ * and since the variable may hold any index every instruction then starts
+ * a block of its own. A block ending in ret may be followed by any return
+ * point, the block after a call; neither of those is among successors.
+ */
+struct BasicBlock {
+  long int first;
+  long int last;
+  long int successors[2];
+  int numberOfSuccessors;
+  int indirect;
+  int returns;
+  int returnPoint;
+};
+
+struct ControlFlowGraph {
+  struct BasicBlock *blocks;
+  long int numberOfBlocks;
+  long int *blockOf; /* per instruction */
+};
+
+void buildControlFlowGraph(struct ControlFlowGraph *graph,
+                           struct Instruction *instructions,
+                           long int totalInstructions);
+
+void freeControlFlowGraph(struct ControlFlowGraph *graph);
+
+/* the number of words in a bitset with a bit per variable */
+size_t variableWords(int numberOfVariables);
+
+/*
+ * Forward "definitely written" analysis: the returned bitsets, one per
+ * instruction plus one for the halt, hold the variables that have been
+ * written on every path reaching the instruction, so reading them there
+ * cannot fail.
+ */
+unsigned long *analyseDefinedVariables(struct ControlFlowGraph *graph,
+                                       struct Instruction *instructions,
+                                       long int totalInstructions,
+                                       int numberOfVariables);
+
+int isDefinedBefore(unsigned long *defined, int numberOfVariables, long int i,
+                    long int slot);
+
+/*
+ * Backward liveness: the returned bitsets, one per block, hold the variables
+ * that may be read before they are written from the start of the block on.
+ */
+unsigned long *analyseLiveVariables(struct ControlFlowGraph *graph,
+                                    struct Instruction *instructions,
+                                    int numberOfVariables);
+
+/* fills out with the variables live at the end of block */
+void liveAfterBlock(struct ControlFlowGraph *graph, unsigned long *live,
+                    long int block, int numberOfVariables, unsigned long *out);
+
+/* turns the variables live after the instruction into those live before it */
+void transferLive(struct Instruction *instruction, unsigned long *live);
+
+#endif /* !DATAFLOW_H_ */
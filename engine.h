@@ -0,0 +1,703 @@
+/*
+ * The interpreter, which interpreter.c includes once for every engine it
+ * builds, with EXECUTE naming the function. The same handlers are built into one of
+ * two engines. The portable engine switches on the opcode inside a loop; the
+ * threaded engine (make threaded) uses the GNU labels-as-values extension so
+ * that every handler jumps straight to the next one through its own indirect
+ * branch.
+ *
+ * With PROFILED_ENGINE defined, every handler also counts the instruction it
+ * runs, and every branch it takes, for --profile. With SAMPLED_ENGINE, it
+ * shows the SIGPROF handler of --sample-profile which instruction it runs and
+ * the calls, or in a program without calls the jumps, that led there. The other engines are left without either rather
+ * than testing for them on every instruction. Threads a program spawns run
+ * the same engine, except that only its first thread is sampled.
+ *
+ * compileTokens() ends the program with OP_HALT, so neither engine checks
+ * the instruction index on straight-line code. Only branches can leave the
+ * program, and BRANCH() sends any target outside of it to OP_HALT. Only
+ * branches can keep a program running either, so the instruction limit is
+ * checked on the branches taken.
+ */
+#if defined(PROFILED_ENGINE)
+#define PROFILE_INSTRUCTION() ++counts[nextInstruction];
+#define PROFILE_BRANCH() ++taken[nextInstruction];
+#define PROFILE_JUMP()
+#define PROFILE_CALL(target)
+#define PROFILE_RETURN()
+#elif defined(SAMPLED_ENGINE)
+#define SPAWNED_ENGINE execute
+#define PROFILE_INSTRUCTION() sampled->instruction = nextInstruction;
+#define PROFILE_BRANCH()
+#define PROFILE_JUMP() sampled->instruction = nextInstruction; if (!sampled->followsCalls && (sampled->depth == 0 || sampled->frames[sampled->depth - 1] != nextInstruction)) recordJump(sampled, nextInstruction);
+#define PROFILE_CALL(target) if (depth <= SAMPLE_DEPTH) sampled->frames[depth - 1] = (unsigned long int)(target) < (unsigned long int)totalInstructions ? (target) : totalInstructions; sampled->depth = depth;
+#define PROFILE_RETURN() sampled->depth = depth;
+#else
+#define PROFILE_INSTRUCTION()
+#define PROFILE_BRANCH()
+#define PROFILE_JUMP()
+#define PROFILE_CALL(target)
+#define PROFILE_RETURN()
+#endif
+#ifndef SPAWNED_ENGINE
+#define SPAWNED_ENGINE EXECUTE
+#endif
+
+#ifdef THREADED_DISPATCH
+#define HANDLER(opcode) opcode##_HANDLER: operands = instructions[nextInstruction].operands; ++executed; PROFILE_INSTRUCTION()
+#define DISPATCH() goto *dispatchTable[instructions[nextInstruction].opcode]
+#else
+#define HANDLER(opcode) case opcode: operands = instructions[nextInstruction].operands; ++executed; PROFILE_INSTRUCTION()
+#define DISPATCH() continue
+#endif
+
+#define NEXT() ++nextInstruction; DISPATCH()
+#define CHECK_LIMIT() if (executed > instructionLimit) exceedLimit(instructionLimit);
+#define BRANCH(target) PROFILE_BRANCH() nextInstruction = (unsigned long int)(target) < (unsigned long int)totalInstructions ? (target) : totalInstructions; PROFILE_JUMP() CHECK_LIMIT() DISPATCH()
+
+/* add x x <immediate> followed by b<cc> x <value> @label */
+#define INCREMENT_AND_BRANCH(opcode, comparison) \
+	HANDLER(opcode) { \
+		struct Operand *branch = instructions[nextInstruction + 1].operands; \
+		long int counter = (long int)getValue(&operands[1], registers, defined, variables) + operands[2].value; \
+\
+		setValue(&operands[0], (void *)counter, registers, defined); \
+		if (counter comparison (long int)getValue(&branch[1], registers, defined, variables)) { \
+			nextInstruction = branch[2].value; \
+			PROFILE_JUMP() \
+			CHECK_LIMIT() \
+			DISPATCH(); \
+		} \
+		nextInstruction += 2; \
+		DISPATCH(); \
+	}
+
+/* v<op> to a b, on as many words as vlen set */
+#define VECTOR_INSTRUCTION(opcode, function) \
+	HANDLER(opcode) { \
+		long int toOperand = (long int)getValue(&operands[0], registers, defined, variables); \
+		long int leftOperand = (long int)getValue(&operands[1], registers, defined, variables); \
+		long int rightOperand = (long int)getValue(&operands[2], registers, defined, variables); \
+\
+		function(toOperand, leftOperand, rightOperand); \
+		NEXT(); \
+	}
+
+/* v<sum/min/max> result a */
+#define VECTOR_REDUCTION(opcode, function) \
+	HANDLER(opcode) { \
+		long int vectorOperand = (long int)getValue(&operands[1], registers, defined, variables); \
+\
+		setValue(&operands[0], (void *)function(vectorOperand), registers, defined); \
+		NEXT(); \
+	}
+
+/* b<cc> x <immediate> @label */
+#define COMPARE_IMMEDIATE_AND_BRANCH(opcode, comparison) \
+	HANDLER(opcode) { \
+		if ((long int)getValue(&operands[0], registers, defined, variables) comparison operands[1].value) { \
+			nextInstruction = operands[2].value; \
+			PROFILE_JUMP() \
+			CHECK_LIMIT() \
+			DISPATCH(); \
+		} \
+		NEXT(); \
+	}
+
+void EXECUTE(struct Machine *machine, long int start, long int *registers, char *defined) {
+	struct Instruction *instructions = machine->instructions;
+	long int totalInstructions = machine->totalInstructions;
+	void **memory = machine->memory;
+	struct Variable *variables = machine->variables;
+	int countInstructions = machine->countInstructions;
+	long int instructionLimit = machine->instructionLimit;
+	long int nextInstruction = start;
+	long int executed = 0;
+	long int depth = 0; /* calls not returned from */
+	struct Operand *operands;
+#if defined(PROFILED_ENGINE)
+	long int *counts = instructionCounts();
+	long int *taken = branchesTaken();
+#elif defined(SAMPLED_ENGINE)
+	struct SampleState *sampled = sampleState();
+#endif
+
+#ifdef THREADED_DISPATCH
+	/* indexed by enum Opcode */
+	static void *const dispatchTable[] = {
+		&&OP_ADD_HANDLER, &&OP_SUB_HANDLER, &&OP_LW_HANDLER, &&OP_SW_HANDLER, &&OP_MULT_HANDLER,
+		&&OP_DIV_HANDLER, &&OP_BEQ_HANDLER, &&OP_BNEQ_HANDLER, &&OP_MOD_HANDLER, &&OP_XOR_HANDLER,
+		&&OP_OR_HANDLER, &&OP_AND_HANDLER, &&OP_NOT_HANDLER, &&OP_SL_HANDLER, &&OP_SR_HANDLER,
+		&&OP_BLT_HANDLER, &&OP_BGT_HANDLER, &&OP_BLE_HANDLER, &&OP_BGE_HANDLER, &&OP_JMP_HANDLER,
+		&&OP_REF_HANDLER, &&OP_DEREF_HANDLER, &&OP_PRINT_HANDLER, &&OP_SCAN_HANDLER, &&OP_EXIT_HANDLER,
+		&&OP_MMAP_HANDLER, &&OP_MMAPW_HANDLER, &&OP_MUNMAP_HANDLER, &&OP_MADVISE_HANDLER,
+		&&OP_MCOPY_HANDLER, &&OP_MFILL_HANDLER, &&OP_MCMP_HANDLER, &&OP_MFIND_HANDLER,
+		&&OP_VLEN_HANDLER, &&OP_VADD_HANDLER, &&OP_VSUB_HANDLER, &&OP_VMULT_HANDLER, &&OP_VAND_HANDLER,
+		&&OP_VOR_HANDLER, &&OP_VXOR_HANDLER, &&OP_VSCALE_HANDLER, &&OP_VSUM_HANDLER, &&OP_VMIN_HANDLER,
+		&&OP_VMAX_HANDLER, &&OP_VDOT_HANDLER, &&OP_SPAWN_HANDLER, &&OP_JOIN_HANDLER, &&OP_CAS_HANDLER,
+		&&OP_FADD_HANDLER, &&OP_XCHG_HANDLER, &&OP_FENCE_HANDLER, &&OP_PFOR_HANDLER, &&OP_PEND_HANDLER,
+		&&OP_CHAN_HANDLER, &&OP_SEND_HANDLER, &&OP_RECV_HANDLER, &&OP_TRYSEND_HANDLER, &&OP_TRYRECV_HANDLER,
+		&&OP_CLOSE_HANDLER, &&OP_CALL_HANDLER, &&OP_RET_HANDLER,
+		&&OP_HALT_HANDLER, &&OP_NOP_HANDLER, &&OP_DIVIDE_BY_CONSTANT_HANDLER, &&OP_MODULO_BY_CONSTANT_HANDLER,
+		&&OP_INCREMENT_BEQ_HANDLER, &&OP_INCREMENT_BNEQ_HANDLER, &&OP_INCREMENT_BLT_HANDLER,
+		&&OP_INCREMENT_BGT_HANDLER, &&OP_INCREMENT_BLE_HANDLER, &&OP_INCREMENT_BGE_HANDLER,
+		&&OP_BEQ_IMMEDIATE_HANDLER, &&OP_BNEQ_IMMEDIATE_HANDLER, &&OP_BLT_IMMEDIATE_HANDLER,
+		&&OP_BGT_IMMEDIATE_HANDLER, &&OP_BLE_IMMEDIATE_HANDLER, &&OP_BGE_IMMEDIATE_HANDLER,
+		&&OP_LOAD_AND_BUMP_HANDLER, &&OP_STORE_AND_BUMP_HANDLER
+	};
+
+	DISPATCH();
+	{
+#else
+	for (;;) switch (instructions[nextInstruction].opcode) {
+	default:
+		printf("Unknown operation %s\n", opcodeName(instructions[nextInstruction].opcode));
+		NEXT();
+
+#endif
+	HANDLER(OP_ADD) {
+		long int leftOperand = (long int)getValue(&operands[1], registers, defined, variables);
+		long int rightOperand = (long int)getValue(&operands[2], registers, defined, variables);
+		long int result = leftOperand + rightOperand;
+
+		setValue(&operands[0], (void *)result, registers, defined);
+		NEXT();
+	}
+
+	HANDLER(OP_SUB) {
+		long int leftOperand = (long int)getValue(&operands[1], registers, defined, variables);
+		long int rightOperand = (long int)getValue(&operands[2], registers, defined, variables);
+		long int result = leftOperand - rightOperand;
+
+		setValue(&operands[0], (void *)result, registers, defined);
+		NEXT();
+	}
+
+	HANDLER(OP_LW) {
+		long int memoryOperand = (long int)getValue(&operands[1], registers, defined, variables);
+
+		setValue(&operands[0], memory[memoryOperand], registers, defined);
+		NEXT();
+	}
+
+	HANDLER(OP_SW) {
+		void *variableOperand = getValue(&operands[0], registers, defined, variables);
+		long int memoryOperand = (long int)getValue(&operands[1], registers, defined, variables);
+
+		memory[memoryOperand] = variableOperand;
+		NEXT();
+	}
+
+	HANDLER(OP_MULT) {
+		long int leftOperand = (long int)getValue(&operands[1], registers, defined, variables);
+		long int rightOperand = (long int)getValue(&operands[2], registers, defined, variables);
+		long int result = leftOperand * rightOperand;
+
+		setValue(&operands[0], (void *)result, registers, defined);
+		NEXT();
+	}
+
+	HANDLER(OP_DIV) {
+		long int leftOperand = (long int)getValue(&operands[1], registers, defined, variables);
+		long int rightOperand = (long int)getValue(&operands[2], registers, defined, variables);
+		long int result = leftOperand / rightOperand;
+
+		setValue(&operands[0], (void *)result, registers, defined);
+		NEXT();
+	}
+
+	HANDLER(OP_BEQ) {
+		long int leftOperand = (long int)getValue(&operands[0], registers, defined, variables);
+		long int rightOperand = (long int)getValue(&operands[1], registers, defined, variables);
+		long int branchAddress = (long int)getValue(&operands[2], registers, defined, variables);
+
+		if (leftOperand == rightOperand) {
+			BRANCH(branchAddress);
+		}
+		NEXT();
+	}
+
+	HANDLER(OP_BNEQ) {
+		long int leftOperand = (long int)getValue(&operands[0], registers, defined, variables);
+		long int rightOperand = (long int)getValue(&operands[1], registers, defined, variables);
+		long int branchAddress = (long int)getValue(&operands[2], registers, defined, variables);
+
+		if (leftOperand != rightOperand) {
+			BRANCH(branchAddress);
+		}
+		NEXT();
+	}
+
+	HANDLER(OP_MOD) {
+		long int leftOperand = (long int)getValue(&operands[1], registers, defined, variables);
+		long int rightOperand = (long int)getValue(&operands[2], registers, defined, variables);
+		long int result = leftOperand % rightOperand;
+
+		setValue(&operands[0], (void *)result, registers, defined);
+		NEXT();
+	}
+
+	HANDLER(OP_XOR) {
+		long int leftOperand = (long int)getValue(&operands[1], registers, defined, variables);
+		long int rightOperand = (long int)getValue(&operands[2], registers, defined, variables);
+		long int result = leftOperand ^ rightOperand;
+
+		setValue(&operands[0], (void *)result, registers, defined);
+		NEXT();
+	}
+
+	HANDLER(OP_OR) {
+		long int leftOperand = (long int)getValue(&operands[1], registers, defined, variables);
+		long int rightOperand = (long int)getValue(&operands[2], registers, defined, variables);
+		long int result = leftOperand | rightOperand;
+
+		setValue(&operands[0], (void *)result, registers, defined);
+		NEXT();
+	}
+
+	HANDLER(OP_AND) {
+		long int leftOperand = (long int)getValue(&operands[1], registers, defined, variables);
+		long int rightOperand = (long int)getValue(&operands[2], registers, defined, variables);
+		long int result = leftOperand & rightOperand;
+
+		setValue(&operands[0], (void *)result, registers, defined);
+		NEXT();
+	}
+
+	HANDLER(OP_NOT) {
+		long int operand = (long int)getValue(&operands[1], registers, defined, variables);
+		long int result = ~operand;
+
+		setValue(&operands[0], (void *)result, registers, defined);
+		NEXT();
+	}
+
+	HANDLER(OP_SL) {
+		long int leftOperand = (long int)getValue(&operands[1], registers, defined, variables);
+		long int rightOperand = (long int)getValue(&operands[2], registers, defined, variables);
+		long int result = leftOperand << rightOperand;
+
+		setValue(&operands[0], (void *)result, registers, defined);
+		NEXT();
+	}
+
+	HANDLER(OP_SR) {
+		long int leftOperand = (long int)getValue(&operands[1], registers, defined, variables);
+		long int rightOperand = (long int)getValue(&operands[2], registers, defined, variables);
+		long int result = leftOperand >> rightOperand;
+
+		setValue(&operands[0], (void *)result, registers, defined);
+		NEXT();
+	}
+
+	HANDLER(OP_BLT) {
+		long int leftOperand = (long int)getValue(&operands[0], registers, defined, variables);
+		long int rightOperand = (long int)getValue(&operands[1], registers, defined, variables);
+		long int branchAddress = (long int)getValue(&operands[2], registers, defined, variables);
+
+		if (leftOperand < rightOperand) {
+			BRANCH(branchAddress);
+		}
+		NEXT();
+	}
+
+	HANDLER(OP_BGT) {
+		long int leftOperand = (long int)getValue(&operands[0], registers, defined, variables);
+		long int rightOperand = (long int)getValue(&operands[1], registers, defined, variables);
+		long int branchAddress = (long int)getValue(&operands[2], registers, defined, variables);
+
+		if (leftOperand > rightOperand) {
+			BRANCH(branchAddress);
+		}
+		NEXT();
+	}
+
+	HANDLER(OP_BLE) {
+		long int leftOperand = (long int)getValue(&operands[0], registers, defined, variables);
+		long int rightOperand = (long int)getValue(&operands[1], registers, defined, variables);
+		long int branchAddress = (long int)getValue(&operands[2], registers, defined, variables);
+
+		if (leftOperand <= rightOperand) {
+			BRANCH(branchAddress);
+		}
+		NEXT();
+	}
+
+	HANDLER(OP_BGE) {
+		long int leftOperand = (long int)getValue(&operands[0], registers, defined, variables);
+		long int rightOperand = (long int)getValue(&operands[1], registers, defined, variables);
+		long int branchAddress = (long int)getValue(&operands[2], registers, defined, variables);
+
+		if (leftOperand >= rightOperand) {
+			BRANCH(branchAddress);
+		}
+		NEXT();
+	}
+
+	HANDLER(OP_JMP) {
+		long int jumpAddress = (long int)getValue(&operands[0], registers, defined, variables);
+
+		BRANCH(jumpAddress);
+	}
+
+	HANDLER(OP_REF) {
+		long int memoryOperand = (long int)getValue(&operands[1], registers, defined, variables);
+
+		setValue(&operands[0], (void *)(memory + memoryOperand), registers, defined);
+		NEXT();
+	}
+
+	HANDLER(OP_DEREF) {
+		long int *addressOperand = (long int *)getValue(&operands[1], registers, defined, variables);
+		long int sizeOperand = (long int)getValue(&operands[2], registers, defined, variables);
+
+		long int result = 0;
+
+		int byteCount;
+		for (byteCount = sizeOperand - 1; byteCount >= 0; --byteCount) {
+			char byte = *((char *)addressOperand + byteCount);
+			result = (result << 8) | byte;
+		}
+
+		setValue(&operands[0], (void *)result, registers, defined);
+		NEXT();
+	}
+
+	HANDLER(OP_PRINT) {
+		long int operand = (long int)getValue(&operands[0], registers, defined, variables);
+
+		writeCharacter((char)operand);
+		NEXT();
+	}
+
+	HANDLER(OP_SCAN) {
+		long int c = readCharacter();
+
+		setValue(&operands[0], (void *)c, registers, defined);
+		NEXT();
+	}
+
+	HANDLER(OP_MMAP) {
+		char *pathOperand = (char *)getValue(&operands[1], registers, defined, variables);
+		long int memoryOperand = (long int)getValue(&operands[2], registers, defined, variables);
+
+		setValue(&operands[0], (void *)mapFile(memoryOperand, pathOperand, 0), registers, defined);
+		NEXT();
+	}
+
+	HANDLER(OP_MMAPW) {
+		char *pathOperand = (char *)getValue(&operands[1], registers, defined, variables);
+		long int memoryOperand = (long int)getValue(&operands[2], registers, defined, variables);
+
+		setValue(&operands[0], (void *)mapFile(memoryOperand, pathOperand, 1), registers, defined);
+		NEXT();
+	}
+
+	HANDLER(OP_MUNMAP) {
+		long int memoryOperand = (long int)getValue(&operands[0], registers, defined, variables);
+		long int lengthOperand = (long int)getValue(&operands[1], registers, defined, variables);
+
+		unmapFile(memoryOperand, lengthOperand);
+		NEXT();
+	}
+
+	HANDLER(OP_MADVISE) {
+		long int memoryOperand = (long int)getValue(&operands[0], registers, defined, variables);
+		long int lengthOperand = (long int)getValue(&operands[1], registers, defined, variables);
+		long int adviceOperand = (long int)getValue(&operands[2], registers, defined, variables);
+
+		adviseMemory(memoryOperand, lengthOperand, adviceOperand);
+		NEXT();
+	}
+
+	HANDLER(OP_MCOPY) {
+		long int toOperand = (long int)getValue(&operands[0], registers, defined, variables);
+		long int fromOperand = (long int)getValue(&operands[1], registers, defined, variables);
+		long int countOperand = (long int)getValue(&operands[2], registers, defined, variables);
+
+		copyWords(toOperand, fromOperand, countOperand);
+		NEXT();
+	}
+
+	HANDLER(OP_MFILL) {
+		long int toOperand = (long int)getValue(&operands[0], registers, defined, variables);
+		long int valueOperand = (long int)getValue(&operands[1], registers, defined, variables);
+		long int countOperand = (long int)getValue(&operands[2], registers, defined, variables);
+
+		fillWords(toOperand, valueOperand, countOperand);
+		NEXT();
+	}
+
+	HANDLER(OP_MCMP) {
+		long int countOperand = (long int)getValue(&operands[0], registers, defined, variables);
+		long int leftOperand = (long int)getValue(&operands[1], registers, defined, variables);
+		long int rightOperand = (long int)getValue(&operands[2], registers, defined, variables);
+
+		setValue(&operands[0], (void *)compareWords(countOperand, leftOperand, rightOperand), registers, defined);
+		NEXT();
+	}
+
+	HANDLER(OP_MFIND) {
+		long int countOperand = (long int)getValue(&operands[0], registers, defined, variables);
+		long int startOperand = (long int)getValue(&operands[1], registers, defined, variables);
+		long int valueOperand = (long int)getValue(&operands[2], registers, defined, variables);
+
+		setValue(&operands[0], (void *)findWord(countOperand, startOperand, valueOperand), registers, defined);
+		NEXT();
+	}
+
+	HANDLER(OP_VLEN) {
+		long int lengthOperand = (long int)getValue(&operands[0], registers, defined, variables);
+
+		setVectorLength(lengthOperand);
+		NEXT();
+	}
+
+	VECTOR_INSTRUCTION(OP_VADD, addVectors)
+	VECTOR_INSTRUCTION(OP_VSUB, subtractVectors)
+	VECTOR_INSTRUCTION(OP_VMULT, multiplyVectors)
+	VECTOR_INSTRUCTION(OP_VAND, andVectors)
+	VECTOR_INSTRUCTION(OP_VOR, orVectors)
+	VECTOR_INSTRUCTION(OP_VXOR, xorVectors)
+	VECTOR_INSTRUCTION(OP_VSCALE, scaleVector)
+
+	VECTOR_REDUCTION(OP_VSUM, sumVector)
+	VECTOR_REDUCTION(OP_VMIN, minimumOfVector)
+	VECTOR_REDUCTION(OP_VMAX, maximumOfVector)
+
+	HANDLER(OP_VDOT) {
+		long int leftOperand = (long int)getValue(&operands[1], registers, defined, variables);
+		long int rightOperand = (long int)getValue(&operands[2], registers, defined, variables);
+
+		setValue(&operands[0], (void *)dotProduct(leftOperand, rightOperand), registers, defined);
+		NEXT();
+	}
+
+	HANDLER(OP_SPAWN) {
+		long int startOperand = (long int)getValue(&operands[1], registers, defined, variables);
+		long int argumentOperand = (long int)getValue(&operands[2], registers, defined, variables);
+		long int thread;
+
+		if (operands[0].kind != OPERAND_VARIABLE) {
+			fail("Can only set value of a variable");
+		}
+		thread = spawnThread(machine, SPAWNED_ENGINE, startOperand, registers, defined, operands[0].value, argumentOperand);
+		setValue(&operands[0], (void *)thread, registers, defined);
+		NEXT();
+	}
+
+	HANDLER(OP_JOIN) {
+		long int threadOperand = (long int)getValue(&operands[1], registers, defined, variables);
+
+		setValue(&operands[0], (void *)joinThread(machine, threadOperand), registers, defined);
+		NEXT();
+	}
+
+	HANDLER(OP_CAS) {
+		long int expectedOperand = (long int)getValue(&operands[0], registers, defined, variables);
+		long int memoryOperand = (long int)getValue(&operands[1], registers, defined, variables);
+		long int desiredOperand = (long int)getValue(&operands[2], registers, defined, variables);
+
+		setValue(&operands[0], (void *)compareAndSwapWord(memoryOperand, expectedOperand, desiredOperand), registers, defined);
+		NEXT();
+	}
+
+	HANDLER(OP_FADD) {
+		long int memoryOperand = (long int)getValue(&operands[1], registers, defined, variables);
+		long int valueOperand = (long int)getValue(&operands[2], registers, defined, variables);
+
+		setValue(&operands[0], (void *)fetchAndAddWord(memoryOperand, valueOperand), registers, defined);
+		NEXT();
+	}
+
+	HANDLER(OP_XCHG) {
+		long int memoryOperand = (long int)getValue(&operands[1], registers, defined, variables);
+		long int valueOperand = (long int)getValue(&operands[2], registers, defined, variables);
+
+		setValue(&operands[0], (void *)exchangeWord(memoryOperand, valueOperand), registers, defined);
+		NEXT();
+	}
+
+	HANDLER(OP_FENCE) {
+		fenceMemory();
+		NEXT();
+	}
+
+	HANDLER(OP_PFOR) {
+		long int startOperand = (long int)getValue(&operands[0], registers, defined, variables);
+		long int endOperand = (long int)getValue(&operands[1], registers, defined, variables);
+		long int bodyOperand = (long int)getValue(&operands[2], registers, defined, variables);
+
+		if (operands[0].kind != OPERAND_VARIABLE) {
+			fail("Can only set value of a variable");
+		}
+		parallelFor(machine, SPAWNED_ENGINE, bodyOperand, registers, defined, operands[0].value, startOperand, endOperand);
+		NEXT();
+	}
+
+	/* ends an iteration of a pfor, or halts outside of one */
+	HANDLER(OP_PEND) {
+		if (countInstructions) {
+			fprintf(stderr, "%ld instructions executed\n", executed);
+		}
+		return;
+	}
+
+	HANDLER(OP_CHAN) {
+		long int capacityOperand = (long int)getValue(&operands[1], registers, defined, variables);
+
+		setValue(&operands[0], (void *)makeChannel(machine, capacityOperand), registers, defined);
+		NEXT();
+	}
+
+	HANDLER(OP_SEND) {
+		long int channelOperand = (long int)getValue(&operands[0], registers, defined, variables);
+		long int valueOperand = (long int)getValue(&operands[1], registers, defined, variables);
+
+		sendWord(machine, channelOperand, valueOperand);
+		NEXT();
+	}
+
+	HANDLER(OP_RECV) {
+		long int channelOperand = (long int)getValue(&operands[1], registers, defined, variables);
+		long int closedOperand = (long int)getValue(&operands[2], registers, defined, variables);
+
+		setValue(&operands[0], (void *)receiveWord(machine, channelOperand, closedOperand), registers, defined);
+		NEXT();
+	}
+
+	HANDLER(OP_TRYSEND) {
+		long int channelOperand = (long int)getValue(&operands[1], registers, defined, variables);
+		long int valueOperand = (long int)getValue(&operands[2], registers, defined, variables);
+
+		setValue(&operands[0], (void *)trySendWord(machine, channelOperand, valueOperand), registers, defined);
+		NEXT();
+	}
+
+	HANDLER(OP_TRYRECV) {
+		long int channelOperand = (long int)getValue(&operands[1], registers, defined, variables);
+		long int emptyOperand = (long int)getValue(&operands[2], registers, defined, variables);
+
+		setValue(&operands[0], (void *)tryReceiveWord(machine, channelOperand, emptyOperand), registers, defined);
+		NEXT();
+	}
+
+	HANDLER(OP_CLOSE) {
+		long int channelOperand = (long int)getValue(&operands[0], registers, defined, variables);
+
+		closeChannel(machine, channelOperand);
+		NEXT();
+	}
+
+	HANDLER(OP_CALL) {
+		long int labelOperand = (long int)getValue(&operands[0], registers, defined, variables);
+
+		if (depth == machine->returnCapacity) {
+			growReturns(machine);
+		}
+		machine->returns[depth++] = nextInstruction + 1;
+		PROFILE_CALL(labelOperand)
+		BRANCH(labelOperand);
+	}
+
+	HANDLER(OP_RET) {
+		if (depth == 0) {
+			fail("Return without a call");
+		}
+		--depth;
+		PROFILE_RETURN()
+		BRANCH(machine->returns[depth]);
+	}
+
+	HANDLER(OP_EXIT) {
+		long int exitCode = (long int)getValue(&operands[0], registers, defined, variables);
+
+		if (countInstructions) {
+			fprintf(stderr, "%ld instructions executed\n", executed);
+		}
+		finish(exitCode);
+	}
+
+	INCREMENT_AND_BRANCH(OP_INCREMENT_BEQ, ==)
+	INCREMENT_AND_BRANCH(OP_INCREMENT_BNEQ, !=)
+	INCREMENT_AND_BRANCH(OP_INCREMENT_BLT, <)
+	INCREMENT_AND_BRANCH(OP_INCREMENT_BGT, >)
+	INCREMENT_AND_BRANCH(OP_INCREMENT_BLE, <=)
+	INCREMENT_AND_BRANCH(OP_INCREMENT_BGE, >=)
+
+	COMPARE_IMMEDIATE_AND_BRANCH(OP_BEQ_IMMEDIATE, ==)
+	COMPARE_IMMEDIATE_AND_BRANCH(OP_BNEQ_IMMEDIATE, !=)
+	COMPARE_IMMEDIATE_AND_BRANCH(OP_BLT_IMMEDIATE, <)
+	COMPARE_IMMEDIATE_AND_BRANCH(OP_BGT_IMMEDIATE, >)
+	COMPARE_IMMEDIATE_AND_BRANCH(OP_BLE_IMMEDIATE, <=)
+	COMPARE_IMMEDIATE_AND_BRANCH(OP_BGE_IMMEDIATE, >=)
+
+	/* lw x p followed by add p p <immediate> */
+	HANDLER(OP_LOAD_AND_BUMP) {
+		struct Operand *bump = instructions[nextInstruction + 1].operands;
+		long int memoryOperand = (long int)getValue(&operands[1], registers, defined, variables);
+
+		setValue(&operands[0], memory[memoryOperand], registers, defined);
+		setValue(&bump[0], (void *)((long int)getValue(&bump[1], registers, defined, variables) + bump[2].value), registers, defined);
+		nextInstruction += 2;
+		DISPATCH();
+	}
+
+	/* sw x p followed by add p p <immediate> */
+	HANDLER(OP_STORE_AND_BUMP) {
+		struct Operand *bump = instructions[nextInstruction + 1].operands;
+		void *variableOperand = getValue(&operands[0], registers, defined, variables);
+		long int memoryOperand = (long int)getValue(&operands[1], registers, defined, variables);
+
+		memory[memoryOperand] = variableOperand;
+		setValue(&bump[0], (void *)((long int)getValue(&bump[1], registers, defined, variables) + bump[2].value), registers, defined);
+		nextInstruction += 2;
+		DISPATCH();
+	}
+
+	HANDLER(OP_HALT) {
+		/* the halt is not an instruction of the program */
+		if (countInstructions) {
+			fprintf(stderr, "%ld instructions executed\n", executed - 1);
+		}
+		return;
+	}
+
+	HANDLER(OP_NOP) {
+		NEXT();
+	}
+
+	HANDLER(OP_DIVIDE_BY_CONSTANT) {
+		long int leftOperand = (long int)getValue(&operands[1], registers, defined, variables);
+		long int result = divideByConstant(leftOperand, operandDivisor(&operands[2]));
+
+		setValue(&operands[0], (void *)result, registers, defined);
+		NEXT();
+	}
+
+	HANDLER(OP_MODULO_BY_CONSTANT) {
+		long int leftOperand = (long int)getValue(&operands[1], registers, defined, variables);
+		long int quotient = divideByConstant(leftOperand, operandDivisor(&operands[2]));
+		long int result = leftOperand - quotient * operandDivisor(&operands[2])->divisor;
+
+		setValue(&operands[0], (void *)result, registers, defined);
+		NEXT();
+	}
+	}
+}
+
+#undef PROFILE_INSTRUCTION
+#undef PROFILE_BRANCH
+#undef PROFILE_JUMP
+#undef PROFILE_CALL
+#undef PROFILE_RETURN
+#undef SPAWNED_ENGINE
+#undef HANDLER
+#undef DISPATCH
+#undef NEXT
+#undef CHECK_LIMIT
+#undef BRANCH
+#undef INCREMENT_AND_BRANCH
+#undef VECTOR_INSTRUCTION
+#undef VECTOR_REDUCTION
+#undef COMPARE_IMMEDIATE_AND_BRANCH
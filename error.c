@@ -0,0 +1,71 @@
+#define _DEFAULT_SOURCE
+
+#include "error.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* the innermost handler of each thread */
+static __thread struct ErrorHandler *handlers;
+
+void pushErrorHandler(struct ErrorHandler *handler) {
+  handler->outer = handlers;
+  handler->stop = 0;
+  handlers = handler;
+}
+
+void popErrorHandler(struct ErrorHandler *handler) {
+  handlers = handler->outer;
+}
+
+int catchingErrors(void) { return handlers != NULL; }
+
+static void stop(int reason, long int exitCode, char const *message) NO_RETURN;
+
+static void stop(int reason, long int exitCode, char const *message) {
+  struct ErrorHandler *handler = handlers;
+
+  if (handler == NULL) {
+    if (reason == STOP_EXIT) {
+      exit(exitCode);
+    }
+    fprintf(stderr, "%s\n", message);
+    exit(1);
+  }
+  handlers = handler->outer;
+  handler->stop = reason;
+  handler->exitCode = exitCode;
+  strcpy(handler->message, message);
+  longjmp(handler->jump, reason);
+}
+
+void passStop(struct ErrorHandler const *handler) {
+  stop(handler->stop, handler->exitCode, handler->message);
+}
+
+void fail(char const *format, ...) {
+  char message[ERROR_MESSAGE_SIZE];
+  va_list arguments;
+
+  va_start(arguments, format);
+  if (handlers == NULL) {
+    /* in full, however long the names in it are */
+    vfprintf(stderr, format, arguments);
+    fputc('\n', stderr);
+    exit(1);
+  }
+  vsnprintf(message, sizeof(message), format, arguments);
+  va_end(arguments);
+  stop(STOP_ERROR, 1, message);
+}
+
+void finish(long int exitCode) { stop(STOP_EXIT, exitCode, ""); }
+
+void exceedLimit(long int limit) {
+  char message[ERROR_MESSAGE_SIZE];
+
+  sprintf(message, "More than %ld instructions executed", limit);
+  stop(STOP_LIMIT, 1, message);
+}
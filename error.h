@@ -0,0 +1,60 @@
+#ifndef ERROR_H_
+#define ERROR_H_
+
+#include <setjmp.h>
+
+/*
+ * Errors found while compiling or running a program, and the ends of a
+ * program that are not its last instruction. Without a handler, fail()
+ * reports the error on stderr and exits with status 1, and finish() exits
+ * with the program's exit code, as broas always has. Code that has to get
+ * control back, such as the library, pushes a handler on the calling thread
+ * first: these then pop it and jump back to it with the reason (a Stop), the
+ * message and the exit code filled in.
+ */
+enum Stop { STOP_ERROR = 1, STOP_EXIT, STOP_LIMIT };
+
+#ifdef __GNUC__
+#define NO_RETURN __attribute__((noreturn))
+#else
+#define NO_RETURN
+#endif
+
+#define ERROR_MESSAGE_SIZE 256
+
+struct ErrorHandler {
+  jmp_buf jump;
+  struct ErrorHandler *outer;
+  int stop; /* 0 until something stops */
+  long int exitCode;
+  char message[ERROR_MESSAGE_SIZE];
+};
+
+/*
+ * Used as
+ *   if (setjmp(handler.jump) == 0) {
+ *     pushErrorHandler(&handler);
+ *     ...
+ *     popErrorHandler(&handler);
+ *   }
+ * after which handler.stop tells whether and why ... stopped.
+ */
+void pushErrorHandler(struct ErrorHandler *handler);
+void popErrorHandler(struct ErrorHandler *handler);
+
+/* whether the calling thread has a handler */
+int catchingErrors(void);
+
+/* stops again for what handler caught, once it has been cleaned up after */
+void passStop(struct ErrorHandler const *handler) NO_RETURN;
+
+/* reports an error, the message formatted as by printf without a newline */
+void fail(char const *format, ...) NO_RETURN;
+
+/* ends the program, for the exit instruction */
+void finish(long int exitCode) NO_RETURN;
+
+/* ends the program for running more than limit instructions */
+void exceedLimit(long int limit) NO_RETURN;
+
+#endif /* !ERROR_H_ */
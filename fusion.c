@@ -0,0 +1,123 @@
+#include "fusion.h"
+
+static int branchCondition(enum Opcode opcode) {
+  switch (opcode) {
+  case OP_BEQ:
+    return 0;
+  case OP_BNEQ:
+    return 1;
+  case OP_BLT:
+    return 2;
+  case OP_BGT:
+    return 3;
+  case OP_BLE:
+    return 4;
+  case OP_BGE:
+    return 5;
+  default:
+    return -1;
+  }
+}
+
+static int isVariable(struct Operand *operand) {
+  return operand->kind == OPERAND_VARIABLE;
+}
+
+static int isImmediate(struct Operand *operand) {
+  return operand->kind == OPERAND_IMMEDIATE;
+}
+
+static int sameVariable(struct Operand *left, struct Operand *right) {
+  return isVariable(left) && isVariable(right) &&
+         left->value == right->value;
+}
+
+/* add x x <immediate> */
+static int isBump(struct Instruction *instruction) {
+  struct Operand *operands = instruction->operands;
+
+  return instruction->opcode == OP_ADD &&
+         sameVariable(&operands[0], &operands[1]) && isImmediate(&operands[2]);
+}
+
+/* add x x <immediate> followed by b<cc> x <value> @label */
+static int isIncrementAndBranch(struct Instruction *instruction) {
+  struct Operand *branch = instruction[1].operands;
+
+  return isBump(instruction) && branchCondition(instruction[1].opcode) >= 0 &&
+         sameVariable(&instruction->operands[0], &branch[0]) &&
+         branch[2].kind == OPERAND_LABEL;
+}
+
+/* b<cc> x <immediate> @label */
+static int isCompareImmediateAndBranch(struct Instruction *instruction) {
+  struct Operand *operands = instruction->operands;
+
+  return branchCondition(instruction->opcode) >= 0 &&
+         isVariable(&operands[0]) && isImmediate(&operands[1]) &&
+         operands[2].kind == OPERAND_LABEL;
+}
+
+/* lw/sw x p followed by add p p <immediate> */
+static int isAccessAndBump(struct Instruction *instruction) {
+  return (instruction->opcode == OP_LW || instruction->opcode == OP_SW) &&
+         isVariable(&instruction->operands[0]) && isBump(&instruction[1]) &&
+         sameVariable(&instruction->operands[1], &instruction[1].operands[0]);
+}
+
+static void report(FILE *dump, long int index, char const *fusion,
+                   char const *first, char const *second) {
+  if (dump == NULL) {
+    return;
+  }
+  if (second == NULL) {
+    fprintf(dump, "instruction %ld: %s (%s)\n", index, fusion, first);
+  } else {
+    fprintf(dump, "instruction %ld: %s (%s + %s)\n", index, fusion, first,
+            second);
+  }
+}
+
+int fuseInstructions(struct Instruction *instructions, long int totalInstructions,
+                     FILE *dump) {
+  static enum Opcode const incrementAndBranch[] = {
+      OP_INCREMENT_BEQ, OP_INCREMENT_BNEQ, OP_INCREMENT_BLT,
+      OP_INCREMENT_BGT, OP_INCREMENT_BLE,  OP_INCREMENT_BGE};
+  static enum Opcode const compareImmediateAndBranch[] = {
+      OP_BEQ_IMMEDIATE, OP_BNEQ_IMMEDIATE, OP_BLT_IMMEDIATE,
+      OP_BGT_IMMEDIATE, OP_BLE_IMMEDIATE,  OP_BGE_IMMEDIATE};
+  int fusions = 0;
+  long int i;
+
+  /*
+   * Only the instruction being looked at is rewritten, so the one after it
+   * still has its original opcode when a pair is matched.
+   */
+  for (i = 0; i < totalInstructions; i++) {
+    struct Instruction *instruction = &instructions[i];
+    enum Opcode opcode = instruction->opcode;
+
+    if (i + 1 < totalInstructions && isIncrementAndBranch(instruction)) {
+      report(dump, i, "increment-and-branch", opcodeName(opcode),
+             opcodeName(instruction[1].opcode));
+      instruction->opcode =
+          incrementAndBranch[branchCondition(instruction[1].opcode)];
+      ++fusions;
+    } else if (i + 1 < totalInstructions && isAccessAndBump(instruction)) {
+      report(dump, i,
+             opcode == OP_LW ? "load-then-bump-pointer"
+                             : "store-then-bump-pointer",
+             opcodeName(opcode), opcodeName(instruction[1].opcode));
+      instruction->opcode =
+          opcode == OP_LW ? OP_LOAD_AND_BUMP : OP_STORE_AND_BUMP;
+      ++fusions;
+    } else if (isCompareImmediateAndBranch(instruction)) {
+      report(dump, i, "compare-immediate-and-branch", opcodeName(opcode),
+             NULL);
+      instruction->opcode = compareImmediateAndBranch[branchCondition(opcode)];
+      ++fusions;
+    }
+  }
+
+  return fusions;
+}
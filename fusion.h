@@ -0,0 +1,16 @@
+#ifndef FUSION_H_
+#define FUSION_H_
+
+#include <stdio.h>
+
+#include "bytecode.h"
+
+/*
+ * Rewrites frequent instruction sequences into superinstructions in place.
+ * Every fusion that fires is listed on dump unless it is NULL. Returns the
+ * number of fusions.
+ */
+int fuseInstructions(struct Instruction *instructions, long int totalInstructions,
+                     FILE *dump);
+
+#endif /* !FUSION_H_ */
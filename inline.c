@@ -0,0 +1,237 @@
+#include "inline.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "dataflow.h"
+
+/* the most instructions a subroutine can have before its ret and be inlined */
+#define MAX_INLINED 8
+
+/* a subroutine that only called leaves is a leaf itself the round after */
+#define MAX_ROUNDS 4
+
+/*
+ * The number of instructions before the ret that ends the subroutine at
+ * start, or -1 when it is no leaf: it branches, calls or stops before then,
+ * or the ret is too far away.
+ */
+static long int leafLength(struct Instruction *instructions,
+                           long int totalInstructions, long int start) {
+  long int i;
+
+  for (i = start; i < totalInstructions && i - start <= MAX_INLINED; i++) {
+    struct Instruction *instruction = &instructions[i];
+
+    if (instruction->opcode == OP_RET) {
+      return i - start;
+    }
+    if (jumpOperand(instruction) >= 0 || !fallsThrough(instruction->opcode)) {
+      return -1;
+    }
+  }
+  return -1;
+}
+
+struct Inliner {
+  struct Instruction *instructions;
+  long int totalInstructions;
+
+  /* per instruction */
+  long int *references; /* the jumps, calls included, that go there */
+  long int *inlinedCalls;
+  long int *bodyLength; /* of the leaf a call is replaced with, or -1 */
+  char *removed;
+};
+
+/* returns 0 when the program jumps through a variable */
+static int countReferences(struct Inliner *inliner) {
+  long int total = inliner->totalInstructions;
+  long int j;
+
+  for (j = 0; j < total; j++) {
+    int jump = jumpOperand(&inliner->instructions[j]);
+    long int target;
+
+    inliner->bodyLength[j] = -1;
+    if (jump < 0) {
+      continue;
+    }
+    target = directTarget(&inliner->instructions[j].operands[jump], total);
+    if (target < 0) {
+      return 0;
+    }
+    ++inliner->references[target];
+  }
+  return 1;
+}
+
+/*
+ * Picks the calls to inline, in order, for as long as the program still
+ * fits, and sets *pNewTotal to the number of instructions it then has.
+ * Returns the number of calls picked.
+ */
+static long int chooseCalls(struct Inliner *inliner, long int maxInstructions,
+                            long int *pNewTotal) {
+  struct Instruction *instructions = inliner->instructions;
+  long int total = inliner->totalInstructions;
+  long int newTotal = total;
+  long int calls = 0;
+  long int j;
+
+  for (j = 0; j < total; j++) {
+    long int target;
+    long int length;
+
+    if (instructions[j].opcode != OP_CALL) {
+      continue;
+    }
+    target = directTarget(&instructions[j].operands[0], total);
+    length = target < total ? leafLength(instructions, total, target) : -1;
+    if (length >= 0 && newTotal + length - 1 <= maxInstructions) {
+      inliner->bodyLength[j] = length;
+      ++inliner->inlinedCalls[target];
+      newTotal += length - 1;
+      ++calls;
+    }
+  }
+  *pNewTotal = newTotal;
+  return calls;
+}
+
+/*
+ * Removes every leaf whose only ways in were calls that are inlined now.
+ * Returns the number of instructions left of newTotal.
+ */
+static long int dropLeaves(struct Inliner *inliner, long int newTotal) {
+  struct Instruction *instructions = inliner->instructions;
+  long int total = inliner->totalInstructions;
+  long int j;
+
+  for (j = 1; j < total; j++) {
+    long int length;
+    long int k;
+    int reached = 0;
+
+    if (inliner->inlinedCalls[j] == 0 ||
+        inliner->inlinedCalls[j] != inliner->references[j] ||
+        fallsThrough(instructions[j - 1].opcode)) {
+      continue;
+    }
+    length = leafLength(instructions, total, j);
+    for (k = j + 1; k <= j + length; k++) {
+      reached |= inliner->references[k] > 0;
+    }
+    if (!reached) {
+      memset(inliner->removed + j, 1, length + 1);
+      newTotal -= length + 1;
+    }
+  }
+  return newTotal;
+}
+
+/*
+ * Lays the program out again with the bodies in place of the calls and
+ * without the leaves removed. Returns the new number of instructions.
+ */
+static long int relayout(struct Inliner *inliner, long int newTotal) {
+  struct Instruction *instructions = inliner->instructions;
+  long int total = inliner->totalInstructions;
+  struct Instruction *layout =
+      malloc((newTotal + 1) * sizeof(struct Instruction));
+  long int *origin = malloc((newTotal + 1) * sizeof(long int));
+  long int *position = malloc((total + 1) * sizeof(long int));
+  long int j;
+  long int k;
+
+  newTotal = 0;
+  for (j = 0; j < total; j++) {
+    position[j] = newTotal;
+    if (inliner->removed[j]) {
+      continue;
+    }
+    if (inliner->bodyLength[j] >= 0) {
+      long int target = directTarget(&instructions[j].operands[0], total);
+
+      for (k = 0; k < inliner->bodyLength[j]; k++) {
+        origin[newTotal] = -1;
+        layout[newTotal++] = instructions[target + k];
+      }
+    } else {
+      origin[newTotal] = j;
+      layout[newTotal++] = instructions[j];
+    }
+  }
+  position[total] = newTotal;
+
+  /* the bodies copied in have no jumps */
+  for (k = 0; k < newTotal; k++) {
+    int jump = jumpOperand(&layout[k]);
+    struct Operand *operand;
+
+    if (origin[k] < 0 || jump < 0) {
+      continue;
+    }
+    operand = &layout[k].operands[jump];
+    if (operand->kind == OPERAND_CONSTANT) {
+      setImmediate(operand, position[directTarget(operand, total)]);
+    } else if (operand->kind == OPERAND_IMMEDIATE ||
+               operand->kind == OPERAND_LABEL) {
+      operand->value = position[directTarget(operand, total)];
+    }
+  }
+
+  memcpy(instructions, layout, newTotal * sizeof(struct Instruction));
+  instructions[newTotal].opcode = OP_HALT;
+
+  free(layout);
+  free(origin);
+  free(position);
+  return newTotal;
+}
+
+/*
+ * Inlines the calls to the leaves there are now. Returns the new number of
+ * instructions, or -1 when there was nothing to inline.
+ */
+static long int inlineRound(struct Instruction *instructions,
+                            long int totalInstructions,
+                            long int maxInstructions) {
+  struct Inliner inliner;
+  long int newTotal = -1;
+  long int total;
+
+  inliner.instructions = instructions;
+  inliner.totalInstructions = totalInstructions;
+  inliner.references = calloc(totalInstructions + 1, sizeof(long int));
+  inliner.inlinedCalls = calloc(totalInstructions + 1, sizeof(long int));
+  inliner.bodyLength = malloc((totalInstructions + 1) * sizeof(long int));
+  inliner.removed = calloc(totalInstructions + 1, 1);
+
+  if (countReferences(&inliner) &&
+      chooseCalls(&inliner, maxInstructions, &total) > 0) {
+    newTotal = relayout(&inliner, dropLeaves(&inliner, total));
+  }
+
+  free(inliner.references);
+  free(inliner.inlinedCalls);
+  free(inliner.bodyLength);
+  free(inliner.removed);
+  return newTotal;
+}
+
+long int inlineCalls(struct Instruction *instructions,
+                     long int totalInstructions, long int maxInstructions) {
+  int round;
+
+  for (round = 0; round < MAX_ROUNDS; round++) {
+    long int newTotal =
+        inlineRound(instructions, totalInstructions, maxInstructions);
+
+    if (newTotal < 0) {
+      break;
+    }
+    totalInstructions = newTotal;
+  }
+  return totalInstructions;
+}
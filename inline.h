@@ -0,0 +1,20 @@
+#ifndef INLINE_H_
+#define INLINE_H_
+
+#include "bytecode.h"
+
+/*
+ * Replaces, in place, every call to a small leaf subroutine with a copy of
+ * its body: straight-line code of a few instructions that calls nothing and
+ * ends in ret. A subroutine that nothing calls, jumps or falls into any more
+ * goes away.
+ *
+ * Instructions move, so branch targets are renumbered as optimizeLoops()
+ * renumbers them, and programs that jump through a variable are left as
+ * they are. Returns the new number of instructions, which never exceeds
+ * maxInstructions.
+ */
+long int inlineCalls(struct Instruction *instructions,
+                     long int totalInstructions, long int maxInstructions);
+
+#endif /* !INLINE_H_ */
@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "interpreter.h"
+#include "error.h"
+#include "io.h"
+#include "memory.h"
+#include "vector.h"
+#include "profile.h"
+#include "thread.h"
+#include "parallel.h"
+#include "channel.h"
+
+void *getValue(struct Operand *operand, long int *registers, char *defined, struct Variable *variables);
+void setValue(struct Operand *operand, void *value, long int *registers, char *defined);
+
+/* the high half of the full product of left and right */
+static long int multiplyHigh(long int left, long int right) {
+#ifdef __SIZEOF_INT128__
+	return (long int)(__extension__ ((__int128)left * right) >> 64);
+#else
+	unsigned long int halfMask = 0xffffffffUL;
+	unsigned long int lowProduct = (left & halfMask) * (right & halfMask);
+	long int middle = (left >> 32) * (long int)(right & halfMask) + (long int)(lowProduct >> 32);
+	long int cross = (long int)(left & halfMask) * (right >> 32) + (middle & (long int)halfMask);
+
+	return (left >> 32) * (right >> 32) + (middle >> 32) + (cross >> 32);
+#endif
+}
+
+static long int divideByConstant(long int dividend, struct Divisor const *divisor) {
+	long int quotient = multiplyHigh(dividend, divisor->magic);
+
+	if (divisor->divisor > 0 && divisor->magic < 0) {
+		quotient += dividend;
+	}
+	else if (divisor->divisor < 0 && divisor->magic > 0) {
+		quotient -= dividend;
+	}
+	quotient >>= divisor->shift;
+	return quotient + (long int)((unsigned long int)quotient >> 63);
+}
+
+/* makes room on the return stack of machine for one more call than it has */
+static void growReturns(struct Machine *machine) {
+	long int capacity = machine->returnCapacity > 0 ? 2 * machine->returnCapacity : 64;
+	long int *returns;
+
+	if (machine->returnCapacity >= machine->callDepth) {
+		fail("More than %ld nested calls", machine->callDepth);
+	}
+	if (capacity > machine->callDepth) {
+		capacity = machine->callDepth;
+	}
+	returns = realloc(machine->returns, capacity * sizeof(long int));
+	if (returns == NULL) {
+		fail("Cannot make room for %ld nested calls", capacity);
+	}
+	machine->returns = returns;
+	machine->returnCapacity = capacity;
+}
+
+#define EXECUTE execute
+#include "engine.h"
+#undef EXECUTE
+
+#define EXECUTE executeProfiled
+#define PROFILED_ENGINE
+#include "engine.h"
+#undef PROFILED_ENGINE
+#undef EXECUTE
+
+#define EXECUTE executeSampled
+#define SAMPLED_ENGINE
+#include "engine.h"
+#undef SAMPLED_ENGINE
+#undef EXECUTE
+
+void *getValue(struct Operand *operand, long int *registers, char *defined, struct Variable *variables) {
+	if (operand->kind == OPERAND_IMMEDIATE || operand->kind == OPERAND_LABEL) return (void *)(long int)operand->value;
+	else if (operand->kind == OPERAND_VARIABLE) {
+		if (defined[operand->value]) {
+			return (void *)registers[operand->value];
+		}
+		fail("%s not defined", variables[operand->value].name);
+	}
+	else if (operand->kind == OPERAND_CONSTANT) {
+		return (void *)operandValue(operand);
+	}
+	else if (operand->kind == OPERAND_INVALID) {
+		fail("Cannot get value of %s, (can only access value of a variable or immediate or label)", operandName(operand));
+	}
+	fail("%s not defined", operandName(operand));
+	return NULL;
+}
+
+void setValue(struct Operand *operand, void *value, long int *registers, char *defined) {
+	if (operand->kind != OPERAND_VARIABLE) {
+		fail("Can only set value of a variable");
+	}
+
+	registers[operand->value] = (long int)value;
+	defined[operand->value] = 1;
+}
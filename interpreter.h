@@ -0,0 +1,68 @@
+#ifndef INTERPRETER_H_
+#define INTERPRETER_H_
+
+#include <stddef.h>
+
+#include "bytecode.h"
+#include "io.h"
+
+struct Threads;
+struct Channels;
+
+/* how deeply call may nest unless --call-depth says otherwise */
+#define DEFAULT_CALL_DEPTH 100000
+
+/*
+ * A program as it runs, shared by every thread that runs it: its
+ * instructions, its memory (mapped by mapMemory() with memoryWords and
+ * hugePages), the constant pool and I/O it uses (NULL for broas's own), and
+ * the threads it spawned and the channels it made, each NULL until there is
+ * one. With countInstructions set, the number of instructions the first
+ * thread executed is printed on stderr when it halts or exits. Each thread
+ * stops with STOP_LIMIT once it has run more than instructionLimit
+ * instructions, a superinstruction counting as one, which is checked when it
+ * branches.
+ *
+ * call pushes the instruction to return to on returns, a stack of
+ * returnCapacity entries that grows up to callDepth. Every thread has one of
+ * its own, NULL until its first call, which whoever set up the thread's
+ * machine frees.
+ */
+struct Machine {
+  struct Instruction *instructions;
+  long int totalInstructions;
+  struct Variable *variables;
+  int numberOfVariables;
+  void **memory;
+  size_t memoryWords;
+  int hugePages;
+  struct ConstantPool *pool;
+  struct Io *io;
+  int countInstructions;
+  long int instructionLimit;
+  struct Threads *threads;
+  struct Channels *channels;
+  long int callDepth;
+  long int *returns;
+  long int returnCapacity;
+};
+
+/*
+ * Interprets the program on the calling thread from instruction start until
+ * it halts, or until it exits or fails (see error.h). registers and defined
+ * have a slot for every variable, and the first thread starts with them
+ * zeroed. Threads the program spawns are left running; finishThreads()
+ * waits for them.
+ *
+ * executeProfiled() counts every instruction for --profile, and
+ * executeSampled() keeps the state of --sample-profile up to date; see
+ * engine.h.
+ */
+void execute(struct Machine *machine, long int start, long int *registers,
+             char *defined);
+void executeProfiled(struct Machine *machine, long int start,
+                     long int *registers, char *defined);
+void executeSampled(struct Machine *machine, long int start,
+                    long int *registers, char *defined);
+
+#endif /* !INTERPRETER_H_ */
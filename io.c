@@ -0,0 +1,191 @@
+#include "io.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define OUTPUT_BUFFER_SIZE 65536
+#define INPUT_BUFFER_SIZE 65536
+
+struct Io {
+  char output[OUTPUT_BUFFER_SIZE];
+  long int outputLength;
+  long int outputCapacity;
+
+  char input[INPUT_BUFFER_SIZE];
+  long int inputPosition;
+  long int inputLength;
+  long int inputCapacity;
+
+  /* a program reading a terminal has to see its prompt before it types */
+  int interactiveInput;
+
+  long int (*write)(void *data, char const *bytes, long int length);
+  long int (*read)(void *data, char *buffer, long int capacity);
+  void *data;
+
+  /*
+   * Taken around every print, and every scan, once threads share the
+   * buffers. A scan waiting for input holds inputLock only, so the other
+   * threads can still print and exit.
+   */
+  int shared;
+  pthread_mutex_t lock;
+  pthread_mutex_t inputLock;
+};
+
+static long int writeStandardOutput(void *data, char const *bytes,
+                                    long int length) {
+  long int written = 0;
+
+  (void)data;
+  while (written < length) {
+    long int count = write(1, bytes + written, length - written);
+
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count <= 0) {
+      return -1;
+    }
+    written += count;
+  }
+  return written;
+}
+
+static long int readStandardInput(void *data, char *buffer, long int capacity) {
+  long int count;
+
+  (void)data;
+  do {
+    count = read(0, buffer, capacity);
+  } while (count < 0 && errno == EINTR);
+  return count;
+}
+
+/* broas prints to this one, the library gives each context its own */
+static struct Io standardIo = {
+    {0}, 0, OUTPUT_BUFFER_SIZE, {0}, 0, 0, INPUT_BUFFER_SIZE, 0,
+    writeStandardOutput, readStandardInput, NULL, 0, PTHREAD_MUTEX_INITIALIZER,
+    PTHREAD_MUTEX_INITIALIZER};
+static __thread struct Io *io = &standardIo;
+
+void initializeIo(int unbuffered) {
+  if (unbuffered) {
+    standardIo.outputCapacity = 1;
+    standardIo.inputCapacity = 1;
+  }
+  standardIo.interactiveInput = isatty(0);
+  /* exit() runs this from every exit instruction and every error */
+  atexit(flushOutput);
+}
+
+struct Io *createIo(long int (*write)(void *data, char const *bytes,
+                                      long int length),
+                    long int (*read)(void *data, char *buffer,
+                                     long int capacity),
+                    void *data) {
+  struct Io *created = malloc(sizeof(struct Io));
+
+  if (created == NULL) {
+    return NULL;
+  }
+  created->outputCapacity = OUTPUT_BUFFER_SIZE;
+  created->inputCapacity = INPUT_BUFFER_SIZE;
+  created->interactiveInput = 0;
+  created->write = write != NULL ? write : writeStandardOutput;
+  created->read = read != NULL ? read : readStandardInput;
+  created->data = data;
+  created->shared = 0;
+  pthread_mutex_init(&created->lock, NULL);
+  pthread_mutex_init(&created->inputLock, NULL);
+  resetIo(created);
+  return created;
+}
+
+void resetIo(struct Io *reset) {
+  reset->outputLength = 0;
+  reset->inputPosition = 0;
+  reset->inputLength = 0;
+}
+
+void destroyIo(struct Io *destroyed) {
+  pthread_mutex_destroy(&destroyed->lock);
+  pthread_mutex_destroy(&destroyed->inputLock);
+  free(destroyed);
+}
+
+struct Io *useIo(struct Io *used) {
+  struct Io *previous = io;
+
+  io = used != NULL ? used : &standardIo;
+  return previous;
+}
+
+void shareIo(struct Io *shared) {
+  (shared != NULL ? shared : &standardIo)->shared = 1;
+}
+
+static void writeOutput(struct Io *current) {
+  /* like printf, output that cannot be written is dropped */
+  if (current->outputLength > 0) {
+    current->write(current->data, current->output, current->outputLength);
+  }
+  current->outputLength = 0;
+}
+
+void flushOutput(void) {
+  struct Io *current = io;
+
+  if (current->shared) {
+    pthread_mutex_lock(&current->lock);
+  }
+  writeOutput(current);
+  if (current->shared) {
+    pthread_mutex_unlock(&current->lock);
+  }
+}
+
+void writeCharacter(char c) {
+  struct Io *current = io;
+
+  if (current->shared) {
+    pthread_mutex_lock(&current->lock);
+  }
+  current->output[current->outputLength++] = c;
+  if (current->outputLength >= current->outputCapacity) {
+    writeOutput(current);
+  }
+  if (current->shared) {
+    pthread_mutex_unlock(&current->lock);
+  }
+}
+
+long int readCharacter(void) {
+  struct Io *current = io;
+  long int c = -1;
+
+  if (current->shared) {
+    pthread_mutex_lock(&current->inputLock);
+  }
+  if (current->interactiveInput) {
+    flushOutput();
+  }
+  if (current->inputPosition == current->inputLength) {
+    long int count =
+        current->read(current->data, current->input, current->inputCapacity);
+
+    if (count > 0) {
+      current->inputPosition = 0;
+      current->inputLength = count;
+    }
+  }
+  if (current->inputPosition < current->inputLength) {
+    c = (unsigned char)current->input[current->inputPosition++];
+  }
+  if (current->shared) {
+    pthread_mutex_unlock(&current->inputLock);
+  }
+  return c;
+}
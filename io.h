@@ -0,0 +1,54 @@
+#ifndef IO_H_
+#define IO_H_
+
+/*
+ * Character I/O for print and scan. Output collects in a buffer that is
+ * written when it fills up, before scan reads from a terminal, and when the
+ * process exits, however it exits. scan reads its input a block at a time.
+ * Unbuffered, every character is written or read with a system call of its
+ * own, and nothing is read ahead of what the program scans.
+ */
+void initializeIo(int unbuffered);
+
+/*
+ * I/O of its own for a program the library runs, through write and read
+ * instead of file descriptors 1 and 0. write is given the output a bufferful
+ * at a time and returns the number of bytes written, or -1 when it cannot
+ * write them, and read fills buffer with up to capacity bytes of input and
+ * returns their number, or 0 or -1 at end of input. Either left NULL uses
+ * the file descriptor. data is passed to both. Returns NULL when out of
+ * memory.
+ */
+struct Io;
+
+struct Io *createIo(long int (*write)(void *data, char const *bytes,
+                                      long int length),
+                    long int (*read)(void *data, char *buffer,
+                                     long int capacity),
+                    void *data);
+
+/* throws away the output not yet written and the input not yet scanned */
+void resetIo(struct Io *io);
+
+void destroyIo(struct Io *io);
+
+/*
+ * Makes io the one print and scan use on the calling thread, NULL meaning
+ * the standard one, and returns the previous one.
+ */
+struct Io *useIo(struct Io *io);
+
+/*
+ * Makes print and scan on io (NULL meaning the standard one) safe to use
+ * from several threads at once, which costs them a lock each from then on.
+ */
+void shareIo(struct Io *io);
+
+void writeCharacter(char c);
+
+/* the next input byte, or -1 at end of input */
+long int readCharacter(void);
+
+void flushOutput(void);
+
+#endif /* !IO_H_ */
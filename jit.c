@@ -0,0 +1,986 @@
+#define _DEFAULT_SOURCE
+
+#include "jit.h"
+
+#include "dataflow.h"
+#include "error.h"
+#include "io.h"
+#include "memory.h"
+#include "vector.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+enum HostRegister {
+  RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+  R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+#define NO_REGISTER (-1)
+
+/* pinned for the whole run, everything else is free for variables */
+#define MEMORY_BASE R12
+#define FRAME_BASE R13
+
+/*
+ * Registers that hold the hottest variables, hottest first. The first
+ * NUMBER_OF_CALLEE_SAVED survive calls into the C helpers, the others are
+ * written back to the frame around every call.
+ */
+static int const variableRegisters[] = {RBX, RBP, R14, R15, RSI,
+                                        RDI, R8,  R9,  R10, R11};
+#define NUMBER_OF_VARIABLE_REGISTERS 10
+#define NUMBER_OF_CALLEE_SAVED 4
+
+/* the rel32 at offset jumps to the native code of an instruction */
+struct Patch {
+  size_t offset;
+  long int target;
+};
+
+/* the rel32 at offset jumps to an error report for an unset variable */
+struct Stub {
+  size_t offset;
+  long int slot;
+};
+
+struct Jit {
+  unsigned char *code;
+  size_t length;
+  size_t capacity;
+  int overflow;
+
+  struct Instruction *instructions;
+  long int totalInstructions;
+  struct Variable *variables;
+  int numberOfVariables;
+
+  /* per register slot */
+  int *hostRegister;
+  char *checked;
+  long int flagsOffset;
+
+  /* per variable register in use, the slot it holds */
+  long int registerSlot[NUMBER_OF_VARIABLE_REGISTERS];
+  int usedRegisters;
+
+  /* per instruction, plus the epilogue at totalInstructions */
+  size_t *nativeOffsets;
+  unsigned long *definedBefore;
+
+  struct Patch *patches;
+  size_t numberOfPatches;
+  struct Stub *stubs;
+  size_t numberOfStubs;
+};
+
+/*
+ * The helpers do exactly what the interpreter does for the instructions
+ * that touch the outside world, so both modes share stdio and the quirks
+ * of deref.
+ */
+static long int jitDeref(long int address, long int size) {
+  long int *addressOperand = (long int *)address;
+  long int result = 0;
+
+  int byteCount;
+  for (byteCount = size - 1; byteCount >= 0; --byteCount) {
+    char byte = *((char *)addressOperand + byteCount);
+    result = (result << 8) | byte;
+  }
+  return result;
+}
+
+static void jitPrint(long int operand) { writeCharacter((char)operand); }
+
+static long int jitScan(void) { return readCharacter(); }
+
+static void jitExit(long int exitCode) { finish(exitCode); }
+
+static long int jitMmap(long int path, long int index) {
+  return mapFile(index, (char const *)path, 0);
+}
+
+static long int jitMmapw(long int path, long int index) {
+  return mapFile(index, (char const *)path, 1);
+}
+
+/* the memory.c or vector.c function behind a block or vector instruction */
+static unsigned long int blockHelper(enum Opcode opcode) {
+  switch (opcode) {
+  case OP_MCOPY:
+    return (unsigned long int)copyWords;
+  case OP_MFILL:
+    return (unsigned long int)fillWords;
+  case OP_MCMP:
+    return (unsigned long int)compareWords;
+  case OP_MFIND:
+    return (unsigned long int)findWord;
+  case OP_VLEN:
+    return (unsigned long int)setVectorLength;
+  case OP_VADD:
+    return (unsigned long int)addVectors;
+  case OP_VSUB:
+    return (unsigned long int)subtractVectors;
+  case OP_VMULT:
+    return (unsigned long int)multiplyVectors;
+  case OP_VAND:
+    return (unsigned long int)andVectors;
+  case OP_VOR:
+    return (unsigned long int)orVectors;
+  case OP_VXOR:
+    return (unsigned long int)xorVectors;
+  case OP_VSCALE:
+    return (unsigned long int)scaleVector;
+  case OP_VSUM:
+    return (unsigned long int)sumVector;
+  case OP_VMIN:
+    return (unsigned long int)minimumOfVector;
+  case OP_VMAX:
+    return (unsigned long int)maximumOfVector;
+  default:
+    return (unsigned long int)dotProduct;
+  }
+}
+
+static void jitUndefined(char const *name) { fail("%s not defined", name); }
+
+static int isSupported(struct Jit *jit) {
+  long int i;
+
+  if (jit->totalInstructions >= (1L << 24)) {
+    return 0;
+  }
+
+  for (i = 0; i < jit->totalInstructions; i++) {
+    struct Instruction *instruction = &jit->instructions[i];
+    int order[MAX_OPERANDS];
+    int count = readOperands(instruction->opcode, order);
+    int j;
+
+    /*
+     * threads, atomics, pfor, channels and calls are left to the
+     * interpreter
+     */
+    if (count < 0 ||
+        (instruction->opcode >= OP_SPAWN && instruction->opcode <= OP_RET)) {
+      return 0;
+    }
+    for (j = 0; j < count; j++) {
+      enum OperandKind kind = instruction->operands[order[j]].kind;
+
+      if (kind != OPERAND_IMMEDIATE && kind != OPERAND_VARIABLE &&
+          kind != OPERAND_LABEL && kind != OPERAND_CONSTANT) {
+        return 0;
+      }
+    }
+    if (writesDestination(instruction->opcode) &&
+        instruction->operands[0].kind != OPERAND_VARIABLE) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*
+ * Gives the variables used most inside loops a host register. A backward
+ * branch marks a loop, and every level of nesting makes a use count eight
+ * times as much.
+ */
+static void allocateRegisters(struct Jit *jit) {
+  long int total = jit->totalInstructions;
+  long int *depth = calloc(total + 1, sizeof(long int));
+  unsigned long *weight = calloc(jit->numberOfVariables + 1,
+                                 sizeof(unsigned long));
+  long int i;
+  int r;
+
+  for (i = 0; i < total; i++) {
+    long int jump = jumpOperand(&jit->instructions[i]);
+
+    if (jump >= 0) {
+      long int target =
+          directTarget(&jit->instructions[i].operands[jump], total);
+
+      if (target >= 0 && target <= i) {
+        ++depth[target];
+        --depth[i + 1];
+      }
+    }
+  }
+  for (i = 1; i <= total; i++) {
+    depth[i] += depth[i - 1];
+  }
+
+  for (i = 0; i < total; i++) {
+    struct Instruction *instruction = &jit->instructions[i];
+    unsigned long use = 1UL << (3 * (depth[i] > 8 ? 8 : depth[i]));
+    int order[MAX_OPERANDS];
+    int count = readOperands(instruction->opcode, order);
+    int j;
+
+    if (writesDestination(instruction->opcode)) {
+      weight[instruction->operands[0].value] += use;
+    }
+    for (j = 0; j < count; j++) {
+      struct Operand *operand = &instruction->operands[order[j]];
+
+      if (operand->kind == OPERAND_VARIABLE) {
+        weight[operand->value] += use;
+      }
+    }
+  }
+
+  for (i = 0; i < jit->numberOfVariables; i++) {
+    jit->hostRegister[i] = NO_REGISTER;
+  }
+
+  for (r = 0; r < NUMBER_OF_VARIABLE_REGISTERS; r++) {
+    long int best = -1;
+
+    for (i = 0; i < jit->numberOfVariables; i++) {
+      if (jit->hostRegister[i] == NO_REGISTER && weight[i] > 0 &&
+          (best < 0 || weight[i] > weight[best])) {
+        best = i;
+      }
+    }
+    if (best < 0) {
+      break;
+    }
+    jit->hostRegister[best] = variableRegisters[r];
+    jit->registerSlot[r] = best;
+    jit->usedRegisters = r + 1;
+  }
+
+  free(depth);
+  free(weight);
+}
+
+static void emitByte(struct Jit *jit, int byte) {
+  if (jit->length == jit->capacity) {
+    jit->overflow = 1;
+    return;
+  }
+  jit->code[jit->length++] = (unsigned char)byte;
+}
+
+static void emitInt32(struct Jit *jit, long int value) {
+  int i;
+  for (i = 0; i < 4; i++) {
+    emitByte(jit, (int)((unsigned long int)value >> (8 * i)) & 0xff);
+  }
+}
+
+static void emitInt64(struct Jit *jit, unsigned long int value) {
+  int i;
+  for (i = 0; i < 8; i++) {
+    emitByte(jit, (int)(value >> (8 * i)) & 0xff);
+  }
+}
+
+static void patchInt32(struct Jit *jit, size_t offset, long int value) {
+  int i;
+
+  if (offset + 4 > jit->length) {
+    return;
+  }
+  for (i = 0; i < 4; i++) {
+    jit->code[offset + i] = (unsigned char)((unsigned long int)value >> (8 * i));
+  }
+}
+
+static int fitsInt32(long int value) {
+  return value >= -2147483647L - 1 && value <= 2147483647L;
+}
+
+static void emitOpcode(struct Jit *jit, int opcode) {
+  if (opcode > 0xff) {
+    emitByte(jit, opcode >> 8);
+  }
+  emitByte(jit, opcode & 0xff);
+}
+
+static void emitRex(struct Jit *jit, int wide, int reg, int index, int base) {
+  int rex = 0x40 | (wide ? 8 : 0) | ((reg >> 3) & 1) << 2 |
+            ((index >> 3) & 1) << 1 | ((base >> 3) & 1);
+  if (rex != 0x40) {
+    emitByte(jit, rex);
+  }
+}
+
+/* opcode with a register as its r/m operand; reg may be a /digit */
+static void emitRegister(struct Jit *jit, int wide, int opcode, int reg,
+                         int rm) {
+  emitRex(jit, wide, reg, 0, rm);
+  emitOpcode(jit, opcode);
+  emitByte(jit, 0xc0 | (reg & 7) << 3 | (rm & 7));
+}
+
+/* opcode with [base + index * 8 + disp] as its r/m operand */
+static void emitMemory(struct Jit *jit, int wide, int opcode, int reg,
+                       int base, int index, long int disp) {
+  emitRex(jit, wide, reg, index == NO_REGISTER ? 0 : index, base);
+  emitOpcode(jit, opcode);
+  if (index == NO_REGISTER && (base & 7) != RSP) {
+    emitByte(jit, 0x80 | (reg & 7) << 3 | (base & 7));
+  } else {
+    emitByte(jit, 0x80 | (reg & 7) << 3 | RSP);
+    if (index == NO_REGISTER) {
+      emitByte(jit, RSP << 3 | (base & 7));
+    } else {
+      emitByte(jit, 3 << 6 | (index & 7) << 3 | (base & 7));
+    }
+  }
+  emitInt32(jit, disp);
+}
+
+static void emitPush(struct Jit *jit, int reg) {
+  emitRex(jit, 0, 0, 0, reg);
+  emitByte(jit, 0x50 + (reg & 7));
+}
+
+static void emitPop(struct Jit *jit, int reg) {
+  emitRex(jit, 0, 0, 0, reg);
+  emitByte(jit, 0x58 + (reg & 7));
+}
+
+static void emitLoadImmediate(struct Jit *jit, int reg, long int value) {
+  if (fitsInt32(value)) {
+    emitRegister(jit, 1, 0xc7, 0, reg);
+    emitInt32(jit, value);
+  } else {
+    emitRex(jit, 1, 0, 0, reg);
+    emitByte(jit, 0xb8 + (reg & 7));
+    emitInt64(jit, (unsigned long int)value);
+  }
+}
+
+static void emitJumpTo(struct Jit *jit, int opcode, long int target) {
+  emitOpcode(jit, opcode);
+  jit->patches[jit->numberOfPatches].offset = jit->length;
+  jit->patches[jit->numberOfPatches].target = target;
+  ++jit->numberOfPatches;
+  emitInt32(jit, 0);
+}
+
+static long int slotOffset(long int slot) { return slot * (long int)sizeof(long int); }
+
+static void loadOperand(struct Jit *jit, int reg, struct Operand *operand) {
+  if (operand->kind == OPERAND_VARIABLE) {
+    int host = jit->hostRegister[operand->value];
+
+    if (host == NO_REGISTER) {
+      emitMemory(jit, 1, 0x8b, reg, FRAME_BASE, NO_REGISTER,
+                 slotOffset(operand->value));
+    } else if (host != reg) {
+      emitRegister(jit, 1, 0x8b, reg, host);
+    }
+  } else {
+    emitLoadImmediate(jit, reg, operandValue(operand));
+  }
+}
+
+static void storeOperand(struct Jit *jit, int reg, struct Operand *operand) {
+  long int slot = operand->value;
+  int host = jit->hostRegister[slot];
+
+  if (host == NO_REGISTER) {
+    emitMemory(jit, 1, 0x89, reg, FRAME_BASE, NO_REGISTER, slotOffset(slot));
+  } else if (host != reg) {
+    emitRegister(jit, 1, 0x8b, host, reg);
+  }
+
+  if (jit->checked[slot]) {
+    emitMemory(jit, 0, 0xc6, 0, FRAME_BASE, NO_REGISTER,
+               jit->flagsOffset + slot);
+    emitByte(jit, 1);
+  }
+}
+
+/*
+ * <op> reg, operand. opcode is the "r64, r/m64" form and digit selects the
+ * operation in the "r/m64, imm32" group.
+ */
+static void emitArithmetic(struct Jit *jit, int opcode, int digit, int reg,
+                           struct Operand *operand) {
+  if (operand->kind == OPERAND_VARIABLE) {
+    int host = jit->hostRegister[operand->value];
+
+    if (host == NO_REGISTER) {
+      emitMemory(jit, 1, opcode, reg, FRAME_BASE, NO_REGISTER,
+                 slotOffset(operand->value));
+    } else {
+      emitRegister(jit, 1, opcode, reg, host);
+    }
+  } else if (fitsInt32(operandValue(operand))) {
+    emitRegister(jit, 1, 0x81, digit, reg);
+    emitInt32(jit, operandValue(operand));
+  } else {
+    emitLoadImmediate(jit, RCX, operandValue(operand));
+    emitRegister(jit, 1, opcode, reg, RCX);
+  }
+}
+
+/*
+ * Sets up [MEMORY_BASE + *index * 8 + *disp] as the address of
+ * memory[operand], using RCX for an index that is not a small constant.
+ */
+static void memoryAddress(struct Jit *jit, struct Operand *operand,
+                          int *index, long int *disp) {
+  if (operand->kind != OPERAND_VARIABLE &&
+      operandValue(operand) >= -(1L << 27) &&
+      operandValue(operand) < (1L << 27)) {
+    *index = NO_REGISTER;
+    *disp = slotOffset(operandValue(operand));
+  } else {
+    loadOperand(jit, RCX, operand);
+    *index = RCX;
+    *disp = 0;
+  }
+}
+
+/*
+ * Calls a C helper with up to three arguments taken from RAX, RDX and RCX; the
+ * result is left in RAX. Variables held in caller-saved registers are parked
+ * in the frame for the duration of the call.
+ */
+static void emitCall(struct Jit *jit, unsigned long int function,
+                     int numberOfArguments) {
+  int r;
+
+  for (r = NUMBER_OF_CALLEE_SAVED; r < jit->usedRegisters; r++) {
+    emitMemory(jit, 1, 0x89, variableRegisters[r], FRAME_BASE, NO_REGISTER,
+               slotOffset(jit->registerSlot[r]));
+  }
+  if (numberOfArguments > 0) {
+    emitRegister(jit, 1, 0x8b, RDI, RAX);
+  }
+  if (numberOfArguments > 1) {
+    emitRegister(jit, 1, 0x8b, RSI, RDX);
+  }
+  if (numberOfArguments > 2) {
+    emitRegister(jit, 1, 0x8b, RDX, RCX);
+  }
+  emitLoadImmediate(jit, RAX, (long int)function);
+  emitRegister(jit, 0, 0xff, 2, RAX);
+  for (r = NUMBER_OF_CALLEE_SAVED; r < jit->usedRegisters; r++) {
+    emitMemory(jit, 1, 0x8b, variableRegisters[r], FRAME_BASE, NO_REGISTER,
+               slotOffset(jit->registerSlot[r]));
+  }
+}
+
+static void emitDefinedCheck(struct Jit *jit, long int i,
+                             struct Operand *operand) {
+  long int slot = operand->value;
+
+  if (operand->kind != OPERAND_VARIABLE ||
+      isDefinedBefore(jit->definedBefore, jit->numberOfVariables, i, slot)) {
+    return;
+  }
+
+  emitMemory(jit, 0, 0x80, 7, FRAME_BASE, NO_REGISTER, jit->flagsOffset + slot);
+  emitByte(jit, 0);
+  emitOpcode(jit, 0x0f84);
+  jit->stubs[jit->numberOfStubs].offset = jit->length;
+  jit->stubs[jit->numberOfStubs].slot = slot;
+  ++jit->numberOfStubs;
+  emitInt32(jit, 0);
+}
+
+/* jumps to the instruction whose index is in RAX, or halts when it is out of range */
+static void emitIndirectJump(struct Jit *jit, unsigned long int table) {
+  emitRegister(jit, 1, 0x81, 7, RAX);
+  emitInt32(jit, jit->totalInstructions);
+  emitJumpTo(jit, 0x0f83, jit->totalInstructions);
+  emitLoadImmediate(jit, RCX, (long int)table);
+  emitMemory(jit, 0, 0xff, 4, RCX, RAX, 0);
+}
+
+/*
+ * RDX = operand / divisor->divisor, computed from the multiplier like
+ * divideByConstant() in the interpreter does. The operand is left in RCX.
+ */
+static void emitDivideByConstant(struct Jit *jit, struct Operand *operand,
+                                 struct Divisor const *divisor) {
+  loadOperand(jit, RCX, operand);
+  emitLoadImmediate(jit, RAX, divisor->magic);
+  emitRegister(jit, 1, 0xf7, 5, RCX);
+  if (divisor->divisor > 0 && divisor->magic < 0) {
+    emitRegister(jit, 1, 0x03, RDX, RCX);
+  } else if (divisor->divisor < 0 && divisor->magic > 0) {
+    emitRegister(jit, 1, 0x2b, RDX, RCX);
+  }
+  if (divisor->shift > 0) {
+    emitRegister(jit, 1, 0xc1, 7, RDX);
+    emitByte(jit, divisor->shift);
+  }
+  emitRegister(jit, 1, 0x8b, RAX, RDX);
+  emitRegister(jit, 1, 0xc1, 5, RAX);
+  emitByte(jit, 63);
+  emitRegister(jit, 1, 0x03, RDX, RAX);
+}
+
+static int conditionCode(enum Opcode opcode) {
+  switch (opcode) {
+  case OP_BEQ:
+    return 0x84;
+  case OP_BNEQ:
+    return 0x85;
+  case OP_BLT:
+    return 0x8c;
+  case OP_BGT:
+    return 0x8f;
+  case OP_BLE:
+    return 0x8e;
+  default:
+    return 0x8d;
+  }
+}
+
+static void compileInstruction(struct Jit *jit, long int i,
+                               unsigned long int table) {
+  struct Instruction *instruction = &jit->instructions[i];
+  struct Operand *operands = instruction->operands;
+  int order[MAX_OPERANDS];
+  int count = readOperands(instruction->opcode, order);
+  int index;
+  long int disp;
+  long int target;
+  int j;
+
+  jit->nativeOffsets[i] = jit->length;
+  for (j = 0; j < count; j++) {
+    emitDefinedCheck(jit, i, &operands[order[j]]);
+  }
+
+  switch (instruction->opcode) {
+  case OP_ADD:
+    loadOperand(jit, RAX, &operands[1]);
+    emitArithmetic(jit, 0x03, 0, RAX, &operands[2]);
+    storeOperand(jit, RAX, &operands[0]);
+    break;
+  case OP_SUB:
+    loadOperand(jit, RAX, &operands[1]);
+    emitArithmetic(jit, 0x2b, 5, RAX, &operands[2]);
+    storeOperand(jit, RAX, &operands[0]);
+    break;
+  case OP_AND:
+    loadOperand(jit, RAX, &operands[1]);
+    emitArithmetic(jit, 0x23, 4, RAX, &operands[2]);
+    storeOperand(jit, RAX, &operands[0]);
+    break;
+  case OP_OR:
+    loadOperand(jit, RAX, &operands[1]);
+    emitArithmetic(jit, 0x0b, 1, RAX, &operands[2]);
+    storeOperand(jit, RAX, &operands[0]);
+    break;
+  case OP_XOR:
+    loadOperand(jit, RAX, &operands[1]);
+    emitArithmetic(jit, 0x33, 6, RAX, &operands[2]);
+    storeOperand(jit, RAX, &operands[0]);
+    break;
+  case OP_MULT:
+    loadOperand(jit, RAX, &operands[1]);
+    if (operands[2].kind != OPERAND_VARIABLE &&
+        fitsInt32(operandValue(&operands[2]))) {
+      emitRegister(jit, 1, 0x69, RAX, RAX);
+      emitInt32(jit, operandValue(&operands[2]));
+    } else {
+      loadOperand(jit, RCX, &operands[2]);
+      emitRegister(jit, 1, 0x0faf, RAX, RCX);
+    }
+    storeOperand(jit, RAX, &operands[0]);
+    break;
+  case OP_DIV:
+  case OP_MOD:
+    /* idiv traps on a zero divisor exactly like the interpreter's / does */
+    loadOperand(jit, RAX, &operands[1]);
+    loadOperand(jit, RCX, &operands[2]);
+    emitByte(jit, 0x48);
+    emitByte(jit, 0x99);
+    emitRegister(jit, 1, 0xf7, 7, RCX);
+    storeOperand(jit, instruction->opcode == OP_DIV ? RAX : RDX, &operands[0]);
+    break;
+  case OP_NOT:
+    loadOperand(jit, RAX, &operands[1]);
+    emitRegister(jit, 1, 0xf7, 2, RAX);
+    storeOperand(jit, RAX, &operands[0]);
+    break;
+  case OP_SL:
+  case OP_SR:
+    loadOperand(jit, RAX, &operands[1]);
+    if (operands[2].kind != OPERAND_VARIABLE) {
+      emitRegister(jit, 1, 0xc1, instruction->opcode == OP_SL ? 4 : 7, RAX);
+      emitByte(jit, (int)(operandValue(&operands[2]) & 0xff));
+    } else {
+      loadOperand(jit, RCX, &operands[2]);
+      emitRegister(jit, 1, 0xd3, instruction->opcode == OP_SL ? 4 : 7, RAX);
+    }
+    storeOperand(jit, RAX, &operands[0]);
+    break;
+  case OP_LW:
+    memoryAddress(jit, &operands[1], &index, &disp);
+    emitMemory(jit, 1, 0x8b, RAX, MEMORY_BASE, index, disp);
+    storeOperand(jit, RAX, &operands[0]);
+    break;
+  case OP_SW:
+    loadOperand(jit, RAX, &operands[0]);
+    memoryAddress(jit, &operands[1], &index, &disp);
+    emitMemory(jit, 1, 0x89, RAX, MEMORY_BASE, index, disp);
+    break;
+  case OP_REF:
+    memoryAddress(jit, &operands[1], &index, &disp);
+    emitMemory(jit, 1, 0x8d, RAX, MEMORY_BASE, index, disp);
+    storeOperand(jit, RAX, &operands[0]);
+    break;
+  case OP_DEREF:
+    loadOperand(jit, RAX, &operands[1]);
+    loadOperand(jit, RDX, &operands[2]);
+    emitCall(jit, (unsigned long int)jitDeref, 2);
+    storeOperand(jit, RAX, &operands[0]);
+    break;
+  case OP_PRINT:
+    loadOperand(jit, RAX, &operands[0]);
+    emitCall(jit, (unsigned long int)jitPrint, 1);
+    break;
+  case OP_SCAN:
+    emitCall(jit, (unsigned long int)jitScan, 0);
+    storeOperand(jit, RAX, &operands[0]);
+    break;
+  case OP_EXIT:
+    loadOperand(jit, RAX, &operands[0]);
+    emitCall(jit, (unsigned long int)jitExit, 1);
+    break;
+  case OP_MMAP:
+  case OP_MMAPW:
+    loadOperand(jit, RAX, &operands[1]);
+    loadOperand(jit, RDX, &operands[2]);
+    emitCall(jit,
+             instruction->opcode == OP_MMAP ? (unsigned long int)jitMmap
+                                            : (unsigned long int)jitMmapw,
+             2);
+    storeOperand(jit, RAX, &operands[0]);
+    break;
+  case OP_MUNMAP:
+    loadOperand(jit, RAX, &operands[0]);
+    loadOperand(jit, RDX, &operands[1]);
+    emitCall(jit, (unsigned long int)unmapFile, 2);
+    break;
+  case OP_MADVISE:
+    loadOperand(jit, RAX, &operands[0]);
+    loadOperand(jit, RDX, &operands[1]);
+    loadOperand(jit, RCX, &operands[2]);
+    emitCall(jit, (unsigned long int)adviseMemory, 3);
+    break;
+  case OP_MCOPY:
+  case OP_MFILL:
+  case OP_MCMP:
+  case OP_MFIND:
+    loadOperand(jit, RAX, &operands[0]);
+    loadOperand(jit, RDX, &operands[1]);
+    loadOperand(jit, RCX, &operands[2]);
+    emitCall(jit, blockHelper(instruction->opcode), 3);
+    if (writesDestination(instruction->opcode)) {
+      storeOperand(jit, RAX, &operands[0]);
+    }
+    break;
+  case OP_VLEN:
+    loadOperand(jit, RAX, &operands[0]);
+    emitCall(jit, blockHelper(instruction->opcode), 1);
+    break;
+  case OP_VADD:
+  case OP_VSUB:
+  case OP_VMULT:
+  case OP_VAND:
+  case OP_VOR:
+  case OP_VXOR:
+  case OP_VSCALE:
+    loadOperand(jit, RAX, &operands[0]);
+    loadOperand(jit, RDX, &operands[1]);
+    loadOperand(jit, RCX, &operands[2]);
+    emitCall(jit, blockHelper(instruction->opcode), 3);
+    break;
+  case OP_VSUM:
+  case OP_VMIN:
+  case OP_VMAX:
+  case OP_VDOT:
+    loadOperand(jit, RAX, &operands[1]);
+    if (instruction->opcode == OP_VDOT) {
+      loadOperand(jit, RDX, &operands[2]);
+    }
+    emitCall(jit, blockHelper(instruction->opcode),
+             instruction->opcode == OP_VDOT ? 2 : 1);
+    storeOperand(jit, RAX, &operands[0]);
+    break;
+  case OP_NOP:
+    break;
+  case OP_DIVIDE_BY_CONSTANT:
+    emitDivideByConstant(jit, &operands[1], operandDivisor(&operands[2]));
+    storeOperand(jit, RDX, &operands[0]);
+    break;
+  case OP_MODULO_BY_CONSTANT:
+    /* the remainder is operand - quotient * divisor */
+    emitDivideByConstant(jit, &operands[1], operandDivisor(&operands[2]));
+    emitLoadImmediate(jit, RAX, operandDivisor(&operands[2])->divisor);
+    emitRegister(jit, 1, 0x0faf, RDX, RAX);
+    emitRegister(jit, 1, 0x2b, RCX, RDX);
+    storeOperand(jit, RCX, &operands[0]);
+    break;
+  case OP_JMP:
+    target = directTarget(&operands[0], jit->totalInstructions);
+    if (target >= 0) {
+      emitJumpTo(jit, 0xe9, target);
+    } else {
+      loadOperand(jit, RAX, &operands[0]);
+      emitIndirectJump(jit, table);
+    }
+    break;
+  default: {
+    /* the six conditional branches */
+    int condition = conditionCode(instruction->opcode);
+
+    loadOperand(jit, RAX, &operands[0]);
+    emitArithmetic(jit, 0x3b, 7, RAX, &operands[1]);
+    target = directTarget(&operands[2], jit->totalInstructions);
+    if (target >= 0) {
+      emitJumpTo(jit, 0x0f00 | condition, target);
+    } else {
+      size_t skip;
+
+      emitOpcode(jit, 0x0f00 | (condition ^ 1));
+      skip = jit->length;
+      emitInt32(jit, 0);
+      loadOperand(jit, RAX, &operands[2]);
+      emitIndirectJump(jit, table);
+      patchInt32(jit, skip, (long int)(jit->length - (skip + 4)));
+    }
+    break;
+  }
+  }
+}
+
+static void compileProgram(struct Jit *jit, void **table) {
+  static int const saved[] = {RBX, RBP, R12, R13, R14, R15};
+  long int i;
+  size_t s;
+  int r;
+
+  for (r = 0; r < 6; r++) {
+    emitPush(jit, saved[r]);
+  }
+  /* six pushes leave the stack 8 bytes off the alignment calls need */
+  emitRegister(jit, 1, 0x83, 5, RSP);
+  emitByte(jit, 8);
+  /* the memory and the frame of the run are the arguments */
+  emitRegister(jit, 1, 0x8b, MEMORY_BASE, RDI);
+  emitRegister(jit, 1, 0x8b, FRAME_BASE, RSI);
+
+  for (i = 0; i < jit->totalInstructions; i++) {
+    compileInstruction(jit, i, (unsigned long int)table);
+  }
+
+  jit->nativeOffsets[jit->totalInstructions] = jit->length;
+  emitRegister(jit, 1, 0x83, 0, RSP);
+  emitByte(jit, 8);
+  for (r = 5; r >= 0; r--) {
+    emitPop(jit, saved[r]);
+  }
+  emitByte(jit, 0xc3);
+
+  for (s = 0; s < jit->numberOfStubs; s++) {
+    patchInt32(jit, jit->stubs[s].offset,
+               (long int)(jit->length - (jit->stubs[s].offset + 4)));
+    emitLoadImmediate(jit, RAX, (long int)jit->variables[jit->stubs[s].slot].name);
+    emitCall(jit, (unsigned long int)jitUndefined, 1);
+  }
+
+  for (s = 0; s < jit->numberOfPatches; s++) {
+    patchInt32(jit, jit->patches[s].offset,
+               (long int)jit->nativeOffsets[jit->patches[s].target] -
+                   (long int)(jit->patches[s].offset + 4));
+  }
+
+  for (i = 0; i <= jit->totalInstructions; i++) {
+    table[i] = jit->code + jit->nativeOffsets[i];
+  }
+}
+
+struct JitCode {
+  void *code;
+  size_t capacity;
+  void **table;
+  int numberOfVariables;
+};
+
+struct JitCode *jitCompile(struct Instruction *instructions,
+                           long int totalInstructions,
+                           struct Variable *variables, int numberOfVariables) {
+  struct Jit jit;
+  struct ControlFlowGraph graph;
+  struct JitCode *compiled = NULL;
+  void **table;
+  void *code;
+  long int i;
+
+  memset(&jit, 0, sizeof(jit));
+  jit.instructions = instructions;
+  jit.totalInstructions = totalInstructions;
+  jit.variables = variables;
+  jit.numberOfVariables = numberOfVariables;
+
+  if (!isSupported(&jit)) {
+    return NULL;
+  }
+
+  jit.hostRegister = malloc((numberOfVariables + 1) * sizeof(int));
+  jit.checked = calloc(numberOfVariables + 1, 1);
+  jit.flagsOffset = slotOffset(numberOfVariables);
+  jit.nativeOffsets = malloc((totalInstructions + 1) * sizeof(size_t));
+  jit.patches = malloc((2 * totalInstructions + 1) * sizeof(struct Patch));
+  jit.stubs = malloc((MAX_OPERANDS * totalInstructions + 1) * sizeof(struct Stub));
+  table = malloc((totalInstructions + 1) * sizeof(void *));
+
+  buildControlFlowGraph(&graph, instructions, totalInstructions);
+  jit.definedBefore = analyseDefinedVariables(&graph, instructions,
+                                              totalInstructions,
+                                              numberOfVariables);
+  freeControlFlowGraph(&graph);
+  for (i = 0; i < totalInstructions; i++) {
+    int order[MAX_OPERANDS];
+    int count = readOperands(instructions[i].opcode, order);
+    int j;
+
+    for (j = 0; j < count; j++) {
+      struct Operand *operand = &instructions[i].operands[order[j]];
+
+      if (operand->kind == OPERAND_VARIABLE &&
+          !isDefinedBefore(jit.definedBefore, numberOfVariables, i,
+                           operand->value)) {
+        jit.checked[operand->value] = 1;
+      }
+    }
+  }
+  allocateRegisters(&jit);
+
+  jit.capacity = 4096 + 320 * (size_t)totalInstructions;
+  code = mmap(NULL, jit.capacity, PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (code != MAP_FAILED) {
+    jit.code = code;
+    compileProgram(&jit, table);
+
+    if (!jit.overflow &&
+        mprotect(code, jit.capacity, PROT_READ | PROT_EXEC) == 0 &&
+        (compiled = malloc(sizeof(struct JitCode))) != NULL) {
+      compiled->code = code;
+      compiled->capacity = jit.capacity;
+      compiled->table = table;
+      compiled->numberOfVariables = numberOfVariables;
+    } else {
+      munmap(code, jit.capacity);
+    }
+  }
+
+  free(jit.hostRegister);
+  free(jit.checked);
+  free(jit.nativeOffsets);
+  free(jit.definedBefore);
+  free(jit.patches);
+  free(jit.stubs);
+  if (compiled == NULL) {
+    free(table);
+  }
+  return compiled;
+}
+
+/* runs the code in a frame of its own, with handler catching how it stops */
+static void runCode(struct JitCode const *compiled, void **memory,
+                    struct ErrorHandler *handler) {
+  long int *frame =
+      calloc(compiled->numberOfVariables + 1, sizeof(long int) + 1);
+  void (*function)(void **memory, long int *frame);
+
+  if (frame == NULL) {
+    fail("Cannot make room for %d variables", compiled->numberOfVariables);
+  }
+  memcpy(&function, &compiled->code, sizeof(function));
+  /* the program may stop inside a helper, and the frame has to go */
+  if (setjmp(handler->jump) == 0) {
+    pushErrorHandler(handler);
+    function(memory, frame);
+    popErrorHandler(handler);
+  }
+  free(frame);
+}
+
+void jitRun(struct JitCode const *compiled, void **memory) {
+  struct ErrorHandler handler;
+
+  runCode(compiled, memory, &handler);
+  if (handler.stop != 0) {
+    passStop(&handler);
+  }
+}
+
+void jitFree(struct JitCode *compiled) {
+  if (compiled == NULL) {
+    return;
+  }
+  munmap(compiled->code, compiled->capacity);
+  free(compiled->table);
+  free(compiled);
+}
+
+int jitExecute(struct Instruction *instructions, long int totalInstructions,
+               void **memory, struct Variable *variables,
+               int numberOfVariables) {
+  struct JitCode *compiled =
+      jitCompile(instructions, totalInstructions, variables, numberOfVariables);
+  struct ErrorHandler handler;
+
+  if (compiled == NULL) {
+    return -1;
+  }
+  runCode(compiled, memory, &handler);
+  jitFree(compiled);
+  if (handler.stop != 0) {
+    passStop(&handler);
+  }
+  return 0;
+}
+
+#else
+
+struct JitCode *jitCompile(struct Instruction *instructions,
+                           long int totalInstructions,
+                           struct Variable *variables, int numberOfVariables) {
+  (void)instructions;
+  (void)totalInstructions;
+  (void)variables;
+  (void)numberOfVariables;
+  return NULL;
+}
+
+void jitRun(struct JitCode const *compiled, void **memory) {
+  (void)compiled;
+  (void)memory;
+}
+
+void jitFree(struct JitCode *compiled) { (void)compiled; }
+
+int jitExecute(struct Instruction *instructions, long int totalInstructions,
+               void **memory, struct Variable *variables,
+               int numberOfVariables) {
+  (void)instructions;
+  (void)totalInstructions;
+  (void)memory;
+  (void)variables;
+  (void)numberOfVariables;
+  return -1;
+}
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef JIT_H_
+#define JIT_H_
+
+#include "bytecode.h"
+
+/* a program compiled to machine code, which any number of runs can share */
+struct JitCode;
+
+/*
+ * Compiles the program to x86-64 machine code, or returns NULL when the
+ * program (or the host) is not supported so that the caller can interpret
+ * it instead. The code keeps pointers to the variables.
+ */
+struct JitCode *jitCompile(struct Instruction *instructions,
+                           long int totalInstructions,
+                           struct Variable *variables, int numberOfVariables);
+
+/*
+ * Runs compiled on memory, with every variable unset, until it halts or
+ * exits. Runs on several threads at once each need memory of their own.
+ */
+void jitRun(struct JitCode const *compiled, void **memory);
+
+void jitFree(struct JitCode *compiled);
+
+/*
+ * Compiles the program to x86-64 machine code and runs it once. Returns -1,
+ * before executing anything, when the program (or the host) is not
+ * supported so that the caller can interpret it instead. Otherwise the
+ * program runs until it halts or exits and 0 is returned.
+ */
+int jitExecute(struct Instruction *instructions, long int totalInstructions,
+               void **memory, struct Variable *variables,
+               int numberOfVariables);
+
+#endif /* !JIT_H_ */
@@ -1,81 +1,220 @@
+#define _DEFAULT_SOURCE
+
 #include "lexer.h"
 
-#include <complex.h>
+#include "error.h"
+
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
-ssize_t readchar(int fd, char *pc) { return read(fd, pc, 1); }
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_AVX2
+#endif
+
+#define READ_BLOCK_SIZE 65536
 
-int readline(int fd, char *line, size_t max) {
-  char c;
+/* the bytes whose separators are found at once, one bit each */
+#define WINDOW_SIZE ((int)(sizeof(unsigned long) * CHAR_BIT))
 
-  if (max == 0) {
-    return -1;
-  }
+/* a source is split among threads only in chunks at least this large */
+#define MIN_CHUNK_SIZE (1 << 20)
 
-  if (readchar(fd, &c) == 0) {
-    return 1;
+#ifdef __GNUC__
+#define countTrailingZeros(mask) __builtin_ctzl(mask)
+#else
+static int countTrailingZeros(unsigned long mask) {
+  int count = 0;
+
+  while (!(mask & 1)) {
+    mask >>= 1;
+    count++;
   }
+  return count;
+}
+#endif
 
-  if (c == '\n') {
-    *line = '\0';
-    return 0;
+/* in enum Opcode order, so that a match's index is its opcode */
+static char const opcodes[][8] = {
+    "add",  "sub",   "lw",     "sw",      "mult", "div",   "beq",  "bneq",
+    "mod",  "xor",   "or",     "and",     "not",  "sl",    "sr",   "blt",
+    "bgt",  "ble",   "bge",    "jmp",     "ref",  "deref", "print", "scan",
+    "exit", "mmap",  "mmapw",  "munmap",  "madvise", "mcopy", "mfill", "mcmp",
+    "mfind", "vlen", "vadd",  "vsub",    "vmult",   "vand", "vor",   "vxor",
+    "vscale", "vsum", "vmin", "vmax",    "vdot", "spawn", "join", "cas",
+    "fadd", "xchg", "fence", "pfor", "pend", "chan", "send", "recv",
+    "trysend", "tryrecv", "close", "call", "ret"};
+
+#define MIN_OPCODE_LENGTH 2
+#define MAX_OPCODE_LENGTH 7
+
+/*
+ * The opcodes hashed on their first, second and last characters and their
+ * length into a table that stays less than a quarter full, each in the first
+ * free slot from its hash on. A word is an opcode when it equals one of the
+ * opcodes from its slot up to the next free slot, which is rarely more than
+ * one. word is at least two characters long, the terminator included.
+ */
+#define OPCODE_HASH_SIZE 256
+#define OPCODE_HASH(word, length)                                              \
+  (((unsigned char)(word)[0] + (unsigned char)(word)[1] +                      \
+    7 * (unsigned char)(word)[(length)-1] + (length)) %                        \
+   OPCODE_HASH_SIZE)
+
+static signed char opcodeHash[OPCODE_HASH_SIZE];
+
+/* the characters that end a word, the terminator after the source included */
+static char separator[UCHAR_MAX + 1];
+
+/* bit i is set when window[i] is a separator; i counts up to length */
+static unsigned long scalarSeparatorMask(char const *window, int length) {
+  unsigned long mask = 0;
+  int i;
+
+  for (i = WINDOW_SIZE - 1; i >= length; i--) {
+    mask = mask << 1 | 1;
   }
+  for (; i >= 0; i--) {
+    mask = mask << 1 | separator[(unsigned char)window[i]];
+  }
+  return mask;
+}
 
-  *line = c;
-  return readline(fd, line + 1, max - 1);
+static unsigned long fullSeparatorMask(char const *window) {
+  return scalarSeparatorMask(window, WINDOW_SIZE);
 }
 
-char *getword(char *line, char *word, size_t max) {
-  size_t i = 0;
+#ifdef __SSE2__
+static unsigned long sse2SeparatorMask(char const *window) {
+  unsigned long mask = 0;
+  int i;
 
-  while ((i < max) && (*line != ' ') && (*line != '\0')) {
-    *word = *line;
-    word++;
-    line++;
-    i++;
-  }
+  for (i = 0; i < WINDOW_SIZE; i += 16) {
+    __m128i bytes = _mm_loadu_si128((__m128i const *)(window + i));
+    __m128i found = _mm_cmpeq_epi8(bytes, _mm_set1_epi8(' '));
 
-  while (*line == ' ') {
-    line++;
+    found = _mm_or_si128(found, _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n')));
+    found = _mm_or_si128(found, _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\t')));
+    found = _mm_or_si128(found, _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\r')));
+    found = _mm_or_si128(found, _mm_cmpeq_epi8(bytes, _mm_setzero_si128()));
+    mask |= (unsigned long)(unsigned int)_mm_movemask_epi8(found) << i;
   }
+  return mask;
+}
+#endif
+
+#ifdef HAVE_AVX2
+__attribute__((target("avx2"))) static unsigned long
+avx2SeparatorMask(char const *window) {
+  unsigned long mask = 0;
+  int i;
 
-  *word = '\0';
-  return line;
+  for (i = 0; i < WINDOW_SIZE; i += 32) {
+    __m256i bytes = _mm256_loadu_si256((__m256i const *)(window + i));
+    __m256i found = _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' '));
+
+    found =
+        _mm256_or_si256(found, _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\n')));
+    found =
+        _mm256_or_si256(found, _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\t')));
+    found =
+        _mm256_or_si256(found, _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\r')));
+    found = _mm256_or_si256(found,
+                            _mm256_cmpeq_epi8(bytes, _mm256_setzero_si256()));
+    mask |= (unsigned long)(unsigned int)_mm256_movemask_epi8(found) << i;
+  }
+  return mask;
 }
+#endif
 
-enum TokenType toktype(char const *word) {
-  static char const opcodes[][8] = {
-      "add", "sub", "lw",  "sw",    "mult",  "div",  "beq", "bneq", "mod",
-      "xor", "or",  "and", "not",   "sl",    "sr",   "blt", "bgt",  "ble",
-      "bge", "jmp", "ref", "deref", "print", "scan", "exit"};
-  static int const n = sizeof(opcodes) / sizeof(opcodes[0]);
+/* the separators of WINDOW_SIZE bytes, found with the widest vectors there are */
+static unsigned long (*separatorMask)(char const *window) = fullSeparatorMask;
+
+static pthread_once_t tablesBuilt = PTHREAD_ONCE_INIT;
+
+/* the source getTokens() loaded last */
+static char *loadedSource;
+
+static void buildTables(void) {
   int i;
 
-  for (i = 0; i < n; i++) {
-    if (strcmp(word, opcodes[i]) == 0) {
-      return OPCODE;
+  memset(opcodeHash, -1, sizeof(opcodeHash));
+  for (i = 0; i < (int)(sizeof(opcodes) / sizeof(opcodes[0])); i++) {
+    int slot = OPCODE_HASH(opcodes[i], strlen(opcodes[i]));
+
+    while (opcodeHash[slot] >= 0) {
+      slot = (slot + 1) % OPCODE_HASH_SIZE;
     }
+    opcodeHash[slot] = (signed char)i;
   }
-
-  if (*word == '@') {
-    return LABEL;
+  separator['\0'] = 1;
+  separator[' '] = 1;
+  separator['\t'] = 1;
+  separator['\r'] = 1;
+  separator['\n'] = 1;
+#ifdef __SSE2__
+  separatorMask = sse2SeparatorMask;
+#endif
+#ifdef HAVE_AVX2
+  if (WINDOW_SIZE % 32 == 0 && __builtin_cpu_supports("avx2")) {
+    separatorMask = avx2SeparatorMask;
   }
+#endif
+}
+
+static int lookupOpcode(char const *word, size_t length) {
+  int slot;
 
-  if (('0' <= *word && *word <= '9') || *word == '-' || *word == '\'') {
-    return IMMEDIATE;
+  if (length < MIN_OPCODE_LENGTH || length > MAX_OPCODE_LENGTH) {
+    return -1;
   }
+  for (slot = OPCODE_HASH(word, length); opcodeHash[slot] >= 0;
+       slot = (slot + 1) % OPCODE_HASH_SIZE) {
+    if (memcmp(word, opcodes[(int)opcodeHash[slot]], length + 1) == 0) {
+      return opcodeHash[slot];
+    }
+  }
+  return -1;
+}
+
+/* what strtol(word, NULL, 10) returns for a word of digits after an optional - */
+static long int parseDecimal(char const *word) {
+  int negative = *word == '-';
+  unsigned long int limit =
+      negative ? (unsigned long int)LONG_MAX + 1 : (unsigned long int)LONG_MAX;
+  unsigned long int magnitude = 0;
+  char const *c;
 
-  return VARIABLE;
+  for (c = word + negative; '0' <= *c && *c <= '9'; c++) {
+    unsigned int digit = *c - '0';
+
+    if (magnitude > (limit - digit) / 10) {
+      magnitude = limit;
+      break;
+    }
+    magnitude = magnitude * 10 + digit;
+  }
+  if (negative && magnitude > 0) {
+    return -(long int)(magnitude - 1) - 1;
+  }
+  return (long int)magnitude;
 }
 
-int getImmVal(char *word) {
+static long int getImmVal(char *word) {
   if (('0' <= *word && *word <= '9') || *word == '-') {
-    return atoi(word);
+    return parseDecimal(word);
   }
   if (word[0] == '\'' && word[1] != '\\') {
     return word[1] - '\0';
@@ -103,51 +242,308 @@ int getImmVal(char *word) {
   return word[2];
 }
 
-int getTokens(int fd, struct LexToken *tokens) {
-  int n = 0;
-  char line[128];
-  while (!readline(fd, line, sizeof(line))) {
-    char word[16];
-    char *l = line;
+static void classify(struct LexToken *token, size_t length) {
+  char *word = token->tokstr;
+  int opcode = lookupOpcode(word, length);
+
+  if (opcode >= 0) {
+    token->type = OPCODE;
+    token->tokint = opcode;
+  } else if (*word == '@') {
+    token->type = LABEL;
+  } else if (('0' <= *word && *word <= '9') || *word == '-' || *word == '\'') {
+    token->type = IMMEDIATE;
+    token->tokint = getImmVal(word);
+  } else {
+    token->type = VARIABLE;
+  }
+}
+
+/*
+ * The whole source, followed by a zero byte that the last word stops at. A
+ * regular file is mapped privately, so writing the terminators never reaches
+ * the file, and the rest of its last page reads as zeros; anything else, and
+ * a file that ends exactly on a page boundary, is read a block at a time.
+ */
+static char *loadSource(int fd, size_t *pSize) {
+  struct stat status;
+  char *source;
+  size_t size = 0;
+  size_t capacity = READ_BLOCK_SIZE;
+  ssize_t count;
+
+  if (fstat(fd, &status) == 0 && S_ISREG(status.st_mode) &&
+      status.st_size > 0 && status.st_size % sysconf(_SC_PAGESIZE) != 0) {
+    source = mmap(NULL, status.st_size + 1, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE, fd, 0);
+    if (source != MAP_FAILED) {
+      *pSize = status.st_size;
+      return source;
+    }
+  }
 
-    while (*l != '\0') {
-      enum TokenType type;
-      l = getword(l, word, sizeof(word));
+  source = malloc(capacity + 1);
+  while ((count = read(fd, source + size, capacity - size)) > 0) {
+    size += count;
+    if (size == capacity) {
+      capacity *= 2;
+      source = realloc(source, capacity + 1);
+    }
+  }
+  source[size] = '\0';
+  *pSize = size;
+  return source;
+}
 
+struct TokenVector {
+  struct LexToken *tokens;
+  int count;
+  int capacity;
+};
+
+static void appendToken(struct TokenVector *vector, char *word, size_t length) {
+  if (vector->count == vector->capacity) {
+    vector->capacity = vector->capacity == 0 ? 1024 : 2 * vector->capacity;
+    vector->tokens =
+        realloc(vector->tokens, vector->capacity * sizeof(struct LexToken));
+    if (vector->tokens == NULL) {
+      fail("Out of memory");
+    }
+  }
+  vector->tokens[vector->count].tokstr = word;
+  classify(&vector->tokens[vector->count], length);
+  vector->count++;
+}
+
+/*
+ * Tokenizes [begin, end), which starts at the beginning of a line and ends
+ * just after a line end or at the terminator after the source. The separators
+ * of a window of WINDOW_SIZE bytes are found at once, as a bit mask, and the
+ * words between them are picked out of the mask; only a word running past
+ * the window and the last few bytes of the range are scanned a byte at a
+ * time. Nothing outside the range is read or written besides the terminator.
+ */
+static void tokenizeRange(char *begin, char *end, struct TokenVector *vector) {
+  char *c = begin;
+
+  while (c < end) {
+    char *window = c;
+    unsigned long separators;
+    unsigned long words;
+    int length = WINDOW_SIZE;
+
+    if (end - window >= WINDOW_SIZE) {
+      separators = separatorMask(window);
+    } else {
+      length = end - window;
+      separators = scalarSeparatorMask(window, length);
+    }
+    c = window + length;
+
+    /* the words start, one after the other, at the clear bits of the mask */
+    words = ~separators;
+    while (words != 0) {
+      int first = countTrailingZeros(words);
+      unsigned long after = separators & (~0UL << first);
+      char *word = window + first;
+      char *stop;
+
+      /* a comment runs from a word starting with ; to the end of its line */
       if (*word == ';') {
+        stop = memchr(word, '\n', end - word);
+        c = stop != NULL ? stop : end;
         break;
       }
 
-      type = toktype(word);
+      if (after != 0) {
+        stop = window + countTrailingZeros(after);
+      } else {
+        for (stop = window + length; !separator[(unsigned char)*stop];) {
+          stop++;
+        }
+      }
+      *stop = '\0';
+      appendToken(vector, word, stop - word);
+
+      if (stop - window >= length - 1) {
+        c = stop + 1;
+        break;
+      }
+      words &= ~0UL << (stop - window + 1);
+    }
+  }
+}
+
+struct Chunk {
+  char *begin;
+  char *end;
+  struct TokenVector vector;
+  pthread_t thread;
+};
+
+static void *tokenizeChunk(void *argument) {
+  struct Chunk *chunk = argument;
+
+  tokenizeRange(chunk->begin, chunk->end, &chunk->vector);
+  return NULL;
+}
+
+/* the number of chunks a source of size bytes is worth splitting into */
+static int countChunks(size_t size, int threads) {
+  if (threads <= 0) {
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+
+    threads = processors > 0 ? processors : 1;
+  }
+  if ((size_t)threads > size / MIN_CHUNK_SIZE) {
+    threads = size / MIN_CHUNK_SIZE;
+  }
+  return threads > 1 ? threads : 1;
+}
+
+struct LexToken *getTokens(int fd, int threads, int *pTotalTokens) {
+  size_t size;
+
+  loadedSource = loadSource(fd, &size);
+  return tokenizeSource(loadedSource, size, threads, pTotalTokens);
+}
+
+struct LexToken *tokenizeSource(char *source, size_t size, int threads,
+                                int *pTotalTokens) {
+  char *end = source + size;
+  int numberOfChunks = countChunks(size, threads);
+  struct Chunk *chunks;
+  struct LexToken *tokens;
+  int totalTokens;
+  int i;
+
+  pthread_once(&tablesBuilt, buildTables);
 
-      tokens[n].type = type;
+  if (numberOfChunks == 1) {
+    struct TokenVector vector = {NULL, 0, 0};
 
-      strcpy(tokens[n].token.tokstr, word);
-      if (type == IMMEDIATE) {
-        tokens[n].token.tokint = getImmVal(word);
+    tokenizeRange(source, end, &vector);
+    *pTotalTokens = vector.count;
+    return vector.tokens != NULL ? vector.tokens : malloc(1);
+  }
+
+  /*
+   * Lines are independent of each other, so the source is cut just after
+   * line ends into chunks that are tokenized side by side. The chunks' tokens
+   * are then put back together in source order, which keeps every label at
+   * the instruction it labels.
+   */
+  chunks = calloc(numberOfChunks, sizeof(struct Chunk));
+  for (i = 0; i < numberOfChunks; i++) {
+    char *cut = source + size / numberOfChunks * (i + 1);
+
+    chunks[i].begin = i == 0 ? source : chunks[i - 1].end;
+    if (i == numberOfChunks - 1) {
+      cut = end;
+    } else {
+      if (cut < chunks[i].begin) {
+        cut = chunks[i].begin;
       }
-      n++;
+      cut = memchr(cut, '\n', end - cut);
+      cut = cut != NULL ? cut + 1 : end;
     }
+    chunks[i].end = cut;
   }
-  return n;
+  for (i = 1; i < numberOfChunks; i++) {
+    if (pthread_create(&chunks[i].thread, NULL, tokenizeChunk, &chunks[i]) !=
+        0) {
+      /* without a thread of its own, a chunk is tokenized when joining */
+      chunks[i].thread = pthread_self();
+    }
+  }
+  tokenizeRange(chunks[0].begin, chunks[0].end, &chunks[0].vector);
+
+  totalTokens = chunks[0].vector.count;
+  for (i = 1; i < numberOfChunks; i++) {
+    if (pthread_equal(chunks[i].thread, pthread_self())) {
+      tokenizeRange(chunks[i].begin, chunks[i].end, &chunks[i].vector);
+    } else {
+      pthread_join(chunks[i].thread, NULL);
+    }
+    totalTokens += chunks[i].vector.count;
+  }
+
+  tokens = realloc(chunks[0].vector.tokens,
+                   (totalTokens + 1) * sizeof(struct LexToken));
+  if (tokens == NULL) {
+    fail("Out of memory");
+  }
+  totalTokens = chunks[0].vector.count;
+  for (i = 1; i < numberOfChunks; i++) {
+    if (chunks[i].vector.count > 0) {
+      memcpy(tokens + totalTokens, chunks[i].vector.tokens,
+             chunks[i].vector.count * sizeof(struct LexToken));
+    }
+    totalTokens += chunks[i].vector.count;
+    free(chunks[i].vector.tokens);
+  }
+  free(chunks);
+
+  *pTotalTokens = totalTokens;
+  return tokens;
 }
 
+long int sourceOffset(char const *tokstr) { return tokstr - loadedSource; }
+
 #ifdef LEXER_MAIN
-int main(void) {
-  int fd = open("test.broas", O_RDONLY);
-  struct LexToken tokens[1024] = {0};
-  int n = getTokens(fd, tokens);
-  int i = 0;
+/*
+ * lexer [file] lists the tokens of file (test.broas by default);
+ * lexer file runs [threads] tokenizes file runs times over and reports the
+ * rate, or lists its tokens when runs is 0. threads is passed to getTokens.
+ */
+int main(int argc, char **argv) {
+  char const *path = argc > 1 ? argv[1] : "test.broas";
+  int runs = argc > 2 ? atoi(argv[2]) : 0;
+  int threads = argc > 3 ? atoi(argv[3]) : 0;
+  int fd = open(path, O_RDONLY);
+  struct LexToken *tokens;
+  int n;
+  int i;
+
+  if (fd < 0) {
+    perror(path);
+    return 1;
+  }
+
+  if (runs > 0) {
+    struct stat status;
+    struct timespec start;
+    struct timespec stop;
+    double seconds;
+
+    /* tokenizing writes into the source, so every run loads it afresh */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < runs; i++) {
+      lseek(fd, 0, SEEK_SET);
+      tokens = getTokens(fd, threads, &n);
+      free(tokens);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    seconds = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+    fstat(fd, &status);
+    printf("%d tokens, %.3f ms per run, %.1f MB/s, %.1f million tokens/s\n",
+           n, seconds * 1000 / runs,
+           (double)status.st_size * runs / seconds / 1e6,
+           (double)n * runs / seconds / 1e6);
+    close(fd);
+    return 0;
+  }
 
+  tokens = getTokens(fd, threads, &n);
   for (i = 0; i < n; i++) {
     if (tokens[i].type == IMMEDIATE) {
-      printf("<IMMEDIATE, %d>\n", tokens[i].token.tokint);
+      printf("<IMMEDIATE, %ld>\n", tokens[i].tokint);
     } else if (tokens[i].type == LABEL) {
-      printf("<LABEL, %s>\n", tokens[i].token.tokstr);
+      printf("<LABEL, %s>\n", tokens[i].tokstr);
     } else if (tokens[i].type == VARIABLE) {
-      printf("<VARIABLE, %s>\n", tokens[i].token.tokstr);
+      printf("<VARIABLE, %s>\n", tokens[i].tokstr);
     } else if (tokens[i].type == OPCODE) {
-      printf("<OPCODE, %s>\n", tokens[i].token.tokstr);
+      printf("<OPCODE, %s>\n", tokens[i].tokstr);
     } else {
       puts("<UNKNOWN>");
     }
@@ -1,18 +1,39 @@
 #ifndef LEXER_H_
 #define LEXER_H_
 
-#define MX_TOK_SZ 32
+#include <stddef.h>
 
 enum TokenType { LABEL, OPCODE, VARIABLE, IMMEDIATE };
 
 struct LexToken {
   enum TokenType type;
-  union {
-    long int tokint;
-    char tokstr[MX_TOK_SZ];
-  } token;
+  /* the word as written, terminated in place in the source buffer */
+  char *tokstr;
+  /* the value of an IMMEDIATE, the opcode number (enum Opcode) of an OPCODE */
+  long int tokint;
 };
 
-int getTokens(int fd, struct LexToken *tokens);
+/*
+ * Splits the source read from fd into tokens. The source is mapped (or read)
+ * into memory once and tokenized in place, so every tokstr points into it
+ * and stays valid for the rest of the process. A source of several megabytes
+ * is cut at line ends into chunks that are tokenized on up to threads
+ * threads, 0 meaning one per online processor. Returns a malloc'd array of
+ * *pTotalTokens tokens, in source order.
+ */
+struct LexToken *getTokens(int fd, int threads, int *pTotalTokens);
+
+/*
+ * Splits size bytes of source, followed by a zero byte, into tokens as
+ * getTokens() does, in place, so that every tokstr points into source.
+ */
+struct LexToken *tokenizeSource(char *source, size_t size, int threads,
+                                int *pTotalTokens);
+
+/*
+ * The byte offset at which a token of the last getTokens() call started in
+ * its source, for relating instructions back to the lines they came from.
+ */
+long int sourceOffset(char const *tokstr);
 
 #endif /* !LEXER_H_ */
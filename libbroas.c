@@ -0,0 +1,319 @@
+#define _DEFAULT_SOURCE
+
+#include "libbroas.h"
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "bytecode.h"
+#include "channel.h"
+#include "error.h"
+#include "fusion.h"
+#include "interpreter.h"
+#include "inline.h"
+#include "io.h"
+#include "jit.h"
+#include "lexer.h"
+#include "loop.h"
+#include "memory.h"
+#include "optimize.h"
+#include "thread.h"
+#include "vector.h"
+
+/* built with -fvisibility=hidden, so that only these leave libbroas.so */
+#define EXPORT __attribute__((visibility("default")))
+
+/*
+ * Everything is written while compiling and only read afterwards. The names
+ * of the variables and of undefined labels point into source.
+ */
+struct BroasProgram {
+  char *source;
+  struct Arena arena;
+  struct ConstantPool *pool;
+  struct Instruction *instructions;
+  long int totalInstructions;
+  struct Variable *variables;
+  int numberOfVariables;
+  int flags;
+
+  /* the instructions fused for the interpreter, apart from them for the JIT */
+  struct Instruction *fused;
+
+  /* with BROAS_JIT, unless the JIT cannot compile the program */
+  struct JitCode *jit;
+};
+
+struct BroasContext {
+  struct BroasProgram const *program;
+  void **memory;
+  size_t memoryWords;
+  long int *registers;
+  char *defined;
+  struct Io *io;
+  long int instructionLimit;
+  long int callDepth;
+
+  /* the program as it runs, its threads included */
+  struct Machine machine;
+};
+
+static __thread char lastError[ERROR_MESSAGE_SIZE];
+
+static pthread_once_t initialized = PTHREAD_ONCE_INIT;
+
+static void initialize(void) { initializeVectors(NULL); }
+
+/* message is a handler's, or shorter */
+static int report(int status, char const *message) {
+  strcpy(lastError, message);
+  return status;
+}
+
+EXPORT int broasCompile(char const *source, size_t length, int flags,
+                        struct BroasProgram **pProgram) {
+  struct BroasProgram *program = calloc(1, sizeof(struct BroasProgram));
+  struct LexToken *volatile tokens = NULL;
+  struct ConstantPool *previousPool;
+  struct ErrorHandler handler;
+  int totalTokens;
+
+  *pProgram = NULL;
+  pthread_once(&initialized, initialize);
+  if (program == NULL || (program->source = malloc(length + 1)) == NULL ||
+      (program->pool = createPool()) == NULL) {
+    broasDestroyProgram(program);
+    return report(BROAS_ERROR, "Out of memory");
+  }
+  memcpy(program->source, source, length);
+  program->source[length] = '\0';
+  initializeArena(&program->arena);
+  program->flags = flags;
+
+  previousPool = usePool(program->pool);
+  if (setjmp(handler.jump) == 0) {
+    pushErrorHandler(&handler);
+    /* on this thread, where fail() can get back here from */
+    tokens = tokenizeSource(program->source, length, 1, &totalTokens);
+    program->totalInstructions = compileTokens(
+        tokens, totalTokens, &program->arena, &program->instructions,
+        &program->variables, &program->numberOfVariables);
+    free(tokens);
+    tokens = NULL;
+
+    if (flags & BROAS_OPTIMIZE) {
+      long int maxInstructions = 2 * program->totalInstructions + 1;
+
+      program->totalInstructions = inlineCalls(
+          program->instructions, program->totalInstructions, maxInstructions);
+      optimizeInstructions(program->instructions, program->totalInstructions,
+                           program->numberOfVariables);
+      program->totalInstructions =
+          optimizeLoops(program->instructions, program->totalInstructions,
+                        maxInstructions, program->numberOfVariables);
+    }
+    program->fused = program->instructions;
+    if (flags & BROAS_JIT) {
+      program->fused = allocateFromArena(
+          &program->arena,
+          (program->totalInstructions + 1) * sizeof(struct Instruction));
+      memcpy(program->fused, program->instructions,
+             (program->totalInstructions + 1) * sizeof(struct Instruction));
+      program->jit =
+          jitCompile(program->instructions, program->totalInstructions,
+                     program->variables, program->numberOfVariables);
+    }
+    fuseInstructions(program->fused, program->totalInstructions, NULL);
+    popErrorHandler(&handler);
+  }
+  usePool(previousPool);
+
+  if (handler.stop != 0) {
+    free(tokens);
+    broasDestroyProgram(program);
+    return report(BROAS_COMPILE_ERROR, handler.message);
+  }
+  *pProgram = program;
+  return BROAS_OK;
+}
+
+EXPORT void broasDestroyProgram(struct BroasProgram *program) {
+  if (program == NULL) {
+    return;
+  }
+  jitFree(program->jit);
+  freeArena(&program->arena);
+  if (program->pool != NULL) {
+    destroyPool(program->pool);
+  }
+  free(program->source);
+  free(program);
+}
+
+/* maps the memory of context, which fails without a handler of its own */
+static int mapContextMemory(struct BroasContext *context) {
+  struct ErrorHandler handler;
+
+  if (setjmp(handler.jump) == 0) {
+    pushErrorHandler(&handler);
+    context->memory = mapMemory(context->memoryWords, 1);
+    popErrorHandler(&handler);
+  }
+  return handler.stop == 0 ? BROAS_OK : report(BROAS_ERROR, handler.message);
+}
+
+EXPORT int broasCreateContext(struct BroasProgram const *program,
+                              size_t memoryBytes, struct BroasIo const *io,
+                              struct BroasContext **pContext) {
+  struct BroasContext *context = calloc(1, sizeof(struct BroasContext));
+
+  *pContext = NULL;
+  if (context == NULL) {
+    return report(BROAS_ERROR, "Out of memory");
+  }
+  context->program = program;
+  context->memoryWords =
+      memoryBytes > 0 ? memoryBytes / sizeof(void *) : DEFAULT_MEMORY_WORDS;
+  context->registers =
+      calloc(program->numberOfVariables + 1, sizeof(long int));
+  context->defined = calloc(program->numberOfVariables + 1, 1);
+  context->io = io != NULL ? createIo(io->write, io->read, io->data)
+                           : createIo(NULL, NULL, NULL);
+  if (context->registers == NULL || context->defined == NULL ||
+      context->io == NULL) {
+    broasDestroyContext(context);
+    return report(BROAS_ERROR, "Out of memory");
+  }
+  if (mapContextMemory(context) != BROAS_OK) {
+    broasDestroyContext(context);
+    return BROAS_ERROR;
+  }
+  *pContext = context;
+  return BROAS_OK;
+}
+
+EXPORT void broasSetInstructionLimit(struct BroasContext *context,
+                                     long int limit) {
+  context->instructionLimit = limit;
+}
+
+EXPORT void broasSetCallDepth(struct BroasContext *context, long int depth) {
+  context->callDepth = depth;
+}
+
+EXPORT int broasRun(struct BroasContext *context, int argc, char **argv,
+                    long int *pExitCode) {
+  struct BroasProgram const *program = context->program;
+  struct Machine *machine = &context->machine;
+  struct ErrorHandler handler;
+  struct ConstantPool *previousPool;
+  struct Io *previousIo;
+  int i;
+
+  if (pExitCode != NULL) {
+    *pExitCode = 0;
+  }
+  if (context->memory == NULL) {
+    return report(BROAS_ERROR, "No memory to run in");
+  }
+  /* the argument count, the arguments and the size of memory come first */
+  if (argc < 0 || (size_t)argc + 2 > context->memoryWords) {
+    return report(BROAS_ERROR, "Memory too small for the arguments");
+  }
+  context->memory[0] = (void *)(long int)argc;
+  for (i = 0; i < argc; i++) {
+    context->memory[i + 1] = argv[i];
+  }
+  context->memory[argc + 1] = (void *)(long int)context->memoryWords;
+
+  machine->instructions = program->fused;
+  machine->totalInstructions = program->totalInstructions;
+  machine->variables = program->variables;
+  machine->numberOfVariables = program->numberOfVariables;
+  machine->memory = context->memory;
+  machine->memoryWords = context->memoryWords;
+  machine->hugePages = 1;
+  machine->pool = program->pool;
+  machine->io = context->io;
+  machine->countInstructions = 0;
+  machine->instructionLimit =
+      context->instructionLimit > 0 ? context->instructionLimit : LONG_MAX;
+  machine->threads = NULL;
+  machine->channels = NULL;
+  machine->callDepth =
+      context->callDepth > 0 ? context->callDepth : DEFAULT_CALL_DEPTH;
+  machine->returns = NULL;
+  machine->returnCapacity = 0;
+
+  previousPool = usePool(program->pool);
+  previousIo = useIo(context->io);
+  useMemory(context->memory, context->memoryWords);
+  setVectorLength(0);
+  if (setjmp(handler.jump) == 0) {
+    pushErrorHandler(&handler);
+    if (program->jit != NULL && context->instructionLimit <= 0) {
+      jitRun(program->jit, context->memory);
+    } else {
+      execute(machine, 0, context->registers, context->defined);
+    }
+    popErrorHandler(&handler);
+  }
+  /* however the run ended, nothing it started may outlive it */
+  if (handler.stop != 0 && handler.stop != STOP_EXIT) {
+    closeChannels(machine);
+  }
+  finishThreads(machine);
+  finishChannels(machine);
+  free(machine->returns);
+  flushOutput();
+  useIo(previousIo);
+  usePool(previousPool);
+
+  switch (handler.stop) {
+  case STOP_EXIT:
+    if (pExitCode != NULL) {
+      *pExitCode = handler.exitCode;
+    }
+    return BROAS_OK;
+  case STOP_ERROR:
+    return report(BROAS_RUNTIME_ERROR, handler.message);
+  case STOP_LIMIT:
+    return report(BROAS_INSTRUCTION_LIMIT, handler.message);
+  default:
+    return BROAS_OK;
+  }
+}
+
+EXPORT int broasResetContext(struct BroasContext *context) {
+  int numberOfVariables = context->program->numberOfVariables;
+
+  memset(context->registers, 0, (numberOfVariables + 1) * sizeof(long int));
+  memset(context->defined, 0, numberOfVariables + 1);
+  resetIo(context->io);
+  /* mapped afresh, as files mapped into it have to go too */
+  if (context->memory != NULL) {
+    unmapMemory(context->memory, context->memoryWords, 1);
+    context->memory = NULL;
+  }
+  return mapContextMemory(context);
+}
+
+EXPORT void broasDestroyContext(struct BroasContext *context) {
+  if (context == NULL) {
+    return;
+  }
+  if (context->memory != NULL) {
+    unmapMemory(context->memory, context->memoryWords, 1);
+  }
+  if (context->io != NULL) {
+    destroyIo(context->io);
+  }
+  free(context->registers);
+  free(context->defined);
+  free(context);
+}
+
+EXPORT char const *broasError(void) { return lastError; }
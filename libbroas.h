@@ -0,0 +1,108 @@
+#ifndef LIBBROAS_H_
+#define LIBBROAS_H_
+
+#include <stddef.h>
+
+/*
+ * broas as a library (make lib builds libbroas.a and libbroas.so). A program
+ * is compiled once, from source in memory, and only read from afterwards, so
+ * it can run in any number of contexts at the same time, on any threads. A
+ * context holds all that a run changes: the program's memory, its variables
+ * and its I/O. It runs on one thread at a time, and the same context can run
+ * the program again and again.
+ *
+ * Nothing here exits the process or writes to stderr. The functions that
+ * can fail return a BroasStatus, and broasError() describes the last failure
+ * on the calling thread. Like broas itself, a program can still crash the
+ * process with lw or sw outside of its memory, or by dividing by zero.
+ */
+enum BroasStatus {
+  BROAS_OK,
+  BROAS_COMPILE_ERROR,     /* the source does not compile */
+  BROAS_RUNTIME_ERROR,     /* the program failed, as broas would report */
+  BROAS_INSTRUCTION_LIMIT, /* the program ran past its instruction limit */
+  BROAS_ERROR              /* out of memory, or too many arguments */
+};
+
+/* for broasCompile() */
+#define BROAS_OPTIMIZE 1 /* as -O */
+#define BROAS_JIT 2      /* as --jit, compiled once, for runs without a limit */
+
+struct BroasProgram;
+struct BroasContext;
+
+/*
+ * Compiles length bytes of source into *pProgram, with the BROAS_ flags
+ * above. Programs can be compiled on several threads at the same time.
+ */
+int broasCompile(char const *source, size_t length, int flags,
+                 struct BroasProgram **pProgram);
+
+/* once all of the program's contexts are destroyed */
+void broasDestroyProgram(struct BroasProgram *program);
+
+/*
+ * Where print and scan go. write is given the output a bufferful at a time,
+ * when the buffer fills up and when a run ends, and returns the number of
+ * bytes written, or -1 when they cannot be written and are dropped. read
+ * fills buffer with up to capacity bytes of input and returns their number,
+ * or 0 at the end of the input. data is passed to both. A function left
+ * NULL writes to standard output or reads from standard input.
+ */
+struct BroasIo {
+  long int (*write)(void *data, char const *bytes, long int length);
+  long int (*read)(void *data, char *buffer, long int capacity);
+  void *data;
+};
+
+/*
+ * Creates a context for program in *pContext, with memoryBytes of memory
+ * (as --mem, 0 meaning 8 MB) and io, or the standard input and output when
+ * io is NULL. The memory is mapped, and only takes space as it is used.
+ */
+int broasCreateContext(struct BroasProgram const *program, size_t memoryBytes,
+                       struct BroasIo const *io,
+                       struct BroasContext **pContext);
+
+/*
+ * Stops the runs of context with BROAS_INSTRUCTION_LIMIT once they run more
+ * than limit instructions, or lets them run on when limit is 0, as they do
+ * at first. Every thread of the program has a limit of its own. The limit
+ * is checked on the branches a program takes, so it may run a straight
+ * stretch of instructions past it, and runs with a limit are interpreted
+ * rather than compiled by BROAS_JIT.
+ */
+void broasSetInstructionLimit(struct BroasContext *context, long int limit);
+
+/*
+ * Lets call nest depth deep in the runs of context before it fails, as
+ * --call-depth does, or as deep as broas lets it when depth is 0, as at
+ * first. Every thread of the program has a return stack of its own.
+ */
+void broasSetCallDepth(struct BroasContext *context, long int depth);
+
+/*
+ * Runs the program in context with the argc arguments of argv, which it
+ * finds in memory as broas passes the arguments after the file name, until
+ * it halts or exits. *pExitCode, unless pExitCode is NULL, is set to the
+ * code it exited with, or 0 when it halted. The run returns once every
+ * thread the program spawned has ended; an error in one of them only comes
+ * back from the join of it. Whatever the run ends with, the output it
+ * printed is written. A run starts with the memory and variables the last
+ * one left behind; broasResetContext() clears them.
+ */
+int broasRun(struct BroasContext *context, int argc, char **argv,
+             long int *pExitCode);
+
+/*
+ * Puts context back as it was created: zeroed memory, no variables set, and
+ * no output or input left in its buffers.
+ */
+int broasResetContext(struct BroasContext *context);
+
+void broasDestroyContext(struct BroasContext *context);
+
+/* the message of the last failure on the calling thread */
+char const *broasError(void);
+
+#endif /* !LIBBROAS_H_ */
@@ -0,0 +1,835 @@
+#include "loop.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dataflow.h"
+
+/* every round can move code out of one more level of nesting */
+#define MAX_ROUNDS 8
+
+#define NO_LOOP (-1)
+
+/*
+ * An instruction to add in front of the one that was at index before.
+ * Preheader instructions only run on the way into the loop headed there
+ * from outside of it; the others run on every path to before.
+ */
+struct Insertion {
+  long int before;
+  int preheader;
+  long int sequence;
+  struct Instruction instruction;
+};
+
+struct LoopOptimizer {
+  struct Instruction *instructions;
+  long int totalInstructions;
+  int numberOfVariables;
+  struct ControlFlowGraph graph;
+  unsigned long *defined; /* per instruction */
+  unsigned long *live;    /* per block */
+
+  /* per block */
+  long int *rank;      /* position in reverse postorder, -1 if unreachable */
+  long int *dominator; /* immediate dominator */
+  long int *firstPredecessor;
+  long int *predecessors;
+  char *inLoop;
+  char *claimed; /* part of a loop already changed in this round */
+
+  /* per variable, for the loop being changed */
+  long int *writes;
+  long int *writer;
+  char *invariant; /* only written by code moved into the preheader */
+
+  /* per instruction */
+  char *removed;
+  long int *loopOf; /* header of the changed loop holding it, or NO_LOOP */
+  char *hasPreheader;
+
+  struct Insertion *insertions;
+  long int numberOfInsertions;
+  long int insertionCapacity;
+};
+
+static void rankBlocks(struct LoopOptimizer *optimizer, long int *sorted) {
+  struct ControlFlowGraph *graph = &optimizer->graph;
+  long int *stack = malloc((graph->numberOfBlocks + 1) * sizeof(long int));
+  int *nextSuccessor = calloc(graph->numberOfBlocks + 1, sizeof(int));
+  long int next = graph->numberOfBlocks;
+  long int top = 0;
+  long int b;
+
+  for (b = 0; b < graph->numberOfBlocks; b++) {
+    optimizer->rank[b] = -1;
+  }
+  if (graph->numberOfBlocks > 0) {
+    stack[top++] = 0;
+    optimizer->rank[0] = 0;
+  }
+
+  /* ranks are handed out backwards as blocks are finished */
+  while (top > 0) {
+    struct BasicBlock *block = &graph->blocks[stack[top - 1]];
+
+    if (nextSuccessor[stack[top - 1]] < block->numberOfSuccessors) {
+      long int successor = block->successors[nextSuccessor[stack[top - 1]]++];
+
+      if (optimizer->rank[successor] < 0) {
+        optimizer->rank[successor] = 0;
+        stack[top++] = successor;
+      }
+    } else {
+      optimizer->rank[stack[--top]] = --next;
+    }
+  }
+
+  for (b = 0; b < graph->numberOfBlocks; b++) {
+    if (optimizer->rank[b] >= 0) {
+      optimizer->rank[b] -= next;
+      sorted[optimizer->rank[b]] = b;
+    }
+  }
+  sorted[graph->numberOfBlocks - next] = -1;
+
+  free(stack);
+  free(nextSuccessor);
+}
+
+static void findPredecessors(struct LoopOptimizer *optimizer) {
+  struct ControlFlowGraph *graph = &optimizer->graph;
+  long int *fill = calloc(graph->numberOfBlocks + 1, sizeof(long int));
+  long int b;
+  int s;
+
+  memset(optimizer->firstPredecessor, 0,
+         (graph->numberOfBlocks + 1) * sizeof(long int));
+  for (b = 0; b < graph->numberOfBlocks; b++) {
+    for (s = 0; optimizer->rank[b] >= 0 &&
+                s < graph->blocks[b].numberOfSuccessors;
+         s++) {
+      ++optimizer->firstPredecessor[graph->blocks[b].successors[s] + 1];
+    }
+  }
+  for (b = 0; b < graph->numberOfBlocks; b++) {
+    optimizer->firstPredecessor[b + 1] += optimizer->firstPredecessor[b];
+  }
+  optimizer->predecessors =
+      malloc((optimizer->firstPredecessor[graph->numberOfBlocks] + 1) *
+             sizeof(long int));
+  for (b = 0; b < graph->numberOfBlocks; b++) {
+    for (s = 0; optimizer->rank[b] >= 0 &&
+                s < graph->blocks[b].numberOfSuccessors;
+         s++) {
+      long int successor = graph->blocks[b].successors[s];
+
+      optimizer->predecessors[optimizer->firstPredecessor[successor] +
+                              fill[successor]++] = b;
+    }
+  }
+
+  free(fill);
+}
+
+static long int commonDominator(struct LoopOptimizer *optimizer, long int a,
+                                long int b) {
+  while (a != b) {
+    while (optimizer->rank[a] > optimizer->rank[b]) {
+      a = optimizer->dominator[a];
+    }
+    while (optimizer->rank[b] > optimizer->rank[a]) {
+      b = optimizer->dominator[b];
+    }
+  }
+  return a;
+}
+
+/* Cooper, Harvey and Kennedy, "A Simple, Fast Dominance Algorithm" */
+static void findDominators(struct LoopOptimizer *optimizer, long int *sorted) {
+  int changed = 1;
+  long int b;
+
+  for (b = 0; b < optimizer->graph.numberOfBlocks; b++) {
+    optimizer->dominator[b] = -1;
+  }
+  optimizer->dominator[0] = 0;
+
+  while (changed) {
+    long int k;
+
+    changed = 0;
+    for (k = 1; sorted[k] >= 0; k++) {
+      long int block = sorted[k];
+      long int dominator = -1;
+      long int p;
+
+      for (p = optimizer->firstPredecessor[block];
+           p < optimizer->firstPredecessor[block + 1]; p++) {
+        long int predecessor = optimizer->predecessors[p];
+
+        if (optimizer->dominator[predecessor] >= 0) {
+          dominator = dominator < 0 ? predecessor
+                                    : commonDominator(optimizer, predecessor,
+                                                      dominator);
+        }
+      }
+      if (optimizer->dominator[block] != dominator) {
+        optimizer->dominator[block] = dominator;
+        changed = 1;
+      }
+    }
+  }
+}
+
+/* dominators come earlier in reverse postorder, so the walk up stops there */
+static int dominates(struct LoopOptimizer *optimizer, long int a, long int b) {
+  if (optimizer->rank[b] < 0) {
+    return 0;
+  }
+  while (optimizer->rank[b] > optimizer->rank[a]) {
+    b = optimizer->dominator[b];
+  }
+  return b == a;
+}
+
+/*
+ * Marks the natural loop headed by block header in inLoop and lists its
+ * blocks in body, header first: every block that reaches a back edge into
+ * header without going through it. Returns the number of blocks, which is
+ * 1 when there is no loop or header only branches to itself.
+ */
+static long int collectLoop(struct LoopOptimizer *optimizer, long int header,
+                            long int *body) {
+  long int size = 1;
+  long int k;
+  long int p;
+
+  optimizer->inLoop[header] = 1;
+  body[0] = header;
+  for (p = optimizer->firstPredecessor[header];
+       p < optimizer->firstPredecessor[header + 1]; p++) {
+    long int predecessor = optimizer->predecessors[p];
+
+    if (dominates(optimizer, header, predecessor) &&
+        !optimizer->inLoop[predecessor]) {
+      optimizer->inLoop[predecessor] = 1;
+      body[size++] = predecessor;
+    }
+  }
+  for (k = 1; k < size; k++) {
+    for (p = optimizer->firstPredecessor[body[k]];
+         p < optimizer->firstPredecessor[body[k] + 1]; p++) {
+      long int predecessor = optimizer->predecessors[p];
+
+      if (!optimizer->inLoop[predecessor]) {
+        optimizer->inLoop[predecessor] = 1;
+        body[size++] = predecessor;
+      }
+    }
+  }
+  return size;
+}
+
+static int hasSelfLoop(struct LoopOptimizer *optimizer, long int header) {
+  struct BasicBlock *block = &optimizer->graph.blocks[header];
+  int s;
+
+  for (s = 0; s < block->numberOfSuccessors; s++) {
+    if (block->successors[s] == header) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void insert(struct LoopOptimizer *optimizer, long int before,
+                   int preheader, struct Instruction *instruction) {
+  struct Insertion *insertion;
+
+  if (optimizer->numberOfInsertions == optimizer->insertionCapacity) {
+    optimizer->insertionCapacity = 2 * optimizer->insertionCapacity + 8;
+    optimizer->insertions =
+        realloc(optimizer->insertions,
+                optimizer->insertionCapacity * sizeof(struct Insertion));
+  }
+  insertion = &optimizer->insertions[optimizer->numberOfInsertions];
+  insertion->before = before;
+  insertion->preheader = preheader;
+  insertion->sequence = optimizer->numberOfInsertions++;
+  insertion->instruction = *instruction;
+}
+
+static int isVariable(struct Operand *operand) {
+  return operand->kind == OPERAND_VARIABLE;
+}
+
+static int isConstant(struct Operand *operand) {
+  return operand->kind == OPERAND_IMMEDIATE ||
+         operand->kind == OPERAND_LABEL || operand->kind == OPERAND_CONSTANT;
+}
+
+/* whether the operand has the same, already set, value all through the loop */
+static int isInvariant(struct LoopOptimizer *optimizer, struct Operand *operand,
+                       long int header) {
+  long int slot = operand->value;
+
+  if (isConstant(operand)) {
+    return 1;
+  }
+  return isVariable(operand) &&
+         (optimizer->invariant[slot] ||
+          (optimizer->writes[slot] == 0 &&
+           isDefinedBefore(optimizer->defined, optimizer->numberOfVariables,
+                           header, slot)));
+}
+
+/* whether block runs on every pass that leaves the loop through a branch */
+static int dominatesExits(struct LoopOptimizer *optimizer, long int block,
+                          long int *body, long int size) {
+  long int k;
+
+  for (k = 0; k < size; k++) {
+    struct BasicBlock *exiting = &optimizer->graph.blocks[body[k]];
+    int s;
+
+    for (s = 0; s < exiting->numberOfSuccessors; s++) {
+      if (!optimizer->inLoop[exiting->successors[s]] &&
+          !dominates(optimizer, block, body[k])) {
+        return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+/*
+ * An instruction may run once before the loop instead of on every pass if
+ * it is pure, reads only invariants and is the only write to its
+ * destination in the loop, which nothing in the loop reads before it.
+ * Unless it runs on every way out, the destination must also be dead after
+ * the loop, since the loop may have been left before it ran.
+ */
+static int isHoistable(struct LoopOptimizer *optimizer, long int i,
+                       long int *body, long int size,
+                       unsigned long *liveOnExit) {
+  struct Instruction *instruction = &optimizer->instructions[i];
+  long int header = optimizer->graph.blocks[body[0]].first;
+  long int slot = instruction->operands[0].value;
+  int order[MAX_OPERANDS];
+  int count = readOperands(instruction->opcode, order);
+  int j;
+
+  if (!isPure(instruction) || optimizer->writes[slot] != 1 ||
+      optimizer->invariant[slot] ||
+      HAS_VARIABLE(optimizer->live + body[0] * variableWords(
+                                                   optimizer->numberOfVariables),
+                   slot)) {
+    return 0;
+  }
+  if (HAS_VARIABLE(liveOnExit, slot) &&
+      !dominatesExits(optimizer, optimizer->graph.blockOf[i], body, size)) {
+    return 0;
+  }
+  for (j = 0; j < count; j++) {
+    if (!isInvariant(optimizer, &instruction->operands[order[j]], header)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*
+ * A counter is a variable whose only write in the loop adds a constant to
+ * it. Returns the instruction that does, and the constant in step, or -1.
+ */
+static long int counterStep(struct LoopOptimizer *optimizer, long int slot,
+                            long int *step) {
+  struct Instruction *instruction;
+  struct Operand *operands;
+
+  if (optimizer->writes[slot] != 1 || optimizer->invariant[slot]) {
+    return -1;
+  }
+  instruction = &optimizer->instructions[optimizer->writer[slot]];
+  operands = instruction->operands;
+
+  if (instruction->opcode == OP_ADD && isVariable(&operands[1]) &&
+      operands[1].value == slot && isConstant(&operands[2])) {
+    *step = operandValue(&operands[2]);
+  } else if (instruction->opcode == OP_ADD && isVariable(&operands[2]) &&
+             operands[2].value == slot && isConstant(&operands[1])) {
+    *step = operandValue(&operands[1]);
+  } else if (instruction->opcode == OP_SUB && isVariable(&operands[1]) &&
+             operands[1].value == slot && isConstant(&operands[2])) {
+    *step = (long int)(0UL - (unsigned long int)operandValue(&operands[2]));
+  } else {
+    return -1;
+  }
+  return optimizer->writer[slot];
+}
+
+static int isLiveAfter(struct LoopOptimizer *optimizer, long int i,
+                       long int slot) {
+  long int block = optimizer->graph.blockOf[i];
+  unsigned long *live =
+      malloc(variableWords(optimizer->numberOfVariables) *
+             sizeof(unsigned long));
+  long int j;
+  int result;
+
+  liveAfterBlock(&optimizer->graph, optimizer->live, block,
+                 optimizer->numberOfVariables, live);
+  for (j = optimizer->graph.blocks[block].last; j > i; j--) {
+    transferLive(&optimizer->instructions[j], live);
+  }
+  result = HAS_VARIABLE(live, slot);
+  free(live);
+  return result;
+}
+
+/*
+ * mult t c k, with c a counter and k an invariant, becomes an update of t
+ * right before the counter's increment, once t = c * k has been set up in
+ * the preheader. That keeps t equal to c * k everywhere in the loop, which
+ * only matters where t is read: t must not be read before the mult on a
+ * pass, nor between the increment and the mult.
+ */
+static int reduceMultiplication(struct LoopOptimizer *optimizer, long int i,
+                                long int header, unsigned long *liveAtHeader) {
+  struct Instruction *instruction = &optimizer->instructions[i];
+  struct Operand *operands = instruction->operands;
+  struct Instruction update;
+  struct Operand *factor = NULL;
+  long int slot = operands[0].value;
+  long int counter = -1;
+  long int increment = -1;
+  long int step = 0;
+  int side;
+
+  if (instruction->opcode != OP_MULT || !isVariable(&operands[0])) {
+    return 0;
+  }
+  for (side = 1; side <= 2 && increment < 0; side++) {
+    factor = &operands[3 - side];
+    counter = operands[side].value;
+    if (isVariable(&operands[side]) &&
+        isInvariant(optimizer, factor, header)) {
+      increment = counterStep(optimizer, counter, &step);
+    }
+  }
+  if (increment < 0 || slot == counter ||
+      (isVariable(factor) && factor->value == slot) ||
+      optimizer->writes[slot] != 1 || HAS_VARIABLE(liveAtHeader, slot) ||
+      !isDefinedBefore(optimizer->defined, optimizer->numberOfVariables,
+                       header, counter) ||
+      isLiveAfter(optimizer, increment, slot)) {
+    return 0;
+  }
+
+  update.opcode = OP_ADD;
+  update.operands[0] = operands[0];
+  update.operands[1] = operands[0];
+  update.operands[2] = *factor;
+  if (isConstant(factor)) {
+    setImmediate(&update.operands[2],
+                 (long int)((unsigned long int)step *
+                            (unsigned long int)operandValue(factor)));
+  } else if (step == -1) {
+    update.opcode = OP_SUB;
+  } else if (step != 1) {
+    return 0;
+  }
+
+  insert(optimizer, header, 1, instruction);
+  insert(optimizer, increment, 0, &update);
+  optimizer->removed[i] = 1;
+  return 1;
+}
+
+static int changeLoop(struct LoopOptimizer *optimizer, long int *body,
+                      long int size) {
+  struct ControlFlowGraph *graph = &optimizer->graph;
+  size_t words = variableWords(optimizer->numberOfVariables);
+  unsigned long *liveAtHeader = optimizer->live + body[0] * words;
+  unsigned long *liveOnExit = calloc(words, sizeof(unsigned long));
+  long int header = graph->blocks[body[0]].first;
+  int changed = 0;
+  int progress = 1;
+  long int k;
+  long int i;
+  int v;
+
+  /* a preheader cannot go between the header and a loop block falling into it */
+  if (header > 0 &&
+      optimizer->inLoop[graph->blockOf[header - 1]] &&
+      fallsThrough(optimizer->instructions[header - 1].opcode)) {
+    free(liveOnExit);
+    return 0;
+  }
+
+  for (v = 0; v < optimizer->numberOfVariables; v++) {
+    optimizer->writes[v] = 0;
+    optimizer->invariant[v] = 0;
+  }
+  for (k = 0; k < size; k++) {
+    struct BasicBlock *block = &graph->blocks[body[k]];
+    int s;
+
+    for (i = block->first; i <= block->last; i++) {
+      struct Instruction *instruction = &optimizer->instructions[i];
+
+      if (!optimizer->removed[i] && writesDestination(instruction->opcode) &&
+          isVariable(&instruction->operands[0])) {
+        ++optimizer->writes[instruction->operands[0].value];
+        optimizer->writer[instruction->operands[0].value] = i;
+      }
+    }
+    for (s = 0; s < block->numberOfSuccessors; s++) {
+      if (!optimizer->inLoop[block->successors[s]]) {
+        size_t w;
+        for (w = 0; w < words; w++) {
+          liveOnExit[w] |= optimizer->live[block->successors[s] * words + w];
+        }
+      }
+    }
+  }
+
+  while (progress) {
+    progress = 0;
+    for (k = 0; k < size; k++) {
+      struct BasicBlock *block = &graph->blocks[body[k]];
+
+      for (i = block->first; i <= block->last; i++) {
+        if (!optimizer->removed[i] &&
+            isHoistable(optimizer, i, body, size, liveOnExit)) {
+          insert(optimizer, header, 1, &optimizer->instructions[i]);
+          optimizer->removed[i] = 1;
+          optimizer->invariant[optimizer->instructions[i].operands[0].value] =
+              1;
+          progress = changed = 1;
+        }
+      }
+    }
+  }
+
+  for (k = 0; k < size; k++) {
+    struct BasicBlock *block = &graph->blocks[body[k]];
+
+    for (i = block->first; i <= block->last; i++) {
+      if (!optimizer->removed[i] &&
+          reduceMultiplication(optimizer, i, header, liveAtHeader)) {
+        changed = 1;
+      }
+    }
+  }
+
+  if (changed) {
+    for (k = 0; k < size; k++) {
+      struct BasicBlock *block = &graph->blocks[body[k]];
+
+      optimizer->claimed[body[k]] = 1;
+      for (i = block->first; i <= block->last; i++) {
+        optimizer->loopOf[i] = header;
+      }
+    }
+    optimizer->hasPreheader[header] = 1;
+  }
+
+  free(liveOnExit);
+  return changed;
+}
+
+static int compareInsertions(void const *left, void const *right) {
+  struct Insertion const *a = left;
+  struct Insertion const *b = right;
+
+  if (a->before != b->before) {
+    return a->before < b->before ? -1 : 1;
+  }
+  if (a->preheader != b->preheader) {
+    return b->preheader - a->preheader;
+  }
+  return a->sequence < b->sequence ? -1 : a->sequence > b->sequence;
+}
+
+/*
+ * Lays the program out again without the removed instructions and with the
+ * insertions in place. A jump to a loop header from outside the loop now
+ * goes to its preheader. Returns the new number of instructions, or -1 when
+ * they would not fit.
+ */
+static long int relayout(struct LoopOptimizer *optimizer,
+                         long int maxInstructions) {
+  long int total = optimizer->totalInstructions;
+  long int *outside = malloc((total + 1) * sizeof(long int));
+  long int *inside = malloc((total + 1) * sizeof(long int));
+  struct Instruction *layout;
+  long int *origin;
+  long int newTotal = optimizer->numberOfInsertions;
+  long int s = 0;
+  long int j;
+  long int k;
+
+  for (j = 0; j < total; j++) {
+    newTotal += !optimizer->removed[j];
+  }
+  if (newTotal > maxInstructions) {
+    free(outside);
+    free(inside);
+    return -1;
+  }
+  layout = malloc((newTotal + 1) * sizeof(struct Instruction));
+  origin = malloc((newTotal + 1) * sizeof(long int));
+
+  qsort(optimizer->insertions, optimizer->numberOfInsertions,
+        sizeof(struct Insertion), compareInsertions);
+  newTotal = 0;
+  for (j = 0; j <= total; j++) {
+    outside[j] = newTotal;
+    while (s < optimizer->numberOfInsertions &&
+           optimizer->insertions[s].before == j &&
+           optimizer->insertions[s].preheader) {
+      origin[newTotal] = -1;
+      layout[newTotal++] = optimizer->insertions[s++].instruction;
+    }
+    inside[j] = newTotal;
+    while (s < optimizer->numberOfInsertions &&
+           optimizer->insertions[s].before == j) {
+      origin[newTotal] = -1;
+      layout[newTotal++] = optimizer->insertions[s++].instruction;
+    }
+    if (j < total && !optimizer->removed[j]) {
+      origin[newTotal] = j;
+      layout[newTotal++] = optimizer->instructions[j];
+    }
+  }
+
+  for (k = 0; k < newTotal; k++) {
+    int jump = jumpOperand(&layout[k]);
+    struct Operand *operand;
+    long int target;
+
+    if (origin[k] < 0 || jump < 0) {
+      continue;
+    }
+    operand = &layout[k].operands[jump];
+    target = directTarget(operand, total);
+    if (operand->kind != OPERAND_IMMEDIATE &&
+        operand->kind != OPERAND_LABEL && operand->kind != OPERAND_CONSTANT) {
+      continue;
+    }
+    if (target >= total) {
+      target = newTotal;
+    } else if (optimizer->hasPreheader[target] &&
+               optimizer->loopOf[origin[k]] != target) {
+      target = outside[target];
+    } else {
+      target = inside[target];
+    }
+    if (operand->kind == OPERAND_CONSTANT) {
+      setImmediate(operand, target);
+    } else {
+      operand->value = target;
+    }
+  }
+
+  memcpy(optimizer->instructions, layout,
+         newTotal * sizeof(struct Instruction));
+  optimizer->instructions[newTotal].opcode = OP_HALT;
+
+  free(outside);
+  free(inside);
+  free(layout);
+  free(origin);
+  return newTotal;
+}
+
+/* one round: every loop that does not overlap one changed before it */
+static int changeLoops(struct LoopOptimizer *optimizer) {
+  struct ControlFlowGraph *graph = &optimizer->graph;
+  long int *sorted = malloc((graph->numberOfBlocks + 1) * sizeof(long int));
+  long int *body = malloc((graph->numberOfBlocks + 1) * sizeof(long int));
+  int changed = 0;
+  long int b;
+
+  rankBlocks(optimizer, sorted);
+  findPredecessors(optimizer);
+  findDominators(optimizer, sorted);
+
+  /* later headers first, which in practice puts inner loops first */
+  for (b = graph->numberOfBlocks - 1; b >= 0; b--) {
+    long int size;
+    long int k;
+    int overlaps = 0;
+
+    if (optimizer->rank[b] < 0) {
+      continue;
+    }
+    size = collectLoop(optimizer, b, body);
+    for (k = 0; k < size; k++) {
+      overlaps |= optimizer->claimed[body[k]];
+    }
+    if ((size > 1 || hasSelfLoop(optimizer, b)) && !overlaps) {
+      changed |= changeLoop(optimizer, body, size);
+    }
+    for (k = 0; k < size; k++) {
+      optimizer->inLoop[body[k]] = 0;
+    }
+  }
+
+  free(optimizer->predecessors);
+  free(sorted);
+  free(body);
+  return changed;
+}
+
+/* Hacker's Delight, figure 10-1, for 64-bit words */
+static void findMagic(long int d, struct Divisor *divisor) {
+  unsigned long int const twoPower63 = (unsigned long int)LONG_MAX + 1;
+  unsigned long int ad = d < 0 ? 0UL - (unsigned long int)d : (unsigned long int)d;
+  unsigned long int t = twoPower63 + (d < 0 ? 1 : 0);
+  unsigned long int anc = t - 1 - t % ad;
+  unsigned long int q1 = twoPower63 / anc;
+  unsigned long int r1 = twoPower63 - q1 * anc;
+  unsigned long int q2 = twoPower63 / ad;
+  unsigned long int r2 = twoPower63 - q2 * ad;
+  unsigned long int delta;
+  int p = 63;
+
+  do {
+    ++p;
+    q1 *= 2;
+    r1 *= 2;
+    if (r1 >= anc) {
+      ++q1;
+      r1 -= anc;
+    }
+    q2 *= 2;
+    r2 *= 2;
+    if (r2 >= ad) {
+      ++q2;
+      r2 -= ad;
+    }
+    delta = ad - r2;
+  } while (q1 < delta || (q1 == delta && r1 == 0));
+
+  divisor->divisor = d;
+  divisor->magic = (long int)(d < 0 ? 0UL - (q2 + 1) : q2 + 1);
+  divisor->shift = p - 64;
+}
+
+static void reduceDivisions(struct Instruction *instructions,
+                            long int totalInstructions) {
+  long int i;
+
+  if (sizeof(long int) * CHAR_BIT != 64) {
+    return;
+  }
+  for (i = 0; i < totalInstructions; i++) {
+    struct Operand *operands = instructions[i].operands;
+    long int d = operandValue(&operands[2]);
+    struct Divisor divisor;
+
+    if ((instructions[i].opcode != OP_DIV && instructions[i].opcode != OP_MOD) ||
+        !isConstant(&operands[2]) || d == 0 || d == 1 || d == -1 ||
+        d == LONG_MIN) {
+      continue;
+    }
+    findMagic(d, &divisor);
+    instructions[i].opcode = instructions[i].opcode == OP_DIV
+                                 ? OP_DIVIDE_BY_CONSTANT
+                                 : OP_MODULO_BY_CONSTANT;
+    setDivisor(&operands[2], &divisor);
+  }
+}
+
+long int optimizeLoops(struct Instruction *instructions,
+                       long int totalInstructions, long int maxInstructions,
+                       int numberOfVariables) {
+  struct LoopOptimizer optimizer;
+  int round;
+
+  optimizer.instructions = instructions;
+  optimizer.numberOfVariables = numberOfVariables;
+  optimizer.writes = malloc((numberOfVariables + 1) * sizeof(long int));
+  optimizer.writer = malloc((numberOfVariables + 1) * sizeof(long int));
+  optimizer.invariant = malloc(numberOfVariables + 1);
+
+  for (round = 0; round < MAX_ROUNDS; round++) {
+    struct ControlFlowGraph *graph = &optimizer.graph;
+    long int numberOfBlocks;
+    int indirect = 0;
+    int changed = 0;
+    long int newTotal = totalInstructions;
+    long int i;
+
+    buildControlFlowGraph(graph, instructions, totalInstructions);
+    numberOfBlocks = graph->numberOfBlocks;
+    /* the successors leave out where these go, which dominance needs */
+    for (i = 0; i < numberOfBlocks; i++) {
+      indirect |= graph->blocks[i].indirect || graph->blocks[i].returns;
+    }
+    if (indirect || numberOfBlocks == 0) {
+      freeControlFlowGraph(graph);
+      break;
+    }
+
+    optimizer.totalInstructions = totalInstructions;
+    optimizer.defined = analyseDefinedVariables(graph, instructions,
+                                                totalInstructions,
+                                                numberOfVariables);
+    optimizer.live =
+        analyseLiveVariables(graph, instructions, numberOfVariables);
+    optimizer.rank = malloc(numberOfBlocks * sizeof(long int));
+    optimizer.dominator = malloc(numberOfBlocks * sizeof(long int));
+    optimizer.firstPredecessor =
+        malloc((numberOfBlocks + 1) * sizeof(long int));
+    optimizer.inLoop = calloc(numberOfBlocks, 1);
+    optimizer.claimed = calloc(numberOfBlocks, 1);
+    optimizer.removed = calloc(totalInstructions + 1, 1);
+    optimizer.loopOf = malloc((totalInstructions + 1) * sizeof(long int));
+    optimizer.hasPreheader = calloc(totalInstructions + 1, 1);
+    optimizer.insertions = NULL;
+    optimizer.numberOfInsertions = 0;
+    optimizer.insertionCapacity = 0;
+
+    for (i = 0; i < totalInstructions; i++) {
+      optimizer.loopOf[i] = NO_LOOP;
+      if (instructions[i].opcode == OP_NOP) {
+        optimizer.removed[i] = 1;
+        changed = 1;
+      }
+    }
+    changed |= changeLoops(&optimizer);
+    if (changed) {
+      newTotal = relayout(&optimizer, maxInstructions);
+    }
+
+    free(optimizer.defined);
+    free(optimizer.live);
+    free(optimizer.rank);
+    free(optimizer.dominator);
+    free(optimizer.firstPredecessor);
+    free(optimizer.inLoop);
+    free(optimizer.claimed);
+    free(optimizer.removed);
+    free(optimizer.loopOf);
+    free(optimizer.hasPreheader);
+    free(optimizer.insertions);
+    freeControlFlowGraph(graph);
+
+    if (!changed || newTotal < 0) {
+      break;
+    }
+    totalInstructions = newTotal;
+  }
+
+  free(optimizer.writes);
+  free(optimizer.writer);
+  free(optimizer.invariant);
+
+  reduceDivisions(instructions, totalInstructions);
+  return totalInstructions;
+}
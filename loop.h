@@ -0,0 +1,22 @@
+#ifndef LOOP_H_
+#define LOOP_H_
+
+#include "bytecode.h"
+
+/*
+ * Finds the natural loops of the program and, in place, moves computations
+ * that give the same result on every pass into a preheader that runs once
+ * before the loop, and turns mult of a counter by a loop invariant into an
+ * addition made next to the counter's increment. No-ops are dropped, and div
+ * and mod by an immediate are replaced by a multiply and shifts.
+ *
+ * Instructions move, so branch targets are renumbered; labels used as
+ * values keep the numbers they had. Programs that jump through a variable
+ * or return from a call only get their divisions replaced. Returns the new number of
+ * instructions, which never exceeds maxInstructions.
+ */
+long int optimizeLoops(struct Instruction *instructions,
+                       long int totalInstructions, long int maxInstructions,
+                       int numberOfVariables);
+
+#endif /* !LOOP_H_ */
@@ -3,478 +3,281 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
 
 #include "lexer.h"
-
-#define MAX_TOKENS_IN_FILE 1024
-#define MAX_TOKENS_IN_LINE 5
-#define MAX_INSTRUCTIONS 100
-
-#define MAX_LABELS 100
-
-#define MAX_VARIABLES 100
-
-#define MEMORY_SIZE 1024
-
-struct Label {
-	char *name;
-	long int instructionIndex;
-};
-
-struct Variable {
-	char *name;
-	void *value;
-};
-
-void *getValue(struct LexToken valueToken, struct Variable *variables, int numberOfVariables, struct Label *labels, int numberOfLabels);
-void setValue(struct LexToken *pVariableToken, void *value, struct Variable *variables, int *pNumberOfVariables);
+#include "bytecode.h"
+#include "jit.h"
+#include "fusion.h"
+#include "optimize.h"
+#include "inline.h"
+#include "loop.h"
+#include "io.h"
+#include "memory.h"
+#include "vector.h"
+#include "profile.h"
+#include "cache.h"
+#include "interpreter.h"
+#include "thread.h"
+#include "channel.h"
+#include "parallel.h"
+#include "batch.h"
+#include "libbroas.h"
 
 int main(int argc, char **argv) {
 	int fd;
 
-	struct LexToken instructions[MAX_INSTRUCTIONS][MAX_TOKENS_IN_LINE];
-	struct LexToken tokens[MAX_TOKENS_IN_FILE];
+	struct Arena arena;
+	struct Instruction *instructions;
+	struct LexToken *tokens;
 	int totalTokens;
-	int nextInstruction = 0;
-	int totalInstructions;
-
-	struct Label labels[MAX_LABELS];
-	int nextLabel = 0;
-
-	struct Variable variables[MAX_VARIABLES];
-	int nextVariable = 0;
-
-	void *memory[MEMORY_SIZE];
-
+	long int totalInstructions;
+
+	struct Variable *variables;
+	int numberOfVariables;
+
+	struct Machine machine;
+	long int *registers;
+	char *defined;
+
+	void **memory;
+	size_t memoryWords = DEFAULT_MEMORY_WORDS;
+	int hugePages = 1;
+	char const *vectorKernelName = NULL;
+
+	int useJit = 0;
+	int dumpFused = 0;
+	int optimize = 0;
+	int countInstructions = 0;
+	int profile = 0;
+	char const *profilePath = NULL;
+	long int sampleRate = 0;
+	char const *samplePath = NULL;
+	int useCache = 0;
+	char const *cacheDirectory = NULL;
+	char *cacheFile = NULL;
+	int unbuffered = 0;
+	int lexerThreads = 0;
+	long int callDepth = DEFAULT_CALL_DEPTH;
+	int batch = 0;
+	int jobs = 0;
+	int fileArgument = 1;
 	int i;
 
-	if (argc < 2) {
-		fprintf(stderr, "Wrong usage. Sample usage: broas <broas_code_file> <...arguments>\n");
-		exit(1);
-	}
-
-	fd = open(argv[1], O_RDONLY);
-
-	memory[0] = (void *)((long int)argc - 2);
-	for (i = 0; i < argc - 2; ++i) {
-		memory[i + 1] = argv[i + 2];
-	}
-
-	totalTokens = getTokens(fd, tokens);
-
-	i = 0;
-	while (i < totalTokens) {
-		struct LexToken lexToken = tokens[i++];
-
-		if (lexToken.type == OPCODE) {
-			instructions[nextInstruction][0] = lexToken;
+	while (fileArgument < argc && argv[fileArgument][0] == '-') {
+		if (strcmp(argv[fileArgument], "-O") == 0) {
+			optimize = 1;
+		}
+		else if (strcmp(argv[fileArgument], "--jit") == 0) {
+			useJit = 1;
+		}
+		else if (strcmp(argv[fileArgument], "--dump-fused") == 0) {
+			dumpFused = 1;
+		}
+		else if (strcmp(argv[fileArgument], "--count") == 0) {
+			countInstructions = 1;
+		}
+		else if (strcmp(argv[fileArgument], "--profile") == 0) {
+			profile = 1;
+		}
+		else if (strncmp(argv[fileArgument], "--profile=", 10) == 0) {
+			profile = 1;
+			profilePath = argv[fileArgument] + 10;
+		}
+		else if (strncmp(argv[fileArgument], "--sample-profile=", 17) == 0) {
+			char *end;
 
-			if (strcmp(lexToken.token.tokstr, "add") == 0) {
-				instructions[nextInstruction][1] = tokens[i++];
-				instructions[nextInstruction][2] = tokens[i++];
-				instructions[nextInstruction][3] = tokens[i++];
-			}
-			else if (strcmp(lexToken.token.tokstr, "sub") == 0) {
-				instructions[nextInstruction][1] = tokens[i++];
-				instructions[nextInstruction][2] = tokens[i++];
-				instructions[nextInstruction][3] = tokens[i++];
-			}
-			else if (strcmp(lexToken.token.tokstr, "lw") == 0) {
-				instructions[nextInstruction][1] = tokens[i++];
-				instructions[nextInstruction][2] = tokens[i++];
-			}
-			else if (strcmp(lexToken.token.tokstr, "sw") == 0) {
-				instructions[nextInstruction][1] = tokens[i++];
-				instructions[nextInstruction][2] = tokens[i++];
-			}
-			else if (strcmp(lexToken.token.tokstr, "mult") == 0) {
-				instructions[nextInstruction][1] = tokens[i++];
-				instructions[nextInstruction][2] = tokens[i++];
-				instructions[nextInstruction][3] = tokens[i++];
-			}
-			else if (strcmp(lexToken.token.tokstr, "div") == 0) {
-				instructions[nextInstruction][1] = tokens[i++];
-				instructions[nextInstruction][2] = tokens[i++];
-				instructions[nextInstruction][3] = tokens[i++];
-			}
-			else if (strcmp(lexToken.token.tokstr, "beq") == 0) {
-				instructions[nextInstruction][1] = tokens[i++];
-				instructions[nextInstruction][2] = tokens[i++];
-				instructions[nextInstruction][3] = tokens[i++];
-			}
-			else if (strcmp(lexToken.token.tokstr, "bneq") == 0) {
-				instructions[nextInstruction][1] = tokens[i++];
-				instructions[nextInstruction][2] = tokens[i++];
-				instructions[nextInstruction][3] = tokens[i++];
-			}
-			else if (strcmp(lexToken.token.tokstr, "mod") == 0) {
-				instructions[nextInstruction][1] = tokens[i++];
-				instructions[nextInstruction][2] = tokens[i++];
-				instructions[nextInstruction][3] = tokens[i++];
-			}
-			else if (strcmp(lexToken.token.tokstr, "xor") == 0) {
-				instructions[nextInstruction][1] = tokens[i++];
-				instructions[nextInstruction][2] = tokens[i++];
-				instructions[nextInstruction][3] = tokens[i++];
-			}
-			else if (strcmp(lexToken.token.tokstr, "or") == 0) {
-				instructions[nextInstruction][1] = tokens[i++];
-				instructions[nextInstruction][2] = tokens[i++];
-				instructions[nextInstruction][3] = tokens[i++];
-			}
-			else if (strcmp(lexToken.token.tokstr, "and") == 0) {
-				instructions[nextInstruction][1] = tokens[i++];
-				instructions[nextInstruction][2] = tokens[i++];
-				instructions[nextInstruction][3] = tokens[i++];
-			}
-			else if (strcmp(lexToken.token.tokstr, "not") == 0) {
-				instructions[nextInstruction][1] = tokens[i++];
-				instructions[nextInstruction][2] = tokens[i++];
+			sampleRate = strtol(argv[fileArgument] + 17, &end, 10);
+			if (*end == ',') {
+				samplePath = end + 1;
 			}
-			else if (strcmp(lexToken.token.tokstr, "sl") == 0) {
-				instructions[nextInstruction][1] = tokens[i++];
-				instructions[nextInstruction][2] = tokens[i++];
-				instructions[nextInstruction][3] = tokens[i++];
+			else if (*end != '\0') {
+				sampleRate = 0;
 			}
-			else if (strcmp(lexToken.token.tokstr, "sr") == 0) {
-				instructions[nextInstruction][1] = tokens[i++];
-				instructions[nextInstruction][2] = tokens[i++];
-				instructions[nextInstruction][3] = tokens[i++];
-			}
-			else if (strcmp(lexToken.token.tokstr, "blt") == 0) {
-				instructions[nextInstruction][1] = tokens[i++];
-				instructions[nextInstruction][2] = tokens[i++];
-				instructions[nextInstruction][3] = tokens[i++];
-			}
-			else if (strcmp(lexToken.token.tokstr, "bgt") == 0) {
-				instructions[nextInstruction][1] = tokens[i++];
-				instructions[nextInstruction][2] = tokens[i++];
-				instructions[nextInstruction][3] = tokens[i++];
-			}
-			else if (strcmp(lexToken.token.tokstr, "ble") == 0) {
-				instructions[nextInstruction][1] = tokens[i++];
-				instructions[nextInstruction][2] = tokens[i++];
-				instructions[nextInstruction][3] = tokens[i++];
-			}
-			else if (strcmp(lexToken.token.tokstr, "bge") == 0) {
-				instructions[nextInstruction][1] = tokens[i++];
-				instructions[nextInstruction][2] = tokens[i++];
-				instructions[nextInstruction][3] = tokens[i++];
-			}
-			else if (strcmp(lexToken.token.tokstr, "jmp") == 0) {
-				instructions[nextInstruction][1] = tokens[i++];
-			}
-			else if (strcmp(lexToken.token.tokstr, "ref") == 0) {
-				instructions[nextInstruction][1] = tokens[i++];
-				instructions[nextInstruction][2] = tokens[i++];
-			}
-			else if (strcmp(lexToken.token.tokstr, "deref") == 0) {
-				instructions[nextInstruction][1] = tokens[i++];
-				instructions[nextInstruction][2] = tokens[i++];
-				instructions[nextInstruction][3] = tokens[i++];
-			}
-			else if (strcmp(lexToken.token.tokstr, "print") == 0) {
-				instructions[nextInstruction][1] = tokens[i++];
-			}
-			else if (strcmp(lexToken.token.tokstr, "scan") == 0) {
-				instructions[nextInstruction][1] = tokens[i++];
-			}
-			else if (strcmp(lexToken.token.tokstr, "exit") == 0) {
-				instructions[nextInstruction][1] = tokens[i++];
-			}
-			else {
-				fprintf(stderr, "Unknown operation %s\n", lexToken.token.tokstr);
+			if (sampleRate <= 0) {
+				fprintf(stderr, "Bad sampling rate in %s, expected --sample-profile=HZ[,FILE]\n", argv[fileArgument]);
 				exit(1);
 			}
-
-			++nextInstruction;
-		}
-
-		else if (lexToken.type == LABEL) {
-			labels[nextLabel].name = tokens[i - 1].token.tokstr;
-			labels[nextLabel].instructionIndex = nextInstruction;
-			++nextLabel;
-		}
-
-		else {
-			fprintf(stderr, "Unexpected token %s in place of opcode or label, (encountered at %dth token position)\n", lexToken.token.tokstr, i);
-			exit(1);
 		}
-	}
-
-	totalInstructions = nextInstruction;
-	nextInstruction = 0;
-
-	while (nextInstruction < totalInstructions) {
-		struct LexToken *instruction = instructions[nextInstruction];
-		char *opcode = instruction[0].token.tokstr;
-
-		if (strcmp(opcode, "add") == 0) {
-			long int leftOperand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-			long int rightOperand = (long int)getValue(instruction[3], variables, nextVariable, labels, nextLabel);
-			long int result = leftOperand + rightOperand;
-
-			setValue(&instruction[1], (void *)result, variables, &nextVariable);
-		}
-
-		else if (strcmp(opcode, "sub") == 0) {
-			long int leftOperand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-			long int rightOperand = (long int)getValue(instruction[3], variables, nextVariable, labels, nextLabel);
-			long int result = leftOperand - rightOperand;
-
-			setValue(&instruction[1], (void *)result, variables, &nextVariable);
+		else if (strcmp(argv[fileArgument], "--cache") == 0) {
+			useCache = 1;
 		}
-
-		else if (strcmp(opcode, "lw") == 0) {
-			long int memoryOperand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-
-			setValue(&instruction[1], memory[memoryOperand], variables, &nextVariable);
+		else if (strncmp(argv[fileArgument], "--cache=", 8) == 0) {
+			useCache = 1;
+			cacheDirectory = argv[fileArgument] + 8;
 		}
-
-		else if (strcmp(opcode, "sw") == 0) {
-			void *variableOperand = getValue(instruction[1], variables, nextVariable, labels, nextLabel);
-			long int memoryOperand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-
-			memory[memoryOperand] = variableOperand;
+		else if (strcmp(argv[fileArgument], "--unbuffered") == 0) {
+			unbuffered = 1;
 		}
-
-		else if (strcmp(opcode, "mult") == 0) {
-			long int leftOperand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-			long int rightOperand = (long int)getValue(instruction[3], variables, nextVariable, labels, nextLabel);
-			long int result = leftOperand * rightOperand;
-
-			setValue(&instruction[1], (void *)result, variables, &nextVariable);
+		else if (strncmp(argv[fileArgument], "--lex-threads=", 14) == 0) {
+			lexerThreads = atoi(argv[fileArgument] + 14);
 		}
-
-		else if (strcmp(opcode, "div") == 0) {
-			long int leftOperand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-			long int rightOperand = (long int)getValue(instruction[3], variables, nextVariable, labels, nextLabel);
-			long int result = leftOperand / rightOperand;
-
-			setValue(&instruction[1], (void *)result, variables, &nextVariable);
+		else if (strncmp(argv[fileArgument], "--threads=", 10) == 0) {
+			setParallelThreads(atoi(argv[fileArgument] + 10));
 		}
-
-		else if (strcmp(opcode, "beq") == 0) {
-			long int leftOperand = (long int)getValue(instruction[1], variables, nextVariable, labels, nextLabel);
-			long int rightOperand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-			long int branchAddress = (long int)getValue(instruction[3], variables, nextVariable, labels, nextLabel);
-			
-			if (leftOperand == rightOperand) {
-				nextInstruction = branchAddress;
-				continue;
+		else if (strncmp(argv[fileArgument], "--call-depth=", 13) == 0) {
+			callDepth = atol(argv[fileArgument] + 13);
+			if (callDepth <= 0) {
+				fprintf(stderr, "Bad call depth in %s, expected --call-depth=N\n", argv[fileArgument]);
+				exit(1);
 			}
 		}
-
-		else if (strcmp(opcode, "bneq") == 0) {
-			long int leftOperand = (long int)getValue(instruction[1], variables, nextVariable, labels, nextLabel);
-			long int rightOperand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-			long int branchAddress = (long int)getValue(instruction[3], variables, nextVariable, labels, nextLabel);
-			
-			if (leftOperand != rightOperand) {
-				nextInstruction = branchAddress;
-				continue;
-			}
+		else if (strcmp(argv[fileArgument], "--batch") == 0) {
+			batch = 1;
 		}
-
-		else if (strcmp(opcode, "mod") == 0) {
-			long int leftOperand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-			long int rightOperand = (long int)getValue(instruction[3], variables, nextVariable, labels, nextLabel);
-			long int result = leftOperand % rightOperand;
-
-			setValue(&instruction[1], (void *)result, variables, &nextVariable);
+		else if (strncmp(argv[fileArgument], "--jobs=", 7) == 0) {
+			jobs = atoi(argv[fileArgument] + 7);
 		}
-
-		else if (strcmp(opcode, "xor") == 0) {
-			long int leftOperand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-			long int rightOperand = (long int)getValue(instruction[3], variables, nextVariable, labels, nextLabel);
-			long int result = leftOperand ^ rightOperand;
-
-			setValue(&instruction[1], (void *)result, variables, &nextVariable);
+		else if (strcmp(argv[fileArgument], "--jobs") == 0 && fileArgument + 1 < argc) {
+			jobs = atoi(argv[++fileArgument]);
 		}
-
-		else if (strcmp(opcode, "or") == 0) {
-			long int leftOperand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-			long int rightOperand = (long int)getValue(instruction[3], variables, nextVariable, labels, nextLabel);
-			long int result = leftOperand | rightOperand;
-
-			setValue(&instruction[1], (void *)result, variables, &nextVariable);
+		else if (strncmp(argv[fileArgument], "--mem=", 6) == 0) {
+			memoryWords = parseMemorySize(argv[fileArgument] + 6);
 		}
-
-		else if (strcmp(opcode, "and") == 0) {
-			long int leftOperand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-			long int rightOperand = (long int)getValue(instruction[3], variables, nextVariable, labels, nextLabel);
-			long int result = leftOperand & rightOperand;
-
-			setValue(&instruction[1], (void *)result, variables, &nextVariable);
+		else if (strcmp(argv[fileArgument], "--mem") == 0 && fileArgument + 1 < argc) {
+			memoryWords = parseMemorySize(argv[++fileArgument]);
 		}
-
-		else if (strcmp(opcode, "not") == 0) {
-			long int operand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-			long int result = ~operand;
-
-			setValue(&instruction[1], (void *)result, variables, &nextVariable);
+		else if (strcmp(argv[fileArgument], "--no-huge-pages") == 0) {
+			hugePages = 0;
 		}
-
-		else if (strcmp(opcode, "sl") == 0) {
-			long int leftOperand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-			long int rightOperand = (long int)getValue(instruction[3], variables, nextVariable, labels, nextLabel);
-			long int result = leftOperand << rightOperand;
-
-			setValue(&instruction[1], (void *)result, variables, &nextVariable);
+		else if (strncmp(argv[fileArgument], "--vector=", 9) == 0) {
+			vectorKernelName = argv[fileArgument] + 9;
 		}
-
-		else if (strcmp(opcode, "sr") == 0) {
-			long int leftOperand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-			long int rightOperand = (long int)getValue(instruction[3], variables, nextVariable, labels, nextLabel);
-			long int result = leftOperand >> rightOperand;
-
-			setValue(&instruction[1], (void *)result, variables, &nextVariable);
+		else {
+			fprintf(stderr, "Unknown option %s\n", argv[fileArgument]);
+			exit(1);
 		}
+		++fileArgument;
+	}
 
-		else if (strcmp(opcode, "blt") == 0) {
-			long int leftOperand = (long int)getValue(instruction[1], variables, nextVariable, labels, nextLabel);
-			long int rightOperand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-			long int branchAddress = (long int)getValue(instruction[3], variables, nextVariable, labels, nextLabel);
-			
-			if (leftOperand < rightOperand) {
-				nextInstruction = branchAddress;
-				continue;
-			}
-		}
+	if (fileArgument >= argc || (batch && fileArgument + 1 >= argc)) {
+		fprintf(stderr, "Wrong usage. Sample usage: broas [-O] [--jit] [--dump-fused] [--count] [--profile[=FILE]] [--sample-profile=HZ[,FILE]] [--cache[=DIR]] [--unbuffered] [--lex-threads=N] [--threads=N] [--call-depth=N] [--mem SIZE] [--no-huge-pages] [--vector=avx2|sse2|scalar] <broas_code_file> <...arguments>\n"
+			"or: broas --batch [-O] [--jit] [--threads=N] [--call-depth=N] [--mem SIZE] [--vector=avx2|sse2|scalar] <broas_code_file> <jobs_file> [--jobs N]\n");
+		exit(1);
+	}
 
-		else if (strcmp(opcode, "bgt") == 0) {
-			long int leftOperand = (long int)getValue(instruction[1], variables, nextVariable, labels, nextLabel);
-			long int rightOperand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-			long int branchAddress = (long int)getValue(instruction[3], variables, nextVariable, labels, nextLabel);
-			
-			if (leftOperand > rightOperand) {
-				nextInstruction = branchAddress;
-				continue;
+	/* the jobs file gives the arguments, so only --jobs may follow it */
+	if (batch) {
+		for (i = fileArgument + 2; i < argc; ++i) {
+			if (strncmp(argv[i], "--jobs=", 7) == 0) {
+				jobs = atoi(argv[i] + 7);
 			}
-		}
-
-		else if (strcmp(opcode, "ble") == 0) {
-			long int leftOperand = (long int)getValue(instruction[1], variables, nextVariable, labels, nextLabel);
-			long int rightOperand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-			long int branchAddress = (long int)getValue(instruction[3], variables, nextVariable, labels, nextLabel);
-			
-			if (leftOperand <= rightOperand) {
-				nextInstruction = branchAddress;
-				continue;
+			else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+				jobs = atoi(argv[++i]);
 			}
-		}
-
-		else if (strcmp(opcode, "bge") == 0) {
-			long int leftOperand = (long int)getValue(instruction[1], variables, nextVariable, labels, nextLabel);
-			long int rightOperand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-			long int branchAddress = (long int)getValue(instruction[3], variables, nextVariable, labels, nextLabel);
-			
-			
-			if (leftOperand >= rightOperand) {
-				nextInstruction = branchAddress;
-				continue;
+			else {
+				fprintf(stderr, "Unexpected %s after the jobs file\n", argv[i]);
+				exit(1);
 			}
 		}
-
-		else if (strcmp(opcode, "jmp") == 0) {
-			long int jumpAddress = (long int)getValue(instruction[1], variables, nextVariable, labels, nextLabel);
-
-			nextInstruction = jumpAddress;
-			continue;
-		}
-
-		else if (strcmp(opcode, "ref") == 0) {
-			long int memoryOperand = (long int)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-
-			setValue(&instruction[1], (void *)(memory + memoryOperand), variables, &nextVariable);
-		}
-
-		else if (strcmp(opcode, "deref") == 0) {
-			long int *addressOperand = (long int *)getValue(instruction[2], variables, nextVariable, labels, nextLabel);
-			long int sizeOperand = (long int)getValue(instruction[3], variables, nextVariable, labels, nextLabel);
-
-			long int result = 0;
-
-			int byteCount;
-			for (byteCount = sizeOperand - 1; byteCount >= 0; --byteCount) {
-				char byte = *((char *)addressOperand + byteCount);
-				result = (result << 8) | byte;
-			}
-
-			setValue(&instruction[1], (void *)result, variables, &nextVariable);
+		if (profile || sampleRate > 0 || countInstructions || useCache || dumpFused) {
+			fprintf(stderr, "--batch cannot be used with --profile, --sample-profile, --count, --cache or --dump-fused\n");
+			exit(1);
 		}
+		initializeVectors(vectorKernelName);
+		return runBatch(argv[fileArgument], argv[fileArgument + 1], (optimize ? BROAS_OPTIMIZE : 0) | (useJit ? BROAS_JIT : 0), memoryWords * sizeof(void *), callDepth, jobs, vectorKernelName);
+	}
 
-		else if (strcmp(opcode, "print") == 0) {
-			long int operand = (long int)getValue(instruction[1], variables, nextVariable, labels, nextLabel);
+	initializeIo(unbuffered);
+	initializeVectors(vectorKernelName);
+	fd = open(argv[fileArgument], O_RDONLY);
 
-			printf("%c", (char)operand);
-		}
+	/* the argument count, the arguments and the size of memory come first */
+	if (memoryWords < (size_t)(argc - fileArgument + 1)) {
+		fprintf(stderr, "Memory too small for the arguments\n");
+		exit(1);
+	}
+	memory = mapMemory(memoryWords, hugePages);
+	memory[0] = (void *)((long int)argc - fileArgument - 1);
+	for (i = 0; i < argc - fileArgument - 1; ++i) {
+		memory[i + 1] = argv[i + fileArgument + 1];
+	}
+	memory[argc - fileArgument] = (void *)(long int)memoryWords;
 
-		else if (strcmp(opcode, "scan") == 0) {
-			long int c = (long int)getchar();
+	if (profile && sampleRate > 0) {
+		fprintf(stderr, "--profile and --sample-profile cannot be used together\n");
+		exit(1);
+	}
 
-			setValue(&instruction[1], (void *)c, variables, &nextVariable);
+	initializeArena(&arena);
+	if (useCache) {
+		cacheFile = cachePath(argv[fileArgument], fd, cacheDirectory);
+	}
+	/* profiles relate instructions to the source, so they always compile it */
+	totalInstructions = -1;
+	if (cacheFile != NULL && !profile && sampleRate == 0) {
+		totalInstructions = loadCache(cacheFile, &arena, &instructions, &variables, &numberOfVariables);
+	}
+	if (totalInstructions < 0) {
+		tokens = getTokens(fd, lexerThreads, &totalTokens);
+		totalInstructions = compileTokens(tokens, totalTokens, &arena, &instructions, &variables, &numberOfVariables);
+		if (cacheFile != NULL) {
+			saveCache(cacheFile, instructions, totalInstructions, variables, numberOfVariables);
 		}
-
-		else if (strcmp(opcode, "exit") == 0) {
-			long int exitCode = (long int)getValue(instruction[1], variables, nextVariable, labels, nextLabel);
-			exit(exitCode);
+		if (profile) {
+			startProfile(argv[fileArgument], profilePath, tokens, totalTokens, totalInstructions);
 		}
-
-		else {
-			printf("Unknown operation %s\n", opcode);
+		else if (sampleRate > 0) {
+			startSampling(argv[fileArgument], samplePath, sampleRate, tokens, totalTokens, totalInstructions);
 		}
-		
-		++nextInstruction;
+		free(tokens);
+	}
+	free(cacheFile);
+	registers = allocateFromArena(&arena, (numberOfVariables + 1) * sizeof(long int));
+	defined = allocateFromArena(&arena, numberOfVariables + 1);
+
+	/* profiles are of the program as it was written */
+	if (optimize && !profile && sampleRate == 0) {
+		/* both grow the program into the room compileTokens() left after it */
+		long int maxInstructions = 2 * totalInstructions + 1;
+
+		totalInstructions = inlineCalls(instructions, totalInstructions, maxInstructions);
+		optimizeInstructions(instructions, totalInstructions, numberOfVariables);
+		totalInstructions = optimizeLoops(instructions, totalInstructions, maxInstructions, numberOfVariables);
 	}
 
-	close(fd);
-	return 0;
-}
-
-void *getValue(struct LexToken valueToken, struct Variable *variables, int numberOfVariables, struct Label *labels, int numberOfLabels) {
-	if (valueToken.type == IMMEDIATE) return (void *)valueToken.token.tokint;
-	else if (valueToken.type == VARIABLE) {
-		int i;
-		for (i = 0; i < numberOfVariables; ++i) {
-			if (strcmp(variables[i].name, valueToken.token.tokstr) == 0) {
-				return variables[i].value;
-			}
-		}
+	machine.instructions = instructions;
+	machine.totalInstructions = totalInstructions;
+	machine.variables = variables;
+	machine.numberOfVariables = numberOfVariables;
+	machine.memory = memory;
+	machine.memoryWords = memoryWords;
+	machine.hugePages = hugePages;
+	machine.pool = NULL;
+	machine.io = NULL;
+	machine.countInstructions = countInstructions;
+	machine.instructionLimit = LONG_MAX;
+	machine.threads = NULL;
+	machine.channels = NULL;
+	machine.callDepth = callDepth;
+	machine.returns = NULL;
+	machine.returnCapacity = 0;
+
+	/* counts are of plain instructions, so counting turns off fusion and the JIT */
+	if (profile) {
+		executeProfiled(&machine, 0, registers, defined);
 	}
-	else if (valueToken.type == LABEL) {
-		int i;
-		for (i = 0; i < numberOfLabels; ++i) {
-			if (strcmp(labels[i].name, valueToken.token.tokstr) == 0) {
-				return (void *)labels[i].instructionIndex;
-			}
+	else if (sampleRate > 0) {
+		/* samples are taken in the interpreter, which runs superinstructions all the same */
+		if (!countInstructions) {
+			fuseInstructions(instructions, totalInstructions, dumpFused ? stderr : NULL);
 		}
+		executeSampled(&machine, 0, registers, defined);
 	}
-	else {
-		fprintf(stderr, "Cannot get value of %s, (can only access value of a variable or immediate or label)\n", valueToken.token.tokstr);
-		exit(1);
-	}
-	fprintf(stderr, "%s not defined\n", valueToken.token.tokstr);
-	exit(1);
-}
-
-void setValue(struct LexToken *pVariableToken, void *value, struct Variable *variables, int *pNumberOfVariables) {
-	int i;
-	struct LexToken variableToken = *pVariableToken;
-	
-	if (variableToken.type != VARIABLE) {
-		fprintf(stderr, "Can only set value of a variable\n");
-		exit(1);
+	else if (countInstructions) {
+		execute(&machine, 0, registers, defined);
 	}
-
-	for (i = 0; i < *pNumberOfVariables; ++i) {
-		if (strcmp(variables[i].name, variableToken.token.tokstr) == 0) {
-			variables[i].value = value;
-			return;
-		}
+	else if (!useJit || jitExecute(instructions, totalInstructions, memory, variables, numberOfVariables) != 0) {
+		fuseInstructions(instructions, totalInstructions, dumpFused ? stderr : NULL);
+		execute(&machine, 0, registers, defined);
 	}
+	/* the program ends with the last of its threads */
+	finishThreads(&machine);
+	finishChannels(&machine);
+	free(machine.returns);
 
-	variables[*pNumberOfVariables].name  = pVariableToken->token.tokstr;
-	variables[*pNumberOfVariables].value = value;
-	++(*pNumberOfVariables);
+	close(fd);
+	unmapMemory(memory, memoryWords, hugePages);
+	freeArena(&arena);
+	return 0;
 }
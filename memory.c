@@ -0,0 +1,296 @@
+#define _DEFAULT_SOURCE
+
+#include "memory.h"
+
+#include "error.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
+
+/* compareWords() finds the block that differs with memcmp, then the word */
+#define COMPARE_BLOCK_WORDS 64
+
+/*
+ * The memory of the program running on this thread, for the instructions
+ * that map files into it and check their ranges
+ */
+static __thread char *memoryBase;
+static __thread size_t memorySize;
+
+size_t parseMemorySize(char const *text) {
+  char *suffix;
+  unsigned long int bytes;
+  int shift = 0;
+
+  if (!isdigit((unsigned char)*text)) {
+    fail("Invalid memory size %s", text);
+  }
+  bytes = strtoul(text, &suffix, 10);
+  switch (toupper((unsigned char)*suffix)) {
+  case 'G':
+    shift += 10;
+    /* fall through */
+  case 'M':
+    shift += 10;
+    /* fall through */
+  case 'K':
+    shift += 10;
+    suffix++;
+    break;
+  }
+  if (*suffix != '\0' || bytes > (unsigned long int)(size_t)-1 >> shift) {
+    fail("Invalid memory size %s", text);
+  }
+  return ((size_t)bytes << shift) / sizeof(void *);
+}
+
+/* the bytes mapped for words words, a whole number of pages */
+static size_t mappedSize(size_t words, int hugePages) {
+  size_t pageSize = hugePages && words * sizeof(void *) >= HUGE_PAGE_SIZE
+                        ? HUGE_PAGE_SIZE
+                        : 4096;
+
+  return (words * sizeof(void *) + pageSize - 1) / pageSize * pageSize;
+}
+
+void **mapMemory(size_t words, int hugePages) {
+  size_t size;
+  size_t slack;
+  char *mapping;
+  char *memory;
+
+  if (words > ((size_t)-1 - 2 * HUGE_PAGE_SIZE) / sizeof(void *)) {
+    fail("Cannot map %lu words of memory", (unsigned long int)words);
+  }
+  size = mappedSize(words, hugePages);
+  slack = hugePages && size >= HUGE_PAGE_SIZE ? HUGE_PAGE_SIZE : 0;
+
+  /*
+   * Reserving no swap lets a program ask for far more memory than it will
+   * touch. Huge pages need an aligned address, so the mapping is a huge page
+   * longer than the memory and trimmed to the aligned part.
+   */
+  mapping = mmap(NULL, size + slack, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (mapping == MAP_FAILED) {
+    fail("Cannot map %lu words of memory", (unsigned long int)words);
+  }
+  memory = mapping;
+  if (slack > 0) {
+    memory = (char *)(((unsigned long int)mapping + HUGE_PAGE_SIZE - 1) /
+                      HUGE_PAGE_SIZE * HUGE_PAGE_SIZE);
+    if (memory > mapping) {
+      munmap(mapping, memory - mapping);
+    }
+    if (memory + size < mapping + size + slack) {
+      munmap(memory + size, mapping + size + slack - (memory + size));
+    }
+  }
+
+#ifdef MADV_HUGEPAGE
+  if (slack > 0) {
+    /* a hint only: without transparent huge pages the memory still works */
+    madvise(memory, size, MADV_HUGEPAGE);
+  }
+#endif
+#ifdef MADV_NOHUGEPAGE
+  if (!hugePages) {
+    madvise(memory, size, MADV_NOHUGEPAGE);
+  }
+#endif
+  useMemory((void **)memory, words);
+  return (void **)memory;
+}
+
+void useMemory(void **memory, size_t words) {
+  memoryBase = (char *)memory;
+  memorySize = words * sizeof(void *);
+}
+
+void unmapMemory(void **memory, size_t words, int hugePages) {
+  munmap(memory, mappedSize(words, hugePages));
+}
+
+static size_t pageSize(void) { return sysconf(_SC_PAGESIZE); }
+
+/*
+ * The start of the length bytes from memory[index] on, which have to be
+ * inside memory; exits naming the instruction otherwise.
+ */
+static char *memoryRange(char const *instruction, long int index,
+                         long int length) {
+  if (index < 0 || length < 0 ||
+      (unsigned long int)index > memorySize / sizeof(void *) ||
+      (unsigned long int)length > memorySize - index * sizeof(void *)) {
+    fail("%s outside of memory at memory[%ld]", instruction, index);
+  }
+  return memoryBase + index * sizeof(void *);
+}
+
+long int mapFile(long int index, char const *path, int writable) {
+  char *start = memoryRange("mmap", index, 0);
+  struct stat status;
+  size_t length;
+  int fd;
+
+  if ((unsigned long int)(start - memoryBase) % pageSize() != 0) {
+    fail("mmap at memory[%ld], which does not start a page", index);
+  }
+
+  fd = open(path, writable ? O_RDWR : O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  if (fstat(fd, &status) != 0 || status.st_size < 0 ||
+      (unsigned long int)status.st_size > memorySize - (start - memoryBase)) {
+    close(fd);
+    return -1;
+  }
+  length = status.st_size;
+
+  /* the mapping replaces the memory pages it lands on */
+  if (length > 0 &&
+      mmap(start, length, PROT_READ | PROT_WRITE,
+           (writable ? MAP_SHARED : MAP_PRIVATE) | MAP_FIXED, fd,
+           0) == MAP_FAILED) {
+    close(fd);
+    return -1;
+  }
+  close(fd);
+  return (long int)length;
+}
+
+void unmapFile(long int index, long int length) {
+  char *start = memoryRange("munmap", index, length);
+
+  if ((unsigned long int)(start - memoryBase) % pageSize() != 0) {
+    fail("munmap at memory[%ld], which does not start a page", index);
+  }
+  length = (length + pageSize() - 1) / pageSize() * pageSize();
+  if (length > 0 &&
+      mmap(start, length, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1,
+           0) == MAP_FAILED) {
+    fail("Cannot map memory back at memory[%ld]", index);
+  }
+}
+
+void adviseMemory(long int index, long int length, long int advice) {
+  static int const advices[] = {MADV_NORMAL, MADV_SEQUENTIAL, MADV_RANDOM,
+                                MADV_WILLNEED};
+  char *start = memoryRange("madvise", index, length);
+  size_t offset = (start - memoryBase) % pageSize();
+
+  if (advice < 0 || advice >= (long int)(sizeof(advices) / sizeof(advices[0]))) {
+    fail("Unknown madvise advice %ld", advice);
+  }
+  /* like any hint, advice the kernel does not take changes nothing */
+  madvise(start - offset, length + offset, advices[advice]);
+}
+
+long int *memoryWords(char const *instruction, long int index,
+                      long int count) {
+  if (count < 0 || (unsigned long int)count > memorySize / sizeof(void *)) {
+    fail("%s of %ld words", instruction, count);
+  }
+  return (long int *)memoryRange(instruction, index, count * sizeof(void *));
+}
+
+void copyWords(long int to, long int from, long int count) {
+  long int *source = memoryWords("mcopy", from, count);
+
+  memmove(memoryWords("mcopy", to, count), source, count * sizeof(long int));
+}
+
+void fillWords(long int to, long int value, long int count) {
+  long int *words = memoryWords("mfill", to, count);
+  long int done = 1;
+
+  if (count == 0) {
+    return;
+  }
+  if (value == 0 || value == -1) {
+    memset(words, (int)value, count * sizeof(long int));
+    return;
+  }
+  /* every memcpy doubles the words filled so far */
+  words[0] = value;
+  while (done < count) {
+    long int step = done < count - done ? done : count - done;
+
+    memcpy(words + done, words, step * sizeof(long int));
+    done += step;
+  }
+}
+
+long int compareWords(long int count, long int a, long int b) {
+  long int *left = memoryWords("mcmp", a, count);
+  long int *right = memoryWords("mcmp", b, count);
+  long int i = 0;
+
+  while (i < count) {
+    long int block = count - i < COMPARE_BLOCK_WORDS ? count - i
+                                                     : COMPARE_BLOCK_WORDS;
+
+    if (memcmp(left + i, right + i, block * sizeof(long int)) != 0) {
+      while (left[i] == right[i]) {
+        i++;
+      }
+      return left[i] < right[i] ? -1 : 1;
+    }
+    i += block;
+  }
+  return 0;
+}
+
+long int findWord(long int count, long int start, long int value) {
+  long int *words = memoryWords("mfind", start, count);
+  long int i = 0;
+
+#ifdef __SSE2__
+  /*
+   * Eight words at a time. SSE2 compares 32-bit halves, so a word matches
+   * when both of its halves do.
+   */
+  if (sizeof(long int) == 8) {
+    __m128i wanted = _mm_set1_epi64x(value);
+
+    for (; i + 8 <= count; i += 8) {
+      __m128i const *block = (__m128i const *)(words + i);
+      __m128i any = _mm_or_si128(
+          _mm_or_si128(_mm_cmpeq_epi32(_mm_loadu_si128(block), wanted),
+                       _mm_cmpeq_epi32(_mm_loadu_si128(block + 1), wanted)),
+          _mm_or_si128(_mm_cmpeq_epi32(_mm_loadu_si128(block + 2), wanted),
+                       _mm_cmpeq_epi32(_mm_loadu_si128(block + 3), wanted)));
+
+      if (_mm_movemask_epi8(any) != 0) {
+        long int j;
+
+        for (j = i; j < i + 8; j++) {
+          if (words[j] == value) {
+            return start + j;
+          }
+        }
+      }
+    }
+  }
+#endif
+  for (; i < count; i++) {
+    if (words[i] == value) {
+      return start + i;
+    }
+  }
+  return -1;
+}
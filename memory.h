@@ -0,0 +1,77 @@
+#ifndef MEMORY_H_
+#define MEMORY_H_
+
+#include <stddef.h>
+
+/* the words of memory a program gets unless --mem says otherwise */
+#define DEFAULT_MEMORY_WORDS ((size_t)1 << 20)
+
+/*
+ * The number of words in a size given in bytes, optionally followed by K, M
+ * or G (powers of 1024), as in 4G. Fails (see error.h) on anything else.
+ */
+size_t parseMemorySize(char const *text);
+
+/*
+ * Maps words words of memory for a program. The kernel zero-fills each page
+ * the first time it is touched, so memory that is never used costs nothing.
+ * Unless hugePages is 0, memory of a huge page or more is aligned to huge
+ * pages and the kernel is asked to back it with them. Fails when the memory
+ * cannot be mapped.
+ */
+void **mapMemory(size_t words, int hugePages);
+
+/*
+ * Makes memory, mapped by mapMemory() with words, the one that the
+ * instructions run on the calling thread work on; they reach the first words
+ * of it only, whatever the page size rounded the mapping up to. mapMemory()
+ * makes the memory it maps that one.
+ */
+void useMemory(void **memory, size_t words);
+
+/* words and hugePages as they were given to mapMemory */
+void unmapMemory(void **memory, size_t words, int hugePages);
+
+/*
+ * Maps the file at path over memory from memory[index] on, where index has
+ * to start a page (be a multiple of 512 with 4 KB pages and 8-byte words).
+ * Writes reach the file when writable is set, and stay in memory otherwise.
+ * Returns the length of the file in bytes, or -1 when it cannot be opened or
+ * mapped or does not fit in memory.
+ */
+long int mapFile(long int index, char const *path, int writable);
+
+/* puts fresh zeroed memory back where mapFile() mapped length bytes */
+void unmapFile(long int index, long int length);
+
+/*
+ * Tells the kernel how length bytes of memory from memory[index] on are
+ * going to be used: 0 as usual, 1 in order, 2 at random, or 3 soon.
+ */
+void adviseMemory(long int index, long int length, long int advice);
+
+/*
+ * The count words from memory[index] on, after checking that they are inside
+ * memory; fails naming the instruction otherwise.
+ */
+long int *memoryWords(char const *instruction, long int index, long int count);
+
+/*
+ * Block instructions on count words from memory[index] on. Ranges may
+ * overlap, and any range that is not inside memory (or a negative count)
+ * stops the program with an error instead of reaching past memory.
+ */
+void copyWords(long int to, long int from, long int count);
+
+void fillWords(long int to, long int value, long int count);
+
+/*
+ * -1, 0 or 1 as the first word that differs is smaller in the range at a or
+ * in the one at b, or 0 when none does
+ */
+long int compareWords(long int count, long int a, long int b);
+
+/* the index of the first word equal to value, or -1 */
+long int findWord(long int count, long int start, long int value);
+
+#endif /* !MEMORY_H_ */
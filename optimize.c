@@ -0,0 +1,537 @@
+#include "optimize.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dataflow.h"
+
+/* every round may expose more work to the next one */
+#define MAX_ROUNDS 8
+
+/* past this many facts (blocks times variables) the program is left alone */
+#define MAX_FACTS (1L << 21)
+
+/*
+ * What is known about a variable at some point of the program. A variable
+ * that is unset on one path and constant on another is VARYING, so a read
+ * that fails on some path is never replaced by a value.
+ */
+enum ValueKind { VALUE_UNSET, VALUE_CONSTANT, VALUE_VARYING };
+
+#define NO_COPY (-1)
+
+/*
+ * Besides its value a variable may be known to hold a copy of another
+ * variable, in which case copy is the slot of that variable.
+ */
+struct Fact {
+  enum ValueKind kind;
+  long int constant;
+  long int copy;
+};
+
+struct Optimizer {
+  struct Instruction *instructions;
+  long int totalInstructions;
+  int numberOfVariables;
+  struct ControlFlowGraph graph;
+
+  /* per block, and per block and variable on entry to the block */
+  char *reached;
+  struct Fact *facts;
+};
+
+static int fold(enum Opcode opcode, long int left, long int right,
+                long int *result) {
+  unsigned long int l = (unsigned long int)left;
+  unsigned long int r = (unsigned long int)right;
+
+  switch (opcode) {
+  case OP_ADD:
+    *result = (long int)(l + r);
+    return 1;
+  case OP_SUB:
+    *result = (long int)(l - r);
+    return 1;
+  case OP_MULT:
+    *result = (long int)(l * r);
+    return 1;
+  case OP_DIV:
+  case OP_MOD:
+    /* these trap, and must keep doing so */
+    if (right == 0 || (right == -1 && left == LONG_MIN)) {
+      return 0;
+    }
+    *result = opcode == OP_DIV ? left / right : left % right;
+    return 1;
+  case OP_XOR:
+    *result = left ^ right;
+    return 1;
+  case OP_OR:
+    *result = left | right;
+    return 1;
+  case OP_AND:
+    *result = left & right;
+    return 1;
+  case OP_NOT:
+    *result = ~left;
+    return 1;
+  case OP_SL:
+  case OP_SR:
+    if (right < 0 || right >= (long int)BITS_PER_WORD) {
+      return 0;
+    }
+    *result = opcode == OP_SL ? (long int)(l << right) : left >> right;
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+static int compare(enum Opcode opcode, long int left, long int right) {
+  switch (opcode) {
+  case OP_BEQ:
+    return left == right;
+  case OP_BNEQ:
+    return left != right;
+  case OP_BLT:
+    return left < right;
+  case OP_BGT:
+    return left > right;
+  case OP_BLE:
+    return left <= right;
+  default:
+    return left >= right;
+  }
+}
+
+static int isConstant(struct Operand *operand, struct Fact *facts,
+                      long int *value) {
+  switch (operand->kind) {
+  case OPERAND_IMMEDIATE:
+  case OPERAND_LABEL:
+  case OPERAND_CONSTANT:
+    *value = operandValue(operand);
+    return 1;
+  case OPERAND_VARIABLE:
+    *value = facts[operand->value].constant;
+    return facts[operand->value].kind == VALUE_CONSTANT;
+  default:
+    return 0;
+  }
+}
+
+/* the value the instruction writes, if it can be worked out now */
+static int constantResult(struct Instruction *instruction, struct Fact *facts,
+                          long int *result) {
+  int order[MAX_OPERANDS];
+  int count = readOperands(instruction->opcode, order);
+  long int values[2] = {0, 0};
+  int j;
+
+  if (count < 1 || count > 2) {
+    return 0;
+  }
+  for (j = 0; j < count; j++) {
+    if (!isConstant(&instruction->operands[order[j]], facts, &values[j])) {
+      return 0;
+    }
+  }
+  return fold(instruction->opcode, values[0], values[1], result);
+}
+
+/* 1 when the branch is always taken, 0 when never, -1 when it depends */
+static int branchOutcome(struct Instruction *instruction, struct Fact *facts) {
+  long int left;
+  long int right;
+
+  if (!isBranch(instruction->opcode) ||
+      !isConstant(&instruction->operands[0], facts, &left) ||
+      !isConstant(&instruction->operands[1], facts, &right)) {
+    return -1;
+  }
+  return compare(instruction->opcode, left, right);
+}
+
+static int isImmediate(struct Operand *operand, long int value) {
+  return (operand->kind == OPERAND_IMMEDIATE ||
+          operand->kind == OPERAND_CONSTANT) &&
+         operandValue(operand) == value;
+}
+
+static int isVariable(struct Operand *operand) {
+  return operand->kind == OPERAND_VARIABLE;
+}
+
+/* the slot the instruction copies into its destination, or NO_COPY */
+static long int copySource(struct Instruction *instruction) {
+  struct Operand *operands = instruction->operands;
+  long int source = NO_COPY;
+
+  switch (instruction->opcode) {
+  case OP_ADD:
+  case OP_XOR:
+  case OP_OR:
+    if (isVariable(&operands[2]) && isImmediate(&operands[1], 0)) {
+      source = operands[2].value;
+      break;
+    }
+    /* fall through */
+  case OP_SUB:
+  case OP_SL:
+  case OP_SR:
+    if (isVariable(&operands[1]) && isImmediate(&operands[2], 0)) {
+      source = operands[1].value;
+    }
+    break;
+  case OP_MULT:
+  case OP_DIV:
+    if (isVariable(&operands[1]) && isImmediate(&operands[2], 1)) {
+      source = operands[1].value;
+    }
+    break;
+  default:
+    break;
+  }
+  return source == operands[0].value ? NO_COPY : source;
+}
+
+static void transfer(struct Optimizer *optimizer,
+                     struct Instruction *instruction, struct Fact *facts) {
+  long int slot = instruction->operands[0].value;
+  long int value;
+  int v;
+
+  if (!writesDestination(instruction->opcode) ||
+      !isVariable(&instruction->operands[0])) {
+    return;
+  }
+
+  for (v = 0; v < optimizer->numberOfVariables; v++) {
+    if (facts[v].copy == slot) {
+      facts[v].copy = NO_COPY;
+    }
+  }
+  facts[slot].kind = VALUE_VARYING;
+  if (constantResult(instruction, facts, &value)) {
+    facts[slot].kind = VALUE_CONSTANT;
+    facts[slot].constant = value;
+  }
+  facts[slot].copy = copySource(instruction);
+}
+
+static int meet(struct Optimizer *optimizer, long int instruction,
+                struct Fact *out) {
+  long int block;
+  struct Fact *in;
+  int changed = 0;
+  int v;
+
+  if (instruction >= optimizer->totalInstructions) {
+    return 0;
+  }
+  block = optimizer->graph.blockOf[instruction];
+  in = optimizer->facts + block * optimizer->numberOfVariables;
+
+  if (!optimizer->reached[block]) {
+    optimizer->reached[block] = 1;
+    memcpy(in, out, optimizer->numberOfVariables * sizeof(struct Fact));
+    return 1;
+  }
+
+  for (v = 0; v < optimizer->numberOfVariables; v++) {
+    if (in[v].kind != VALUE_VARYING &&
+        (in[v].kind != out[v].kind ||
+         (in[v].kind == VALUE_CONSTANT && in[v].constant != out[v].constant))) {
+      in[v].kind = VALUE_VARYING;
+      changed = 1;
+    }
+    if (in[v].copy != NO_COPY && in[v].copy != out[v].copy) {
+      in[v].copy = NO_COPY;
+      changed = 1;
+    }
+  }
+  return changed;
+}
+
+/*
+ * Forward analysis of constants and copies over the blocks that can run.
+ * A branch whose outcome is already known only reaches the side it takes,
+ * and a jump through a variable whose value is known reaches just that
+ * instruction; any other jump through a variable may land anywhere, and a
+ * ret after any call.
+ */
+static void analyseFacts(struct Optimizer *optimizer, struct Fact *out) {
+  struct ControlFlowGraph *graph = &optimizer->graph;
+  int changed = 1;
+  int v;
+
+  memset(optimizer->reached, 0, graph->numberOfBlocks);
+  for (v = 0; v < optimizer->numberOfVariables; v++) {
+    out[v].kind = VALUE_UNSET;
+    out[v].copy = NO_COPY;
+  }
+  meet(optimizer, 0, out);
+
+  while (changed) {
+    long int b;
+
+    changed = 0;
+    for (b = 0; b < graph->numberOfBlocks; b++) {
+      struct BasicBlock *block = &graph->blocks[b];
+      struct Instruction *last = &optimizer->instructions[block->last];
+      int jump = jumpOperand(last);
+      int outcome;
+      long int i;
+
+      if (!optimizer->reached[b]) {
+        continue;
+      }
+
+      memcpy(out, optimizer->facts + b * optimizer->numberOfVariables,
+             optimizer->numberOfVariables * sizeof(struct Fact));
+      for (i = block->first; i <= block->last; i++) {
+        transfer(optimizer, &optimizer->instructions[i], out);
+      }
+
+      outcome = branchOutcome(last, out);
+      if (fallsThrough(last->opcode) && outcome != 1) {
+        changed |= meet(optimizer, block->last + 1, out);
+      }
+      if (jump >= 0 && outcome != 0) {
+        long int target;
+
+        if (isConstant(&last->operands[jump], out, &target)) {
+          /* out of range halts, which meet() ignores */
+          if (target < 0) {
+            target = optimizer->totalInstructions;
+          }
+          changed |= meet(optimizer, target, out);
+        } else {
+          long int j;
+          for (j = 0; j < graph->numberOfBlocks; j++) {
+            changed |= meet(optimizer, graph->blocks[j].first, out);
+          }
+        }
+      }
+      if (block->returns) {
+        long int j;
+        for (j = 0; j < graph->numberOfBlocks; j++) {
+          if (graph->blocks[j].returnPoint) {
+            changed |= meet(optimizer, graph->blocks[j].first, out);
+          }
+        }
+      }
+    }
+  }
+}
+
+/*
+ * Rewrites instruction i with what is known before it: reads of constants
+ * become immediates and reads of copies read the original, a result that
+ * is constant is written as add <destination> <constant> 0, and a branch
+ * that always goes the same way becomes a jmp or goes away.
+ */
+static int rewriteInstruction(struct Optimizer *optimizer, long int i,
+                              struct Fact *facts, unsigned long *defined) {
+  struct Instruction *instruction = &optimizer->instructions[i];
+  struct Operand *operands = instruction->operands;
+  int order[MAX_OPERANDS];
+  int count = readOperands(instruction->opcode, order);
+  int changed = 0;
+  long int value;
+  int j;
+
+  if (count < 0) {
+    return 0;
+  }
+
+  for (j = 0; j < count; j++) {
+    struct Operand *operand = &operands[order[j]];
+    struct Fact *fact;
+
+    /* the count of mcmp and mfind is also where their result goes */
+    if (!isVariable(operand) ||
+        (order[j] == 0 && writesDestination(instruction->opcode))) {
+      continue;
+    }
+    fact = &facts[operand->value];
+    if (fact->kind == VALUE_CONSTANT) {
+      setImmediate(operand, fact->constant);
+      changed = 1;
+    } else if (fact->copy != NO_COPY) {
+      operand->value = fact->copy;
+      changed = 1;
+    }
+  }
+
+  if (writesDestination(instruction->opcode) && isVariable(&operands[0]) &&
+      constantResult(instruction, facts, &value) &&
+      !(instruction->opcode == OP_ADD && isImmediate(&operands[1], value) &&
+        isImmediate(&operands[2], 0))) {
+    instruction->opcode = OP_ADD;
+    setImmediate(&operands[1], value);
+    setImmediate(&operands[2], 0);
+    changed = 1;
+  }
+
+  switch (branchOutcome(instruction, facts)) {
+  case 1:
+    instruction->opcode = OP_JMP;
+    operands[0] = operands[2];
+    changed = 1;
+    break;
+  case 0:
+    /* the target is still read, which may fail */
+    if (operands[2].kind == OPERAND_IMMEDIATE ||
+        operands[2].kind == OPERAND_LABEL ||
+        operands[2].kind == OPERAND_CONSTANT ||
+        (isVariable(&operands[2]) &&
+         isDefinedBefore(defined, optimizer->numberOfVariables, i,
+                         operands[2].value))) {
+      instruction->opcode = OP_NOP;
+      changed = 1;
+    }
+    break;
+  default:
+    break;
+  }
+
+  return changed;
+}
+
+static int propagate(struct Optimizer *optimizer) {
+  struct ControlFlowGraph *graph = &optimizer->graph;
+  struct Fact *facts =
+      malloc((optimizer->numberOfVariables + 1) * sizeof(struct Fact));
+  unsigned long *defined =
+      analyseDefinedVariables(graph, optimizer->instructions,
+                              optimizer->totalInstructions,
+                              optimizer->numberOfVariables);
+  int changes = 0;
+  long int b;
+
+  analyseFacts(optimizer, facts);
+
+  for (b = 0; b < graph->numberOfBlocks; b++) {
+    struct BasicBlock *block = &graph->blocks[b];
+    long int i;
+
+    if (!optimizer->reached[b]) {
+      continue;
+    }
+    memcpy(facts, optimizer->facts + b * optimizer->numberOfVariables,
+           optimizer->numberOfVariables * sizeof(struct Fact));
+    for (i = block->first; i <= block->last; i++) {
+      changes += rewriteInstruction(optimizer, i, facts, defined);
+      transfer(optimizer, &optimizer->instructions[i], facts);
+    }
+  }
+
+  free(facts);
+  free(defined);
+  return changes;
+}
+
+/* whether dropping the instruction changes nothing but its destination */
+static int isRemovable(struct Optimizer *optimizer, long int i,
+                       unsigned long *defined) {
+  struct Instruction *instruction = &optimizer->instructions[i];
+  int order[MAX_OPERANDS];
+  int count = readOperands(instruction->opcode, order);
+  int j;
+
+  if (!isPure(instruction)) {
+    return 0;
+  }
+  for (j = 0; j < count; j++) {
+    struct Operand *operand = &instruction->operands[order[j]];
+
+    if (isVariable(operand) &&
+        !isDefinedBefore(defined, optimizer->numberOfVariables, i,
+                         operand->value)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* every removable store to a variable that is not live afterwards goes */
+static int eliminateDeadStores(struct Optimizer *optimizer) {
+  struct ControlFlowGraph *graph = &optimizer->graph;
+  size_t words = variableWords(optimizer->numberOfVariables);
+  unsigned long *live = malloc(words * sizeof(unsigned long));
+  unsigned long *liveIn =
+      analyseLiveVariables(graph, optimizer->instructions,
+                           optimizer->numberOfVariables);
+  unsigned long *defined =
+      analyseDefinedVariables(graph, optimizer->instructions,
+                              optimizer->totalInstructions,
+                              optimizer->numberOfVariables);
+  int changes = 0;
+  long int b;
+
+  for (b = 0; b < graph->numberOfBlocks; b++) {
+    struct BasicBlock *block = &graph->blocks[b];
+    long int i;
+
+    liveAfterBlock(graph, liveIn, b, optimizer->numberOfVariables, live);
+    for (i = block->last; i >= block->first; i--) {
+      struct Instruction *instruction = &optimizer->instructions[i];
+
+      if (isRemovable(optimizer, i, defined) &&
+          !HAS_VARIABLE(live, instruction->operands[0].value)) {
+        instruction->opcode = OP_NOP;
+        ++changes;
+        continue;
+      }
+      transferLive(instruction, live);
+    }
+  }
+
+  free(live);
+  free(liveIn);
+  free(defined);
+  return changes;
+}
+
+int optimizeInstructions(struct Instruction *instructions,
+                         long int totalInstructions, int numberOfVariables) {
+  struct Optimizer optimizer;
+  int changes = 0;
+  int round;
+
+  optimizer.instructions = instructions;
+  optimizer.totalInstructions = totalInstructions;
+  optimizer.numberOfVariables = numberOfVariables;
+
+  for (round = 0; round < MAX_ROUNDS; round++) {
+    struct ControlFlowGraph *graph = &optimizer.graph;
+    int changed;
+
+    buildControlFlowGraph(graph, instructions, totalInstructions);
+    if (graph->numberOfBlocks * (numberOfVariables + 1) > MAX_FACTS) {
+      freeControlFlowGraph(graph);
+      break;
+    }
+    optimizer.reached = malloc(graph->numberOfBlocks + 1);
+    optimizer.facts = malloc((graph->numberOfBlocks * numberOfVariables + 1) *
+                             sizeof(struct Fact));
+    changed = propagate(&optimizer);
+    free(optimizer.reached);
+    free(optimizer.facts);
+    freeControlFlowGraph(graph);
+
+    /* branches may have been folded, so the graph is built again */
+    buildControlFlowGraph(graph, instructions, totalInstructions);
+    changed += eliminateDeadStores(&optimizer);
+    freeControlFlowGraph(graph);
+
+    changes += changed;
+    if (!changed) {
+      break;
+    }
+  }
+  return changes;
+}
@@ -0,0 +1,16 @@
+#ifndef OPTIMIZE_H_
+#define OPTIMIZE_H_
+
+#include "bytecode.h"
+
+/*
+ * Propagates constants and copies into the instructions that read them,
+ * folds what becomes constant and removes stores that are never read, in
+ * place. Removed instructions turn into OP_NOP so that every label keeps its
+ * index. The program behaves exactly as before, errors included. Returns the
+ * number of instructions changed.
+ */
+int optimizeInstructions(struct Instruction *instructions,
+                         long int totalInstructions, int numberOfVariables);
+
+#endif /* !OPTIMIZE_H_ */
@@ -0,0 +1,308 @@
+#define _DEFAULT_SOURCE
+
+#include "parallel.h"
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "io.h"
+#include "memory.h"
+#include "thread.h"
+#include "vector.h"
+
+/* a pfor in progress, which lives on the stack of the thread running it */
+struct Job {
+  struct Machine machine; /* the program's, counting no instructions */
+  void (*engine)(struct Machine *machine, long int start, long int *registers,
+                 char *defined);
+  long int body;
+  long int *registers;
+  char *defined;
+  long int slot;
+  long int vectorLength;
+  long int grain;           /* the most iterations a piece is run with */
+  long int pending;         /* the iterations neither done nor skipped */
+  struct ErrorHandler stop; /* how the first iteration to stop stopped */
+};
+
+/* the iterations of job from first up to last */
+struct Piece {
+  struct Job *job;
+  long int first;
+  long int last;
+};
+
+/* its thread pushes and pops pieces at the bottom, the others take the top */
+struct Queue {
+  struct Piece *pieces;
+  long int top;
+  long int bottom;
+  long int capacity;
+};
+
+/*
+ * One lock guards the queues and the jobs. It is taken a few times a piece,
+ * and ranges are only split into about eight pieces for every thread.
+ */
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t poolChanged = PTHREAD_COND_INITIALIZER;
+static pthread_once_t poolStarted = PTHREAD_ONCE_INIT;
+static int requestedThreads;
+static int numberOfWorkers;
+
+/* one for every worker, then one for the threads that run a pfor otherwise */
+static struct Queue *queues;
+static long int queued;
+
+/* the queue of the calling thread, when it is a worker */
+static __thread int ownQueue = -1;
+
+void setParallelThreads(int threads) { requestedThreads = threads; }
+
+static struct Queue *queueOfCaller(void) {
+  return &queues[ownQueue >= 0 ? ownQueue : numberOfWorkers];
+}
+
+/* with poolLock held */
+static void pushPiece(struct Queue *queue, struct Piece const *piece) {
+  if (queue->bottom == queue->capacity && queue->top > 0) {
+    memmove(queue->pieces, queue->pieces + queue->top,
+            (queue->bottom - queue->top) * sizeof(struct Piece));
+    queue->bottom -= queue->top;
+    queue->top = 0;
+  }
+  if (queue->bottom == queue->capacity) {
+    queue->capacity = queue->capacity > 0 ? 2 * queue->capacity : 64;
+    queue->pieces =
+        realloc(queue->pieces, queue->capacity * sizeof(struct Piece));
+  }
+  queue->pieces[queue->bottom++] = *piece;
+  ++queued;
+}
+
+/*
+ * With poolLock held: the newest piece of the calling thread's own queue,
+ * or else the oldest, and so largest, of another's. Returns 0 when there is
+ * none.
+ */
+static int takePiece(struct Piece *piece) {
+  int own = ownQueue >= 0 ? ownQueue : numberOfWorkers;
+  int i;
+
+  if (queued == 0) {
+    return 0;
+  }
+  for (i = 0; i <= numberOfWorkers; i++) {
+    struct Queue *queue = &queues[(own + i) % (numberOfWorkers + 1)];
+
+    if (queue->bottom > queue->top) {
+      *piece = i == 0 ? queue->pieces[--queue->bottom]
+                      : queue->pieces[queue->top++];
+      if (queue->top == queue->bottom) {
+        queue->top = 0;
+        queue->bottom = 0;
+      }
+      --queued;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Runs iteration index of job, returning 0 when it stopped. Registers and
+ * defined are NULL when they could not be allocated, which stops the job.
+ */
+static int runIteration(struct Job *job, struct Machine *machine,
+                        long int index, long int *registers, char *defined) {
+  size_t slots = job->machine.numberOfVariables + 1;
+  struct ErrorHandler handler;
+
+  setVectorLength(job->vectorLength);
+  if (setjmp(handler.jump) == 0) {
+    pushErrorHandler(&handler);
+    if (registers == NULL || defined == NULL) {
+      fail("Cannot make room for %lu variables", (unsigned long int)slots);
+    }
+    memcpy(registers, job->registers, slots * sizeof(long int));
+    memcpy(defined, job->defined, slots);
+    registers[job->slot] = index;
+    defined[job->slot] = 1;
+    job->engine(machine, job->body, registers, defined);
+    popErrorHandler(&handler);
+    return 1;
+  }
+
+  pthread_mutex_lock(&poolLock);
+  if (job->stop.stop == 0) {
+    job->stop = handler;
+  }
+  pthread_mutex_unlock(&poolLock);
+  return 0;
+}
+
+static void runPiece(struct Piece const *piece) {
+  struct Job *job = piece->job;
+  size_t slots = job->machine.numberOfVariables + 1;
+  long int first = piece->first;
+  long int last = piece->last;
+  int stopped;
+
+  /* halves are split off for other threads until what is left is small */
+  while (last - first > job->grain) {
+    struct Piece half;
+
+    half.job = job;
+    half.first = first + (last - first) / 2;
+    half.last = last;
+    pthread_mutex_lock(&poolLock);
+    pushPiece(queueOfCaller(), &half);
+    pthread_cond_signal(&poolChanged);
+    pthread_mutex_unlock(&poolLock);
+    last = half.first;
+  }
+
+  pthread_mutex_lock(&poolLock);
+  stopped = job->stop.stop != 0;
+  pthread_mutex_unlock(&poolLock);
+  if (!stopped) {
+    struct Machine machine = job->machine;
+    long int *registers = malloc(slots * sizeof(long int));
+    char *defined = malloc(slots);
+    long int i;
+
+    usePool(job->machine.pool);
+    useIo(job->machine.io);
+    useMemory(job->machine.memory, job->machine.memoryWords);
+    for (i = first; i < last; i++) {
+      if (!runIteration(job, &machine, i, registers, defined)) {
+        break;
+      }
+    }
+    free(registers);
+    free(defined);
+    free(machine.returns);
+  }
+
+  pthread_mutex_lock(&poolLock);
+  job->pending -= last - first;
+  if (job->pending == 0) {
+    pthread_cond_broadcast(&poolChanged);
+  }
+  pthread_mutex_unlock(&poolLock);
+}
+
+static void *runWorker(void *argument) {
+  struct Piece piece;
+
+  ownQueue = (int)(long int)argument;
+  pthread_mutex_lock(&poolLock);
+  for (;;) {
+    if (takePiece(&piece)) {
+      pthread_mutex_unlock(&poolLock);
+      runPiece(&piece);
+      pthread_mutex_lock(&poolLock);
+    } else {
+      pthread_cond_wait(&poolChanged, &poolLock);
+    }
+  }
+  return NULL;
+}
+
+static void startPool(void) {
+  int threads = requestedThreads > 0 ? requestedThreads
+                                     : (int)sysconf(_SC_NPROCESSORS_ONLN);
+  sigset_t profiling;
+  sigset_t previous;
+  int i;
+
+  if (threads < 1) {
+    threads = 1;
+  }
+  /* a worker that cannot be started leaves its queue empty */
+  numberOfWorkers = threads - 1;
+  queues = calloc(threads, sizeof(struct Queue));
+
+  /* SIGPROF samples the thread that started the program, see profile.h */
+  sigemptyset(&profiling);
+  sigaddset(&profiling, SIGPROF);
+  pthread_sigmask(SIG_BLOCK, &profiling, &previous);
+  for (i = 0; i < numberOfWorkers; i++) {
+    pthread_t worker;
+
+    if (pthread_create(&worker, NULL, runWorker, (void *)(long int)i) == 0) {
+      pthread_detach(worker);
+    }
+  }
+  pthread_sigmask(SIG_SETMASK, &previous, NULL);
+}
+
+void parallelFor(struct Machine *machine,
+                 void (*engine)(struct Machine *machine, long int start,
+                                long int *registers, char *defined),
+                 long int body, long int *registers, char *defined,
+                 long int slot, long int start, long int end) {
+  struct Job job;
+  struct Piece whole;
+
+  if (start >= end) {
+    return;
+  }
+  pthread_once(&poolStarted, startPool);
+  /* the body may print, or spawn threads of its own */
+  shareMachine(machine);
+
+  job.machine = *machine;
+  job.machine.countInstructions = 0;
+  /* each piece calls on a return stack of its own */
+  job.machine.returns = NULL;
+  job.machine.returnCapacity = 0;
+  job.engine = engine;
+  job.body =
+      (unsigned long int)body < (unsigned long int)machine->totalInstructions
+          ? body
+          : machine->totalInstructions;
+  job.registers = registers;
+  job.defined = defined;
+  job.slot = slot;
+  job.vectorLength = currentVectorLength();
+  job.grain = (end - start) / (8 * (numberOfWorkers + 1));
+  if (job.grain < 1) {
+    job.grain = 1;
+  }
+  job.pending = end - start;
+  job.stop.stop = 0;
+
+  whole.job = &job;
+  whole.first = start;
+  whole.last = end;
+  runPiece(&whole);
+
+  /* the pieces left are taken here as well, whichever job they are of */
+  pthread_mutex_lock(&poolLock);
+  while (job.pending > 0) {
+    struct Piece piece;
+
+    if (takePiece(&piece)) {
+      pthread_mutex_unlock(&poolLock);
+      runPiece(&piece);
+      pthread_mutex_lock(&poolLock);
+    } else {
+      pthread_cond_wait(&poolChanged, &poolLock);
+    }
+  }
+  pthread_mutex_unlock(&poolLock);
+
+  usePool(machine->pool);
+  useIo(machine->io);
+  useMemory(machine->memory, machine->memoryWords);
+  setVectorLength(job.vectorLength);
+  if (job.stop.stop != 0) {
+    passStop(&job.stop);
+  }
+}
@@ -0,0 +1,33 @@
+#ifndef PARALLEL_H_
+#define PARALLEL_H_
+
+#include "interpreter.h"
+
+/*
+ * The number of threads pfor runs on, the one that runs it included, for
+ * --threads. 0, as it starts out, means one for every processor. It has to
+ * be set before the first pfor, which starts the pool of threads.
+ */
+void setParallelThreads(int threads);
+
+/*
+ * Runs the iterations of a pfor: engine runs the program from instruction
+ * body, until it halts or reaches a pend, once for every index from start
+ * up to end, each time with a fresh copy of registers and defined, the
+ * variable in slot set to the index, and with the vector length as it is
+ * now. The range is split in halves until the pieces are small, and every
+ * thread of the pool keeps the pieces it splits off in a queue of its own,
+ * from which the others take them when they run out. The calling thread
+ * works on the iterations too and returns once all of them are done, with
+ * its registers as they were.
+ *
+ * When an iteration stops (see error.h), those not yet started are skipped
+ * and the calling thread then stops the same way.
+ */
+void parallelFor(struct Machine *machine,
+                 void (*engine)(struct Machine *machine, long int start,
+                                long int *registers, char *defined),
+                 long int body, long int *registers, char *defined,
+                 long int slot, long int start, long int end);
+
+#endif /* !PARALLEL_H_ */
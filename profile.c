@@ -0,0 +1,578 @@
+#define _DEFAULT_SOURCE
+
+#include "profile.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "bytecode.h"
+
+#define READ_BLOCK_SIZE 65536
+
+/* how many samples the SIGPROF handler can get ahead of the drain thread */
+#define SAMPLE_RING_SIZE 4096
+#define DRAIN_INTERVAL_NANOSECONDS 10000000L
+
+/* the instructions from a label, or from the start of the program, on */
+struct Block {
+  long int first;
+  char const *label;
+  long int line;
+  long int entries;
+  long int executed;
+};
+
+/* what both profilers know of the program */
+static char const *sourceName;
+static FILE *destination;
+static long int numberOfInstructions;
+static long int *instructionLines;
+static unsigned char *opcodes;
+static struct Block *blocks;
+static long int numberOfBlocks;
+
+/* what --profile counts */
+static long int *counts;
+static long int *taken;
+
+/* the source as it is on disk, or NULL when it could not be read again */
+static char *source;
+static size_t sourceSize;
+
+static char *readSource(char const *path, size_t *pSize) {
+  FILE *file = fopen(path, "rb");
+  size_t capacity = READ_BLOCK_SIZE;
+  size_t size = 0;
+  size_t count;
+  char *text;
+
+  if (file == NULL) {
+    return NULL;
+  }
+  text = malloc(capacity);
+  while ((count = fread(text + size, 1, capacity - size, file)) > 0) {
+    size += count;
+    if (size == capacity) {
+      capacity *= 2;
+      text = realloc(text, capacity);
+    }
+  }
+  fclose(file);
+  *pSize = size;
+  return text;
+}
+
+/*
+ * The line a token is on. Tokens come in source order, so the lines are
+ * counted from where the last token was looked up.
+ */
+static long int lineOf(struct LexToken const *token, size_t *pScanned,
+                       long int *pLine) {
+  long int offset = sourceOffset(token->tokstr);
+
+  if (source == NULL || offset < 0 || (size_t)offset > sourceSize) {
+    return 0;
+  }
+  for (; *pScanned < (size_t)offset; ++*pScanned) {
+    if (source[*pScanned] == '\n') {
+      ++*pLine;
+    }
+  }
+  return *pLine;
+}
+
+static int isConditionalBranch(long int opcode) {
+  return opcode == OP_BEQ || opcode == OP_BNEQ || opcode == OP_BLT ||
+         opcode == OP_BGT || opcode == OP_BLE || opcode == OP_BGE;
+}
+
+static double percentage(long int part, long int total) {
+  return total == 0 ? 0.0 : 100.0 * part / total;
+}
+
+static void writeListing(FILE *output, long int total) {
+  char const *text = source;
+  char const *end = source + sourceSize;
+  long int instruction = 0;
+  long int line = 1;
+
+  fprintf(output, "%6s %12s %7s  %s\n", "line", "count", "%", "source");
+  while (text < end) {
+    char const *lineEnd = memchr(text, '\n', end - text);
+    long int first = instruction;
+    long int count = 0;
+    int length;
+
+    if (lineEnd == NULL) {
+      lineEnd = end;
+    }
+    length = (int)(lineEnd - text);
+    if (length > 0 && text[length - 1] == '\r') {
+      --length;
+    }
+
+    while (instruction < numberOfInstructions &&
+           instructionLines[instruction] <= line) {
+      count += counts[instruction++];
+    }
+    if (instruction > first) {
+      fprintf(output, "%6ld %12ld %6.2f%%  %.*s", line, count,
+              percentage(count, total), length, text);
+    } else {
+      fprintf(output, "%6ld %12s %7s  %.*s", line, "", "", length, text);
+    }
+    for (; first < instruction; first++) {
+      if (isConditionalBranch(opcodes[first])) {
+        fprintf(output, "    ; taken %ld, not taken %ld", taken[first],
+                counts[first] - taken[first]);
+      }
+    }
+    fputc('\n', output);
+
+    text = lineEnd + 1;
+    ++line;
+  }
+}
+
+/* the blocks that execute the most instructions first */
+static int compareBlocks(void const *left, void const *right) {
+  struct Block const *a = left;
+  struct Block const *b = right;
+
+  if (a->executed != b->executed) {
+    return a->executed > b->executed ? -1 : 1;
+  }
+  return a->first < b->first ? -1 : a->first > b->first;
+}
+
+static void writeBlocks(FILE *output, long int total) {
+  long int i;
+
+  for (i = 0; i < numberOfBlocks; i++) {
+    long int next =
+        i + 1 < numberOfBlocks ? blocks[i + 1].first : numberOfInstructions;
+    long int instruction;
+
+    if (blocks[i].label == NULL) {
+      blocks[i].line = instructionLines[blocks[i].first];
+    }
+    blocks[i].entries = counts[blocks[i].first];
+    blocks[i].executed = 0;
+    for (instruction = blocks[i].first; instruction < next; instruction++) {
+      blocks[i].executed += counts[instruction];
+    }
+  }
+  qsort(blocks, numberOfBlocks, sizeof(struct Block), compareBlocks);
+
+  fprintf(output, "\n%-24s %6s %12s %14s %7s\n", "block", "line", "entries",
+          "instructions", "%");
+  for (i = 0; i < numberOfBlocks; i++) {
+    fprintf(output, "%-24s %6ld %12ld %14ld %6.2f%%\n",
+            blocks[i].label != NULL ? blocks[i].label : "(start)",
+            blocks[i].line, blocks[i].entries, blocks[i].executed,
+            percentage(blocks[i].executed, total));
+  }
+}
+
+static void writeProfile(void) {
+  FILE *output = destination;
+  long int total = 0;
+  long int i;
+
+  for (i = 0; i < numberOfInstructions; i++) {
+    total += counts[i];
+  }
+  fprintf(output, "Profile of %s: %ld instructions executed\n\n", sourceName,
+          total);
+  if (source != NULL) {
+    writeListing(output, total);
+  } else {
+    fprintf(output, "(%s could not be read again for the listing)\n",
+            sourceName);
+  }
+  writeBlocks(output, total);
+  fflush(output);
+}
+
+/* the profile goes to path, or to stderr; better known before a long run */
+static void openDestination(char const *path) {
+  destination = path != NULL ? fopen(path, "w") : stderr;
+  if (destination == NULL) {
+    fprintf(stderr, "Cannot write the profile to %s\n", path);
+    exit(1);
+  }
+}
+
+/*
+ * Relates the instructions to the lines of the source, read again from
+ * sourcePath, and to the labels that begin the basic blocks.
+ */
+static void mapSource(char const *sourcePath, struct LexToken const *tokens,
+                      int totalTokens, long int totalInstructions) {
+  long int instruction = 0;
+  long int line = 1;
+  size_t scanned = 0;
+  int i = 0;
+
+  sourceName = sourcePath;
+  numberOfInstructions = totalInstructions;
+  instructionLines = calloc(totalInstructions + 1, sizeof(long int));
+  opcodes = calloc(totalInstructions + 1, 1);
+  blocks = malloc((totalTokens + 1) * sizeof(struct Block));
+  if (instructionLines == NULL || opcodes == NULL || blocks == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(1);
+  }
+  source = readSource(sourcePath, &sourceSize);
+
+  blocks[0].first = 0;
+  blocks[0].label = NULL;
+  blocks[0].line = 0;
+  numberOfBlocks = totalInstructions > 0 ? 1 : 0;
+
+  /* compileTokens() has checked that every opcode has its operands */
+  while (i < totalTokens) {
+    struct LexToken const *token = &tokens[i++];
+
+    if (token->type == OPCODE) {
+      instructionLines[instruction] = lineOf(token, &scanned, &line);
+      opcodes[instruction] = (unsigned char)token->tokint;
+      i += operandCount((enum Opcode)token->tokint);
+      ++instruction;
+    } else if (token->type == LABEL && instruction < totalInstructions) {
+      struct Block *block = &blocks[numberOfBlocks - 1];
+
+      /* of several labels in a row, the first names the block */
+      if (block->first != instruction) {
+        block = &blocks[numberOfBlocks++];
+        block->first = instruction;
+        block->label = NULL;
+      }
+      if (block->label == NULL) {
+        block->label = token->tokstr;
+        block->line = lineOf(token, &scanned, &line);
+      }
+    }
+  }
+  opcodes[totalInstructions] = OP_HALT;
+}
+
+void startProfile(char const *sourcePath, char const *outputPath,
+                  struct LexToken const *tokens, int totalTokens,
+                  long int totalInstructions) {
+  openDestination(outputPath);
+  mapSource(sourcePath, tokens, totalTokens, totalInstructions);
+  counts = calloc(totalInstructions + 1, sizeof(long int));
+  taken = calloc(totalInstructions + 1, sizeof(long int));
+  if (counts == NULL || taken == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(1);
+  }
+  atexit(writeProfile);
+}
+
+long int *instructionCounts(void) { return counts; }
+
+long int *branchesTaken(void) { return taken; }
+
+/*
+ * --sample-profile. The SIGPROF handler copies what the sampled engine
+ * shows in state into a ring that has a single writer at each end: the
+ * handler only advances ringHead and the drain thread only ringTail, so
+ * neither takes a lock, and the handler does nothing that is not safe in a
+ * signal handler. The drain thread folds the samples into a table of
+ * distinct stacks, which is written out when the program ends.
+ */
+struct Sample {
+  long int instruction;
+  long int depth;
+  long int frames[SAMPLE_DEPTH];
+};
+
+/* a distinct stack and the number of samples that found it, 0 when unused */
+struct Stack {
+  struct Sample sample;
+  long int count;
+};
+
+static struct SampleState state;
+
+static struct Sample ring[SAMPLE_RING_SIZE];
+static unsigned long int ringHead;
+static unsigned long int ringTail;
+static unsigned long int droppedSamples;
+
+static struct Stack *stacks;
+static unsigned long int stackMask;
+static long int numberOfStacks;
+
+static pthread_t drainThread;
+static int stopDraining;
+
+struct SampleState *sampleState(void) { return &state; }
+
+void recordJump(struct SampleState *sampled, long int target) {
+  long int depth = sampled->depth;
+  long int i;
+
+  for (i = depth - 1; i >= 0; i--) {
+    if (sampled->frames[i] == target) {
+      sampled->depth = i + 1;
+      return;
+    }
+  }
+  if (depth == SAMPLE_DEPTH) {
+    for (i = 1; i < SAMPLE_DEPTH; i++) {
+      sampled->frames[i - 1] = sampled->frames[i];
+    }
+    --depth;
+  }
+  sampled->frames[depth] = target;
+  sampled->depth = depth + 1;
+}
+
+/* the frames of a sample that were kept */
+static long int keptFrames(long int depth) {
+  return depth < SAMPLE_DEPTH ? depth : SAMPLE_DEPTH;
+}
+
+static void takeSample(int signalNumber) {
+  unsigned long int head = ringHead;
+  struct Sample *sample;
+  long int depth = state.depth;
+  long int i;
+
+  (void)signalNumber;
+  if (head - __atomic_load_n(&ringTail, __ATOMIC_ACQUIRE) ==
+      SAMPLE_RING_SIZE) {
+    ++droppedSamples;
+    return;
+  }
+  sample = &ring[head % SAMPLE_RING_SIZE];
+  sample->instruction = state.instruction;
+  sample->depth = depth;
+  for (i = 0; i < keptFrames(depth); i++) {
+    sample->frames[i] = state.frames[i];
+  }
+  __atomic_store_n(&ringHead, head + 1, __ATOMIC_RELEASE);
+}
+
+static unsigned long int hashSample(struct Sample const *sample) {
+  unsigned long int hash =
+      2166136261UL ^ (unsigned long int)sample->instruction;
+  long int i;
+
+  hash = (hash ^ (unsigned long int)sample->depth) * 16777619UL;
+  for (i = 0; i < keptFrames(sample->depth); i++) {
+    hash = (hash ^ (unsigned long int)sample->frames[i]) * 16777619UL;
+  }
+  return hash * 16777619UL;
+}
+
+static int sameStack(struct Sample const *a, struct Sample const *b) {
+  return a->instruction == b->instruction && a->depth == b->depth &&
+         memcmp(a->frames, b->frames,
+                keptFrames(a->depth) * sizeof(long int)) == 0;
+}
+
+static struct Stack *findStack(struct Stack *table, unsigned long int mask,
+                               struct Sample const *sample) {
+  unsigned long int hash = hashSample(sample);
+
+  for (;;) {
+    struct Stack *stack = &table[hash & mask];
+
+    if (stack->count == 0 || sameStack(&stack->sample, sample)) {
+      return stack;
+    }
+    hash++;
+  }
+}
+
+/* the table is grown to stay at most half full */
+static void addSample(struct Sample const *sample) {
+  struct Stack *stack;
+
+  if (2 * (unsigned long int)numberOfStacks >= stackMask) {
+    unsigned long int mask = stackMask == 0 ? 1023 : 2 * stackMask + 1;
+    struct Stack *table = calloc(mask + 1, sizeof(struct Stack));
+    unsigned long int i;
+
+    if (table == NULL) {
+      fprintf(stderr, "Out of memory\n");
+      exit(1);
+    }
+    for (i = 0; stacks != NULL && i <= stackMask; i++) {
+      if (stacks[i].count != 0) {
+        *findStack(table, mask, &stacks[i].sample) = stacks[i];
+      }
+    }
+    free(stacks);
+    stacks = table;
+    stackMask = mask;
+  }
+
+  stack = findStack(stacks, stackMask, sample);
+  if (stack->count == 0) {
+    stack->sample = *sample;
+    ++numberOfStacks;
+  }
+  ++stack->count;
+}
+
+static void drainRing(void) {
+  unsigned long int head = __atomic_load_n(&ringHead, __ATOMIC_ACQUIRE);
+  unsigned long int tail = ringTail;
+
+  for (; tail != head; tail++) {
+    addSample(&ring[tail % SAMPLE_RING_SIZE]);
+  }
+  __atomic_store_n(&ringTail, tail, __ATOMIC_RELEASE);
+}
+
+static void *drainSamples(void *unused) {
+  struct timespec interval;
+
+  (void)unused;
+  interval.tv_sec = 0;
+  interval.tv_nsec = DRAIN_INTERVAL_NANOSECONDS;
+  while (!__atomic_load_n(&stopDraining, __ATOMIC_ACQUIRE)) {
+    nanosleep(&interval, NULL);
+    drainRing();
+  }
+  return NULL;
+}
+
+/* the block holding an instruction: the last one to start at or before it */
+static struct Block const *blockOf(long int instruction) {
+  long int low = 0;
+  long int high = numberOfBlocks - 1;
+
+  if (numberOfBlocks == 0) {
+    return NULL;
+  }
+  while (low < high) {
+    long int middle = (low + high + 1) / 2;
+
+    if (blocks[middle].first <= instruction) {
+      low = middle;
+    } else {
+      high = middle - 1;
+    }
+  }
+  return &blocks[low];
+}
+
+/* a jump target by its label, or by its line when it has none */
+static void writeFrame(FILE *output, long int target) {
+  struct Block const *block = blockOf(target);
+
+  if (target >= numberOfInstructions) {
+    fputs(";(end)", output);
+  } else if (block != NULL && block->first == target && block->label != NULL) {
+    fprintf(output, ";%s", block->label);
+  } else {
+    fprintf(output, ";line %ld", instructionLines[target]);
+  }
+}
+
+/*
+ * One line of folded stacks: the program, the calls or the jumps that led
+ * to the instruction, with ... for the calls too deep to keep, the label of
+ * the block it is in when that is not the last frame, and the instruction
+ * itself, then the number of samples.
+ */
+static void writeStack(FILE *output, struct Stack const *stack) {
+  struct Sample const *sample = &stack->sample;
+  long int instruction = sample->instruction;
+  struct Block const *block = blockOf(instruction);
+  long int i;
+
+  fputs(sourceName, output);
+  for (i = 0; i < keptFrames(sample->depth); i++) {
+    writeFrame(output, sample->frames[i]);
+  }
+  if (sample->depth > SAMPLE_DEPTH) {
+    fputs(";...", output);
+  }
+  if (instruction >= numberOfInstructions) {
+    fputs(";(end)", output);
+  } else {
+    if (block != NULL && block->label != NULL &&
+        (sample->depth == 0 || sample->depth > SAMPLE_DEPTH ||
+         sample->frames[sample->depth - 1] != block->first)) {
+      fprintf(output, ";%s", block->label);
+    }
+    fprintf(output, ";%s (line %ld)",
+            opcodeName((enum Opcode)opcodes[instruction]),
+            instructionLines[instruction]);
+  }
+  fprintf(output, " %ld\n", stack->count);
+}
+
+static void writeSamples(void) {
+  struct itimerval off;
+  unsigned long int i;
+
+  memset(&off, 0, sizeof(off));
+  setitimer(ITIMER_PROF, &off, NULL);
+  __atomic_store_n(&stopDraining, 1, __ATOMIC_RELEASE);
+  pthread_join(drainThread, NULL);
+  drainRing();
+
+  for (i = 0; stacks != NULL && i <= stackMask; i++) {
+    if (stacks[i].count != 0) {
+      writeStack(destination, &stacks[i]);
+    }
+  }
+  fflush(destination);
+  if (droppedSamples != 0) {
+    fprintf(stderr, "%lu samples dropped, the ring of %d was full\n",
+            droppedSamples, SAMPLE_RING_SIZE);
+  }
+}
+
+void startSampling(char const *sourcePath, char const *outputPath, long int hz,
+                   struct LexToken const *tokens, int totalTokens,
+                   long int totalInstructions) {
+  struct sigaction action;
+  struct itimerval timer;
+  sigset_t profiling;
+  sigset_t previous;
+  long int interval = hz < 1000000 ? 1000000 / hz : 1;
+  long int i;
+
+  openDestination(outputPath);
+  mapSource(sourcePath, tokens, totalTokens, totalInstructions);
+  /* a program that calls gets its call stack, the others their jumps */
+  for (i = 0; i < totalInstructions; i++) {
+    state.followsCalls |= opcodes[i] == OP_CALL;
+  }
+
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = takeSample;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGPROF, &action, NULL);
+
+  /* the drain thread starts with SIGPROF blocked, so it never samples */
+  sigemptyset(&profiling);
+  sigaddset(&profiling, SIGPROF);
+  pthread_sigmask(SIG_BLOCK, &profiling, &previous);
+  if (pthread_create(&drainThread, NULL, drainSamples, NULL) != 0) {
+    fprintf(stderr, "Cannot start the thread that collects samples\n");
+    exit(1);
+  }
+  pthread_sigmask(SIG_SETMASK, &previous, NULL);
+  atexit(writeSamples);
+
+  timer.it_interval.tv_sec = interval / 1000000;
+  timer.it_interval.tv_usec = interval % 1000000;
+  timer.it_value = timer.it_interval;
+  setitimer(ITIMER_PROF, &timer, NULL);
+}
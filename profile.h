@@ -0,0 +1,55 @@
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include "lexer.h"
+
+/*
+ * Execution counts for --profile. The profiled engine counts every
+ * instruction it runs, and every branch it takes, in the arrays below. When
+ * the program ends, however it ends, they are written to outputPath (or to
+ * stderr when it is NULL) as the source with the counts next to its lines,
+ * followed by the counts of its basic blocks, each of which runs from a label
+ * to the next one.
+ *
+ * startProfile() reads the source again from sourcePath and relates it to
+ * the tokens it was compiled from, so it comes before they are freed.
+ */
+void startProfile(char const *sourcePath, char const *outputPath,
+                  struct LexToken const *tokens, int totalTokens,
+                  long int totalInstructions);
+
+/* indexed by instruction, OP_HALT included */
+long int *instructionCounts(void);
+long int *branchesTaken(void);
+
+/*
+ * Sampling for --sample-profile, hz times a second of processor time. The
+ * sampled engine keeps state up to date: the instruction it is running, and
+ * the frames that led to it, oldest first. In a program that calls, frames
+ * are the subroutines called and not returned from; depth counts them all,
+ * though only the first SAMPLE_DEPTH are kept. A program without call has no
+ * call stack, so its frames are the targets of the jumps that led to the
+ * instruction instead: a jump back to a target already among them returns
+ * to it, as a loop goes back to its head, and any other jump is added. The
+ * samples are written to outputPath (or to stderr when it is NULL) as folded
+ * stacks when the program ends.
+ */
+#define SAMPLE_DEPTH 64
+
+struct SampleState {
+  long int volatile instruction;
+  int followsCalls;
+  long int volatile depth;
+  long int volatile frames[SAMPLE_DEPTH];
+};
+
+void startSampling(char const *sourcePath, char const *outputPath, long int hz,
+                   struct LexToken const *tokens, int totalTokens,
+                   long int totalInstructions);
+
+struct SampleState *sampleState(void);
+
+/* goes back to target when it is among the jumps, or adds it */
+void recordJump(struct SampleState *sampled, long int target);
+
+#endif /* !PROFILE_H_ */
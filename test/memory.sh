@@ -0,0 +1,41 @@
+#!/bin/sh
+# Checks that memory ends at the size --mem gives, also when that size is not
+# a multiple of the page size the memory is mapped with. Runs ./a.out, so
+# build it first. Usage: test/memory.sh
+cd "$(dirname "$0")/.." || exit 1
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+# 3M is 393216 words: memory[393215] is the last word, in the last 2 MB huge
+# page, which the mapping rounds up to 4M
+cat > "$tmp/last.broas" << 'END'
+add n 1 0
+mfill 393215 'A' 1
+lw x 393215
+print x
+END
+cat > "$tmp/past.broas" << 'END'
+add n 1 0
+mfill 500000 7 1
+lw x 500000
+print x
+END
+
+status=0
+check() {
+	expected=$1
+	shift
+	actual=$(./a.out "$@" < /dev/null 2>&1; echo "exit $?")
+	if [ "$actual" != "$expected" ]; then
+		echo "./a.out $*: got '$actual', expected '$expected'" >&2
+		status=1
+	fi
+}
+
+for flags in "" --no-huge-pages --jit "--jit --no-huge-pages"; do
+	check "Aexit 0" --mem=3M $flags "$tmp/last.broas"
+	check "mfill outside of memory at memory[500000]
+exit 1" --mem=3M $flags "$tmp/past.broas"
+done
+[ $status -eq 0 ] && echo "memory: ok"
+exit $status
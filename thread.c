@@ -0,0 +1,288 @@
+#define _DEFAULT_SOURCE
+
+#include "thread.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "channel.h"
+#include "error.h"
+#include "io.h"
+#include "memory.h"
+
+struct Thread {
+  pthread_t thread;
+  struct Machine machine; /* the program's, counting no instructions */
+  void (*engine)(struct Machine *machine, long int start, long int *registers,
+                 char *defined);
+  long int start;
+  long int *registers;
+  char *defined;
+  int handled;                 /* whether join gets its errors */
+  struct ErrorHandler handler; /* and how it stopped */
+};
+
+struct Threads {
+  pthread_mutex_t lock;
+  struct Thread **threads; /* by number, from 1, NULL once joined */
+  long int count;
+  long int capacity;
+};
+
+/* the thread the calling one runs, NULL on threads broas did not spawn */
+static __thread struct Thread *self;
+
+static void *runThread(void *argument) {
+  struct Thread *thread = argument;
+
+  self = thread;
+  usePool(thread->machine.pool);
+  useIo(thread->machine.io);
+  useMemory(thread->machine.memory, thread->machine.memoryWords);
+  if (setjmp(thread->handler.jump) == 0) {
+    pushErrorHandler(&thread->handler);
+    thread->engine(&thread->machine, thread->start, thread->registers,
+                   thread->defined);
+    popErrorHandler(&thread->handler);
+  }
+  if (!thread->handled && thread->handler.stop != 0 &&
+      thread->handler.stop != STOP_EXIT) {
+    passStop(&thread->handler);
+  }
+  return NULL;
+}
+
+void shareMachine(struct Machine *machine) {
+  /* only one thread runs until then, so nothing races for this */
+  if (machine->threads == NULL) {
+    machine->threads = calloc(1, sizeof(struct Threads));
+    if (machine->threads == NULL) {
+      fail("Cannot make room for threads");
+    }
+    pthread_mutex_init(&machine->threads->lock, NULL);
+    shareIo(machine->io);
+  }
+  shareChannels(machine);
+}
+
+static void freeThread(struct Thread *thread) {
+  free(thread->registers);
+  free(thread->defined);
+  free(thread->machine.returns);
+  free(thread);
+}
+
+long int spawnThread(struct Machine *machine,
+                     void (*engine)(struct Machine *machine, long int start,
+                                    long int *registers, char *defined),
+                     long int start, long int *registers, char *defined,
+                     long int slot, long int argument) {
+  struct Threads *threads;
+  struct Thread *thread = malloc(sizeof(struct Thread));
+  size_t slots = machine->numberOfVariables + 1;
+  sigset_t profiling;
+  sigset_t previous;
+  long int id = 0;
+  int created;
+
+  if (thread == NULL) {
+    fail("Cannot make room for a thread");
+  }
+  shareMachine(machine);
+  threads = machine->threads;
+
+  thread->machine = *machine;
+  thread->machine.countInstructions = 0;
+  thread->machine.returns = NULL;
+  thread->machine.returnCapacity = 0;
+  thread->engine = engine;
+  thread->start =
+      (unsigned long int)start < (unsigned long int)machine->totalInstructions
+          ? start
+          : machine->totalInstructions;
+  thread->registers = malloc(slots * sizeof(long int));
+  thread->defined = malloc(slots);
+  if (thread->registers == NULL || thread->defined == NULL) {
+    free(thread->registers);
+    free(thread->defined);
+    free(thread);
+    fail("Cannot make room for %lu variables", (unsigned long int)slots);
+  }
+  memcpy(thread->registers, registers, slots * sizeof(long int));
+  memcpy(thread->defined, defined, slots);
+  thread->registers[slot] = argument;
+  thread->defined[slot] = 1;
+  thread->handled = self != NULL ? self->handled : catchingErrors();
+  thread->handler.stop = 0;
+
+  pthread_mutex_lock(&threads->lock);
+  if (threads->count == threads->capacity) {
+    long int capacity = threads->capacity > 0 ? 2 * threads->capacity : 16;
+    struct Thread **grown =
+        realloc(threads->threads, capacity * sizeof(struct Thread *));
+
+    if (grown == NULL) {
+      pthread_mutex_unlock(&threads->lock);
+      freeThread(thread);
+      fail("Cannot make room for %ld threads", capacity);
+    }
+    threads->threads = grown;
+    threads->capacity = capacity;
+  }
+  /* SIGPROF samples the thread that started the program, see profile.h */
+  sigemptyset(&profiling);
+  sigaddset(&profiling, SIGPROF);
+  pthread_sigmask(SIG_BLOCK, &profiling, &previous);
+  created = pthread_create(&thread->thread, NULL, runThread, thread);
+  pthread_sigmask(SIG_SETMASK, &previous, NULL);
+  if (created == 0) {
+    threads->threads[threads->count++] = thread;
+    id = threads->count;
+  }
+  pthread_mutex_unlock(&threads->lock);
+
+  if (created != 0) {
+    freeThread(thread);
+    fail("Cannot start a thread");
+  }
+  return id;
+}
+
+/* takes thread id out of the table, so that only one join gets it */
+static struct Thread *takeThread(struct Threads *threads, long int id) {
+  struct Thread *thread = NULL;
+
+  pthread_mutex_lock(&threads->lock);
+  if (id >= 1 && id <= threads->count) {
+    thread = threads->threads[id - 1];
+    threads->threads[id - 1] = NULL;
+  }
+  pthread_mutex_unlock(&threads->lock);
+  return thread;
+}
+
+long int joinThread(struct Machine *machine, long int id) {
+  struct Thread *thread =
+      machine->threads != NULL ? takeThread(machine->threads, id) : NULL;
+  struct ErrorHandler handler;
+
+  if (thread == NULL) {
+    fail("No thread %ld to join", id);
+  }
+  pthread_join(thread->thread, NULL);
+  handler = thread->handler;
+  freeThread(thread);
+
+  if (handler.stop == STOP_EXIT) {
+    return handler.exitCode;
+  }
+  if (handler.stop != 0) {
+    passStop(&handler);
+  }
+  return 0;
+}
+
+void finishThreads(struct Machine *machine) {
+  struct Threads *threads = machine->threads;
+  long int id;
+
+  if (threads == NULL) {
+    return;
+  }
+  /* the threads still running may spawn more */
+  for (id = 1;; id++) {
+    struct Thread *thread;
+    long int count;
+
+    pthread_mutex_lock(&threads->lock);
+    count = threads->count;
+    pthread_mutex_unlock(&threads->lock);
+    if (id > count) {
+      break;
+    }
+    thread = takeThread(threads, id);
+    if (thread != NULL) {
+      pthread_join(thread->thread, NULL);
+      freeThread(thread);
+    }
+  }
+  pthread_mutex_destroy(&threads->lock);
+  free(threads->threads);
+  free(threads);
+  machine->threads = NULL;
+}
+
+#ifdef __GNUC__
+
+long int compareAndSwapWord(long int index, long int expected,
+                            long int desired) {
+  long int *word = memoryWords("cas", index, 1);
+
+  __atomic_compare_exchange_n(word, &expected, desired, 0, __ATOMIC_SEQ_CST,
+                              __ATOMIC_SEQ_CST);
+  return expected;
+}
+
+long int fetchAndAddWord(long int index, long int value) {
+  long int *word = memoryWords("fadd", index, 1);
+
+  return __atomic_fetch_add(word, value, __ATOMIC_SEQ_CST);
+}
+
+long int exchangeWord(long int index, long int value) {
+  long int *word = memoryWords("xchg", index, 1);
+
+  return __atomic_exchange_n(word, value, __ATOMIC_SEQ_CST);
+}
+
+void fenceMemory(void) { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+
+#else
+
+/* without the builtins, one lock makes the operations atomic to each other */
+static pthread_mutex_t atomicLock = PTHREAD_MUTEX_INITIALIZER;
+
+long int compareAndSwapWord(long int index, long int expected,
+                            long int desired) {
+  long int *word = memoryWords("cas", index, 1);
+  long int found;
+
+  pthread_mutex_lock(&atomicLock);
+  found = *word;
+  if (found == expected) {
+    *word = desired;
+  }
+  pthread_mutex_unlock(&atomicLock);
+  return found;
+}
+
+long int fetchAndAddWord(long int index, long int value) {
+  long int *word = memoryWords("fadd", index, 1);
+  long int found;
+
+  pthread_mutex_lock(&atomicLock);
+  found = *word;
+  *word = (long int)((unsigned long int)found + (unsigned long int)value);
+  pthread_mutex_unlock(&atomicLock);
+  return found;
+}
+
+long int exchangeWord(long int index, long int value) {
+  long int *word = memoryWords("xchg", index, 1);
+  long int found;
+
+  pthread_mutex_lock(&atomicLock);
+  found = *word;
+  *word = value;
+  pthread_mutex_unlock(&atomicLock);
+  return found;
+}
+
+void fenceMemory(void) {
+  pthread_mutex_lock(&atomicLock);
+  pthread_mutex_unlock(&atomicLock);
+}
+
+#endif
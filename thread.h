@@ -0,0 +1,53 @@
+#ifndef THREAD_H_
+#define THREAD_H_
+
+#include "interpreter.h"
+
+/*
+ * Readies machine for its program to run on several threads at once, which
+ * it has to be before a second thread starts.
+ */
+void shareMachine(struct Machine *machine);
+
+/*
+ * Spawns a thread of the program running on machine, which engine runs from
+ * instruction start (halting at once when start is outside the program)
+ * with a copy of registers and defined, the variable in slot set to
+ * argument. The thread shares the machine's memory and I/O and runs until it
+ * halts or exits. Returns the number join takes it by, counting from 1.
+ *
+ * When the spawning thread stops on errors with a handler of its own (see
+ * error.h), so does the new one and its error is passed on to the thread
+ * that joins it; otherwise an error ends the process, as it would have on
+ * the first thread.
+ */
+long int spawnThread(struct Machine *machine,
+                     void (*engine)(struct Machine *machine, long int start,
+                                    long int *registers, char *defined),
+                     long int start, long int *registers, char *defined,
+                     long int slot, long int argument);
+
+/*
+ * Waits for thread id to end and returns the code it exited with, or 0 when
+ * it halted. Fails when there is no such thread or it was joined already.
+ */
+long int joinThread(struct Machine *machine, long int id);
+
+/* waits for the threads that were never joined, once the program is done */
+void finishThreads(struct Machine *machine);
+
+/*
+ * Atomic operations on memory[index], which fail when it is outside memory.
+ * All of them are sequentially consistent. compareAndSwapWord() stores
+ * desired when the word is expected, fetchAndAddWord() adds value to it and
+ * exchangeWord() stores value; each returns the word as it was before.
+ */
+long int compareAndSwapWord(long int index, long int expected,
+                            long int desired);
+long int fetchAndAddWord(long int index, long int value);
+long int exchangeWord(long int index, long int value);
+
+/* orders the loads and stores before it against the ones after it */
+void fenceMemory(void);
+
+#endif /* !THREAD_H_ */
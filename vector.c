@@ -0,0 +1,486 @@
+#include "vector.h"
+
+#include "error.h"
+#include "memory.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_SIMD
+#define AVX2 __attribute__((target("avx2")))
+#endif
+
+enum BinaryOperation { ADD, SUBTRACT, MULTIPLY, AND, OR, XOR, BINARY_OPERATIONS };
+
+typedef void BinaryKernel(long int *to, long int const *a, long int const *b,
+                          long int n);
+typedef void ScaleKernel(long int *to, long int const *a, long int factor,
+                         long int n);
+typedef long int ReduceKernel(long int const *a, long int n);
+typedef long int DotKernel(long int const *a, long int const *b, long int n);
+
+struct Kernels {
+  char const *name;
+  BinaryKernel *binary[BINARY_OPERATIONS];
+  ScaleKernel *scale;
+  ReduceKernel *sum;
+  ReduceKernel *minimum;
+  ReduceKernel *maximum;
+  DotKernel *dot;
+};
+
+/*
+ * The plain C kernels, which the others also finish their last few words
+ * with. Arithmetic is done on unsigned words so that it wraps around.
+ */
+#define SCALAR_BINARY(name, operation)                                         \
+  static void name(long int *to, long int const *a, long int const *b,         \
+                   long int n) {                                               \
+    long int i;                                                                \
+                                                                               \
+    for (i = 0; i < n; i++) {                                                  \
+      to[i] = (long int)((unsigned long int)a[i] operation(                    \
+          unsigned long int) b[i]);                                            \
+    }                                                                          \
+  }
+
+SCALAR_BINARY(scalarAdd, +)
+SCALAR_BINARY(scalarSubtract, -)
+SCALAR_BINARY(scalarMultiply, *)
+SCALAR_BINARY(scalarAnd, &)
+SCALAR_BINARY(scalarOr, |)
+SCALAR_BINARY(scalarXor, ^)
+
+static void scalarScale(long int *to, long int const *a, long int factor,
+                        long int n) {
+  long int i;
+
+  for (i = 0; i < n; i++) {
+    to[i] = (long int)((unsigned long int)a[i] * (unsigned long int)factor);
+  }
+}
+
+static long int scalarSum(long int const *a, long int n) {
+  unsigned long int sum = 0;
+  long int i;
+
+  for (i = 0; i < n; i++) {
+    sum += (unsigned long int)a[i];
+  }
+  return (long int)sum;
+}
+
+static long int scalarMinimum(long int const *a, long int n) {
+  long int minimum = LONG_MAX;
+  long int i;
+
+  for (i = 0; i < n; i++) {
+    if (a[i] < minimum) {
+      minimum = a[i];
+    }
+  }
+  return minimum;
+}
+
+static long int scalarMaximum(long int const *a, long int n) {
+  long int maximum = LONG_MIN;
+  long int i;
+
+  for (i = 0; i < n; i++) {
+    if (a[i] > maximum) {
+      maximum = a[i];
+    }
+  }
+  return maximum;
+}
+
+static long int scalarDot(long int const *a, long int const *b, long int n) {
+  unsigned long int sum = 0;
+  long int i;
+
+  for (i = 0; i < n; i++) {
+    sum += (unsigned long int)a[i] * (unsigned long int)b[i];
+  }
+  return (long int)sum;
+}
+
+static struct Kernels const scalarKernels = {
+    "scalar",
+    {scalarAdd, scalarSubtract, scalarMultiply, scalarAnd, scalarOr,
+     scalarXor},
+    scalarScale,
+    scalarSum,
+    scalarMinimum,
+    scalarMaximum,
+    scalarDot};
+
+#ifdef HAVE_SIMD
+/*
+ * Neither SSE2 nor AVX2 multiplies 64-bit lanes, so the low 64 bits of a
+ * product are put together from 32-bit halves: the low halves multiplied,
+ * plus the two cross products moved up by 32 bits.
+ */
+static __m128i sse2Multiply(__m128i x, __m128i y) {
+  __m128i low = _mm_mul_epu32(x, y);
+  __m128i cross = _mm_add_epi64(_mm_mul_epu32(_mm_srli_epi64(x, 32), y),
+                                _mm_mul_epu32(x, _mm_srli_epi64(y, 32)));
+
+  return _mm_add_epi64(low, _mm_slli_epi64(cross, 32));
+}
+
+/* two words at a time, the rest left to the scalar kernel */
+#define SSE2_BINARY(name, operation, tail)                                     \
+  static void name(long int *to, long int const *a, long int const *b,         \
+                   long int n) {                                               \
+    long int i;                                                                \
+                                                                               \
+    for (i = 0; i + 2 <= n; i += 2) {                                          \
+      __m128i x = _mm_loadu_si128((__m128i const *)(a + i));                   \
+      __m128i y = _mm_loadu_si128((__m128i const *)(b + i));                   \
+                                                                               \
+      _mm_storeu_si128((__m128i *)(to + i), operation(x, y));                  \
+    }                                                                          \
+    tail(to + i, a + i, b + i, n - i);                                         \
+  }
+
+SSE2_BINARY(sse2Add, _mm_add_epi64, scalarAdd)
+SSE2_BINARY(sse2Subtract, _mm_sub_epi64, scalarSubtract)
+SSE2_BINARY(sse2MultiplyVectors, sse2Multiply, scalarMultiply)
+SSE2_BINARY(sse2And, _mm_and_si128, scalarAnd)
+SSE2_BINARY(sse2Or, _mm_or_si128, scalarOr)
+SSE2_BINARY(sse2Xor, _mm_xor_si128, scalarXor)
+
+static void sse2Scale(long int *to, long int const *a, long int factor,
+                      long int n) {
+  __m128i y = _mm_set1_epi64x(factor);
+  long int i;
+
+  for (i = 0; i + 2 <= n; i += 2) {
+    __m128i x = _mm_loadu_si128((__m128i const *)(a + i));
+
+    _mm_storeu_si128((__m128i *)(to + i), sse2Multiply(x, y));
+  }
+  scalarScale(to + i, a + i, factor, n - i);
+}
+
+static long int sse2Total(__m128i sum) {
+  long int lanes[2];
+
+  _mm_storeu_si128((__m128i *)lanes, sum);
+  return (long int)((unsigned long int)lanes[0] + (unsigned long int)lanes[1]);
+}
+
+static long int sse2Sum(long int const *a, long int n) {
+  __m128i sum = _mm_setzero_si128();
+  long int i;
+
+  for (i = 0; i + 2 <= n; i += 2) {
+    sum = _mm_add_epi64(sum, _mm_loadu_si128((__m128i const *)(a + i)));
+  }
+  return (long int)((unsigned long int)sse2Total(sum) +
+                    (unsigned long int)scalarSum(a + i, n - i));
+}
+
+static long int sse2Dot(long int const *a, long int const *b, long int n) {
+  __m128i sum = _mm_setzero_si128();
+  long int i;
+
+  for (i = 0; i + 2 <= n; i += 2) {
+    sum = _mm_add_epi64(
+        sum, sse2Multiply(_mm_loadu_si128((__m128i const *)(a + i)),
+                          _mm_loadu_si128((__m128i const *)(b + i))));
+  }
+  return (long int)((unsigned long int)sse2Total(sum) +
+                    (unsigned long int)scalarDot(a + i, b + i, n - i));
+}
+
+/* SSE2 has no 64-bit comparison, so the minimum and maximum stay scalar */
+static struct Kernels const sse2Kernels = {
+    "sse2",
+    {sse2Add, sse2Subtract, sse2MultiplyVectors, sse2And, sse2Or, sse2Xor},
+    sse2Scale,
+    sse2Sum,
+    scalarMinimum,
+    scalarMaximum,
+    sse2Dot};
+
+AVX2 static __m256i avx2Multiply(__m256i x, __m256i y) {
+  __m256i low = _mm256_mul_epu32(x, y);
+  __m256i cross =
+      _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(x, 32), y),
+                       _mm256_mul_epu32(x, _mm256_srli_epi64(y, 32)));
+
+  return _mm256_add_epi64(low, _mm256_slli_epi64(cross, 32));
+}
+
+AVX2 static __m256i avx2Add(__m256i x, __m256i y) {
+  return _mm256_add_epi64(x, y);
+}
+
+AVX2 static __m256i avx2Subtract(__m256i x, __m256i y) {
+  return _mm256_sub_epi64(x, y);
+}
+
+AVX2 static __m256i avx2And(__m256i x, __m256i y) {
+  return _mm256_and_si256(x, y);
+}
+
+AVX2 static __m256i avx2Or(__m256i x, __m256i y) {
+  return _mm256_or_si256(x, y);
+}
+
+AVX2 static __m256i avx2Xor(__m256i x, __m256i y) {
+  return _mm256_xor_si256(x, y);
+}
+
+/* four words at a time, the rest left to the scalar kernel */
+#define AVX2_BINARY(name, operation, tail)                                     \
+  AVX2 static void name(long int *to, long int const *a, long int const *b,    \
+                        long int n) {                                          \
+    long int i;                                                                \
+                                                                               \
+    for (i = 0; i + 4 <= n; i += 4) {                                          \
+      __m256i x = _mm256_loadu_si256((__m256i const *)(a + i));                \
+      __m256i y = _mm256_loadu_si256((__m256i const *)(b + i));                \
+                                                                               \
+      _mm256_storeu_si256((__m256i *)(to + i), operation(x, y));               \
+    }                                                                          \
+    tail(to + i, a + i, b + i, n - i);                                         \
+  }
+
+AVX2_BINARY(avx2AddVectors, avx2Add, scalarAdd)
+AVX2_BINARY(avx2SubtractVectors, avx2Subtract, scalarSubtract)
+AVX2_BINARY(avx2MultiplyVectors, avx2Multiply, scalarMultiply)
+AVX2_BINARY(avx2AndVectors, avx2And, scalarAnd)
+AVX2_BINARY(avx2OrVectors, avx2Or, scalarOr)
+AVX2_BINARY(avx2XorVectors, avx2Xor, scalarXor)
+
+AVX2 static void avx2Scale(long int *to, long int const *a, long int factor,
+                           long int n) {
+  __m256i y = _mm256_set1_epi64x(factor);
+  long int i;
+
+  for (i = 0; i + 4 <= n; i += 4) {
+    __m256i x = _mm256_loadu_si256((__m256i const *)(a + i));
+
+    _mm256_storeu_si256((__m256i *)(to + i), avx2Multiply(x, y));
+  }
+  scalarScale(to + i, a + i, factor, n - i);
+}
+
+AVX2 static long int avx2Total(__m256i sum) {
+  long int lanes[4];
+
+  _mm256_storeu_si256((__m256i *)lanes, sum);
+  return (long int)((unsigned long int)lanes[0] + (unsigned long int)lanes[1] +
+                    (unsigned long int)lanes[2] + (unsigned long int)lanes[3]);
+}
+
+AVX2 static long int avx2Sum(long int const *a, long int n) {
+  __m256i sum = _mm256_setzero_si256();
+  long int i;
+
+  for (i = 0; i + 4 <= n; i += 4) {
+    sum = _mm256_add_epi64(sum, _mm256_loadu_si256((__m256i const *)(a + i)));
+  }
+  return (long int)((unsigned long int)avx2Total(sum) +
+                    (unsigned long int)scalarSum(a + i, n - i));
+}
+
+AVX2 static long int avx2Minimum(long int const *a, long int n) {
+  __m256i minimum = _mm256_set1_epi64x(LONG_MAX);
+  long int lanes[4];
+  long int result;
+  long int i;
+  int lane;
+
+  for (i = 0; i + 4 <= n; i += 4) {
+    __m256i x = _mm256_loadu_si256((__m256i const *)(a + i));
+
+    minimum = _mm256_blendv_epi8(minimum, x, _mm256_cmpgt_epi64(minimum, x));
+  }
+  _mm256_storeu_si256((__m256i *)lanes, minimum);
+  result = scalarMinimum(a + i, n - i);
+  for (lane = 0; lane < 4; lane++) {
+    if (lanes[lane] < result) {
+      result = lanes[lane];
+    }
+  }
+  return result;
+}
+
+AVX2 static long int avx2Maximum(long int const *a, long int n) {
+  __m256i maximum = _mm256_set1_epi64x(LONG_MIN);
+  long int lanes[4];
+  long int result;
+  long int i;
+  int lane;
+
+  for (i = 0; i + 4 <= n; i += 4) {
+    __m256i x = _mm256_loadu_si256((__m256i const *)(a + i));
+
+    maximum = _mm256_blendv_epi8(maximum, x, _mm256_cmpgt_epi64(x, maximum));
+  }
+  _mm256_storeu_si256((__m256i *)lanes, maximum);
+  result = scalarMaximum(a + i, n - i);
+  for (lane = 0; lane < 4; lane++) {
+    if (lanes[lane] > result) {
+      result = lanes[lane];
+    }
+  }
+  return result;
+}
+
+AVX2 static long int avx2Dot(long int const *a, long int const *b,
+                             long int n) {
+  __m256i sum = _mm256_setzero_si256();
+  long int i;
+
+  for (i = 0; i + 4 <= n; i += 4) {
+    sum = _mm256_add_epi64(
+        sum, avx2Multiply(_mm256_loadu_si256((__m256i const *)(a + i)),
+                          _mm256_loadu_si256((__m256i const *)(b + i))));
+  }
+  return (long int)((unsigned long int)avx2Total(sum) +
+                    (unsigned long int)scalarDot(a + i, b + i, n - i));
+}
+
+static struct Kernels const avx2Kernels = {
+    "avx2",
+    {avx2AddVectors, avx2SubtractVectors, avx2MultiplyVectors, avx2AndVectors,
+     avx2OrVectors, avx2XorVectors},
+    avx2Scale,
+    avx2Sum,
+    avx2Minimum,
+    avx2Maximum,
+    avx2Dot};
+#endif
+
+static struct Kernels const *kernels = &scalarKernels;
+
+/* set by vlen, for the program running on this thread */
+static __thread long int vectorLength;
+
+void initializeVectors(char const *name) {
+#ifdef HAVE_SIMD
+  int hasAvx2 = __builtin_cpu_supports("avx2");
+
+  /* every x86-64 processor has SSE2 */
+  kernels = hasAvx2 ? &avx2Kernels : &sse2Kernels;
+  if (name == NULL) {
+    return;
+  }
+  if (strcmp(name, "avx2") == 0 && hasAvx2) {
+    kernels = &avx2Kernels;
+    return;
+  }
+  if (strcmp(name, "sse2") == 0) {
+    kernels = &sse2Kernels;
+    return;
+  }
+#endif
+  if (name == NULL) {
+    return;
+  }
+  if (strcmp(name, "scalar") == 0) {
+    kernels = &scalarKernels;
+    return;
+  }
+  fail("No %s vector kernels on this processor", name);
+}
+
+char const *vectorKernels(void) { return kernels->name; }
+
+void setVectorLength(long int length) {
+  if (length < 0) {
+    fail("vlen of %ld words", length);
+  }
+  vectorLength = length;
+}
+
+long int currentVectorLength(void) { return vectorLength; }
+
+/* whether the ranges of the vector length at x and y share some but not all words */
+static int overlapPartly(long int const *x, long int const *y) {
+  return x != y && x < y + vectorLength && y < x + vectorLength;
+}
+
+/*
+ * A destination that overlaps a source partly would be read after the
+ * kernel wrote it, so the result is put together elsewhere first.
+ */
+static void binary(char const *instruction, enum BinaryOperation operation,
+                   long int to, long int a, long int b) {
+  long int *target = memoryWords(instruction, to, vectorLength);
+  long int const *left = memoryWords(instruction, a, vectorLength);
+  long int const *right = memoryWords(instruction, b, vectorLength);
+
+  if (overlapPartly(target, left) || overlapPartly(target, right)) {
+    long int *result = malloc(vectorLength * sizeof(long int));
+
+    if (result == NULL) {
+      fail("Cannot make room for %ld words", vectorLength);
+    }
+    kernels->binary[operation](result, left, right, vectorLength);
+    memcpy(target, result, vectorLength * sizeof(long int));
+    free(result);
+  } else {
+    kernels->binary[operation](target, left, right, vectorLength);
+  }
+}
+
+void addVectors(long int to, long int a, long int b) {
+  binary("vadd", ADD, to, a, b);
+}
+
+void subtractVectors(long int to, long int a, long int b) {
+  binary("vsub", SUBTRACT, to, a, b);
+}
+
+void multiplyVectors(long int to, long int a, long int b) {
+  binary("vmult", MULTIPLY, to, a, b);
+}
+
+void andVectors(long int to, long int a, long int b) {
+  binary("vand", AND, to, a, b);
+}
+
+void orVectors(long int to, long int a, long int b) {
+  binary("vor", OR, to, a, b);
+}
+
+void xorVectors(long int to, long int a, long int b) {
+  binary("vxor", XOR, to, a, b);
+}
+
+void scaleVector(long int to, long int a, long int factor) {
+  long int *target = memoryWords("vscale", to, vectorLength);
+  long int const *source = memoryWords("vscale", a, vectorLength);
+
+  if (overlapPartly(target, source)) {
+    memmove(target, source, vectorLength * sizeof(long int));
+    source = target;
+  }
+  kernels->scale(target, source, factor, vectorLength);
+}
+
+long int sumVector(long int a) {
+  return kernels->sum(memoryWords("vsum", a, vectorLength), vectorLength);
+}
+
+long int minimumOfVector(long int a) {
+  return kernels->minimum(memoryWords("vmin", a, vectorLength), vectorLength);
+}
+
+long int maximumOfVector(long int a) {
+  return kernels->maximum(memoryWords("vmax", a, vectorLength), vectorLength);
+}
+
+long int dotProduct(long int a, long int b) {
+  return kernels->dot(memoryWords("vdot", a, vectorLength),
+                      memoryWords("vdot", b, vectorLength), vectorLength);
+}
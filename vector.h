@@ -0,0 +1,41 @@
+#ifndef VECTOR_H_
+#define VECTOR_H_
+
+/*
+ * Vector instructions on ranges of memory. The number of words they work on
+ * is set beforehand with vlen, as with a vector length register, so that an
+ * instruction names at most three ranges or values. Every range is checked
+ * to be inside memory. Arithmetic wraps around like the scalar instructions,
+ * and a destination may overlap the ranges it is computed from: every word
+ * is read before any is written.
+ *
+ * The kernels are picked once, by initializeVectors(): AVX2 or SSE2 when
+ * the processor has them, or plain C. All of them give the same results.
+ */
+void initializeVectors(char const *kernels);
+
+/* the name of the kernels initializeVectors() picked */
+char const *vectorKernels(void);
+
+void setVectorLength(long int length);
+long int currentVectorLength(void);
+
+/* memory[to + i] = memory[a + i] <op> memory[b + i] for i below the length */
+void addVectors(long int to, long int a, long int b);
+void subtractVectors(long int to, long int a, long int b);
+void multiplyVectors(long int to, long int a, long int b);
+void andVectors(long int to, long int a, long int b);
+void orVectors(long int to, long int a, long int b);
+void xorVectors(long int to, long int a, long int b);
+
+/* memory[to + i] = memory[a + i] * factor */
+void scaleVector(long int to, long int a, long int factor);
+
+/* of the words from memory[a] on; the minimum of none is LONG_MAX */
+long int sumVector(long int a);
+long int minimumOfVector(long int a);
+long int maximumOfVector(long int a);
+
+long int dotProduct(long int a, long int b);
+
+#endif /* !VECTOR_H_ */